@@ -0,0 +1,342 @@
+#include "baseclasses/assetmanager.h"
+#include <SDL2/SDL_image.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+// Start of the cache files
+const char CACHE_MAGIC[4] = {'P', 'S', 'C', 'I'};
+
+// AssetHandle implementation
+AssetHandle::AssetHandle() {
+  manager = NULL;
+  asset = -1;
+}
+
+AssetHandle::AssetHandle(AssetManager* _manager, int _asset) {
+  manager = _manager;
+  asset = _asset;
+  if(manager != NULL)
+    manager->acquire(asset);
+}
+
+AssetHandle::AssetHandle(const AssetHandle &other) : AssetHandle(other.manager, other.asset) {
+}
+
+AssetHandle &AssetHandle::operator=(const AssetHandle &other) {
+  if(other.manager != NULL)
+    other.manager->acquire(other.asset);
+  if(manager != NULL)
+    manager->release(asset);
+  manager = other.manager;
+  asset = other.asset;
+  return *this;
+}
+
+AssetHandle::~AssetHandle() {
+  if(manager != NULL)
+    manager->release(asset);
+}
+
+bool AssetHandle::isValid() {
+  return manager != NULL;
+}
+
+bool AssetHandle::isReady() {
+  return manager != NULL && manager->assets[asset].state == AssetManager::ASSET_READY;
+}
+
+bool AssetHandle::hasFailed() {
+  return manager != NULL && manager->assets[asset].state == AssetManager::ASSET_FAILED;
+}
+
+SDL_Texture* AssetHandle::getTexture() {
+  return manager != NULL ? manager->assets[asset].texture : NULL;
+}
+
+int AssetHandle::getWidth() {
+  return manager != NULL ? manager->assets[asset].width : 0;
+}
+
+int AssetHandle::getHeight() {
+  return manager != NULL ? manager->assets[asset].height : 0;
+}
+
+// AssetManager implementation
+AssetManager::AssetManager(int workerCount, const char* _cacheDirectory) {
+  pending = 0;
+  stopping = false;
+  
+  if(_cacheDirectory != NULL) {
+    cacheDirectory = _cacheDirectory;
+    mkdir(_cacheDirectory, 0755);
+  }
+  
+  for(int i = 0; i < std::max(workerCount, 1); ++i)
+    workers.push_back(std::thread(&AssetManager::workerLoop, this));
+}
+
+AssetManager::~AssetManager() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  jobReady.notify_all();
+  uploadSpace.notify_all();
+  for(unsigned int i = 0; i < workers.size(); ++i)
+    workers[i].join();
+  
+  for(unsigned int i = 0; i < uploads.size(); ++i)
+    if(uploads[i].surface != NULL)
+      SDL_FreeSurface(uploads[i].surface);
+  
+  for(unsigned int i = 0; i < assets.size(); ++i)
+    if(assets[i].texture != NULL)
+      SDL_DestroyTexture(assets[i].texture);
+}
+
+AssetHandle AssetManager::loadImage(const char* path) {
+  std::unordered_map<std::string, int>::iterator found = assetOfPath.find(path);
+  if(found != assetOfPath.end())
+    return AssetHandle(this, found->second);
+  
+  int asset;
+  if(!freeAssets.empty()) {
+    asset = freeAssets.back();
+    freeAssets.pop_back();
+  } else {
+    asset = assets.size();
+    assets.push_back(Asset());
+  }
+  
+  assets[asset].path = path;
+  assets[asset].refCount = 0;
+  assets[asset].state = ASSET_LOADING;
+  assets[asset].texture = NULL;
+  assets[asset].width = assets[asset].height = 0;
+  assetOfPath[path] = asset;
+  ++pending;
+  
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    jobs.push_back({asset, path});
+  }
+  jobReady.notify_one();
+  
+  return AssetHandle(this, asset);
+}
+
+void AssetManager::acquire(int asset) {
+  ++assets[asset].refCount;
+}
+
+void AssetManager::release(int asset) {
+  Asset &unused = assets[asset];
+  if(--unused.refCount > 0)
+    return;
+  
+  // A loading image is freed when it arrives
+  if(unused.state == ASSET_LOADING)
+    return;
+  
+  if(unused.texture != NULL)
+    SDL_DestroyTexture(unused.texture);
+  unused.texture = NULL;
+  assetOfPath.erase(unused.path);
+  freeAssets.push_back(asset);
+}
+
+void AssetManager::workerLoop() {
+  while(true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      jobReady.wait(guard, [&] { return stopping || !jobs.empty(); });
+      if(stopping)
+        return;
+      job = jobs.front();
+      jobs.pop_front();
+    }
+    
+    SDL_Surface* surface = decode(job.path);
+    
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      uploadSpace.wait(guard, [&] {
+        return stopping || (int)uploads.size() < UPLOAD_QUEUE_SIZE;
+      });
+      if(stopping) {
+        if(surface != NULL)
+          SDL_FreeSurface(surface);
+        return;
+      }
+      uploads.push_back({job.asset, surface});
+    }
+    uploadReady.notify_one();
+  }
+}
+
+std::string AssetManager::getCachePath(const std::string &path) {
+  // FNV-1a hash of the path
+  unsigned long long hash = 14695981039346656037ull;
+  for(unsigned int i = 0; i < path.size(); ++i) {
+    hash ^= (unsigned char)path[i];
+    hash *= 1099511628211ull;
+  }
+  
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.raw", hash);
+  return cacheDirectory + name;
+}
+
+SDL_Surface* AssetManager::readCache(const std::string &cachePath,
+                                     long long modified, long long size) {
+  FILE *fin = fopen(cachePath.c_str(), "rb");
+  if(fin == NULL)
+    return NULL;
+  
+  // The cache is only used if the image didn't change since
+  char magic[4];
+  long long header[2];
+  int dimensions[2];
+  if(fread(magic, sizeof(char), 4, fin) != 4 || memcmp(magic, CACHE_MAGIC, 4) != 0 ||
+     fread(header, sizeof(long long), 2, fin) != 2 ||
+     header[0] != modified || header[1] != size ||
+     fread(dimensions, sizeof(int), 2, fin) != 2 ||
+     dimensions[0] <= 0 || dimensions[1] <= 0) {
+    fclose(fin);
+    return NULL;
+  }
+  
+  SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, dimensions[0], dimensions[1], 32,
+                                                        SDL_PIXELFORMAT_ARGB8888);
+  if(surface == NULL) {
+    fclose(fin);
+    return NULL;
+  }
+  
+  for(int y = 0; y < surface->h; ++y) {
+    unsigned char* row = (unsigned char*)surface->pixels + y * surface->pitch;
+    if(fread(row, 4, surface->w, fin) != (size_t)surface->w) {
+      SDL_FreeSurface(surface);
+      fclose(fin);
+      return NULL;
+    }
+  }
+  
+  fclose(fin);
+  return surface;
+}
+
+void AssetManager::writeCache(const std::string &cachePath, long long modified,
+                              long long size, SDL_Surface* surface) {
+  // Written aside and renamed, so a cache file is never half written
+  std::string temporary = cachePath + ".tmp";
+  FILE *fout = fopen(temporary.c_str(), "wb");
+  if(fout == NULL) {
+    SDL_Log("Unable to write the image cache %s\n", temporary.c_str());
+    return;
+  }
+  
+  long long header[2] = {modified, size};
+  int dimensions[2] = {surface->w, surface->h};
+  bool written = fwrite(CACHE_MAGIC, sizeof(char), 4, fout) == 4 &&
+                 fwrite(header, sizeof(long long), 2, fout) == 2 &&
+                 fwrite(dimensions, sizeof(int), 2, fout) == 2;
+  for(int y = 0; written && y < surface->h; ++y) {
+    unsigned char* row = (unsigned char*)surface->pixels + y * surface->pitch;
+    written = fwrite(row, 4, surface->w, fout) == (size_t)surface->w;
+  }
+  
+  if(fclose(fout) != 0 || !written || rename(temporary.c_str(), cachePath.c_str()) != 0)
+    remove(temporary.c_str());
+}
+
+SDL_Surface* AssetManager::decode(const std::string &path) {
+  struct stat info;
+  bool cached = !cacheDirectory.empty() && stat(path.c_str(), &info) == 0;
+  std::string cachePath;
+  if(cached) {
+    cachePath = getCachePath(path);
+    SDL_Surface* surface = readCache(cachePath, info.st_mtime, info.st_size);
+    if(surface != NULL)
+      return surface;
+  }
+  
+  SDL_Surface* loaded = IMG_Load(path.c_str());
+  if(loaded == NULL) {
+    SDL_Log("Unable to load image %s: %s\n", path.c_str(), IMG_GetError());
+    return NULL;
+  }
+  
+  SDL_Surface* surface = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+  SDL_FreeSurface(loaded);
+  if(surface == NULL) {
+    SDL_Log("Unable to convert image %s: %s\n", path.c_str(), SDL_GetError());
+    return NULL;
+  }
+  
+  if(cached)
+    writeCache(cachePath, info.st_mtime, info.st_size, surface);
+  return surface;
+}
+
+void AssetManager::upload(SDL_Renderer* renderer, Decoded decoded) {
+  Asset &loaded = assets[decoded.asset];
+  --pending;
+  
+  if(decoded.surface != NULL && loaded.refCount > 0) {
+    loaded.texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                       SDL_TEXTUREACCESS_STATIC,
+                                       decoded.surface->w, decoded.surface->h);
+    if(loaded.texture == NULL) {
+      SDL_Log("Unable to create texture %s: %s\n", loaded.path.c_str(), SDL_GetError());
+    } else {
+      SDL_SetTextureBlendMode(loaded.texture, SDL_BLENDMODE_BLEND);
+      SDL_UpdateTexture(loaded.texture, NULL, decoded.surface->pixels,
+                        decoded.surface->pitch);
+      loaded.width = decoded.surface->w;
+      loaded.height = decoded.surface->h;
+    }
+  }
+  
+  if(decoded.surface != NULL)
+    SDL_FreeSurface(decoded.surface);
+  loaded.state = loaded.texture != NULL ? ASSET_READY : ASSET_FAILED;
+  
+  // Nobody wants it anymore
+  if(loaded.refCount == 0) {
+    loaded.refCount = 1;
+    release(decoded.asset);
+  }
+}
+
+void AssetManager::update(SDL_Renderer* renderer, int maxUploads) {
+  for(int i = 0; i < maxUploads; ++i) {
+    Decoded decoded;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if(uploads.empty())
+        return;
+      decoded = uploads.front();
+      uploads.pop_front();
+    }
+    uploadSpace.notify_one();
+    upload(renderer, decoded);
+  }
+}
+
+void AssetManager::finishLoading(SDL_Renderer* renderer) {
+  while(pending > 0) {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      uploadReady.wait(guard, [&] { return !uploads.empty(); });
+    }
+    update(renderer, UPLOAD_QUEUE_SIZE);
+  }
+}
+
+int AssetManager::getPendingCount() {
+  return pending;
+}
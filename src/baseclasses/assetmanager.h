@@ -0,0 +1,136 @@
+#ifndef __ASSETMANAGER_H
+#define __ASSETMANAGER_H
+
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Decoded images waiting for their texture, the workers wait when there
+// are this many
+const int UPLOAD_QUEUE_SIZE = 16;
+
+// Textures created by one AssetManager::update()
+const int UPLOADS_PER_UPDATE = 4;
+
+class AssetManager;
+
+// Reference to an image of an AssetManager, the image is unloaded when no
+// handle refers to it anymore
+// Handles should only be used on the render thread, and destroyed before
+// their manager
+class AssetHandle {
+private:
+  AssetManager* manager;
+  int asset;
+public:
+  AssetHandle();
+  AssetHandle(AssetManager* _manager, int _asset);
+  AssetHandle(const AssetHandle &other);
+  AssetHandle &operator=(const AssetHandle &other);
+  ~AssetHandle();
+  
+  // False for handles that don't refer to an image
+  bool isValid();
+  
+  // True once the texture exists
+  bool isReady();
+  
+  // True if the image couldn't be loaded
+  bool hasFailed();
+  
+  // NULL until the image is ready
+  SDL_Texture* getTexture();
+  int getWidth();
+  int getHeight();
+};
+
+// Loads images in the background
+// Worker threads decode the files, then update() turns a few of them into
+// textures every frame on the render thread
+// Every file is loaded once, however many times it is asked for
+// If a cache directory is given, the decoded pixels are saved there and
+// read back by later runs instead of decoding the file again
+class AssetManager {
+private:
+  enum AssetState {
+    ASSET_LOADING,
+    ASSET_READY,
+    ASSET_FAILED
+  };
+  
+  struct Asset {
+    std::string path;
+    int refCount;
+    AssetState state;
+    SDL_Texture* texture;
+    int width, height;
+  };
+  
+  // Image decoded by a worker, NULL if it failed
+  struct Decoded {
+    int asset;
+    SDL_Surface* surface;
+  };
+  
+  struct Job {
+    int asset;
+    std::string path;
+  };
+  
+  // Only used by the render thread
+  std::vector<Asset> assets;
+  std::vector<int> freeAssets;
+  std::unordered_map<std::string, int> assetOfPath;
+  int pending;
+  
+  std::string cacheDirectory;
+  
+  // Shared with the workers
+  std::vector<std::thread> workers;
+  std::mutex lock;
+  std::condition_variable jobReady, uploadReady, uploadSpace;
+  std::deque<Job> jobs;
+  std::deque<Decoded> uploads;
+  bool stopping;
+  
+  void workerLoop();
+  
+  // Read the image from the cache, or decode it and fill the cache
+  SDL_Surface* decode(const std::string &path);
+  
+  std::string getCachePath(const std::string &path);
+  SDL_Surface* readCache(const std::string &cachePath, long long modified, long long size);
+  void writeCache(const std::string &cachePath, long long modified, long long size,
+                  SDL_Surface* surface);
+  
+  void upload(SDL_Renderer* renderer, Decoded decoded);
+  
+  void acquire(int asset);
+  void release(int asset);
+  
+  friend class AssetHandle;
+public:
+  // _cacheDirectory may be NULL to disable the cache
+  AssetManager(int workerCount = 2, const char* _cacheDirectory = NULL);
+  ~AssetManager();
+  
+  // Start loading the image, or return the one already loaded
+  AssetHandle loadImage(const char* path);
+  
+  // Create the textures of some decoded images
+  // Should be called every frame on the render thread
+  void update(SDL_Renderer* renderer, int maxUploads = UPLOADS_PER_UPDATE);
+  
+  // Wait until every requested image is ready or failed
+  void finishLoading(SDL_Renderer* renderer);
+  
+  // Images still loading
+  int getPendingCount();
+};
+
+#endif
@@ -0,0 +1,135 @@
+#include "baseclasses/broadphase.h"
+#include <algorithm>
+
+// Bodies covering more cells than this aren't inserted in the cells, they
+// are compared with every other body, so there should be few of them
+const int MAX_CELLS_PER_BODY = 64;
+
+static inline unsigned int hashCell(int x, int y, unsigned int mask) {
+  return ((unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u) & mask;
+}
+
+SpatialHash::SpatialHash(float _cellSize) {
+  cellSize = _cellSize;
+}
+
+void SpatialHash::setCellSize(float _cellSize) {
+  cellSize = _cellSize;
+}
+
+void SpatialHash::clear() {
+  boxes.clear();
+  used.clear();
+}
+
+void SpatialHash::insert(int body, const BoundingBox &box) {
+  if(body >= (int)boxes.size()) {
+    boxes.resize(body + 1);
+    used.resize(body + 1, false);
+  }
+  boxes[body] = box;
+  used[body] = true;
+}
+
+void SpatialHash::insert(PhysicalObject** objects, int count) {
+  for(int i = 0; i < count; ++i)
+    if(objects[i] != NULL && objects[i]->isPhysicsActive())
+      insert(i, objects[i]->getShape()->getBoundingBox());
+}
+
+void SpatialHash::remove(int body) {
+  if(body < (int)used.size())
+    used[body] = false;
+}
+
+int SpatialHash::getCell(float x, float usedCellSize) {
+  return (int)floor(x / usedCellSize);
+}
+
+void SpatialHash::findPairs(std::vector<BodyPair> &pairs) {
+  pairs.clear();
+  
+  int bodies = 0;
+  float usedCellSize = cellSize;
+  if(usedCellSize <= 0.0f) {
+    // Twice the average size of a box
+    double total = 0.0;
+    for(unsigned int i = 0; i < boxes.size(); ++i)
+      if(used[i]) {
+        total += (boxes[i].x2 - boxes[i].x1) + (boxes[i].y2 - boxes[i].y1);
+        ++bodies;
+      }
+    usedCellSize = bodies > 0 ? (float)(total / bodies) : 1.0f;
+    if(usedCellSize <= 0.0f)
+      usedCellSize = 1.0f;
+  }
+  
+  // Every body goes in the cells its box covers, except the huge ones
+  entries.clear();
+  hugeBodies.clear();
+  huge.assign(boxes.size(), false);
+  for(unsigned int i = 0; i < boxes.size(); ++i) {
+    if(!used[i])
+      continue;
+    int x1 = getCell(boxes[i].x1, usedCellSize), x2 = getCell(boxes[i].x2, usedCellSize);
+    int y1 = getCell(boxes[i].y1, usedCellSize), y2 = getCell(boxes[i].y2, usedCellSize);
+    if((long long)(x2 - x1 + 1) * (y2 - y1 + 1) > MAX_CELLS_PER_BODY) {
+      hugeBodies.push_back(i);
+      huge[i] = true;
+      continue;
+    }
+    for(int x = x1; x <= x2; ++x)
+      for(int y = y1; y <= y2; ++y)
+        entries.push_back({x, y, (int)i});
+  }
+  
+  // Huge bodies are compared with every body, a pair of huge bodies is
+  // reported by the first one
+  for(unsigned int h = 0; h < hugeBodies.size(); ++h) {
+    int i = hugeBodies[h];
+    for(int j = 0; j < (int)boxes.size(); ++j)
+      if(used[j] && j != i && (!huge[j] || i < j) && boxes[i].intersects(boxes[j]))
+        pairs.push_back(BodyPair(std::min(i, j), std::max(i, j)));
+  }
+  
+  // Counting sort of the entries by bucket
+  unsigned int bucketCount = 1;
+  while(bucketCount < entries.size() * 2)
+    bucketCount <<= 1;
+  unsigned int mask = bucketCount - 1;
+  
+  bucketStart.assign(bucketCount + 1, 0);
+  for(unsigned int i = 0; i < entries.size(); ++i)
+    ++bucketStart[hashCell(entries[i].cellX, entries[i].cellY, mask) + 1];
+  for(unsigned int i = 1; i <= bucketCount; ++i)
+    bucketStart[i] += bucketStart[i - 1];
+  
+  sortedEntries.resize(entries.size());
+  for(unsigned int i = 0; i < entries.size(); ++i) {
+    unsigned int bucket = hashCell(entries[i].cellX, entries[i].cellY, mask);
+    sortedEntries[bucketStart[bucket]++] = entries[i];
+  }
+  // bucketStart[i] is now the end of bucket i, so bucket i starts at
+  // bucketStart[i - 1]
+  
+  for(unsigned int bucket = 0; bucket < bucketCount; ++bucket) {
+    int start = bucket == 0 ? 0 : bucketStart[bucket - 1];
+    int end = bucketStart[bucket];
+    for(int i = start; i < end; ++i)
+      for(int j = i + 1; j < end; ++j) {
+        const CellEntry &a = sortedEntries[i], &b = sortedEntries[j];
+        if(a.cellX != b.cellX || a.cellY != b.cellY)
+          continue;
+        const BoundingBox &boxA = boxes[a.body], &boxB = boxes[b.body];
+        if(!boxA.intersects(boxB))
+          continue;
+        // Only the cell holding the corner of the intersection reports it
+        if(getCell(std::max(boxA.x1, boxB.x1), usedCellSize) != a.cellX ||
+           getCell(std::max(boxA.y1, boxB.y1), usedCellSize) != a.cellY)
+          continue;
+        pairs.push_back(BodyPair(std::min(a.body, b.body), std::max(a.body, b.body)));
+      }
+  }
+  
+  std::sort(pairs.begin(), pairs.end());
+}
@@ -0,0 +1,69 @@
+#ifndef __BROADPHASE_H
+#define __BROADPHASE_H
+
+#include <vector>
+#include <utility>
+#include "geometry.h"
+#include "object.h"
+
+// Pair of bodies whose bounding boxes intersect, first < second
+typedef std::pair<int, int> BodyPair;
+
+// Broad phase of the collision detection: a uniform grid hashed into
+// buckets. Every body is inserted into the cells its bounding box covers,
+// and only bodies sharing a cell are compared. A pair is reported once,
+// by the cell holding the top-left corner of the intersection of the two
+// boxes. The few bodies covering too many cells are compared with every
+// body instead
+// Bodies are identified by the id given to insert()
+class SpatialHash {
+private:
+  // A body inside a cell
+  struct CellEntry {
+    int cellX, cellY;
+    int body;
+  };
+  
+  // Side of a cell, the automatic size is used if it isn't positive
+  float cellSize;
+  
+  // The inserted boxes by body id, with a flag telling if the id is used
+  std::vector<BoundingBox> boxes;
+  std::vector<bool> used;
+  
+  // Entries and counting sort by bucket
+  std::vector<CellEntry> entries;
+  std::vector<CellEntry> sortedEntries;
+  std::vector<int> bucketStart;
+  
+  // Bodies covering too many cells to be inserted in them, with a flag for
+  // every body id
+  std::vector<int> hugeBodies;
+  std::vector<bool> huge;
+  
+  int getCell(float x, float usedCellSize);
+public:
+  // cellSize should be about twice the size of a typical body, if it
+  // isn't positive it's chosen from the inserted boxes
+  SpatialHash(float _cellSize = 0.0f);
+  
+  void setCellSize(float _cellSize);
+  
+  // Remove every body
+  void clear();
+  
+  // Insert or move the body with the given id (ids should be small, they
+  // index an array)
+  void insert(int body, const BoundingBox &box);
+  
+  // Insert the shape of every active object, its id is its index
+  void insert(PhysicalObject** objects, int count);
+  
+  // Remove a body
+  void remove(int body);
+  
+  // Fill pairs with every pair of bodies whose boxes intersect, sorted
+  void findPairs(std::vector<BodyPair> &pairs);
+};
+
+#endif
@@ -0,0 +1,451 @@
+#include "baseclasses/collision.h"
+#include <algorithm>
+
+// Iteration limits of GJK and EPA, and the size of the EPA polytope
+const int GJK_ITERATIONS = 32;
+const int EPA_ITERATIONS = 32;
+const int EPA_MAX_VERTICES = GJK_ITERATIONS + 3;
+const float EPA_TOLERANCE = 1e-4f;
+
+static inline bool isCircle(const Polygon* p) {
+  return p->circleRadius >= 0.0f;
+}
+
+static inline Vector2D perpendicular(Vector2D v) {
+  return Vector2D(-v.y, v.x);
+}
+
+static inline Vector2D normalize(Vector2D v) {
+  float length = v.length();
+  if(length <= 0.0f)
+    return Vector2D(1.0f, 0.0f);
+  return v * (1.0f / length);
+}
+
+static Vector2D averageVertex(const Polygon* p) {
+  Vector2D center;
+  for(int i = 0; i < p->size(); ++i)
+    center = center + p->getVertex(i);
+  return center * (1.0f / p->size());
+}
+
+// Projection of the polygon on a unit axis
+static void project(const Polygon* p, Vector2D axis, float &low, float &high) {
+  low = high = dot(p->getVertex(0), axis);
+  for(int i = 1; i < p->size(); ++i) {
+    float d = dot(p->getVertex(i), axis);
+    low = std::min(low, d);
+    high = std::max(high, d);
+  }
+}
+
+// Outward unit normal of edge i of the polygon
+static Vector2D edgeNormal(const Polygon* p, int i, Vector2D center) {
+  int n = p->size();
+  Vector2D a = p->getVertex(i), b = p->getVertex((i + 1) % n);
+  Vector2D normal = normalize(perpendicular(b - a));
+  if(dot(normal, a - center) < 0.0f)
+    normal = normal * -1.0f;
+  return normal;
+}
+
+// Edge of the polygon whose outward normal is the closest to direction
+// Segments return themselves and points return a degenerate edge
+static void getFace(const Polygon* p, Vector2D direction, Vector2D &v1, Vector2D &v2) {
+  int n = p->size();
+  if(n <= 2) {
+    v1 = p->getVertex(0);
+    v2 = p->getVertex(n - 1);
+    return;
+  }
+  
+  Vector2D center = averageVertex(p);
+  int best = 0;
+  float bestDot = -2.0f;
+  for(int i = 0; i < n; ++i) {
+    float d = dot(edgeNormal(p, i, center), direction);
+    if(d > bestDot) {
+      bestDot = d;
+      best = i;
+    }
+  }
+  v1 = p->getVertex(best);
+  v2 = p->getVertex((best + 1) % n);
+}
+
+// Vertex of the polygon furthest in the given direction
+static Vector2D polygonSupport(const Polygon* p, Vector2D direction) {
+  Vector2D best = p->getVertex(0);
+  float bestDot = dot(best, direction);
+  for(int i = 1; i < p->size(); ++i) {
+    float d = dot(p->getVertex(i), direction);
+    if(d > bestDot) {
+      bestDot = d;
+      best = p->getVertex(i);
+    }
+  }
+  return best;
+}
+
+// Test the polygons along axis, keeping the axis with the smallest overlap
+// Returns false if the axis separates them
+static bool testAxis(const Polygon* a, const Polygon* b, Vector2D axis,
+                     bool fromA, float &bestOverlap, Vector2D &bestNormal,
+                     bool &bestFromA) {
+  float aLow, aHigh, bLow, bHigh;
+  project(a, axis, aLow, aHigh);
+  project(b, axis, bLow, bHigh);
+  
+  if(aHigh < bLow || bHigh < aLow)
+    return false;
+  
+  float overlap = std::min(aHigh - bLow, bHigh - aLow);
+  if(overlap < bestOverlap) {
+    bestOverlap = overlap;
+    // Point the normal from a towards b
+    if(bLow + bHigh < aLow + aHigh)
+      axis = axis * -1.0f;
+    bestNormal = axis;
+    bestFromA = fromA;
+  }
+  return true;
+}
+
+// Test the axes given by the edges of p
+static bool testAxesOf(const Polygon* p, const Polygon* a, const Polygon* b,
+                       bool fromA, float &bestOverlap, Vector2D &bestNormal,
+                       bool &bestFromA) {
+  int n = p->size();
+  if(n == 1)
+    return true;
+  
+  int edges = n == 2 ? 1 : n;
+  for(int i = 0; i < edges; ++i) {
+    Vector2D edge = p->getVertex((i + 1) % n) - p->getVertex(i);
+    if(dot(edge, edge) <= 0.0f)
+      continue;
+    if(!testAxis(a, b, normalize(perpendicular(edge)), fromA,
+                 bestOverlap, bestNormal, bestFromA))
+      return false;
+    // Segments can also be separated along their own direction
+    if(n == 2 && !testAxis(a, b, normalize(edge), fromA,
+                           bestOverlap, bestNormal, bestFromA))
+      return false;
+  }
+  return true;
+}
+
+bool collidePolygons(const Polygon* a, const Polygon* b, ContactManifold* manifold) {
+  float overlap = 1e30f;
+  Vector2D normal(1.0f, 0.0f);
+  bool fromA = true;
+  
+  if(!testAxesOf(a, a, b, true, overlap, normal, fromA) ||
+     !testAxesOf(b, a, b, false, overlap, normal, fromA))
+    return false;
+  
+  // Two points
+  if(a->size() == 1 && b->size() == 1) {
+    Vector2D d = b->getVertex(0) - a->getVertex(0);
+    if(dot(d, d) > 0.0f)
+      return false;
+    overlap = 0.0f;
+  }
+  
+  if(manifold == NULL)
+    return true;
+  
+  manifold->normal = normal;
+  manifold->penetration = overlap;
+  
+  // Clip the incident face against the side planes of the reference face
+  const Polygon* reference = fromA ? a : b;
+  const Polygon* incident = fromA ? b : a;
+  Vector2D referenceNormal = fromA ? normal : normal * -1.0f;
+  
+  Vector2D r1, r2, i1, i2;
+  getFace(reference, referenceNormal, r1, r2);
+  getFace(incident, referenceNormal * -1.0f, i1, i2);
+  
+  Vector2D clipped[2] = {i1, i2};
+  int count = 2;
+  Vector2D tangent = r2 - r1;
+  float tangentLength2 = dot(tangent, tangent);
+  if(tangentLength2 > 0.0f) {
+    tangent = tangent * (1.0f / sqrt(tangentLength2));
+    float low = dot(r1, tangent), high = dot(r2, tangent);
+    for(int side = 0; side < 2 && count == 2; ++side) {
+      // Keep dot(p, sign * tangent) <= limit
+      float sign = side == 0 ? -1.0f : 1.0f;
+      float limit = side == 0 ? -low : high;
+      float d0 = dot(clipped[0], tangent) * sign - limit;
+      float d1 = dot(clipped[1], tangent) * sign - limit;
+      if(d0 > 0.0f && d1 > 0.0f)
+        count = 0;
+      else if(d0 > 0.0f)
+        clipped[0] = clipped[0] + (clipped[1] - clipped[0]) * (d0 / (d0 - d1));
+      else if(d1 > 0.0f)
+        clipped[1] = clipped[1] + (clipped[0] - clipped[1]) * (d1 / (d1 - d0));
+    }
+  }
+  
+  manifold->pointCount = 0;
+  for(int i = 0; i < count; ++i) {
+    float depth = dot(r1 - clipped[i], referenceNormal);
+    if(depth >= -EPA_TOLERANCE &&
+       (i == 0 || dot(clipped[1] - clipped[0], clipped[1] - clipped[0]) > 0.0f))
+      manifold->points[manifold->pointCount++] = clipped[i];
+  }
+  
+  if(manifold->pointCount == 0) {
+    manifold->points[0] = polygonSupport(incident, referenceNormal * -1.0f);
+    manifold->pointCount = 1;
+  }
+  return true;
+}
+
+bool collideCircles(const Polygon* a, const Polygon* b, ContactManifold* manifold) {
+  Vector2D d = b->getVertex(0) - a->getVertex(0);
+  float radii = a->circleRadius + b->circleRadius;
+  float distance2 = dot(d, d);
+  if(distance2 > radii * radii)
+    return false;
+  
+  if(manifold != NULL) {
+    float distance = sqrt(distance2);
+    manifold->normal = distance > 0.0f ? d * (1.0f / distance) : Vector2D(1.0f, 0.0f);
+    manifold->penetration = radii - distance;
+    manifold->pointCount = 1;
+    manifold->points[0] = a->getVertex(0) + manifold->normal *
+                          (a->circleRadius - manifold->penetration / 2.0f);
+  }
+  return true;
+}
+
+bool collideCirclePolygon(const Polygon* circle, const Polygon* b,
+                          ContactManifold* manifold) {
+  Vector2D center = circle->getVertex(0);
+  float radius = circle->circleRadius;
+  int n = b->size();
+  
+  // Closest point of the border of b, and the edge it's on
+  Vector2D closest = b->getVertex(0);
+  float closestDistance2 = dot(center - closest, center - closest);
+  int closestEdge = 0;
+  int edges = n == 1 ? 0 : (n == 2 ? 1 : n);
+  for(int i = 0; i < edges; ++i) {
+    Vector2D q = closestPointOnSegment(center, b->getVertex(i), b->getVertex((i + 1) % n));
+    float distance2 = dot(center - q, center - q);
+    if(distance2 < closestDistance2) {
+      closestDistance2 = distance2;
+      closest = q;
+      closestEdge = i;
+    }
+  }
+  
+  // The center is inside if it's on the same side of every edge
+  bool inside = false;
+  if(n >= 3) {
+    bool negative = false, positive = false;
+    for(int i = 0; i < n; ++i) {
+      float side = cross(b->getVertex((i + 1) % n) - b->getVertex(i), center - b->getVertex(i));
+      negative = negative || side < 0.0f;
+      positive = positive || side > 0.0f;
+    }
+    inside = !(negative && positive);
+  }
+  
+  if(!inside && closestDistance2 > radius * radius)
+    return false;
+  
+  if(manifold != NULL) {
+    float distance = sqrt(closestDistance2);
+    Vector2D normal;
+    if(distance > 0.0f)
+      normal = (closest - center) * (1.0f / distance);
+    else if(n >= 3)
+      normal = edgeNormal(b, closestEdge, averageVertex(b)) * -1.0f;
+    else
+      normal = Vector2D(1.0f, 0.0f);
+    
+    if(inside) {
+      // The circle leaves through the closest point, so b moves the other way
+      manifold->normal = normal * -1.0f;
+      manifold->penetration = radius + distance;
+    } else {
+      manifold->normal = normal;
+      manifold->penetration = radius - distance;
+    }
+    manifold->pointCount = 1;
+    manifold->points[0] = closest;
+  }
+  return true;
+}
+
+// Point of the shape furthest in the given direction
+static Vector2D support(const Polygon* p, Vector2D direction) {
+  Vector2D point = polygonSupport(p, direction);
+  if(p->circleRadius > 0.0f)
+    point = point + normalize(direction) * p->circleRadius;
+  return point;
+}
+
+// Point of the Minkowski difference a - b furthest in the given direction
+static inline Vector2D minkowskiSupport(const Polygon* a, const Polygon* b,
+                                        Vector2D direction) {
+  return support(a, direction) - support(b, direction * -1.0f);
+}
+
+// Vector perpendicular to v pointing towards toward
+static inline Vector2D perpendicularTowards(Vector2D v, Vector2D toward) {
+  Vector2D p = perpendicular(v);
+  if(dot(p, toward) < 0.0f)
+    p = p * -1.0f;
+  return p;
+}
+
+// Run EPA on the triangle of the GJK simplex and fill the manifold
+static void expandPolytope(const Polygon* a, const Polygon* b,
+                           Vector2D* simplex, ContactManifold* manifold) {
+  Vector2D polytope[EPA_MAX_VERTICES];
+  int count = 3;
+  polytope[0] = simplex[0];
+  polytope[1] = simplex[1];
+  polytope[2] = simplex[2];
+  
+  // Keep the polytope counter clockwise so the outward normal of edge
+  // (p, q) is (q - p) rotated clockwise
+  if(cross(polytope[1] - polytope[0], polytope[2] - polytope[0]) < 0.0f)
+    std::swap(polytope[1], polytope[2]);
+  
+  Vector2D normal(1.0f, 0.0f);
+  float distance = 0.0f;
+  for(int iteration = 0; iteration < EPA_ITERATIONS; ++iteration) {
+    int closest = 0;
+    distance = 1e30f;
+    for(int i = 0; i < count; ++i) {
+      Vector2D p = polytope[i], q = polytope[(i + 1) % count];
+      Vector2D edgeNormal = normalize(Vector2D(q.y - p.y, p.x - q.x));
+      float d = dot(edgeNormal, p);
+      if(d < distance) {
+        distance = d;
+        normal = edgeNormal;
+        closest = i;
+      }
+    }
+    
+    Vector2D point = minkowskiSupport(a, b, normal);
+    if(dot(point, normal) - distance < EPA_TOLERANCE || count == EPA_MAX_VERTICES)
+      break;
+    
+    for(int i = count; i > closest + 1; --i)
+      polytope[i] = polytope[i - 1];
+    polytope[closest + 1] = point;
+    ++count;
+  }
+  
+  // The border of a - b is at distance from the origin along normal,
+  // so moving b along normal by distance separates the shapes
+  manifold->normal = normal;
+  manifold->penetration = std::max(0.0f, distance);
+  manifold->pointCount = 1;
+  manifold->points[0] = (support(a, normal) + support(b, normal * -1.0f)) * 0.5f;
+}
+
+bool collideConvex(const Polygon* a, const Polygon* b, ContactManifold* manifold) {
+  Vector2D simplex[3];
+  int count = 0;
+  
+  Vector2D direction = averageVertex(b) - averageVertex(a);
+  if(dot(direction, direction) <= 0.0f)
+    direction = Vector2D(1.0f, 0.0f);
+  
+  simplex[count++] = minkowskiSupport(a, b, direction);
+  direction = simplex[0] * -1.0f;
+  
+  bool enclosed = false;
+  for(int iteration = 0; iteration < GJK_ITERATIONS; ++iteration) {
+    if(dot(direction, direction) <= 0.0f) {
+      enclosed = true; // The origin is on the simplex
+      break;
+    }
+    
+    Vector2D point = minkowskiSupport(a, b, direction);
+    if(dot(point, direction) < 0.0f)
+      return false;
+    simplex[count++] = point;
+    
+    Vector2D last = simplex[count - 1], toOrigin = last * -1.0f;
+    if(count == 2) {
+      Vector2D ab = simplex[0] - last;
+      if(dot(ab, toOrigin) > 0.0f) {
+        direction = perpendicularTowards(ab, toOrigin);
+        if(cross(ab, toOrigin) == 0.0f)
+          direction = Vector2D(); // The origin is on the segment
+      } else {
+        simplex[0] = last;
+        count = 1;
+        direction = toOrigin;
+      }
+    } else {
+      Vector2D ab = simplex[1] - last, ac = simplex[0] - last;
+      Vector2D abPerpendicular = perpendicularTowards(ab, ac * -1.0f);
+      Vector2D acPerpendicular = perpendicularTowards(ac, ab * -1.0f);
+      if(dot(abPerpendicular, toOrigin) > 0.0f) {
+        simplex[0] = simplex[1];
+        simplex[1] = last;
+        count = 2;
+        direction = abPerpendicular;
+      } else if(dot(acPerpendicular, toOrigin) > 0.0f) {
+        simplex[1] = last;
+        count = 2;
+        direction = acPerpendicular;
+      } else {
+        enclosed = true; // The triangle holds the origin
+        break;
+      }
+    }
+  }
+  
+  // Out of iterations without an answer, which happens with degenerate
+  // shapes or coordinates too large for the float products
+  if(!enclosed)
+    return collideShapes(a, b, manifold);
+  
+  if(manifold == NULL)
+    return true;
+  
+  if(count < 3) {
+    // The shapes only touch, build a thin triangle for EPA
+    Vector2D edge = count == 2 ? simplex[1] - simplex[0] : Vector2D(1.0f, 0.0f);
+    Vector2D side = normalize(perpendicular(edge));
+    simplex[1] = count == 2 ? simplex[1] : simplex[0];
+    simplex[2] = minkowskiSupport(a, b, side);
+    if(cross(simplex[1] - simplex[0], simplex[2] - simplex[0]) == 0.0f)
+      simplex[2] = minkowskiSupport(a, b, side * -1.0f);
+    if(cross(simplex[1] - simplex[0], simplex[2] - simplex[0]) == 0.0f) {
+      manifold->normal = side;
+      manifold->penetration = 0.0f;
+      manifold->pointCount = 1;
+      manifold->points[0] = support(a, side);
+      return true;
+    }
+  }
+  expandPolytope(a, b, simplex, manifold);
+  return true;
+}
+
+bool collideShapes(const Polygon* a, const Polygon* b, ContactManifold* manifold) {
+  if(isCircle(a) && isCircle(b))
+    return collideCircles(a, b, manifold);
+  if(isCircle(a))
+    return collideCirclePolygon(a, b, manifold);
+  if(isCircle(b)) {
+    if(!collideCirclePolygon(b, a, manifold))
+      return false;
+    if(manifold != NULL)
+      manifold->normal = manifold->normal * -1.0f;
+    return true;
+  }
+  return collidePolygons(a, b, manifold);
+}
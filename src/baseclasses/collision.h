@@ -0,0 +1,43 @@
+#ifndef __COLLISION_H
+#define __COLLISION_H
+
+#include "geometry.h"
+
+// Narrow phase of the collision detection
+// Every shape is convex: a point, a segment, a convex polygon or a circle
+// None of these functions allocate memory
+
+// Most contact points of a collision
+const int MAX_CONTACT_POINTS = 2;
+
+// Description of the collision of shape a with shape b
+struct ContactManifold {
+  // Unit vector from a towards b, moving b by normal * penetration
+  // separates the shapes
+  Vector2D normal;
+  float penetration;
+  
+  // Points where the shapes touch
+  int pointCount;
+  Vector2D points[MAX_CONTACT_POINTS];
+};
+
+// Each function returns true if the shapes collide, and if manifold isn't
+// NULL fills it with the contact
+
+// Separating axis test for two shapes that aren't circles
+bool collidePolygons(const Polygon* a, const Polygon* b, ContactManifold* manifold);
+
+// Closed form tests with circles
+bool collideCircles(const Polygon* a, const Polygon* b, ContactManifold* manifold);
+bool collideCirclePolygon(const Polygon* circle, const Polygon* b,
+                          ContactManifold* manifold);
+
+// GJK and EPA for any two convex shapes, circles included
+// Falls back to collideShapes() if GJK runs out of iterations
+bool collideConvex(const Polygon* a, const Polygon* b, ContactManifold* manifold);
+
+// Pick the right test for the two shapes
+bool collideShapes(const Polygon* a, const Polygon* b, ContactManifold* manifold);
+
+#endif
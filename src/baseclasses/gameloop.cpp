@@ -0,0 +1,91 @@
+#include "baseclasses/gameloop.h"
+#include "baseclasses/timer.h"
+#include "baseclasses/profiler.h"
+#include <cstdio>
+
+GameLoop::GameLoop(Uint64 _tickNs, int _maxTicksPerFrame) {
+  tickNs = _tickNs;
+  maxTicksPerFrame = _maxTicksPerFrame;
+  resetStats();
+}
+
+int GameLoop::runRoom(Room* room, SDL_Renderer* renderer) {
+  room->initialize();
+  
+  Uint64 accumulator = 0;
+  Uint64 previous = Timer::getTimeNs();
+  
+  while(true) {
+    Uint64 now = Timer::getTimeNs();
+    accumulator += now - previous;
+    previous = now;
+    
+    for(int ticks = 0; accumulator >= tickNs && ticks < maxTicksPerFrame; ++ticks) {
+      PROFILE_ZONE("GameLoop tick");
+      Uint64 start = Timer::getTimeNs();
+      room->updateIdleObjects();
+      bool running = room->runGameLoop();
+      Uint64 elapsed = Timer::getTimeNs() - start;
+      
+      ++stats.ticks;
+      stats.totalTickNs += elapsed;
+      if(elapsed > stats.maxTickNs)
+        stats.maxTickNs = elapsed;
+      if(elapsed > tickNs)
+        ++stats.overrunTicks;
+      
+      accumulator -= tickNs;
+      if(!running) {
+        room->releaseShapes();
+        return room->getTransition();
+      }
+    }
+    
+    // Too far behind, forget the ticks we can't catch up with
+    if(accumulator >= tickNs) {
+      stats.droppedTicks += accumulator / tickNs;
+      accumulator %= tickNs;
+    }
+    
+    if(renderer != NULL) {
+      PROFILE_ZONE("GameLoop render");
+      room->setInterpolation((float)accumulator / tickNs);
+      room->render(renderer);
+      SDL_RenderPresent(renderer);
+      ++stats.frames;
+      Profiler::get().nextFrame();
+    } else {
+      Uint64 wait = (tickNs - accumulator) / 1000000ull;
+      if(wait > 0)
+        SDL_Delay((Uint32)wait);
+    }
+  }
+}
+
+void GameLoop::run(RoomContext* context, int firstRoom, SDL_Renderer* renderer) {
+  int roomId = firstRoom;
+  while(roomId != EXIT_ROOM)
+    roomId = runRoom(context->getRoom(roomId), renderer);
+}
+
+const GameLoopStats& GameLoop::getStats() {
+  return stats;
+}
+
+void GameLoop::resetStats() {
+  stats.ticks = stats.frames = 0;
+  stats.overrunTicks = stats.droppedTicks = 0;
+  stats.totalTickNs = stats.maxTickNs = 0;
+}
+
+void GameLoop::logStats() {
+  double averageMs = 0.0;
+  if(stats.ticks > 0)
+    averageMs = (double)stats.totalTickNs / stats.ticks / 1000000.0;
+  fprintf(stderr, "%llu ticks, %llu frames, %llu overruns, %llu dropped, "
+                  "%.3f ms average tick, %.3f ms longest tick\n",
+          (unsigned long long)stats.ticks, (unsigned long long)stats.frames,
+          (unsigned long long)stats.overrunTicks,
+          (unsigned long long)stats.droppedTicks,
+          averageMs, stats.maxTickNs / 1000000.0);
+}
@@ -0,0 +1,57 @@
+#ifndef __GAMELOOP_H
+#define __GAMELOOP_H
+
+#include <SDL2/SDL.h>
+#include "room.h"
+
+// Statistics about the ticks run by a GameLoop
+struct GameLoopStats {
+  // Ticks and frames run
+  Uint64 ticks;
+  Uint64 frames;
+  
+  // Ticks that took longer than a tick to update
+  Uint64 overrunTicks;
+  
+  // Ticks skipped because the loop fell too far behind
+  Uint64 droppedTicks;
+  
+  // Time spent updating, in nanoseconds
+  Uint64 totalTickNs;
+  Uint64 maxTickNs;
+};
+
+// Runs the rooms with a fixed tick
+// Every tick updates the idle objects of the room and calls runGameLoop(),
+// then the room is rendered once with the fraction of the tick that passed
+// since the last update. If rendering is slow, several ticks are run before
+// the next frame to catch up, but no more than maxTicksPerFrame
+class GameLoop {
+private:
+  // Length of a tick in nanoseconds
+  Uint64 tickNs;
+  
+  // Most ticks run before rendering a frame
+  int maxTicksPerFrame;
+  
+  GameLoopStats stats;
+public:
+  GameLoop(Uint64 _tickNs = MS_TICK_SIZE * 1000000ull, int _maxTicksPerFrame = 5);
+  
+  // Run the room until runGameLoop() returns false
+  // Returns the room we should change to
+  // If renderer is NULL nothing is rendered and the loop sleeps between ticks
+  int runRoom(Room* room, SDL_Renderer* renderer);
+  
+  // Run the rooms of the context, starting with firstRoom, until
+  // a room changes to EXIT_ROOM
+  void run(RoomContext* context, int firstRoom, SDL_Renderer* renderer);
+  
+  const GameLoopStats& getStats();
+  void resetStats();
+  
+  // Print the statistics to stderr
+  void logStats();
+};
+
+#endif
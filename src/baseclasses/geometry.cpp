@@ -1,8 +1,12 @@
 #include "baseclasses/geometry.h"
+#include "baseclasses/collision.h"
 #include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // Geometry utility functions
-const float EPS = 1.0f;
+const float EPS = 1e-4f;
 
 // Returns the value of the area determinant of point abc
 // More precisely, it returns the area of the triangle a, b, c
@@ -39,25 +43,30 @@ float triangleArea(Vector2D a, Vector2D b, Vector2D c) {
   return fabs(ccwDeterminant(a, b, c)) / 2.0f;
 }
 
+// Gets the point of segment [AB] closest to c
+Vector2D closestPointOnSegment(Vector2D c, Vector2D a, Vector2D b) {
+  Vector2D ab = b - a;
+  float length2 = dot(ab, ab);
+  if(length2 <= 0.0f)
+    return a;
+  float t = dot(c - a, ab) / length2;
+  t = std::max(0.0f, std::min(1.0f, t));
+  return a + ab * t;
+}
+
 // Gets the distance between point c to segment [AB]
 float pointToSegmentDistance(Vector2D c, Vector2D a, Vector2D b) {
-  float ab = pointDistance(a, b);
-  float h = triangleArea(c, a, b) * 2.0f / ab;
-  float da = pointDistance(c, a),
-        db = pointDistance(c, b);
-  
-  float foot1 = sqrt(da * da - h * h),
-        foot2 = sqrt(db * db - h * h);
-  
-  if(approxEqual(foot1 + foot2, ab))
-    return h;
-  return std::min(da, db);
+  return pointDistance(c, closestPointOnSegment(c, a, b));
 }
 
-// Check if the given point is inside a triangle
+// Check if the given point is inside a triangle (the border included)
 bool insideTriangle(Vector2D a, Vector2D b, Vector2D c, Vector2D point) {
-  return approxEqual(triangleArea(a, b, point) + triangleArea(b, c, point) +
-                     triangleArea(c, a, point),  triangleArea(a, b, c));
+  float d1 = ccwDeterminant(a, b, point),
+        d2 = ccwDeterminant(b, c, point),
+        d3 = ccwDeterminant(c, a, point);
+  bool negative = d1 < 0.0f || d2 < 0.0f || d3 < 0.0f;
+  bool positive = d1 > 0.0f || d2 > 0.0f || d3 > 0.0f;
+  return !(negative && positive);
 }
 
 // Vector2D implementation
@@ -86,59 +95,184 @@ Vector2D Vector2D::operator* (const float &t) const {
   return Vector2D(x * t, y * t);
 }
 
+// VertexList implementation
+VertexList::VertexList() {
+  data = inlineData;
+  count = 0;
+  capacity = INLINE_VERTICES;
+}
+
+VertexList::VertexList(const VertexList &other) : VertexList() {
+  *this = other;
+}
+
+VertexList &VertexList::operator=(const VertexList &other) {
+  if(this == &other)
+    return *this;
+  
+  clear();
+  for(int i = 0; i < other.count; ++i)
+    push_back(other.data[i]);
+  return *this;
+}
+
+VertexList::~VertexList() {
+  if(data != inlineData)
+    delete[] data;
+}
+
+void VertexList::push_back(Vector2D vertex) {
+  if(count == capacity) {
+    Vector2D* grown = new Vector2D[capacity * 2];
+    for(int i = 0; i < count; ++i)
+      grown[i] = data[i];
+    if(data != inlineData)
+      delete[] data;
+    data = grown;
+    capacity *= 2;
+  }
+  data[count++] = vertex;
+}
+
+void VertexList::resize(int _count) {
+  while(count < _count)
+    push_back(Vector2D());
+  count = _count;
+}
+
+void VertexList::clear() {
+  count = 0;
+}
+
 // Polygon implementation
 Polygon::Polygon() {
   centroidPos = Vector2D();
   circleRadius = -1.0f;
+  angle = 0.0f;
+  cosAngle = 1.0f;
+  sinAngle = 0.0f;
+  localBox = {0.0f, 0.0f, 0.0f, 0.0f};
+  transformDirty = true;
+}
+
+void rotateVertices(const Vector2D* from, Vector2D* to, int count,
+                    float cosine, float sine) {
+  int i = 0;
+#ifdef __SSE2__
+  static_assert(sizeof(Vector2D) == 2 * sizeof(float), "Vector2D isn't packed");
+  
+  // (x, y) becomes x * (c, c) + (y, x) * (-s, s)
+  __m128 cosines = _mm_set1_ps(cosine);
+  __m128 sines = _mm_setr_ps(-sine, sine, -sine, sine);
+  for(; i + 2 <= count; i += 2) {
+    __m128 v = _mm_loadu_ps(&from[i].x);
+    __m128 swapped = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    _mm_storeu_ps(&to[i].x, _mm_add_ps(_mm_mul_ps(v, cosines),
+                                       _mm_mul_ps(swapped, sines)));
+  }
+#endif
+  for(; i < count; ++i) {
+    float x = from[i].x, y = from[i].y;
+    to[i] = Vector2D(x * cosine - y * sine, x * sine + y * cosine);
+  }
+}
+
+void updateTransforms(Polygon* const* polygons, int count) {
+  for(int i = 0; i < count; ++i)
+    if(polygons[i] != NULL && polygons[i]->transformDirty)
+      polygons[i]->updateTransform();
+}
+
+void Polygon::updateTransform() const {
+  int n = vertices.size();
+  rotated.resize(n);
+  transformDirty = false;
+  if(n == 0) {
+    localBox = {0.0f, 0.0f, 0.0f, 0.0f};
+    return;
+  }
+  
+  rotateVertices(&vertices[0], &rotated[0], n, cosAngle, sinAngle);
+  
+  localBox = {rotated[0].x, rotated[0].y, rotated[0].x, rotated[0].y};
+  for(int i = 1; i < n; ++i) {
+    localBox.x1 = std::min(localBox.x1, rotated[i].x);
+    localBox.x2 = std::max(localBox.x2, rotated[i].x);
+    localBox.y1 = std::min(localBox.y1, rotated[i].y);
+    localBox.y2 = std::max(localBox.y2, rotated[i].y);
+  }
+  
+  if(circleRadius > 0.0f) {
+    localBox.x1 -= circleRadius;
+    localBox.y1 -= circleRadius;
+    localBox.x2 += circleRadius;
+    localBox.y2 += circleRadius;
+  }
+}
+
+void Polygon::shapeChanged() {
+  transformDirty = true;
 }
 
 Vector2D Polygon::getCenterOfMass() {  
   Vector2D com = Vector2D();
-  for(int i = 0; i < polygon.size(); ++i)
-    com = com + polygon[i];
-  com = com * (1.0f / polygon.size());
-  return com;
+  for(int i = 0; i < vertices.size(); ++i)
+    com = com + vertices[i];
+  com = com * (1.0f / vertices.size());
+  return centroidPos + Vector2D(com.x * cosAngle - com.y * sinAngle,
+                                com.x * sinAngle + com.y * cosAngle);
 }
 
 void Polygon::centerOfMassCentroid() {
-  centroidPos = getCenterOfMass();
+  setCentroidPosition(getCenterOfMass());
 }
 
 void Polygon::setCentroidPosition(Vector2D pos) {
+  // The vertices are unrotated, so is the shift
+  Vector2D shift = pos - centroidPos;
+  shift = Vector2D(shift.x * cosAngle + shift.y * sinAngle,
+                   -shift.x * sinAngle + shift.y * cosAngle);
+  for(int i = 0; i < vertices.size(); ++i)
+    vertices[i] = vertices[i] - shift;
   centroidPos = pos;
+  shapeChanged();
 }
 
 void Polygon::translate(Vector2D translation) {
-  centroidPos = Vector2D();
-  for(unsigned int i = 0; i < polygon.size(); ++i) {
-    polygon[i] = polygon[i] + translation;
-    centroidPos = centroidPos + polygon[i] * (1.0f / polygon.size());
-  }
+  centroidPos = centroidPos + translation;
 }
 
-void Polygon::rotate(float angle, float x, float y) {
-  float dx, dy;
-  for(unsigned int i = 0; i < polygon.size(); ++i) {
-    dx = polygon[i].x - x;
-    dy = polygon[i].y - y;
-    
-    polygon[i].x = x + (dx * cos(angle) - dy * sin(angle));
-    polygon[i].y = y + (dx * sin(angle) + dy * cos(angle));
-  }
+void Polygon::setRotation(float _angle) {
+  // Kept small so the cosine and sine stay precise
+  angle = remainder(_angle, 2.0f * PI);
+  cosAngle = cos(angle);
+  sinAngle = sin(angle);
+  shapeChanged();
+}
+
+float Polygon::getRotation() const {
+  return angle;
+}
+
+void Polygon::rotate(float _angle, float x, float y) {
+  float c = cos(_angle), s = sin(_angle);
+  float dx = centroidPos.x - x, dy = centroidPos.y - y;
+  centroidPos = Vector2D(x + (dx * c - dy * s), y + (dx * s + dy * c));
   
-  dx = centroidPos.x - x;
-  dy = centroidPos.y - y;
-  centroidPos = Vector2D({x + (dx * cos(angle) - dy * sin(angle)),
-                          y + (dx * sin(angle) + dy * cos(angle))});
+  setRotation(angle + _angle);
 }
 
-void Polygon::rotate(float angle) {
-  rotate(angle, centroidPos.x, centroidPos.y);
+void Polygon::rotate(float _angle) {
+  setRotation(angle + _angle);
 }
 
 bool Polygon::inside(Vector2D point) {
-  for(int i = 1; i + 1 < polygon.size(); ++i) {
-    if(insideTriangle(polygon[0], polygon[i], polygon[i + 1], point)) {
+  // Bring the point in the frame of the unrotated vertices
+  point = point - centroidPos;
+  point = Vector2D(point.x * cosAngle + point.y * sinAngle,
+                   -point.x * sinAngle + point.y * cosAngle);
+  for(int i = 1; i + 1 < vertices.size(); ++i) {
+    if(insideTriangle(vertices[0], vertices[i], vertices[i + 1], point)) {
       return true;
     }
   }
@@ -146,103 +280,51 @@ bool Polygon::inside(Vector2D point) {
 }
 
 bool Polygon::collides(Polygon* otherPoly) {
-  // Circle to circle intersection
-  /*if(circleRadius >= 0.0f && otherPoly->circleRadius >= 0.0f) {
-    return pointDistance(polygon[0], otherPoly->polygon[0]) 
-        <= circleRadius + otherPoly->circleRadius;
-  } else if(circleRadius >= 0.0f) { // Circle to polygon intersection
-    for(int i = 0; i < otherPoly->polygon.size(); ++i) {
-      int ii = (i + 1) % otherPoly->polygon.size();
-      
-      if(pointToSegmentDistance(polygon[0], otherPoly->polygon[i],
-         otherPoly->polygon[ii]) <= circleRadius)
-        return true;
-    }
-    
-    return otherPoly->inside(polygon[0]);
-  } else if(otherPoly->circleRadius >= 0.0f) { // Polygon to circle intersection
-    return otherPoly->collides(this);
-  } else { // Polygon to polygon intersection
-    for(int i = 0; i < polygon.size(); ++i)
-      for(int j = 0; j < otherPoly->polygon.size(); ++j) {
-        int ii = (i + 1) % polygon.size();
-        int jj = (j + 1) % otherPoly->polygon.size();
-        if(segmentToSegmentCollision(polygon[i], polygon[ii],
-                          otherPoly->polygon[j], otherPoly->polygon[jj]))
-          return true;
-      }
-    return otherPoly->inside(polygon[0]) ||
-           inside(otherPoly->polygon[0]);
-  }*/
-  
-  //return false;
-  
-  float x1, y1, x2, y2;
-  float ox1, oy1, ox2, oy2;
-  
-  x1 = y1 = ox1 = oy1 =  1e9;
-  x2 = y2 = ox2 = oy2 = -1e9;
-  
-  for(unsigned int i = 0; i < polygon.size(); ++i) {
-    x1 = std::min(x1, polygon[i].x);
-    x2 = std::max(x2, polygon[i].x);
-    y1 = std::min(y1, polygon[i].y);
-    y2 = std::max(y2, polygon[i].y);
-  }
-  
-  for(unsigned int i = 0; i < otherPoly->polygon.size(); ++i) {
-    ox1 = std::min(ox1, otherPoly->polygon[i].x);
-    ox2 = std::max(ox2, otherPoly->polygon[i].x);
-    oy1 = std::min(oy1, otherPoly->polygon[i].y);
-    oy2 = std::max(oy2, otherPoly->polygon[i].y);
-  }
-  
-  return std::max(x1, ox1) <= std::min(x2, ox2) &&
-         std::max(y1, oy1) <= std::min(y2, oy2);
+  return getBoundingBox().intersects(otherPoly->getBoundingBox()) &&
+         collideShapes(this, otherPoly, NULL);
 }
 
-Polygon* getRectangle(float x, float y, float w, float h) {
-  Polygon* polygon = new Polygon();
-  polygon->polygon.push_back(Vector2D(x - w / 2.0f, y - h / 2.0f));
-  polygon->polygon.push_back(Vector2D(x + w / 2.0f, y - h / 2.0f));
-  polygon->polygon.push_back(Vector2D(x + w / 2.0f, y + h / 2.0f));
-  polygon->polygon.push_back(Vector2D(x - w / 2.0f, y + h / 2.0f));
-  polygon->centerOfMassCentroid();
+Polygon getRectangle(float x, float y, float w, float h) {
+  Polygon polygon;
+  polygon.vertices.push_back(Vector2D(x - w / 2.0f, y - h / 2.0f));
+  polygon.vertices.push_back(Vector2D(x + w / 2.0f, y - h / 2.0f));
+  polygon.vertices.push_back(Vector2D(x + w / 2.0f, y + h / 2.0f));
+  polygon.vertices.push_back(Vector2D(x - w / 2.0f, y + h / 2.0f));
+  polygon.centerOfMassCentroid();
   return polygon;
 }
 
-Polygon* getPoint(float x, float y) {
-  Polygon* polygon = new Polygon();
-  polygon->polygon.push_back(Vector2D(x, y));
-  polygon->centerOfMassCentroid();
+Polygon getPoint(float x, float y) {
+  Polygon polygon;
+  polygon.vertices.push_back(Vector2D(x, y));
+  polygon.centerOfMassCentroid();
   return polygon;
 }
 
-Polygon* getRegularPolygon(float x, float y, float radius, int n) {
-  Polygon* polygon = new Polygon();
+Polygon getRegularPolygon(float x, float y, float radius, int n) {
+  Polygon polygon;
   float angleGrowth = PI * 2 / n, angle = 0.0f;
   
   for(int i = 0; i < n; ++i) {
-    polygon->polygon.push_back(Vector2D(x, y) + 
+    polygon.vertices.push_back(Vector2D(x, y) + 
                                Vector2D(cos(angle), sin(angle)) * radius);
     angle += angleGrowth;
   }
-  polygon->centerOfMassCentroid();
+  polygon.centerOfMassCentroid();
   return polygon;
 }
 
-Polygon* getSegment(float x1, float y1, float x2, float y2) {
-  Polygon* polygon = new Polygon();
-  polygon->polygon.push_back(Vector2D(x1, y1));
-  polygon->polygon.push_back(Vector2D(x2, y2));
-  polygon->centerOfMassCentroid();
+Polygon getSegment(float x1, float y1, float x2, float y2) {
+  Polygon polygon;
+  polygon.vertices.push_back(Vector2D(x1, y1));
+  polygon.vertices.push_back(Vector2D(x2, y2));
+  polygon.centerOfMassCentroid();
   return polygon;
 }
 
-Polygon* getCircle(float x, float y, float radius) {
-  Polygon* polygon = getPoint(x, y);
-  polygon->circleRadius = radius;
-  polygon->centerOfMassCentroid();
+Polygon getCircle(float x, float y, float radius) {
+  Polygon polygon = getPoint(x, y);
+  polygon.circleRadius = radius;
+  polygon.shapeChanged();
   return polygon;
 }
-
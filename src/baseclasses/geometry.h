@@ -1,11 +1,6 @@
 #ifndef __GEOMETRY_H
 #define __GEOMETRY_H
 
-/* TODO:
- * implement rotation
- * implement a bad collision function for the moment
- * implement a good collision function
- */
 #include <cmath>
 #include <vector>
 
@@ -24,14 +19,72 @@ struct Vector2D {
   Vector2D operator* (const float &x) const;
 };
 
+inline float dot(Vector2D a, Vector2D b) {
+  return a.x * b.x + a.y * b.y;
+}
+
+// z component of the cross product of a and b
+inline float cross(Vector2D a, Vector2D b) {
+  return a.x * b.y - a.y * b.x;
+}
+
+// Axis aligned bounding box
+struct BoundingBox {
+  float x1, y1, x2, y2;
+  
+  // Checks if two boxes intersect
+  bool intersects(const BoundingBox &box) const {
+    return x1 <= box.x2 && box.x1 <= x2 && y1 <= box.y2 && box.y1 <= y2;
+  }
+};
+
+// Up to this many vertices are stored inside the polygon itself
+const int INLINE_VERTICES = 8;
+
+// List of vertices kept inline while it is small enough, on the heap
+// otherwise
+class VertexList {
+private:
+  Vector2D inlineData[INLINE_VERTICES];
+  Vector2D* data;
+  int count, capacity;
+public:
+  VertexList();
+  VertexList(const VertexList &other);
+  VertexList &operator=(const VertexList &other);
+  ~VertexList();
+  
+  void push_back(Vector2D vertex);
+  void resize(int _count);
+  void clear();
+  
+  int size() const {
+    return count;
+  }
+  
+  bool empty() const {
+    return count == 0;
+  }
+  
+  Vector2D &operator[](int i) {
+    return data[i];
+  }
+  
+  const Vector2D &operator[](int i) const {
+    return data[i];
+  }
+};
+
 // Struct that holds a polygon
 struct Polygon {
   Polygon();
   
   // Centroid of polygon
+  // This is the position of the polygon, the vertices are relative to it
   Vector2D centroidPos;
   
   // Sets the center of the polygon at the given position
+  // The polygon doesn't move
   void setCentroidPosition(Vector2D pos);
   
   // Sets the center of the polygon at the center of mass of the polygon
@@ -44,8 +97,51 @@ struct Polygon {
   
   
   // This holds the vertices of the polygon in trigonometric order
-  // (counter clockwise)
-  std::vector<Vector2D> polygon;
+  // (counter clockwise), relative to centroidPos and before the rotation
+  // Call shapeChanged() after changing them directly
+  VertexList vertices;
+  
+  // Orientation of the polygon in radians, counter clockwise, with its
+  // cosine and sine
+  float angle, cosAngle, sinAngle;
+  
+  // Vertices after the rotation and their bounding box (including the
+  // radius of circles), both relative to centroidPos
+  // They are computed by updateTransform() when needed
+  mutable VertexList rotated;
+  mutable BoundingBox localBox;
+  mutable bool transformDirty;
+  
+  // Recompute the rotated vertices and the bounding box if they are dirty
+  // Isn't thread safe, call it before sharing the polygon between threads
+  void updateTransform() const;
+  
+  // Call after changing the vertices or the radius
+  void shapeChanged();
+  
+  // Number of vertices
+  int size() const {
+    return vertices.size();
+  }
+  
+  // Position of the i'th vertex
+  Vector2D getVertex(int i) const {
+    if(transformDirty)
+      updateTransform();
+    return centroidPos + rotated[i];
+  }
+  
+  // Bounding box of the polygon
+  BoundingBox getBoundingBox() const {
+    if(transformDirty)
+      updateTransform();
+    return {localBox.x1 + centroidPos.x, localBox.y1 + centroidPos.y,
+            localBox.x2 + centroidPos.x, localBox.y2 + centroidPos.y};
+  }
+  
+  // Sets the orientation of the polygon, around the centroid
+  void setRotation(float _angle);
+  float getRotation() const;
   
   // Translates the polygon with the vector (x, y)
   void translate(Vector2D translation);
@@ -60,9 +156,9 @@ struct Polygon {
   // The rotation will be in counter-clockwise direction
   void rotate(float angle);
 
-  // Checks collision between two polygons
-  // Note: at the moment, this just returns true if the
-  //       bounding boxes of the two polygons intersect
+  // Checks collision between two convex polygons
+  // Use a SpatialHash to find the pairs to check among many polygons and
+  // collideShapes() to get the contact normal and penetration
   bool collides(Polygon* otherPolygon);
   
   // Checks if the given point is inside the polygon
@@ -70,13 +166,24 @@ struct Polygon {
 };
 
 float pointDistance(Vector2D a, Vector2D b);
+float pointToSegmentDistance(Vector2D c, Vector2D a, Vector2D b);
+Vector2D closestPointOnSegment(Vector2D c, Vector2D a, Vector2D b);
+bool insideTriangle(Vector2D a, Vector2D b, Vector2D c, Vector2D point);
+
+// Rotate count vertices around the origin, two at a time with SSE2
+void rotateVertices(const Vector2D* from, Vector2D* to, int count,
+                    float cosine, float sine);
+
+// Update the transforms of many polygons, NULL ones are skipped
+void updateTransforms(Polygon* const* polygons, int count);
 
 // Creates various shapes
-Polygon* getRectangle(float x, float y, float w, float h);
-Polygon* getPoint(float x, float y);
-Polygon* getRegularPolygon(float x, float y, float radius, int n);
-Polygon* getSegment(float x1, float y1, float x2, float y2);
-Polygon* getCircle(float x, float y, float radius);
+// Objects should keep them in an arena, see Room::createShape()
+Polygon getRectangle(float x, float y, float w, float h);
+Polygon getPoint(float x, float y);
+Polygon getRegularPolygon(float x, float y, float radius, int n);
+Polygon getSegment(float x1, float y1, float x2, float y2);
+Polygon getCircle(float x, float y, float radius);
 
 #endif
 
@@ -1,10 +1,18 @@
 #include "baseclasses/graphicshandler.h"
 #include <algorithm>
+#include <cstring>
 
 FontRenderer::FontRenderer(const char* filename, int fontsize) {
   usedFont = TTF_OpenFont(filename, fontsize);
   if(usedFont == NULL)
     SDL_Log("Failed to open font: %s\n", TTF_GetError());
+  
+  atlasRenderer = NULL;
+  atlasTexture = NULL;
+  atlasSurface = NULL;
+  shelfX = shelfY = shelfHeight = 0;
+  for(int i = 0; i < 256; ++i)
+    glyphs[i].loaded = false;
 }
 
 FontRenderer::~FontRenderer() {
@@ -12,58 +20,241 @@ FontRenderer::~FontRenderer() {
     TTF_CloseFont(usedFont);
     usedFont = NULL;
   }
+  
+  if(atlasTexture != NULL) {
+    SDL_DestroyTexture(atlasTexture);
+    atlasTexture = NULL;
+  }
+  
+  if(atlasSurface != NULL) {
+    SDL_FreeSurface(atlasSurface);
+    atlasSurface = NULL;
+  }
 }
 
 std::string FontRenderer::inttostring(int x) {
-  bool negative = (x < 0);
-  std::string rez;
+  char buffer[12];
+  inttostring(x, buffer);
+  return std::string(buffer);
+}
+
+int FontRenderer::inttostring(int x, char* buffer) {
+  // Unsigned, so the smallest int can be negated
+  unsigned int value = x < 0 ? 0u - (unsigned int)x : (unsigned int)x;
+  char digits[10];
+  int count = 0;
+  
+  do {
+    digits[count++] = value % 10 + '0';
+    value /= 10;
+  } while(value > 0);
   
+  int length = 0;
   if(x < 0)
-    x = -x;
+    buffer[length++] = '-';
+  while(count > 0)
+    buffer[length++] = digits[--count];
+  buffer[length] = '\0';
+  return length;
+}
+
+bool FontRenderer::createAtlas(SDL_Renderer* renderer, int height) {
+  SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, GLYPH_ATLAS_WIDTH, height, 32,
+                                                        SDL_PIXELFORMAT_ARGB8888);
+  if(surface == NULL) {
+    SDL_Log("Unable to create glyph atlas: %s\n", SDL_GetError());
+    return false;
+  }
   
-  if(x == 0)
-    rez.push_back('0');
+  SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                           SDL_TEXTUREACCESS_STATIC,
+                                           GLYPH_ATLAS_WIDTH, height);
+  if(texture == NULL) {
+    SDL_Log("Unable to create glyph atlas: %s\n", SDL_GetError());
+    SDL_FreeSurface(surface);
+    return false;
+  }
+  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
   
-  while(x > 0) {
-    rez.push_back(x % 10 + '0');
-    x /= 10;
+  // The glyphs are kept when growing, they are rendered again for
+  // another renderer
+  if(atlasSurface != NULL && renderer == atlasRenderer) {
+    SDL_SetSurfaceBlendMode(atlasSurface, SDL_BLENDMODE_NONE);
+    SDL_BlitSurface(atlasSurface, NULL, surface, NULL);
+  } else {
+    shelfX = shelfY = shelfHeight = 0;
+    for(int i = 0; i < 256; ++i)
+      glyphs[i].loaded = false;
   }
+  SDL_UpdateTexture(texture, NULL, surface->pixels, surface->pitch);
   
-  if(negative)
-    rez.push_back('-');
-  reverse(rez.begin(), rez.end());
-  return rez;
+  if(atlasTexture != NULL)
+    SDL_DestroyTexture(atlasTexture);
+  if(atlasSurface != NULL)
+    SDL_FreeSurface(atlasSurface);
+  atlasRenderer = renderer;
+  atlasTexture = texture;
+  atlasSurface = surface;
+  
+  // The texture coordinates of the cached strings changed
+  textCache.clear();
+  textIndex.clear();
+  return true;
 }
 
-void FontRenderer::renderText(SDL_Renderer* renderer, float _x, float _y,
-                             std::string text) {
-  SDL_Color color;
-  SDL_GetRenderDrawColor(renderer, &color.r, &color.g, &color.b, &color.a);
+FontRenderer::Glyph* FontRenderer::getGlyph(unsigned char c) {
+  Glyph* glyph = &glyphs[c];
+  if(glyph->loaded)
+    return glyph;
   
-  SDL_Surface* surface = TTF_RenderText_Solid(usedFont, text.c_str(), color);
+  glyph->loaded = true;
+  glyph->rect = {0, 0, 0, 0};
+  glyph->advance = 0;
+  
+  int minx, maxx, miny, maxy;
+  if(TTF_GlyphMetrics(usedFont, c, &minx, &maxx, &miny, &maxy, &glyph->advance) < 0)
+    return glyph;
+  
+  // The glyph is white and colored when drawn
+  SDL_Color white = {255, 255, 255, 255};
+  SDL_Surface* rendered = TTF_RenderGlyph_Blended(usedFont, c, white);
+  if(rendered == NULL)
+    return glyph;
+  SDL_Surface* surface = SDL_ConvertSurfaceFormat(rendered, SDL_PIXELFORMAT_ARGB8888, 0);
+  SDL_FreeSurface(rendered);
   if(surface == NULL)
-    SDL_Log("Unable to create font surface: %s\n", TTF_GetError());
-  else {
-    SDL_Texture* texture;
-    texture = SDL_CreateTextureFromSurface(renderer, surface);
-    if(texture == NULL)
-      SDL_Log("Unable to create texture from surface: %s\n", SDL_GetError());
-    else {
-      int textureWidth = surface->w; 
-      int textureHeight = surface->h;
-      
-      SDL_Rect rect = {(int)floor(_x - textureWidth / 2.0f),
-                       (int)floor(_y - textureHeight / 2.0f),
-                       textureWidth, textureHeight};
-      SDL_RenderCopy(renderer, texture, NULL, &rect);
-      
-      SDL_DestroyTexture(texture);
-      texture = NULL;
+    return glyph;
+  
+  // One pixel between glyphs, so they don't bleed into each other
+  if(shelfX + surface->w + 1 > atlasSurface->w) {
+    shelfX = 0;
+    shelfY += shelfHeight;
+    shelfHeight = 0;
+  }
+  while(shelfY + surface->h + 1 > atlasSurface->h)
+    if(!createAtlas(atlasRenderer, atlasSurface->h * 2)) {
+      SDL_FreeSurface(surface);
+      return glyph;
     }
+  
+  glyph->rect = {shelfX, shelfY, surface->w, surface->h};
+  SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_NONE);
+  SDL_BlitSurface(surface, NULL, atlasSurface, &glyph->rect);
+  
+  unsigned char* pixels = (unsigned char*)atlasSurface->pixels +
+                          glyph->rect.y * atlasSurface->pitch + glyph->rect.x * 4;
+  SDL_UpdateTexture(atlasTexture, &glyph->rect, pixels, atlasSurface->pitch);
+  
+  shelfX += surface->w + 1;
+  shelfHeight = std::max(shelfHeight, surface->h + 1);
+  SDL_FreeSurface(surface);
+  return glyph;
+}
+
+FontRenderer::CachedText* FontRenderer::layoutText(const char* text) {
+  std::string key(text);
+  std::unordered_map<std::string, std::list<CachedText>::iterator>::iterator found;
+  found = textIndex.find(key);
+  if(found != textIndex.end()) {
+    textCache.splice(textCache.begin(), textCache, found->second);
+    return &textCache.front();
+  }
+  
+  // Load the glyphs first, the atlas might grow and forget the cache
+  for(const char* c = text; *c != '\0'; ++c)
+    getGlyph((unsigned char)*c);
+  
+  CachedText layout;
+  layout.text = key;
+  
+  float atlasW = atlasSurface->w, atlasH = atlasSurface->h;
+  SDL_Color white = {255, 255, 255, 255};
+  int pen = 0;
+  Uint16 previous = 0;
+  for(const char* c = text; *c != '\0'; ++c) {
+    Uint16 ch = (unsigned char)*c;
+    if(previous != 0)
+      pen += TTF_GetFontKerningSizeGlyphs(usedFont, previous, ch);
+    previous = ch;
     
-    SDL_FreeSurface(surface);
-    surface = NULL;
+    Glyph* glyph = &glyphs[ch];
+    if(glyph->rect.w > 0) {
+      SDL_Rect r = glyph->rect;
+      float x1 = pen, y1 = 0.0f, x2 = pen + r.w, y2 = r.h;
+      float u1 = r.x / atlasW, v1 = r.y / atlasH;
+      float u2 = (r.x + r.w) / atlasW, v2 = (r.y + r.h) / atlasH;
+      layout.vertices.push_back({{x1, y1}, white, {u1, v1}});
+      layout.vertices.push_back({{x2, y1}, white, {u2, v1}});
+      layout.vertices.push_back({{x2, y2}, white, {u2, v2}});
+      layout.vertices.push_back({{x1, y2}, white, {u1, v2}});
+    }
+    pen += glyph->advance;
   }
+  layout.width = pen;
+  
+  textCache.push_front(layout);
+  textIndex[key] = textCache.begin();
+  if((int)textCache.size() > TEXT_CACHE_SIZE) {
+    textIndex.erase(textCache.back().text);
+    textCache.pop_back();
+  }
+  return &textCache.front();
+}
+
+void FontRenderer::renderText(SDL_Renderer* renderer, float _x, float _y,
+                             const char* text) {
+  if(usedFont == NULL)
+    return;
+  if(renderer != atlasRenderer && !createAtlas(renderer, GLYPH_ATLAS_HEIGHT))
+    return;
+  
+  CachedText* layout = layoutText(text);
+  if(layout->vertices.empty())
+    return;
+  
+  SDL_Color color;
+  SDL_GetRenderDrawColor(renderer, &color.r, &color.g, &color.b, &color.a);
+  
+  float left = floor(_x - layout->width / 2.0f);
+  float top = floor(_y - TTF_FontHeight(usedFont) / 2.0f);
+  
+  vertices = layout->vertices;
+  for(unsigned int i = 0; i < vertices.size(); ++i) {
+    vertices[i].position.x += left;
+    vertices[i].position.y += top;
+    vertices[i].color = color;
+  }
+  
+  indices.clear();
+  for(unsigned int quad = 0; quad < vertices.size(); quad += 4) {
+    int corners[6] = {0, 1, 2, 0, 2, 3};
+    for(int k = 0; k < 6; ++k)
+      indices.push_back(quad + corners[k]);
+  }
+  
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+  if(SDL_RenderGeometry(renderer, atlasTexture, vertices.data(), vertices.size(),
+                        indices.data(), indices.size()) == 0)
+    return;
+#endif
+  
+  // The renderer can't draw geometry, copy the glyphs one by one
+  SDL_SetTextureColorMod(atlasTexture, color.r, color.g, color.b);
+  for(unsigned int quad = 0; quad < vertices.size(); quad += 4) {
+    const SDL_Vertex &a = vertices[quad], &b = vertices[quad + 2];
+    SDL_Rect from = {(int)round(a.tex_coord.x * atlasSurface->w),
+                     (int)round(a.tex_coord.y * atlasSurface->h),
+                     (int)round(b.position.x - a.position.x),
+                     (int)round(b.position.y - a.position.y)};
+    SDL_Rect target = {(int)a.position.x, (int)a.position.y, from.w, from.h};
+    SDL_RenderCopy(renderer, atlasTexture, &from, &target);
+  }
+  SDL_SetTextureColorMod(atlasTexture, 255, 255, 255);
+}
+
+void FontRenderer::renderText(SDL_Renderer* renderer, float _x, float _y,
+                             std::string text) {
+  renderText(renderer, _x, _y, text.c_str());
 }
 
 TileSetRenderer::TileSetRenderer(const char* filename, 
@@ -71,20 +262,14 @@ TileSetRenderer::TileSetRenderer(const char* filename,
                                  int _tw, int _th) {
   SDL_Surface* surface = IMG_Load(filename);
   texture = NULL;
+  atlas = NULL;
   
-  textureWidth = surface->w; 
-  textureHeight = surface->h;
-  
-  tileWidth = _tw;
-  tileHeight = _th;
-  if(_tw == 0 || _th == 0) {
-    tileWidth = textureWidth;
-    tileHeight = textureHeight;
-  }
-  
+  textureWidth = textureHeight = 0;
   if(surface == NULL) {
     SDL_Log("Unable to load image %s: %s\n", filename, SDL_GetError());
   } else {
+    textureWidth = surface->w; 
+    textureHeight = surface->h;
     texture = SDL_CreateTextureFromSurface(renderer, surface);
     if(texture == NULL)
       SDL_Log("Unable to create texture %s: %s\n", filename, SDL_GetError());
@@ -92,13 +277,69 @@ TileSetRenderer::TileSetRenderer(const char* filename,
     surface = NULL;
   }
   
+  region.page = 0;
+  region.rect = {0, 0, textureWidth, textureHeight};
+  
+  tileWidth = _tw;
+  tileHeight = _th;
+  if(_tw == 0 || _th == 0) {
+    tileWidth = textureWidth;
+    tileHeight = textureHeight;
+  }
+  
+  rotationAngle = 0.0f;
+  rotationCenter = {0, 0};
+  customCenter = false;
+  textureFlip = SDL_FLIP_NONE;
+}
+
+TileSetRenderer::TileSetRenderer(const char* filename, TextureAtlas* _atlas,
+                                 int _tw, int _th) {
+  texture = NULL;
+  atlas = _atlas;
+  
+  region.page = -1;
+  region.rect = {0, 0, 0, 0};
+  if(!atlas->load(filename, region))
+    atlas = NULL;
+  textureWidth = region.rect.w;
+  textureHeight = region.rect.h;
+  
+  tileWidth = _tw;
+  tileHeight = _th;
+  if(_tw == 0 || _th == 0) {
+    tileWidth = textureWidth;
+    tileHeight = textureHeight;
+  }
+  
   rotationAngle = 0.0f;
-  rotationCenter = NULL;
+  rotationCenter = {0, 0};
+  customCenter = false;
+  textureFlip = SDL_FLIP_NONE;
+}
+
+TileSetRenderer::TileSetRenderer(AssetHandle _image, int _tw, int _th) {
+  texture = NULL;
+  atlas = NULL;
+  image = _image;
+  
+  // The size is known when the image is ready
+  textureWidth = textureHeight = 0;
+  region.page = 0;
+  region.rect = {0, 0, 0, 0};
+  
+  tileWidth = _tw;
+  tileHeight = _th;
+  
+  rotationAngle = 0.0f;
+  rotationCenter = {0, 0};
+  customCenter = false;
   textureFlip = SDL_FLIP_NONE;
 }
 
 TileSetRenderer::~TileSetRenderer() {
-  if(texture != NULL) {
+  // The pages of the atlas and the images belong to their managers
+  if(texture != NULL && atlas == NULL && !image.isValid()) {
     SDL_DestroyTexture(texture);
     texture = NULL;
   }
@@ -113,24 +354,57 @@ void TileSetRenderer::setRotationAngle(double x) {
 }
 
 void TileSetRenderer::setRotationCenter(SDL_Point x) {
-  rotationCenter = &x;
+  rotationCenter = x;
+  customCenter = true;
 }
 
 void TileSetRenderer::setCentroidRotation() {
-  rotationCenter = NULL;
+  customCenter = false;
+}
+
+bool TileSetRenderer::resolveTexture(SDL_Renderer* renderer) {
+  if(atlas != NULL) {
+    atlas->upload(renderer);
+    texture = atlas->getTexture(region.page);
+  } else if(image.isValid() && texture == NULL && image.isReady()) {
+    texture = image.getTexture();
+    textureWidth = image.getWidth();
+    textureHeight = image.getHeight();
+    region.rect = {0, 0, textureWidth, textureHeight};
+    if(tileWidth == 0 || tileHeight == 0) {
+      tileWidth = textureWidth;
+      tileHeight = textureHeight;
+    }
+  }
+  return texture != NULL;
 }
 
 void TileSetRenderer::renderTexture(SDL_Renderer* renderer, int l, int c, 
                                     SDL_Rect target) {
-  if(texture != NULL) {
-    SDL_Rect from = {c * tileWidth, l * tileHeight, tileWidth, tileHeight};
-    SDL_RenderCopyEx(renderer, texture, &from, &target, rotationAngle, rotationCenter, textureFlip);
+  if(resolveTexture(renderer)) {
+    SDL_Rect from = {region.rect.x + c * tileWidth, region.rect.y + l * tileHeight,
+                     tileWidth, tileHeight};
+    SDL_RenderCopyEx(renderer, texture, &from, &target, rotationAngle,
+                     customCenter ? &rotationCenter : NULL, textureFlip);
   }
 }
 
 void TileSetRenderer::renderTexture(SDL_Renderer* renderer, SDL_Rect target) {
-  if(texture != NULL)
-    SDL_RenderCopyEx(renderer, texture, NULL, &target, rotationAngle, rotationCenter, textureFlip);
+  if(resolveTexture(renderer))
+    SDL_RenderCopyEx(renderer, texture, &region.rect, &target, rotationAngle,
+                     customCenter ? &rotationCenter : NULL, textureFlip);
+}
+
+void TileSetRenderer::drawTile(SpriteBatch* batch, int l, int c, SDL_FRect target,
+                               int depth) {
+  if(atlas == NULL)
+    return;
+  
+  SDL_Rect from = {region.rect.x + c * tileWidth, region.rect.y + l * tileHeight,
+                   tileWidth, tileHeight};
+  SDL_FPoint center = {(float)rotationCenter.x, (float)rotationCenter.y};
+  batch->draw(region.page, from, target, depth, rotationAngle,
+              customCenter ? &center : NULL, textureFlip);
 }
 
 
@@ -139,41 +413,171 @@ SDL_Rect TileSetRenderer::getCenteredPosition(int x, int y) {
   return rez;
 }
 
-void drawPolygon(SDL_Renderer* renderer, Polygon* poly) {
+ShapeBatcher::ShapeBatcher() {
+  color = {255, 255, 255, 255};
+  useGeometry = true;
+}
+
+const std::vector<SDL_FPoint> &ShapeBatcher::getUnitCircle(int segments) {
+  static std::vector<SDL_FPoint> tables[32];
+  
+  int level = 0;
+  while((1 << level) < segments)
+    ++level;
+  
+  std::vector<SDL_FPoint> &table = tables[level];
+  if(table.empty()) {
+    int count = 1 << level;
+    for(int i = 0; i <= count; ++i) {
+      float angle = 2 * PI * (i % count) / count;
+      table.push_back({(float)cos(angle), (float)sin(angle)});
+    }
+  }
+  return table;
+}
+
+void ShapeBatcher::setColor(SDL_Color _color) {
+  color = _color;
+}
+
+void ShapeBatcher::addLine(float x1, float y1, float x2, float y2) {
+  Strip strip = {(int)stripPoints.size(), 2, color};
+  stripPoints.push_back({x1, y1});
+  stripPoints.push_back({x2, y2});
+  strips.push_back(strip);
+}
+
+void ShapeBatcher::addPoint(float x, float y) {
+  points.push_back({x, y});
+  pointColors.push_back(color);
+}
+
+void ShapeBatcher::addPolygon(Polygon* poly) {
   if(poly->circleRadius >= 0.0f) {
-    int prec = (int)floor(12 * poly->circleRadius);
-    float prevX, prevY;
-    
-    float angleGrowth = 2 * PI / prec, angle = angleGrowth;
-    
-    prevX = poly->centroidPos.x + poly->circleRadius;
-    prevY = poly->centroidPos.y;
-    
-    for(int i = 0; i < prec; ++i) {
-      float newX = poly->centroidPos.x + cos(angle) * poly->circleRadius, 
-            newY = poly->centroidPos.y + sin(angle) * poly->circleRadius;
-      SDL_RenderDrawLine(renderer, (int)floor(prevX),
-                                   (int)floor(prevY),
-                                   (int)floor(newX),
-                                   (int)floor(newY));
+    addCircle(poly->centroidPos.x, poly->centroidPos.y, poly->circleRadius);
+    return;
+  }
+  
+  int n = poly->size();
+  if(n == 1) {
+    addPoint(poly->getVertex(0).x, poly->getVertex(0).y);
+    return;
+  }
+  
+  // Segments are drawn once, polygons are closed
+  Strip strip = {(int)stripPoints.size(), n == 2 ? 2 : n + 1, color};
+  for(int i = 0; i < strip.count; ++i) {
+    Vector2D vertex = poly->getVertex(i % n);
+    stripPoints.push_back({vertex.x, vertex.y});
+  }
+  strips.push_back(strip);
+}
+
+void ShapeBatcher::addCircle(float x, float y, float radius) {
+  if(radius < 1.0f) {
+    addPoint(x, y);
+    return;
+  }
+  
+  // A chord of a circle with n segments is at most r * (1 - cos(PI / n))
+  // away from the circle
+  int segments = (int)ceil(PI / acos(1.0f - CIRCLE_TOLERANCE / radius));
+  segments = std::max(MIN_CIRCLE_SEGMENTS, std::min(MAX_CIRCLE_SEGMENTS, segments));
+  
+  const std::vector<SDL_FPoint> &table = getUnitCircle(segments);
+  Strip strip = {(int)stripPoints.size(), (int)table.size(), color};
+  for(unsigned int i = 0; i < table.size(); ++i)
+    stripPoints.push_back({x + table[i].x * radius, y + table[i].y * radius});
+  strips.push_back(strip);
+}
+
+void ShapeBatcher::flushGeometry(SDL_Renderer* renderer) {
+  vertices.clear();
+  indices.clear();
+  
+  // Every line is a quad one pixel wide
+  for(unsigned int s = 0; s < strips.size(); ++s) {
+    const Strip &strip = strips[s];
+    for(int i = strip.first; i + 1 < strip.first + strip.count; ++i) {
+      SDL_FPoint p = stripPoints[i], q = stripPoints[i + 1];
+      float dx = q.x - p.x, dy = q.y - p.y;
+      float length = sqrt(dx * dx + dy * dy);
+      if(length == 0.0f)
+        continue;
       
-      prevX = newX;
-      prevY = newY;
+      float nx = -dy / length * 0.5f, ny = dx / length * 0.5f;
+      int base = vertices.size();
+      vertices.push_back({{p.x + nx, p.y + ny}, strip.color, {0.0f, 0.0f}});
+      vertices.push_back({{p.x - nx, p.y - ny}, strip.color, {0.0f, 0.0f}});
+      vertices.push_back({{q.x - nx, q.y - ny}, strip.color, {0.0f, 0.0f}});
+      vertices.push_back({{q.x + nx, q.y + ny}, strip.color, {0.0f, 0.0f}});
       
-      angle += angleGrowth;
+      int quad[6] = {0, 1, 2, 0, 2, 3};
+      for(int k = 0; k < 6; ++k)
+        indices.push_back(base + quad[k]);
     }
-  } else {
-    for(unsigned int i = 0; i < poly->polygon.size(); ++i) {
-      int i2 = (i + 1) % poly->polygon.size();
-      SDL_RenderDrawLine(renderer, (int)poly->polygon[i].x,  
-                                   (int)poly->polygon[i].y, 
-                                   (int)poly->polygon[i2].x, 
-                                   (int)poly->polygon[i2].y);
+  }
+  
+  if(vertices.empty())
+    return;
+  
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+  if(SDL_RenderGeometry(renderer, NULL, vertices.data(), vertices.size(),
+                        indices.data(), indices.size()) == 0)
+    return;
+  SDL_Log("Unable to draw geometry, drawing lines instead: %s\n", SDL_GetError());
+#endif
+  useGeometry = false;
+  flushStrips(renderer);
+}
+
+void ShapeBatcher::flushStrips(SDL_Renderer* renderer) {
+  for(unsigned int s = 0; s < strips.size(); ++s) {
+    const Strip &strip = strips[s];
+    SDL_SetRenderDrawColor(renderer, strip.color.r, strip.color.g,
+                           strip.color.b, strip.color.a);
+    SDL_RenderDrawLinesF(renderer, &stripPoints[strip.first], strip.count);
+  }
+}
+
+void ShapeBatcher::flushPoints(SDL_Renderer* renderer) {
+  // One call for every run of points with the same color
+  unsigned int first = 0;
+  for(unsigned int i = 1; i <= points.size(); ++i) {
+    if(i == points.size() || memcmp(&pointColors[i], &pointColors[first], sizeof(SDL_Color)) != 0) {
+      SDL_Color c = pointColors[first];
+      SDL_SetRenderDrawColor(renderer, c.r, c.g, c.b, c.a);
+      SDL_RenderDrawPointsF(renderer, &points[first], i - first);
+      first = i;
     }
-    
-    if(poly->polygon.size() == 1)
-      SDL_RenderDrawPoint(renderer, (int)poly->polygon[0].x, 
-                                    (int)poly->polygon[0].y);
   }
 }
 
+void ShapeBatcher::flush(SDL_Renderer* renderer) {
+  SDL_Color previous;
+  SDL_GetRenderDrawColor(renderer, &previous.r, &previous.g, &previous.b, &previous.a);
+  
+  if(useGeometry)
+    flushGeometry(renderer);
+  else
+    flushStrips(renderer);
+  if(!points.empty())
+    flushPoints(renderer);
+  
+  SDL_SetRenderDrawColor(renderer, previous.r, previous.g, previous.b, previous.a);
+  
+  stripPoints.clear();
+  strips.clear();
+  points.clear();
+  pointColors.clear();
+}
+
+void drawPolygon(SDL_Renderer* renderer, Polygon* poly) {
+  static ShapeBatcher batcher;
+  
+  SDL_Color color;
+  SDL_GetRenderDrawColor(renderer, &color.r, &color.g, &color.b, &color.a);
+  batcher.setColor(color);
+  batcher.addPolygon(poly);
+  batcher.flush(renderer);
+}
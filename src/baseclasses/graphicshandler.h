@@ -5,16 +5,135 @@
 #include <SDL2/SDL_ttf.h>
 #include <SDL2/SDL_image.h>
 #include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
 #include "geometry.h"
+#include "textureatlas.h"
+#include "spritebatch.h"
+#include "assetmanager.h"
+
+// Largest error between a drawn circle and the real one, in pixels
+const float CIRCLE_TOLERANCE = 0.25f;
+
+// Bounds of the number of segments of a drawn circle, both powers of two
+const int MIN_CIRCLE_SEGMENTS = 8;
+const int MAX_CIRCLE_SEGMENTS = 1024;
+
+// Collects the lines and points drawn during a frame and sends them to the
+// renderer with a few calls, instead of one for every line
+// Lines become thin quads drawn by SDL_RenderGeometry, or line strips if
+// the renderer can't draw geometry
+class ShapeBatcher {
+private:
+  // Connected lines with the same color
+  struct Strip {
+    int first, count;
+    SDL_Color color;
+  };
+  
+  std::vector<SDL_FPoint> stripPoints;
+  std::vector<Strip> strips;
+  
+  std::vector<SDL_FPoint> points;
+  std::vector<SDL_Color> pointColors;
+  
+  // Quads built from the strips on flush
+  std::vector<SDL_Vertex> vertices;
+  std::vector<int> indices;
+  
+  SDL_Color color;
+  
+  // False once the renderer failed to draw geometry
+  bool useGeometry;
+  
+  // Corners of a regular polygon with the given number of sides on the
+  // unit circle, computed once
+  static const std::vector<SDL_FPoint> &getUnitCircle(int segments);
+  
+  void flushGeometry(SDL_Renderer* renderer);
+  void flushStrips(SDL_Renderer* renderer);
+  void flushPoints(SDL_Renderer* renderer);
+public:
+  ShapeBatcher();
+  
+  // Color of the next shapes
+  void setColor(SDL_Color _color);
+  
+  void addLine(float x1, float y1, float x2, float y2);
+  void addPoint(float x, float y);
+  
+  // The outline of the polygon, or of the circle if it is one
+  void addPolygon(Polygon* poly);
+  
+  // A circle with as many segments as its size on the screen needs
+  void addCircle(float x, float y, float radius);
+  
+  // Draw everything added since the last flush
+  // The color of the renderer is left unchanged
+  void flush(SDL_Renderer* renderer);
+};
 
 // Draw the contour of the polygon with the last renderer color
+// Drawing many polygons through a ShapeBatcher is faster
 void drawPolygon(SDL_Renderer* renderer, Polygon* poly);
 
+// Strings whose layout is kept by a FontRenderer
+const int TEXT_CACHE_SIZE = 64;
+
+// Size of the glyph atlas when it is created, it grows in height
+const int GLYPH_ATLAS_WIDTH = 512;
+const int GLYPH_ATLAS_HEIGHT = 128;
+
 // Draw text on the screen
+// The glyphs are rendered once in an atlas texture and every string is
+// drawn with one call
 class FontRenderer {
 private:
+  // A character in the atlas
+  struct Glyph {
+    bool loaded;
+    SDL_Rect rect;
+    int advance;
+  };
+  
+  // Laid out string, with the vertices relative to its top left corner
+  struct CachedText {
+    std::string text;
+    std::vector<SDL_Vertex> vertices;
+    int width;
+  };
+  
   // Given font
   TTF_Font* usedFont;
+  
+  // The atlas is kept in memory too, so it can be copied when it grows
+  SDL_Renderer* atlasRenderer;
+  SDL_Texture* atlasTexture;
+  SDL_Surface* atlasSurface;
+  
+  // Shelf where the next glyph goes
+  int shelfX, shelfY, shelfHeight;
+  
+  // Characters of TTF_RenderText (latin1)
+  Glyph glyphs[256];
+  
+  // Most recently used strings first
+  std::list<CachedText> textCache;
+  std::unordered_map<std::string, std::list<CachedText>::iterator> textIndex;
+  
+  // Reused for every draw
+  std::vector<SDL_Vertex> vertices;
+  std::vector<int> indices;
+  
+  // Create the atlas for the renderer, throwing away the old one
+  bool createAtlas(SDL_Renderer* renderer, int height);
+  
+  // Render the character in the atlas if it isn't there
+  Glyph* getGlyph(unsigned char c);
+  
+  // Layout of the text, from the cache if possible
+  CachedText* layoutText(const char* text);
 public:
   // Load the font with the given size
   FontRenderer(const char* filename, int fontsize);
@@ -23,7 +142,13 @@ public:
   // Convert an int to a string
   static std::string inttostring(int x);
   
+  // Write an int in buffer, which needs 12 characters
+  // Returns the length of the number
+  static int inttostring(int x, char* buffer);
+  
   // Render text on the screen at the given position
+  void renderText(SDL_Renderer* renderer, float _x, float _y, 
+                  const char* text);
   void renderText(SDL_Renderer* renderer, float _x, float _y, 
                   std::string text);
 };
@@ -34,17 +159,30 @@ private:
   // The loaded texture
   int textureWidth, textureHeight;
 
-  // The loaded texture
+  // The loaded texture, or the page of the atlas holding it
   SDL_Texture* texture;
   
+  // Atlas holding the tileset, NULL if it has its own texture
+  TextureAtlas* atlas;
+  
+  // Part of the texture holding the tileset
+  AtlasRegion region;
+  
+  // Image loaded in the background, if the tileset was made from one
+  AssetHandle image;
+  
+  // Find the texture, false if it isn't loaded yet
+  bool resolveTexture(SDL_Renderer* renderer);
+  
   // Tile width and height
   int tileWidth, tileHeight;
 
   // Rotation angle
   double rotationAngle;
   
-  // Rotation center
-  SDL_Point* rotationCenter;
+  // Rotation center, used if customCenter is true
+  SDL_Point rotationCenter;
+  bool customCenter;
   
   // Texture flip
   SDL_RendererFlip textureFlip;
@@ -55,6 +193,14 @@ public:
   TileSetRenderer(const char* filename, SDL_Renderer* renderer,
                   int _tw = 0, int _th = 0);
   
+  // Create a tileset from an image of an AssetManager
+  // Nothing is rendered until the image is ready
+  TileSetRenderer(AssetHandle _image, int _tw = 0, int _th = 0);
+  
+  // Create a tileset in a page of the atlas, to draw it with a SpriteBatch
+  TileSetRenderer(const char* filename, TextureAtlas* _atlas,
+                  int _tw = 0, int _th = 0);
+  
   // Unload text
   ~TileSetRenderer();
   
@@ -81,6 +227,10 @@ public:
 
   // Render the entire texture on the given target
   void renderTexture(SDL_Renderer* renderer, SDL_Rect target);
+  
+  // Queue the tile in the batch, with the rotation and flip of the tileset
+  // Only for tilesets inside the atlas of the batch
+  void drawTile(SpriteBatch* batch, int l, int c, SDL_FRect target, int depth = 0);
 };
 
 #endif
@@ -1,10 +1,19 @@
 #include "baseclasses/object.h"
 #include "baseclasses/room.h"
+#include "baseclasses/registry.h"
+#include "baseclasses/physicsworld.h"
 
 // DisplayableObject implementation
 DisplayableObject::DisplayableObject() {
   invisible = false;
   depth = 0;
+  registry = NULL;
+  registrySlot = -1;
+}
+
+DisplayableObject::~DisplayableObject() {
+  if(registry != NULL)
+    registry->remove(this);
 }
 
 int DisplayableObject::getDepth() {
@@ -13,20 +22,50 @@ int DisplayableObject::getDepth() {
 
 void DisplayableObject::setDepth(int _depth) {
   depth = _depth;
+  if(registry != NULL)
+    registry->reorder(registrySlot, depth, getTexture());
+}
+
+void DisplayableObject::textureChanged() {
+  if(registry != NULL)
+    registry->reorder(registrySlot, depth, getTexture());
 }
 
 void DisplayableObject::makeInvisible() {
   invisible = true;
+  if(registry != NULL)
+    registry->setActive(registrySlot, false);
 }
 
 void DisplayableObject::makeVisible() {
   invisible = false;
+  if(registry != NULL)
+    registry->setActive(registrySlot, true);
+}
+
+bool DisplayableObject::isVisible() {
+  return !invisible;
+}
+
+SDL_Texture* DisplayableObject::getTexture() {
+  return NULL;
+}
+
+bool DisplayableObject::queueSprites(SpriteBatch* batch) {
+  return false;
 }
 
 // IdleObject implementation
 IdleObject::IdleObject() {
   idleActive = true;
   idlePriority = 0;
+  registry = NULL;
+  registrySlot = -1;
+}
+
+IdleObject::~IdleObject() {
+  if(registry != NULL)
+    registry->remove(this);
 }
 
 int IdleObject::getIdlePriority() {
@@ -35,14 +74,24 @@ int IdleObject::getIdlePriority() {
 
 void IdleObject::makeUpdateActive() {
   idleActive = true;
+  if(registry != NULL)
+    registry->setActive(registrySlot, true);
 }
 
 void IdleObject::makeUpdateInactive() {
   idleActive = false;
+  if(registry != NULL)
+    registry->setActive(registrySlot, false);
+}
+
+bool IdleObject::isUpdateActive() {
+  return idleActive;
 }
 
 void IdleObject::setIdlePriority(int _prio) {
   idlePriority = _prio;
+  if(registry != NULL)
+    registry->reorder(registrySlot, idlePriority, NULL);
 }
 
 // MouseObject implementation
@@ -72,36 +121,68 @@ void KeyboardObject::makeKeyboardInactive() {
 }
 
 // PhysicalObject implementation
-PhysicalObject::PhysicalObject(Polygon* _shape, float _mass) {
+PhysicalObject::PhysicalObject(Polygon* _shape, float _mass) :
+  PhysicalObject(PhysicsWorld::getDefault(), _shape, _mass) {
+}
+
+PhysicalObject::PhysicalObject(PhysicsWorld* _world, Polygon* _shape, float _mass) {
+  world = _world;
   shape = _shape;
-  mass = _mass;
+  body = world->createBody(shape, _mass);
+  generation = world->getGeneration(body);
 }
 
 PhysicalObject::~PhysicalObject() {
-  delete shape;
+  // The body is already gone if the room of the shape was left, and its id
+  // may belong to a body of the next room
+  if(world->getGeneration(body) == generation)
+    world->destroyBody(body);
 }
 
 void PhysicalObject::addForce(Vector2D addedForce) {
-  force = force + addedForce;
+  world->addForce(body, addedForce);
 }
 
 void PhysicalObject::applyForce() {
-  velocity = velocity + force * ((1.0f / mass) * MS_TICK_SIZE);
-  force = Vector2D();
+  world->applyForce(body);
 }
 
 void PhysicalObject::applyVelocity() {
-  shape->translate(velocity);
+  world->applyVelocity(body);
+}
+
+Vector2D PhysicalObject::getVelocity() {
+  return world->getVelocity(body);
+}
+
+void PhysicalObject::setVelocity(Vector2D velocity) {
+  world->setVelocity(body, velocity);
+}
+
+void PhysicalObject::setPosition(Vector2D position) {
+  world->setPosition(body, position);
 }
 
 Polygon* PhysicalObject::getShape() {
   return shape;
 }
 
+PhysicsWorld* PhysicalObject::getWorld() {
+  return world;
+}
+
+int PhysicalObject::getBody() {
+  return body;
+}
+
 void PhysicalObject::makePhysicsActive() {
-  physicsActive = true;
+  world->setActive(body, true);
 }
 
 void PhysicalObject::makePhysicsInactive() {
-  physicsActive = false;
+  world->setActive(body, false);
+}
+
+bool PhysicalObject::isPhysicsActive() {
+  return world->isActive(body);
 }
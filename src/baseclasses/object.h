@@ -4,8 +4,17 @@
 #include <SDL2/SDL.h>
 #include "geometry.h"
 
+template<typename T> class ObjectRegistry;
+class SpriteBatch;
+
 // The object will be rendered on the screen
 class DisplayableObject {
+private:
+  // Registry holding the object (NULL if there is none) and the slot of
+  // the object inside it
+  ObjectRegistry<DisplayableObject>* registry;
+  int registrySlot;
+  friend class ObjectRegistry<DisplayableObject>;
 protected:
   // True if the object is invisible
   bool invisible;
@@ -16,8 +25,12 @@ protected:
   
   // Set the depth of an object
   void setDepth(int _depth);
+  
+  // Must be called when getTexture() returns another texture
+  void textureChanged();
 public:
   DisplayableObject();
+  virtual ~DisplayableObject();
 
   // Display the object
   virtual void display(SDL_Renderer* renderer) = 0;
@@ -28,10 +41,27 @@ public:
   
   // Returns the depth of an object
   int getDepth();
+  
+  // Returns true if the object is visible
+  bool isVisible();
+  
+  // Texture used to display the object, NULL if it doesn't use one
+  // Objects with the same depth and texture are rendered one after another
+  virtual SDL_Texture* getTexture();
+  
+  // Queue the sprites of the object in batch, at its depth, instead of
+  // displaying it. Returns false if it must be displayed with display()
+  virtual bool queueSprites(SpriteBatch* batch);
 };
 
 // The object will do something every tick
 class IdleObject {
+private:
+  // Registry holding the object (NULL if there is none) and the slot of
+  // the object inside it
+  ObjectRegistry<IdleObject>* registry;
+  int registrySlot;
+  friend class ObjectRegistry<IdleObject>;
 protected:
   // Priority of the object
   // The bigger the priority, the earlier it will be updated
@@ -44,6 +74,7 @@ protected:
   void setIdlePriority(int _prio);
 public:
   IdleObject();
+  virtual ~IdleObject();
 
   // Actions to do every tick
   virtual void update() = 0;
@@ -51,6 +82,9 @@ public:
   // Make the object active or inactive
   virtual void makeUpdateActive();
   virtual void makeUpdateInactive();
+  
+  // Returns true if the object is active
+  bool isUpdateActive();
 
   // Returns the priority
   int getIdlePriority();
@@ -93,41 +127,56 @@ public:
 };
 
 
+class PhysicsWorld;
+
+// Handle to a body of a PhysicsWorld, the state of the body is kept by
+// the world
 class PhysicalObject {
 protected:
-  // True if the object is active
-  bool physicsActive;
-
-  // Velocity vector
-  Vector2D velocity;
+  // World holding the body
+  PhysicsWorld* world;
   
-  // Force vector applied on the object
-  Vector2D force;
-  
-  // Mass of the object
-  float mass;
+  // Id of the body inside the world, and its generation when it was
+  // created
+  int body;
+  unsigned int generation;
   
   // Shape of the object. It's centroid is it's position
+  // It isn't owned by the object, it usually comes from Room::createShape()
   Polygon* shape;
 public:
   PhysicalObject(Polygon* _shape, float _mass = 1.0f);
-  ~PhysicalObject();
+  PhysicalObject(PhysicsWorld* _world, Polygon* _shape, float _mass = 1.0f);
+  virtual ~PhysicalObject();
   
   // Adds force to the object
   virtual void addForce(Vector2D addedForce);
   
   // Turns the force into velocity
+  // Prefer PhysicsWorld::integrate() for many objects
   virtual void applyForce();
   
   // Moves the object according to its velocity
   virtual void applyVelocity();
   
+  Vector2D getVelocity();
+  void setVelocity(Vector2D velocity);
+  
+  // Moves the object at the given position
+  void setPosition(Vector2D position);
+  
   // Gets the shape of the polygon
   Polygon* getShape();
   
+  PhysicsWorld* getWorld();
+  int getBody();
+  
   // Make the object active or inactive
   void makePhysicsActive();
   void makePhysicsInactive();
+  
+  // Returns true if the object is active
+  bool isPhysicsActive();
 };
 
 class Collider {
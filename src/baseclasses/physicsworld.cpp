@@ -0,0 +1,394 @@
+#include "baseclasses/physicsworld.h"
+#include "baseclasses/room.h"
+#include "baseclasses/profiler.h"
+#include <algorithm>
+
+// Pairs checked by one task of the narrow phase
+const int NARROW_PHASE_CHUNK = 256;
+
+PhysicsWorld::PhysicsWorld() {
+  bodyCount = 0;
+  restitution = 0.0f;
+  pool = NULL;
+  threadCount = 0;
+}
+
+PhysicsWorld::~PhysicsWorld() {
+  delete pool;
+}
+
+PhysicsWorld* PhysicsWorld::getDefault() {
+  static PhysicsWorld world;
+  return &world;
+}
+
+int PhysicsWorld::createBody(Polygon* shape, float mass) {
+  int body;
+  if(!freeBodies.empty()) {
+    body = freeBodies.back();
+    freeBodies.pop_back();
+  } else {
+    body = shapes.size();
+    positionX.push_back(0.0f);
+    positionY.push_back(0.0f);
+    velocityX.push_back(0.0f);
+    velocityY.push_back(0.0f);
+    forceX.push_back(0.0f);
+    forceY.push_back(0.0f);
+    inverseMass.push_back(0.0f);
+    activeMask.push_back(0.0f);
+    shapes.push_back(NULL);
+    generations.push_back(0);
+  }
+
+  positionX[body] = shape->centroidPos.x;
+  positionY[body] = shape->centroidPos.y;
+  velocityX[body] = velocityY[body] = 0.0f;
+  forceX[body] = forceY[body] = 0.0f;
+  activeMask[body] = 1.0f;
+  shapes[body] = shape;
+  setMass(body, mass);
+
+  ++bodyCount;
+  return body;
+}
+
+void PhysicsWorld::destroyBody(int body) {
+  if(body < 0 || body >= (int)shapes.size() || shapes[body] == NULL)
+    return;
+
+  shapes[body] = NULL;
+  ++generations[body];
+  activeMask[body] = 0.0f;
+  velocityX[body] = velocityY[body] = 0.0f;
+  forceX[body] = forceY[body] = 0.0f;
+  freeBodies.push_back(body);
+  --bodyCount;
+}
+
+int PhysicsWorld::getBodyCount() {
+  return bodyCount;
+}
+
+int PhysicsWorld::getCapacity() {
+  return shapes.size();
+}
+
+Polygon* PhysicsWorld::getShape(int body) {
+  return shapes[body];
+}
+
+unsigned int PhysicsWorld::getGeneration(int body) {
+  return generations[body];
+}
+
+void PhysicsWorld::addForce(int body, Vector2D force) {
+  forceX[body] += force.x;
+  forceY[body] += force.y;
+}
+
+Vector2D PhysicsWorld::getVelocity(int body) {
+  return Vector2D(velocityX[body], velocityY[body]);
+}
+
+void PhysicsWorld::setVelocity(int body, Vector2D velocity) {
+  velocityX[body] = velocity.x;
+  velocityY[body] = velocity.y;
+}
+
+Vector2D PhysicsWorld::getPosition(int body) {
+  return Vector2D(positionX[body], positionY[body]);
+}
+
+void PhysicsWorld::setPosition(int body, Vector2D position) {
+  positionX[body] = position.x;
+  positionY[body] = position.y;
+  shapes[body]->centroidPos = position;
+}
+
+float PhysicsWorld::getMass(int body) {
+  return inverseMass[body] > 0.0f ? 1.0f / inverseMass[body] : 0.0f;
+}
+
+void PhysicsWorld::setMass(int body, float mass) {
+  inverseMass[body] = mass > 0.0f ? 1.0f / mass : 0.0f;
+}
+
+void PhysicsWorld::setActive(int body, bool active) {
+  activeMask[body] = active ? 1.0f : 0.0f;
+}
+
+bool PhysicsWorld::isActive(int body) {
+  return activeMask[body] != 0.0f;
+}
+
+void PhysicsWorld::applyForce(int body) {
+  velocityX[body] += forceX[body] * (inverseMass[body] * MS_TICK_SIZE);
+  velocityY[body] += forceY[body] * (inverseMass[body] * MS_TICK_SIZE);
+  forceX[body] = forceY[body] = 0.0f;
+}
+
+void PhysicsWorld::applyVelocity(int body) {
+  Vector2D position = shapes[body]->centroidPos + getVelocity(body);
+  setPosition(body, position);
+}
+
+void PhysicsWorld::integrate() {
+  int n = shapes.size();
+
+  // The shapes may have been moved directly since the last tick
+  for(int i = 0; i < n; ++i)
+    if(shapes[i] != NULL) {
+      positionX[i] = shapes[i]->centroidPos.x;
+      positionY[i] = shapes[i]->centroidPos.y;
+    }
+
+  float* __restrict px = positionX.data();
+  float* __restrict py = positionY.data();
+  float* __restrict vx = velocityX.data();
+  float* __restrict vy = velocityY.data();
+  float* __restrict fx = forceX.data();
+  float* __restrict fy = forceY.data();
+  const float* __restrict invMass = inverseMass.data();
+  const float* __restrict active = activeMask.data();
+
+  // Branch free so the compiler can vectorize it, inactive bodies keep
+  // their force and velocity but don't move
+  const float tick = MS_TICK_SIZE;
+  for(int i = 0; i < n; ++i) {
+    float scale = invMass[i] * tick * active[i];
+    vx[i] += fx[i] * scale;
+    vy[i] += fy[i] * scale;
+    fx[i] -= fx[i] * active[i];
+    fy[i] -= fy[i] * active[i];
+    px[i] += vx[i] * active[i];
+    py[i] += vy[i] * active[i];
+  }
+
+  for(int i = 0; i < n; ++i)
+    if(shapes[i] != NULL)
+      shapes[i]->centroidPos = Vector2D(px[i], py[i]);
+}
+
+void PhysicsWorld::setThreadCount(int count) {
+  threadCount = count;
+  delete pool;
+  pool = NULL;
+}
+
+int PhysicsWorld::getThreadCount() {
+  if(pool == NULL)
+    pool = new ThreadPool(threadCount);
+  return pool->getThreadCount();
+}
+
+void PhysicsWorld::setRestitution(float _restitution) {
+  restitution = _restitution;
+}
+
+const std::vector<Contact> &PhysicsWorld::getContacts() {
+  return contacts;
+}
+
+int PhysicsWorld::getIslandCount() {
+  return islandOrder.size();
+}
+
+bool PhysicsWorld::isMovable(int body) {
+  return inverseMass[body] * activeMask[body] > 0.0f;
+}
+
+float PhysicsWorld::getInverseMass(int body) {
+  return inverseMass[body] * activeMask[body];
+}
+
+int PhysicsWorld::findIsland(int body) {
+  while(islandParent[body] != body) {
+    islandParent[body] = islandParent[islandParent[body]];
+    body = islandParent[body];
+  }
+  return body;
+}
+
+void PhysicsWorld::findContacts() {
+  PROFILE_ZONE("find contacts");
+
+  // The narrow phase reads the shapes from many threads
+  updateTransforms(shapes.data(), shapes.size());
+
+  // Inactive bodies don't collide, they would be walls that can't move
+  broadPhase.clear();
+  for(unsigned int i = 0; i < shapes.size(); ++i)
+    if(shapes[i] != NULL && activeMask[i] != 0.0f)
+      broadPhase.insert(i, shapes[i]->getBoundingBox());
+  broadPhase.findPairs(pairs);
+
+  // Nothing to solve between two bodies that can't move
+  unsigned int kept = 0;
+  for(unsigned int i = 0; i < pairs.size(); ++i)
+    if(isMovable(pairs[i].first) || isMovable(pairs[i].second))
+      pairs[kept++] = pairs[i];
+  pairs.resize(kept);
+
+  candidates.resize(pairs.size());
+  candidateHits.resize(pairs.size());
+
+  int chunks = (pairs.size() + NARROW_PHASE_CHUNK - 1) / NARROW_PHASE_CHUNK;
+  pool->run(chunks, [&](int chunk) {
+    unsigned int end = std::min((unsigned int)pairs.size(),
+                                (unsigned int)(chunk + 1) * NARROW_PHASE_CHUNK);
+    for(unsigned int i = chunk * NARROW_PHASE_CHUNK; i < end; ++i) {
+      Contact &contact = candidates[i];
+      contact.a = pairs[i].first;
+      contact.b = pairs[i].second;
+      contact.impulse = 0.0f;
+      candidateHits[i] = collideShapes(shapes[contact.a], shapes[contact.b],
+                                       &contact.manifold);
+    }
+  });
+
+  contacts.clear();
+  for(unsigned int i = 0; i < candidates.size(); ++i)
+    if(candidateHits[i])
+      contacts.push_back(candidates[i]);
+}
+
+void PhysicsWorld::buildIslands() {
+  PROFILE_ZONE("build islands");
+
+  islandParent.resize(shapes.size());
+  for(unsigned int i = 0; i < islandParent.size(); ++i)
+    islandParent[i] = i;
+
+  // Bodies that can't move don't join islands, or a floor would merge
+  // everything standing on it
+  for(unsigned int i = 0; i < contacts.size(); ++i) {
+    int a = contacts[i].a, b = contacts[i].b;
+    if(isMovable(a) && isMovable(b)) {
+      a = findIsland(a);
+      b = findIsland(b);
+      if(a != b)
+        islandParent[std::max(a, b)] = std::min(a, b);
+    }
+  }
+
+  // Number the islands in the order of their first contact, and sort the
+  // contacts by island keeping their order
+  islandOfContact.resize(contacts.size());
+  islandStart.clear();
+  std::vector<int> &islandOfRoot = islandScratch;
+  islandOfRoot.assign(shapes.size(), -1);
+  for(unsigned int i = 0; i < contacts.size(); ++i) {
+    int body = isMovable(contacts[i].a) ? contacts[i].a : contacts[i].b;
+    int root = findIsland(body);
+    if(islandOfRoot[root] == -1) {
+      islandOfRoot[root] = islandStart.size();
+      islandStart.push_back(0);
+    }
+    islandOfContact[i] = islandOfRoot[root];
+    ++islandStart[islandOfRoot[root]];
+  }
+
+  int islands = islandStart.size();
+  int position = 0;
+  for(int i = 0; i < islands; ++i) {
+    int count = islandStart[i];
+    islandStart[i] = position;
+    position += count;
+  }
+  islandStart.push_back(position);
+
+  islandContacts.resize(contacts.size());
+  std::vector<int> &next = islandScratch;
+  next.assign(islandStart.begin(), islandStart.end() - 1);
+  for(unsigned int i = 0; i < contacts.size(); ++i)
+    islandContacts[next[islandOfContact[i]]++] = i;
+
+  // Largest islands first, so they don't end up last on one thread
+  islandOrder.resize(islands);
+  for(int i = 0; i < islands; ++i)
+    islandOrder[i] = i;
+  std::stable_sort(islandOrder.begin(), islandOrder.end(), [&](int x, int y) {
+    return islandStart[x + 1] - islandStart[x] > islandStart[y + 1] - islandStart[y];
+  });
+}
+
+void PhysicsWorld::solveIsland(int island) {
+  int first = islandStart[island], last = islandStart[island + 1];
+
+  for(int i = first; i < last; ++i) {
+    Contact &contact = contacts[islandContacts[i]];
+    Vector2D n = contact.manifold.normal;
+    float normalVelocity = (velocityX[contact.b] - velocityX[contact.a]) * n.x +
+                           (velocityY[contact.b] - velocityY[contact.a]) * n.y;
+    contact.targetVelocity = std::max(-restitution * normalVelocity, 0.0f);
+  }
+
+  // Bodies that can't move may be shared by islands, so only the movable
+  // ones are written
+  for(int iteration = 0; iteration < SOLVER_ITERATIONS; ++iteration)
+    for(int i = first; i < last; ++i) {
+      Contact &contact = contacts[islandContacts[i]];
+      int a = contact.a, b = contact.b;
+      float inverseA = getInverseMass(a), inverseB = getInverseMass(b);
+      Vector2D n = contact.manifold.normal;
+
+      float normalVelocity = (velocityX[b] - velocityX[a]) * n.x +
+                             (velocityY[b] - velocityY[a]) * n.y;
+      float impulse = (contact.targetVelocity - normalVelocity) / (inverseA + inverseB);
+
+      // The total impulse can only push the bodies apart
+      float total = std::max(contact.impulse + impulse, 0.0f);
+      impulse = total - contact.impulse;
+      contact.impulse = total;
+
+      if(inverseA > 0.0f) {
+        velocityX[a] -= n.x * impulse * inverseA;
+        velocityY[a] -= n.y * impulse * inverseA;
+      }
+      if(inverseB > 0.0f) {
+        velocityX[b] += n.x * impulse * inverseB;
+        velocityY[b] += n.y * impulse * inverseB;
+      }
+    }
+
+  for(int i = first; i < last; ++i) {
+    Contact &contact = contacts[islandContacts[i]];
+    int a = contact.a, b = contact.b;
+    float inverseA = getInverseMass(a), inverseB = getInverseMass(b);
+    Vector2D n = contact.manifold.normal;
+
+    float correction = std::max(contact.manifold.penetration - PENETRATION_SLOP, 0.0f) *
+                       POSITION_CORRECTION / (inverseA + inverseB);
+    if(inverseA > 0.0f) {
+      positionX[a] -= n.x * correction * inverseA;
+      positionY[a] -= n.y * correction * inverseA;
+    }
+    if(inverseB > 0.0f) {
+      positionX[b] += n.x * correction * inverseB;
+      positionY[b] += n.y * correction * inverseB;
+    }
+  }
+}
+
+void PhysicsWorld::step() {
+  PROFILE_ZONE("physics step");
+
+  if(pool == NULL)
+    pool = new ThreadPool(threadCount);
+
+  integrate();
+  findContacts();
+  buildIslands();
+
+  {
+    PROFILE_ZONE("solve islands");
+    pool->run(islandOrder.size(), [&](int task) {
+      solveIsland(islandOrder[task]);
+    });
+  }
+
+  for(unsigned int i = 0; i < shapes.size(); ++i)
+    if(shapes[i] != NULL)
+      shapes[i]->centroidPos = Vector2D(positionX[i], positionY[i]);
+}
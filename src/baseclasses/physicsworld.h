@@ -0,0 +1,153 @@
+#ifndef __PHYSICSWORLD_H
+#define __PHYSICSWORLD_H
+
+#include <vector>
+#include "geometry.h"
+#include "collision.h"
+#include "broadphase.h"
+#include "threadpool.h"
+
+// Sequential impulse passes over the contacts of an island
+const int SOLVER_ITERATIONS = 8;
+
+// Penetration left alone by the position correction, and the part of the
+// rest that is corrected every step
+const float PENETRATION_SLOP = 0.05f;
+const float POSITION_CORRECTION = 0.4f;
+
+// Collision of body a with body b found during the last step
+struct Contact {
+  int a, b;
+  ContactManifold manifold;
+
+  // Accumulated normal impulse and the normal velocity the solver aims for
+  float impulse;
+  float targetVelocity;
+};
+
+// Owns the state of the physical bodies as a structure of arrays, so that
+// all of them are integrated in one pass over contiguous memory
+// Bodies are identified by the index returned by createBody()
+// The position of a body is the centroid of its shape, which is updated
+// after every integration
+class PhysicsWorld {
+private:
+  std::vector<float> positionX, positionY;
+  std::vector<float> velocityX, velocityY;
+  std::vector<float> forceX, forceY;
+
+  // 0 for static bodies
+  std::vector<float> inverseMass;
+
+  // 1 if the body is active, 0 otherwise (or if the slot is free)
+  std::vector<float> activeMask;
+
+  std::vector<Polygon*> shapes;
+  std::vector<int> freeBodies;
+
+  // Bumped every time the body is destroyed, ids are reused
+  std::vector<unsigned int> generations;
+
+  int bodyCount;
+
+  float restitution;
+
+  // Created on the first step
+  ThreadPool* pool;
+  int threadCount;
+
+  SpatialHash broadPhase;
+  std::vector<BodyPair> pairs;
+  std::vector<Contact> candidates;
+  std::vector<char> candidateHits;
+  std::vector<Contact> contacts;
+
+  // Islands are groups of movable bodies touching each other, with their
+  // contacts stored contiguously in islandContacts
+  std::vector<int> islandParent;
+  std::vector<int> islandOfContact;
+  std::vector<int> islandStart;
+  std::vector<int> islandContacts;
+  std::vector<int> islandOrder;
+
+  // Island of each union-find root, then the next free place of each
+  // island while the contacts are sorted
+  std::vector<int> islandScratch;
+
+  int findIsland(int body);
+  bool isMovable(int body);
+  float getInverseMass(int body);
+
+  void findContacts();
+  void buildIslands();
+  void solveIsland(int island);
+public:
+  PhysicsWorld();
+  ~PhysicsWorld();
+
+  // World used by the objects that aren't given one
+  static PhysicsWorld* getDefault();
+
+  // Adds a body with the given shape, a mass of 0 makes it static
+  // The shape is not owned by the world
+  int createBody(Polygon* shape, float mass = 1.0f);
+  void destroyBody(int body);
+
+  // Number of bodies alive
+  int getBodyCount();
+
+  // Size of the arrays, every body id is smaller than this
+  int getCapacity();
+
+  Polygon* getShape(int body);
+
+  // Generation of the id, a handle kept with the generation it had when the
+  // body was created still owns the body if it didn't change
+  unsigned int getGeneration(int body);
+
+  void addForce(int body, Vector2D force);
+
+  Vector2D getVelocity(int body);
+  void setVelocity(int body, Vector2D velocity);
+
+  Vector2D getPosition(int body);
+  void setPosition(int body, Vector2D position);
+
+  float getMass(int body);
+  void setMass(int body, float mass);
+
+  // Inactive bodies are neither moved nor collided with
+  void setActive(int body, bool active);
+  bool isActive(int body);
+
+  // Turns the force of the body into velocity and clears it
+  void applyForce(int body);
+
+  // Moves the body according to its velocity
+  void applyVelocity(int body);
+
+  // Applies force and velocity on every active body, for one tick
+  void integrate();
+
+  // Integrates the bodies, then finds and resolves their collisions
+  // Independent islands of touching bodies are solved in parallel, each
+  // one on a single thread in a fixed order, so the result doesn't depend
+  // on the number of threads
+  void step();
+
+  // Number of threads used by step(), counting the calling one
+  // If it isn't positive every core is used
+  void setThreadCount(int count);
+  int getThreadCount();
+
+  // Bounciness of the collisions, between 0 and 1
+  void setRestitution(float _restitution);
+
+  // Collisions found by the last step, sorted by bodies
+  const std::vector<Contact> &getContacts();
+
+  // Number of islands solved by the last step
+  int getIslandCount();
+};
+
+#endif
@@ -0,0 +1,109 @@
+#include "baseclasses/profiler.h"
+#include "baseclasses/timer.h"
+#include <cstdio>
+
+// Small id of the calling thread
+static Uint32 getThreadId() {
+  static std::atomic<Uint32> threads(0);
+  thread_local Uint32 id = threads.fetch_add(1) + 1;
+  return id;
+}
+
+Profiler::Profiler() {
+  for(unsigned int i = 0; i < RING_SIZE; ++i)
+    ring[i].sequence.store(0, std::memory_order_relaxed);
+  next = 0;
+  frame = 0;
+  enabled = false;
+}
+
+Profiler& Profiler::get() {
+  static Profiler* profiler = new Profiler();
+  return *profiler;
+}
+
+void Profiler::enable() {
+  enabled = true;
+}
+
+void Profiler::disable() {
+  enabled = false;
+}
+
+bool Profiler::isEnabled() {
+  return enabled.load(std::memory_order_relaxed);
+}
+
+void Profiler::record(const char* name, Uint64 startNs, Uint64 durationNs) {
+  Uint64 position = next.fetch_add(1, std::memory_order_relaxed);
+  ProfileEvent &event = ring[position % RING_SIZE];
+  
+  event.sequence.store(0, std::memory_order_release);
+  event.name = name;
+  event.startNs = startNs;
+  event.durationNs = durationNs;
+  event.threadId = getThreadId();
+  event.frame = frame.load(std::memory_order_relaxed);
+  event.sequence.store(position + 1, std::memory_order_release);
+}
+
+void Profiler::nextFrame() {
+  frame.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Profiler::dumpChromeTrace(const char* filename) {
+  FILE *fout = fopen(filename, "w");
+  if(fout == NULL)
+    return false;
+  
+  Uint64 last = next.load(std::memory_order_acquire);
+  Uint64 first = last > RING_SIZE ? last - RING_SIZE : 0;
+  Uint64 origin = 0;
+  bool hasOrigin = false;
+  
+  fprintf(fout, "{\"traceEvents\":[\n");
+  bool firstEvent = true;
+  for(Uint64 position = first; position < last; ++position) {
+    ProfileEvent &event = ring[position % RING_SIZE];
+    
+    // Copy the event and make sure nobody wrote it meanwhile
+    if(event.sequence.load(std::memory_order_acquire) != position + 1)
+      continue;
+    const char* name = event.name;
+    Uint64 startNs = event.startNs, durationNs = event.durationNs;
+    Uint32 threadId = event.threadId, eventFrame = event.frame;
+    if(event.sequence.load(std::memory_order_acquire) != position + 1)
+      continue;
+    
+    if(!hasOrigin) {
+      origin = startNs;
+      hasOrigin = true;
+    }
+    
+    fprintf(fout, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                  "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}",
+            firstEvent ? "" : ",\n", name, threadId,
+            (double)(Sint64)(startNs - origin) / 1000.0, durationNs / 1000.0,
+            eventFrame);
+    firstEvent = false;
+  }
+  fprintf(fout, "\n]}\n");
+  fclose(fout);
+  return true;
+}
+
+ProfileZone::ProfileZone(const char* _name) {
+  // Zones started while the profiler is disabled cost one check
+  name = NULL;
+  startNs = 0;
+  if(Profiler::get().isEnabled()) {
+    name = _name;
+    startNs = Timer::getTimeNs();
+  }
+}
+
+ProfileZone::~ProfileZone() {
+  Profiler& profiler = Profiler::get();
+  if(name != NULL && profiler.isEnabled())
+    profiler.record(name, startNs, Timer::getTimeNs() - startNs);
+}
@@ -0,0 +1,80 @@
+#ifndef __PROFILER_H
+#define __PROFILER_H
+
+#include <SDL2/SDL.h>
+#include <atomic>
+
+// One measured run of a profiling zone
+struct ProfileEvent {
+  // Name of the zone, must be a string literal
+  const char* name;
+  
+  // Start and length of the zone in nanoseconds
+  Uint64 startNs;
+  Uint64 durationNs;
+  
+  // Thread that ran the zone and frame in which it ended
+  Uint32 threadId;
+  Uint32 frame;
+  
+  // Position of the event in the ring plus one, written last
+  // Readers use it to skip slots that are being written
+  std::atomic<Uint64> sequence;
+};
+
+// Records the timings of the profiling zones of every thread
+// The last RING_SIZE events are kept in a lock-free ring buffer
+class Profiler {
+private:
+  static const unsigned int RING_SIZE = 1 << 16;
+  
+  ProfileEvent ring[RING_SIZE];
+  
+  // Number of events recorded so far
+  std::atomic<Uint64> next;
+  
+  // Current frame
+  std::atomic<Uint32> frame;
+  
+  // Zones aren't recorded while disabled, the profiler starts disabled
+  std::atomic<bool> enabled;
+  
+  Profiler();
+public:
+  // The profiler of the program
+  static Profiler& get();
+  
+  void enable();
+  void disable();
+  bool isEnabled();
+  
+  // Add an event to the ring
+  void record(const char* name, Uint64 startNs, Uint64 durationNs);
+  
+  // Mark the end of a frame
+  void nextFrame();
+  
+  // Write the events in the ring as a Chrome trace (chrome://tracing or
+  // Perfetto can open it)
+  // Returns false if the file can't be written
+  bool dumpChromeTrace(const char* filename);
+};
+
+// Measures the time from its construction to its destruction
+class ProfileZone {
+private:
+  // NULL if the profiler was disabled when the zone started
+  const char* name;
+  Uint64 startNs;
+public:
+  ProfileZone(const char* _name);
+  ~ProfileZone();
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+
+// Profile the rest of the current scope
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef __REGISTRY_H
+#define __REGISTRY_H
+
+#include <set>
+#include <vector>
+#include <SDL2/SDL.h>
+
+// Keeps objects ordered by a key, with O(log n) insertion and removal
+// Objects with a bigger order come first, objects with the same order are
+// grouped by their batch key (e.g. their texture) and then kept in the
+// order they were added
+// Every object is either active or inactive, only the active ones are kept
+// in the order, so iterating never visits the inactive ones
+// Adding, removing, reordering and activating an object only updates that
+// object in the order, nothing is ever rebuilt or sorted
+// T must have the members registry and registrySlot, set by the registry
+template<typename T>
+class ObjectRegistry {
+private:
+  struct Key {
+    int order;
+    const void* batch;
+    unsigned int sequence;
+    unsigned int slot;
+    
+    bool operator< (const Key &k) const {
+      if(order != k.order)
+        return order > k.order;
+      if(batch != k.batch)
+        return batch < k.batch;
+      return sequence < k.sequence;
+    }
+  };
+  
+  // Objects and their keys by slot, free slots hold NULL
+  std::vector<T*> objects;
+  std::vector<Key> keys;
+  std::vector<unsigned int> freeSlots;
+  
+  // Active flag of every slot
+  std::vector<Uint64> activeSlots;
+  
+  // Keys of the active objects in order, with the key every slot has in it
+  // (it differs from keys while an update waits for the iteration to end)
+  std::set<Key> sorted;
+  std::vector<Key> sortedKeys;
+  std::vector<bool> inSorted;
+  
+  // Number of objects
+  int count;
+  
+  // Number of objects added so far
+  unsigned int sequence;
+  
+  // Number of iterations running, nested ones included. While iterating,
+  // the order isn't changed: the slots to update and the removed objects to
+  // free are handled after the outermost iteration
+  int iterating;
+  std::vector<unsigned int> pendingUpdates;
+  std::vector<unsigned int> pendingRemoval;
+  
+  static void setBit(std::vector<Uint64> &bits, unsigned int i, bool value) {
+    if(value)
+      bits[i >> 6] |= (Uint64)1 << (i & 63);
+    else
+      bits[i >> 6] &= ~((Uint64)1 << (i & 63));
+  }
+  
+  static bool getBit(const std::vector<Uint64> &bits, unsigned int i) {
+    return (bits[i >> 6] >> (i & 63)) & 1;
+  }
+  
+  bool isListed(unsigned int slot) {
+    return objects[slot] != NULL && getBit(activeSlots, slot);
+  }
+  
+  // Move the slot to where it belongs in the order, or out of it
+  void update(unsigned int slot) {
+    if(iterating > 0) {
+      pendingUpdates.push_back(slot);
+      return;
+    }
+    
+    bool listed = isListed(slot);
+    if(inSorted[slot] && (!listed || sortedKeys[slot].order != keys[slot].order ||
+                          sortedKeys[slot].batch != keys[slot].batch)) {
+      sorted.erase(sortedKeys[slot]);
+      inSorted[slot] = false;
+    }
+    if(listed && !inSorted[slot]) {
+      sorted.insert(keys[slot]);
+      sortedKeys[slot] = keys[slot];
+      inSorted[slot] = true;
+    }
+  }
+  
+  // Free a slot whose object was removed
+  void release(unsigned int slot) {
+    update(slot);
+    freeSlots.push_back(slot);
+  }
+public:
+  ObjectRegistry() {
+    count = 0;
+    sequence = 0;
+    iterating = 0;
+  }
+  
+  ~ObjectRegistry() {
+    for(unsigned int i = 0; i < objects.size(); ++i)
+      if(objects[i] != NULL) {
+        objects[i]->registry = NULL;
+        objects[i]->registrySlot = -1;
+      }
+  }
+  
+  // Add an object, it must not be in another registry of the same type
+  void add(T* object, int order, const void* batch, bool active) {
+    unsigned int slot;
+    if(!freeSlots.empty()) {
+      slot = freeSlots.back();
+      freeSlots.pop_back();
+    } else {
+      slot = objects.size();
+      objects.push_back(NULL);
+      keys.push_back(Key());
+      sortedKeys.push_back(Key());
+      inSorted.push_back(false);
+      if(activeSlots.size() * 64 < objects.size())
+        activeSlots.push_back(0);
+    }
+    
+    objects[slot] = object;
+    keys[slot] = {order, batch, sequence++, slot};
+    setBit(activeSlots, slot, active);
+    object->registry = this;
+    object->registrySlot = slot;
+    ++count;
+    update(slot);
+  }
+  
+  // Remove an object from the registry
+  // The object may be destroyed right after, even while iterating
+  void remove(T* object) {
+    if(object->registry != this)
+      return;
+    unsigned int slot = object->registrySlot;
+    object->registry = NULL;
+    object->registrySlot = -1;
+    objects[slot] = NULL;
+    setBit(activeSlots, slot, false);
+    --count;
+    if(iterating > 0)
+      pendingRemoval.push_back(slot);
+    else
+      release(slot);
+  }
+  
+  // Move the object at slot to its new order and batch key
+  void reorder(int slot, int order, const void* batch) {
+    if(keys[slot].order == order && keys[slot].batch == batch)
+      return;
+    keys[slot].order = order;
+    keys[slot].batch = batch;
+    update(slot);
+  }
+  
+  // Set the active flag of the object at slot
+  // Objects activated while iterating are visited starting with the next
+  // iteration
+  void setActive(int slot, bool active) {
+    if(getBit(activeSlots, slot) == active)
+      return;
+    setBit(activeSlots, slot, active);
+    update(slot);
+  }
+  
+  // Call f(object) for every active object, in order
+  // Objects may add and remove objects from f, added objects are visited
+  // starting with the next iteration. f may iterate the registry again
+  template<typename F>
+  void forEachActive(F f) {
+    ++iterating;
+    typename std::set<Key>::iterator it;
+    for(it = sorted.begin(); it != sorted.end(); ++it)
+      // Objects deactivated or removed by earlier objects are skipped
+      if(isListed(it->slot))
+        f(objects[it->slot]);
+    if(--iterating > 0)
+      return;
+    
+    for(unsigned int i = 0; i < pendingUpdates.size(); ++i)
+      update(pendingUpdates[i]);
+    pendingUpdates.clear();
+    for(unsigned int i = 0; i < pendingRemoval.size(); ++i)
+      release(pendingRemoval[i]);
+    pendingRemoval.clear();
+  }
+  
+  // Returns the batch key of the object at slot
+  const void* getBatch(int slot) {
+    return keys[slot].batch;
+  }
+  
+  // Number of objects
+  int size() {
+    return count;
+  }
+};
+
+#endif
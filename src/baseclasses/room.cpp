@@ -1,8 +1,93 @@
 #include "baseclasses/room.h"
+#include "baseclasses/physicsworld.h"
+
+Room::Room() {
+  transition = EXIT_ROOM;
+  interpolation = 0.0f;
+  renderBatches = 0;
+  spriteBatch = NULL;
+}
 
 Room::~Room() {
 }
 
+Polygon* Room::createShape(const Polygon &shape) {
+  return shapes.create(shape);
+}
+
+void Room::releaseShapes() {
+  // The bodies still using the shapes would be stepped with freed shapes
+  PhysicsWorld* world = PhysicsWorld::getDefault();
+  for(int body = 0; body < world->getCapacity(); ++body)
+    if(world->getShape(body) != NULL && shapes.owns(world->getShape(body)))
+      world->destroyBody(body);
+  shapes.release();
+}
+
+void Room::addIdleObject(IdleObject* object) {
+  idleObjects.add(object, object->getIdlePriority(), NULL,
+                  object->isUpdateActive());
+}
+
+void Room::removeIdleObject(IdleObject* object) {
+  idleObjects.remove(object);
+}
+
+void Room::updateIdleObjects() {
+  idleObjects.forEachActive([](IdleObject* object) {
+    object->update();
+  });
+}
+
+void Room::addDisplayObject(DisplayableObject* object) {
+  displayObjects.add(object, object->getDepth(), object->getTexture(),
+                     object->isVisible());
+}
+
+void Room::removeDisplayObject(DisplayableObject* object) {
+  displayObjects.remove(object);
+}
+
+void Room::renderObjects(SDL_Renderer* renderer) {
+  renderBatches = 0;
+  bool queued = false;
+  displayObjects.forEachActive([&](DisplayableObject* object) {
+    if(spriteBatch != NULL && object->queueSprites(spriteBatch)) {
+      queued = true;
+      return;
+    }
+    // The sprites queued so far go under the object
+    if(queued) {
+      spriteBatch->flush(renderer);
+      renderBatches += spriteBatch->getDrawCalls();
+      queued = false;
+    }
+    object->display(renderer);
+    ++renderBatches;
+  });
+  
+  if(queued) {
+    spriteBatch->flush(renderer);
+    renderBatches += spriteBatch->getDrawCalls();
+  }
+}
+
+int Room::getRenderBatches() {
+  return renderBatches;
+}
+
+void Room::setSpriteBatch(SpriteBatch* batch) {
+  spriteBatch = batch;
+}
+
+void Room::setInterpolation(float alpha) {
+  interpolation = alpha;
+}
+
+float Room::getInterpolation() {
+  return interpolation;
+}
+
 int Room::getTransition() {
   return transition;
 }
@@ -3,10 +3,15 @@
 
 #include <vector> // std::vector
 #include <SDL2/SDL.h>
+#include "object.h"
+#include "registry.h"
+#include "shapearena.h"
+#include "spritebatch.h"
 
-// TODO: decide MS_TICK_SIZE and check it's data type
 // TODO: destructors
 
+// Length of a game tick in milliseconds, GameLoop updates the rooms
+// exactly once every tick
 const int MS_TICK_SIZE = 10;
 
 // If the transition is -1, that means that we exit the game
@@ -19,7 +24,28 @@ protected:
   // This should contain the room we need to change to after
   // runGameLoop() returns true
   int transition;
+  
+  // Objects updated every tick, by decreasing priority
+  ObjectRegistry<IdleObject> idleObjects;
+  
+  // Objects rendered every frame, by decreasing depth
+  ObjectRegistry<DisplayableObject> displayObjects;
+  
+  // Draw calls made by the last renderObjects()
+  int renderBatches;
+  
+  // Batch the objects queue their sprites in, NULL if every object is
+  // displayed by itself
+  SpriteBatch* spriteBatch;
+  
+  // Shapes of the objects of the room, released when the room is left
+  ShapeArena shapes;
+  
+  // How far we are between the last tick and the next one, from 0 to 1
+  // Set before every render() so objects can interpolate their position
+  float interpolation;
 public:
+  Room();
   ~Room();
 
   // Runs one game loop
@@ -29,6 +55,44 @@ public:
   // Render all objects inside the room
   virtual void render(SDL_Renderer* renderer) = 0;
   
+  // Add or remove an object updated every tick
+  void addIdleObject(IdleObject* object);
+  void removeIdleObject(IdleObject* object);
+  
+  // Call update() on every active idle object
+  void updateIdleObjects();
+  
+  // Add or remove an object rendered every frame
+  void addDisplayObject(DisplayableObject* object);
+  void removeDisplayObject(DisplayableObject* object);
+  
+  // Draw every visible object, in order. Objects that queue their sprites
+  // in the sprite batch are drawn together, with one call for every atlas
+  // page, until an object that must be displayed by itself
+  void renderObjects(SDL_Renderer* renderer);
+  
+  // Draw calls made by the last renderObjects(), every object displayed by
+  // itself counts as one
+  int getRenderBatches();
+  
+  // Batch for the sprites of the objects, NULL to display every object by
+  // itself. The room doesn't own it
+  void setSpriteBatch(SpriteBatch* batch);
+  
+  // Interpolation used by the next render()
+  void setInterpolation(float alpha);
+  float getInterpolation();
+  
+  // Copy the shape in the arena of the room
+  // It stays valid until the room is left, so the objects using it should
+  // be deleted by then (their bodies in the default world are destroyed
+  // when it is left, the ones in other worlds aren't)
+  Polygon* createShape(const Polygon &shape);
+  
+  // Free every shape created by the room, after destroying the bodies of
+  // the default world that still use them
+  void releaseShapes();
+  
   virtual void initialize() = 0;
   
   // Returns which room we should change
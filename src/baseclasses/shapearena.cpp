@@ -0,0 +1,44 @@
+#include "baseclasses/shapearena.h"
+#include <new>
+#include <algorithm>
+
+ShapeArena::ShapeArena() {
+  used = 0;
+}
+
+ShapeArena::~ShapeArena() {
+  release();
+  for(unsigned int i = 0; i < blocks.size(); ++i)
+    ::operator delete(blocks[i]);
+}
+
+Polygon* ShapeArena::create(const Polygon &shape) {
+  int block = used / SHAPES_PER_BLOCK;
+  if(block == (int)blocks.size())
+    blocks.push_back((Polygon*)::operator new(sizeof(Polygon) * SHAPES_PER_BLOCK));
+  
+  Polygon* place = blocks[block] + used % SHAPES_PER_BLOCK;
+  ++used;
+  return new(place) Polygon(shape);
+}
+
+void ShapeArena::release() {
+  // Only polygons with many vertices own memory, but every one is
+  // destroyed properly
+  for(int i = 0; i < used; ++i)
+    blocks[i / SHAPES_PER_BLOCK][i % SHAPES_PER_BLOCK].~Polygon();
+  used = 0;
+}
+
+bool ShapeArena::owns(const Polygon* shape) {
+  for(int block = 0; block * SHAPES_PER_BLOCK < used; ++block) {
+    int count = std::min(used - block * SHAPES_PER_BLOCK, SHAPES_PER_BLOCK);
+    if(blocks[block] <= shape && shape < blocks[block] + count)
+      return true;
+  }
+  return false;
+}
+
+int ShapeArena::size() {
+  return used;
+}
@@ -0,0 +1,34 @@
+#ifndef __SHAPEARENA_H
+#define __SHAPEARENA_H
+
+#include <vector>
+#include "geometry.h"
+
+// Shapes allocated together in each block of the arena
+const int SHAPES_PER_BLOCK = 256;
+
+// Holds shapes in big blocks of memory and frees all of them at once
+// The returned pointers stay valid until release()
+class ShapeArena {
+private:
+  std::vector<Polygon*> blocks;
+  
+  // Shapes given out since the last release()
+  int used;
+public:
+  ShapeArena();
+  ~ShapeArena();
+  
+  // Copy the shape inside the arena
+  Polygon* create(const Polygon &shape);
+  
+  // Destroy every shape, the blocks are kept for the next ones
+  void release();
+  
+  // Returns true if the shape was created by the arena and not released
+  bool owns(const Polygon* shape);
+  
+  int size();
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "baseclasses/spritebatch.h"
+#include "baseclasses/geometry.h"
+#include <algorithm>
+#include <cmath>
+
+SpriteBatch::SpriteBatch(TextureAtlas* _atlas) {
+  atlas = _atlas;
+  drawCalls = 0;
+  geometryUnsupported = false;
+}
+
+void SpriteBatch::draw(int page, SDL_Rect source, SDL_FRect target, int depth,
+                       double angle, const SDL_FPoint* center,
+                       SDL_RendererFlip flip) {
+  Sprite sprite;
+  sprite.depth = depth;
+  sprite.page = page;
+  sprite.sequence = sprites.size();
+  sprite.source = source;
+  sprite.target = target;
+  sprite.angle = angle;
+  if(center != NULL)
+    sprite.center = *center;
+  else
+    sprite.center = {target.w / 2.0f, target.h / 2.0f};
+  sprite.flip = flip;
+  sprites.push_back(sprite);
+}
+
+void SpriteBatch::addVertices(const Sprite &sprite, SDL_Color color) {
+  float size = atlas->getPageSize();
+  float u1 = sprite.source.x / size, v1 = sprite.source.y / size;
+  float u2 = (sprite.source.x + sprite.source.w) / size;
+  float v2 = (sprite.source.y + sprite.source.h) / size;
+  if(sprite.flip & SDL_FLIP_HORIZONTAL)
+    std::swap(u1, u2);
+  if(sprite.flip & SDL_FLIP_VERTICAL)
+    std::swap(v1, v2);
+  
+  // Corners relative to the center, clockwise on the screen
+  float c = 1.0f, s = 0.0f;
+  if(sprite.angle != 0.0) {
+    double radians = sprite.angle * PI / 180.0;
+    c = cos(radians);
+    s = sin(radians);
+  }
+  
+  float originX = sprite.target.x + sprite.center.x;
+  float originY = sprite.target.y + sprite.center.y;
+  float left = -sprite.center.x, top = -sprite.center.y;
+  float right = left + sprite.target.w, bottom = top + sprite.target.h;
+  
+  float cornerX[4] = {left, right, right, left};
+  float cornerY[4] = {top, top, bottom, bottom};
+  float cornerU[4] = {u1, u2, u2, u1};
+  float cornerV[4] = {v1, v1, v2, v2};
+  
+  int base = vertices.size();
+  for(int i = 0; i < 4; ++i) {
+    SDL_Vertex vertex;
+    vertex.position = {originX + cornerX[i] * c - cornerY[i] * s,
+                       originY + cornerX[i] * s + cornerY[i] * c};
+    vertex.color = color;
+    vertex.tex_coord = {cornerU[i], cornerV[i]};
+    vertices.push_back(vertex);
+  }
+  
+  int quad[6] = {0, 1, 2, 0, 2, 3};
+  for(int i = 0; i < 6; ++i)
+    indices.push_back(base + quad[i]);
+}
+
+void SpriteBatch::drawRun(SDL_Renderer* renderer, int page, int first, int last) {
+  SDL_Texture* texture = atlas->getTexture(page);
+  if(texture == NULL)
+    return;
+  
+  ++drawCalls;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+  if(!geometryUnsupported) {
+    vertices.clear();
+    indices.clear();
+    SDL_Color white = {255, 255, 255, 255};
+    for(int i = first; i < last; ++i)
+      addVertices(sprites[i], white);
+    
+    if(SDL_RenderGeometry(renderer, texture, vertices.data(), vertices.size(),
+                          indices.data(), indices.size()) == 0)
+      return;
+    geometryUnsupported = true;
+  }
+#endif
+  
+  // The renderer can't draw geometry
+  for(int i = first; i < last; ++i) {
+    const Sprite &sprite = sprites[i];
+    SDL_Rect target = {(int)sprite.target.x, (int)sprite.target.y,
+                       (int)sprite.target.w, (int)sprite.target.h};
+    SDL_Point center = {(int)sprite.center.x, (int)sprite.center.y};
+    SDL_RenderCopyEx(renderer, texture, &sprite.source, &target, sprite.angle,
+                     &center, sprite.flip);
+  }
+}
+
+void SpriteBatch::flush(SDL_Renderer* renderer) {
+  drawCalls = 0;
+  atlas->upload(renderer);
+  
+  std::sort(sprites.begin(), sprites.end(), [](const Sprite &a, const Sprite &b) {
+    if(a.depth != b.depth)
+      return a.depth > b.depth;
+    if(a.page != b.page)
+      return a.page < b.page;
+    return a.sequence < b.sequence;
+  });
+  
+  int first = 0;
+  for(int i = 1; i <= (int)sprites.size(); ++i)
+    if(i == (int)sprites.size() || sprites[i].page != sprites[first].page) {
+      drawRun(renderer, sprites[first].page, first, i);
+      first = i;
+    }
+  
+  sprites.clear();
+}
+
+int SpriteBatch::getDrawCalls() {
+  return drawCalls;
+}
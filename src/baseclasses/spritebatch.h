@@ -0,0 +1,60 @@
+#ifndef __SPRITEBATCH_H
+#define __SPRITEBATCH_H
+
+#include <SDL2/SDL.h>
+#include <vector>
+#include "textureatlas.h"
+
+// Collects the sprites drawn during a frame and draws them sorted by
+// decreasing depth, like the objects of a room, with one call for every
+// run of sprites from the same atlas page
+// Rotation and flip are applied on the vertices
+class SpriteBatch {
+private:
+  struct Sprite {
+    int depth;
+    int page;
+    
+    // Order of draw(), keeps the sort stable
+    int sequence;
+    
+    SDL_Rect source;
+    SDL_FRect target;
+    
+    // Clockwise, in degrees, around center (relative to target)
+    double angle;
+    SDL_FPoint center;
+    SDL_RendererFlip flip;
+  };
+  
+  TextureAtlas* atlas;
+  
+  std::vector<Sprite> sprites;
+  std::vector<SDL_Vertex> vertices;
+  std::vector<int> indices;
+  
+  // Calls made by the last flush()
+  int drawCalls;
+  
+  // Set once SDL_RenderGeometry failed, the sprites are then drawn one by
+  // one without trying it again
+  bool geometryUnsupported;
+  
+  void addVertices(const Sprite &sprite, SDL_Color color);
+  void drawRun(SDL_Renderer* renderer, int page, int first, int last);
+public:
+  SpriteBatch(TextureAtlas* _atlas);
+  
+  // Queue a part of a page
+  // center is relative to the target, the center of the target if NULL
+  void draw(int page, SDL_Rect source, SDL_FRect target, int depth = 0,
+            double angle = 0.0, const SDL_FPoint* center = NULL,
+            SDL_RendererFlip flip = SDL_FLIP_NONE);
+  
+  // Draw every queued sprite
+  void flush(SDL_Renderer* renderer);
+  
+  int getDrawCalls();
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef __SPSCQUEUE_H
+#define __SPSCQUEUE_H
+
+#include <atomic>
+#include <vector>
+
+// Lock-free queue with a fixed capacity for exactly one thread that pushes
+// and one thread that pops
+template<typename T>
+class SPSCQueue {
+private:
+  // Ring buffer, its size is a power of two
+  std::vector<T> buffer;
+  unsigned int mask;
+  
+  // Next position to pop, only written by the consumer
+  alignas(64) std::atomic<unsigned int> head;
+  
+  // Next position to push, only written by the producer
+  alignas(64) std::atomic<unsigned int> tail;
+public:
+  // The capacity is rounded up to a power of two
+  SPSCQueue(unsigned int capacity) {
+    unsigned int size = 1;
+    while(size < capacity)
+      size <<= 1;
+    buffer.resize(size);
+    mask = size - 1;
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+  }
+  
+  // Producer: add x to the queue
+  // Returns false if the queue is full
+  bool push(const T &x) {
+    unsigned int t = tail.load(std::memory_order_relaxed);
+    if(t - head.load(std::memory_order_acquire) > mask)
+      return false;
+    buffer[t & mask] = x;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+  
+  // Consumer: remove the oldest element and store it in x
+  // Returns false if the queue is empty
+  bool pop(T &x) {
+    unsigned int h = head.load(std::memory_order_relaxed);
+    if(h == tail.load(std::memory_order_acquire))
+      return false;
+    x = buffer[h & mask];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+  
+  // Approximate number of elements, exact when called by either thread
+  // while the other one is idle
+  unsigned int size() {
+    return tail.load(std::memory_order_acquire) -
+           head.load(std::memory_order_acquire);
+  }
+  
+  unsigned int capacity() {
+    return mask + 1;
+  }
+};
+
+#endif
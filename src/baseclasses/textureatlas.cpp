@@ -0,0 +1,122 @@
+#include "baseclasses/textureatlas.h"
+#include <SDL2/SDL_image.h>
+#include <algorithm>
+
+// Empty pixels around every image, so the filtering doesn't mix them
+const int ATLAS_PADDING = 1;
+
+TextureAtlas::TextureAtlas(int _pageSize) {
+  pageSize = _pageSize;
+}
+
+TextureAtlas::~TextureAtlas() {
+  for(unsigned int i = 0; i < pages.size(); ++i) {
+    if(pages[i].texture != NULL)
+      SDL_DestroyTexture(pages[i].texture);
+    SDL_FreeSurface(pages[i].surface);
+  }
+}
+
+bool TextureAtlas::place(Page &page, int w, int h, SDL_Rect &rect) {
+  if(page.shelfX + w > pageSize) {
+    page.shelfX = 0;
+    page.shelfY += page.shelfHeight;
+    page.shelfHeight = 0;
+  }
+  if(page.shelfY + h > pageSize)
+    return false;
+  
+  rect = {page.shelfX, page.shelfY, w - ATLAS_PADDING, h - ATLAS_PADDING};
+  page.shelfX += w;
+  page.shelfHeight = std::max(page.shelfHeight, h);
+  return true;
+}
+
+bool TextureAtlas::add(SDL_Surface* surface, AtlasRegion &region) {
+  int w = surface->w + ATLAS_PADDING, h = surface->h + ATLAS_PADDING;
+  if(w > pageSize || h > pageSize) {
+    SDL_Log("Image of %dx%d doesn't fit in an atlas page\n", surface->w, surface->h);
+    return false;
+  }
+  
+  // Only the last page is tried, the older ones are nearly full
+  region.page = -1;
+  if(!pages.empty() && place(pages.back(), w, h, region.rect))
+    region.page = pages.size() - 1;
+  
+  if(region.page == -1) {
+    Page page;
+    page.surface = SDL_CreateRGBSurfaceWithFormat(0, pageSize, pageSize, 32,
+                                                  SDL_PIXELFORMAT_ARGB8888);
+    if(page.surface == NULL) {
+      SDL_Log("Unable to create atlas page: %s\n", SDL_GetError());
+      return false;
+    }
+    page.texture = NULL;
+    page.renderer = NULL;
+    page.shelfX = page.shelfY = page.shelfHeight = 0;
+    page.dirty = true;
+    pages.push_back(page);
+    
+    place(pages.back(), w, h, region.rect);
+    region.page = pages.size() - 1;
+  }
+  
+  Page &page = pages[region.page];
+  SDL_Rect target = region.rect;
+  SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_NONE);
+  SDL_BlitSurface(surface, NULL, page.surface, &target);
+  page.dirty = true;
+  return true;
+}
+
+bool TextureAtlas::load(const char* filename, AtlasRegion &region) {
+  SDL_Surface* surface = IMG_Load(filename);
+  if(surface == NULL) {
+    SDL_Log("Unable to load image %s: %s\n", filename, IMG_GetError());
+    return false;
+  }
+  
+  bool added = add(surface, region);
+  SDL_FreeSurface(surface);
+  return added;
+}
+
+void TextureAtlas::upload(SDL_Renderer* renderer) {
+  for(unsigned int i = 0; i < pages.size(); ++i) {
+    Page &page = pages[i];
+    if(page.texture != NULL && page.renderer != renderer) {
+      SDL_DestroyTexture(page.texture);
+      page.texture = NULL;
+    }
+    
+    if(page.texture == NULL) {
+      page.texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                       SDL_TEXTUREACCESS_STATIC, pageSize, pageSize);
+      if(page.texture == NULL) {
+        SDL_Log("Unable to create atlas texture: %s\n", SDL_GetError());
+        continue;
+      }
+      SDL_SetTextureBlendMode(page.texture, SDL_BLENDMODE_BLEND);
+      page.renderer = renderer;
+      page.dirty = true;
+    }
+    
+    if(page.dirty) {
+      SDL_UpdateTexture(page.texture, NULL, page.surface->pixels, page.surface->pitch);
+      page.dirty = false;
+    }
+  }
+}
+
+SDL_Texture* TextureAtlas::getTexture(int page) {
+  return pages[page].texture;
+}
+
+int TextureAtlas::getPageCount() {
+  return pages.size();
+}
+
+int TextureAtlas::getPageSize() {
+  return pageSize;
+}
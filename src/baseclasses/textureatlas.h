@@ -0,0 +1,60 @@
+#ifndef __TEXTUREATLAS_H
+#define __TEXTUREATLAS_H
+
+#include <SDL2/SDL.h>
+#include <vector>
+
+// Side of a page of the atlas, in pixels
+const int ATLAS_PAGE_SIZE = 2048;
+
+// Part of a page holding one image
+struct AtlasRegion {
+  int page;
+  SDL_Rect rect;
+};
+
+// Merges many images into a few big textures (pages), so sprites from
+// different images can be drawn with one call
+// Images are packed on shelves, a page is added when no page has room
+class TextureAtlas {
+private:
+  struct Page {
+    // Copy of the texture, updated when an image is added
+    SDL_Surface* surface;
+    SDL_Texture* texture;
+    SDL_Renderer* renderer;
+    
+    // Shelf where the next image goes
+    int shelfX, shelfY, shelfHeight;
+    
+    // True if the surface changed since the last upload
+    bool dirty;
+  };
+  
+  std::vector<Page> pages;
+  int pageSize;
+  
+  // Find room for an image of the given size on the page
+  bool place(Page &page, int w, int h, SDL_Rect &rect);
+public:
+  TextureAtlas(int _pageSize = ATLAS_PAGE_SIZE);
+  ~TextureAtlas();
+  
+  // Copy the image in the atlas
+  // Returns false if it is bigger than a page
+  bool add(SDL_Surface* surface, AtlasRegion &region);
+  
+  // Load the image from the file and add it
+  bool load(const char* filename, AtlasRegion &region);
+  
+  // Create or update the textures of the changed pages
+  void upload(SDL_Renderer* renderer);
+  
+  // Texture of the page, NULL before upload()
+  SDL_Texture* getTexture(int page);
+  
+  int getPageCount();
+  int getPageSize();
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "baseclasses/threadpool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threadCount) {
+  if(threadCount <= 0)
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+  job = NULL;
+  generation = 0;
+  active = 0;
+  stopping = false;
+
+  for(int i = 0; i < threadCount; ++i)
+    workers.push_back(new Worker());
+  for(int i = 1; i < threadCount; ++i)
+    threads.push_back(std::thread(&ThreadPool::threadLoop, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  wake.notify_all();
+
+  for(unsigned int i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  for(unsigned int i = 0; i < workers.size(); ++i)
+    delete workers[i];
+}
+
+int ThreadPool::getThreadCount() {
+  return workers.size();
+}
+
+bool ThreadPool::popTask(int worker, int &task) {
+  // Its own queue from the back, where the first dealt tasks are
+  {
+    Worker* own = workers[worker];
+    std::lock_guard<std::mutex> guard(own->lock);
+    if(!own->tasks.empty()) {
+      task = own->tasks.back();
+      own->tasks.pop_back();
+      return true;
+    }
+  }
+
+  // Then steal from the front of another queue
+  int n = workers.size();
+  for(int i = 1; i < n; ++i) {
+    Worker* victim = workers[(worker + i) % n];
+    std::lock_guard<std::mutex> guard(victim->lock);
+    if(!victim->tasks.empty()) {
+      task = victim->tasks.front();
+      victim->tasks.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void ThreadPool::work(int worker) {
+  int task;
+  // No task is added while a batch runs, so an empty scan means it's over
+  while(popTask(worker, task))
+    (*job)(task);
+}
+
+void ThreadPool::threadLoop(int worker) {
+  unsigned int seen = 0;
+  while(true) {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      wake.wait(guard, [&] { return stopping || generation != seen; });
+      if(stopping)
+        return;
+      seen = generation;
+    }
+
+    work(worker);
+
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if(--active == 0)
+        done.notify_all();
+    }
+  }
+}
+
+void ThreadPool::run(int taskCount, const std::function<void(int)> &task) {
+  if(threads.empty() || taskCount <= 1) {
+    for(int i = 0; i < taskCount; ++i)
+      task(i);
+    return;
+  }
+
+  // Deal the tasks like cards, so the longest ones are spread out
+  int n = workers.size();
+  for(int i = 0; i < taskCount; ++i)
+    workers[i % n]->tasks.push_front(i);
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    job = &task;
+    active = threads.size();
+    ++generation;
+  }
+  wake.notify_all();
+
+  work(0);
+
+  std::unique_lock<std::mutex> guard(lock);
+  done.wait(guard, [&] { return active == 0; });
+  job = NULL;
+}
@@ -0,0 +1,55 @@
+#ifndef __THREADPOOL_H
+#define __THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Pool of threads running batches of independent tasks
+// Every thread has its own queue of tasks and takes work from the queues
+// of the others once it runs out
+class ThreadPool {
+private:
+  struct Worker {
+    std::mutex lock;
+    std::deque<int> tasks;
+  };
+
+  // Queue 0 belongs to the thread calling run()
+  std::vector<Worker*> workers;
+  std::vector<std::thread> threads;
+
+  std::mutex lock;
+  std::condition_variable wake, done;
+
+  // Task of the current batch
+  const std::function<void(int)>* job;
+
+  // Incremented for every batch, to wake the threads
+  unsigned int generation;
+
+  // Threads still working on the current batch
+  int active;
+
+  bool stopping;
+
+  bool popTask(int worker, int &task);
+  void work(int worker);
+  void threadLoop(int worker);
+public:
+  // threadCount counts the calling thread, if it isn't positive every core
+  // is used
+  ThreadPool(int threadCount = 0);
+  ~ThreadPool();
+
+  int getThreadCount();
+
+  // Calls task(i) for every 0 <= i < taskCount and waits for all of them
+  // The tasks are queued in order, so the first ones should be the longest
+  void run(int taskCount, const std::function<void(int)> &task);
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "baseclasses/timer.h"
+#include <time.h>
 
 Timer::Timer() {
   active = false;
@@ -6,18 +7,22 @@ Timer::Timer() {
 }
 
 Uint32 Timer::getTimeAmmount() {
+  return (Uint32)(getTimeAmmountNs() / 1000000ull);
+}
+
+Uint64 Timer::getTimeAmmountNs() {
   if(active)
-    return getTime() - lastT;
+    return getTimeNs() - lastT;
   return 0;
 }
 
 void Timer::resetTimer() {
-  lastT = getTime();
+  lastT = getTimeNs();
 }
 
 void Timer::startTimer() {
   active = true;
-  lastT = getTime();
+  lastT = getTimeNs();
 }
 
 void Timer::stopTimer() {
@@ -27,3 +32,16 @@ void Timer::stopTimer() {
 Uint32 Timer::getTime() {
   return SDL_GetTicks();
 }
+
+Uint64 Timer::getTimeNs() {
+#if defined(CLOCK_MONOTONIC)
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (Uint64)now.tv_sec * 1000000000ull + now.tv_nsec;
+#else
+  static Uint64 frequency = SDL_GetPerformanceFrequency();
+  Uint64 counter = SDL_GetPerformanceCounter();
+  return counter / frequency * 1000000000ull +
+         counter % frequency * 1000000000ull / frequency;
+#endif
+}
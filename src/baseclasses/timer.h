@@ -5,8 +5,8 @@
 
 class Timer {
 private:
-  // Last time since we checked the timer
-  Uint32 lastT;
+  // Last time since we checked the timer, in nanoseconds
+  Uint64 lastT;
   // Check if the timer is activated
   bool active;
 public:
@@ -18,10 +18,16 @@ public:
   void stopTimer();
   // Reset the timer
   void resetTimer();
-  // Get the time measured by the timer
+  // Get the time measured by the timer in milliseconds
   Uint32 getTimeAmmount();
+  // Get the time measured by the timer in nanoseconds
+  Uint64 getTimeAmmountNs();
   // Get the ammount of milliseconds since SDL was initialized
   Uint32 getTime();
+  
+  // Get the time of a monotonic clock in nanoseconds
+  // Only differences between two calls are meaningful
+  static Uint64 getTimeNs();
 };
 
 #endif
@@ -0,0 +1,159 @@
+#include "baseclasses/timerwheel.h"
+#include <algorithm>
+
+// Slot of a level holding the given millisecond
+static inline int slotOf(Uint64 time, int level) {
+  return (time >> (level * WHEEL_SLOT_BITS)) & (WHEEL_SLOTS - 1);
+}
+
+TimerWheel::TimerWheel(Uint32 now) {
+  std::fill(heads, heads + WHEEL_LEVELS * WHEEL_SLOTS, -1);
+  current = 0;
+  lastTime = now;
+  generation = 0;
+  count = 0;
+}
+
+void TimerWheel::insert(int node) {
+  TimerNode &timer = nodes[node];
+  // Timers further than the wheel reaches wait in the last level, at its
+  // furthest slot
+  Uint64 deadline = std::min(timer.deadline, current + WHEEL_RANGE - 1);
+  Uint64 delay = deadline - current;
+  int level = 0;
+  while(level < WHEEL_LEVELS - 1 && delay >= 1ull << ((level + 1) * WHEEL_SLOT_BITS))
+    ++level;
+
+  int list = level * WHEEL_SLOTS + slotOf(deadline, level);
+  timer.list = list;
+  timer.prev = -1;
+  timer.next = heads[list];
+  if(heads[list] != -1)
+    nodes[heads[list]].prev = node;
+  heads[list] = node;
+}
+
+void TimerWheel::unlink(int node) {
+  TimerNode &timer = nodes[node];
+  if(timer.prev != -1)
+    nodes[timer.prev].next = timer.next;
+  else
+    heads[timer.list] = timer.next;
+  if(timer.next != -1)
+    nodes[timer.next].prev = timer.prev;
+  timer.list = -1;
+}
+
+void TimerWheel::cascade(int level, int slot) {
+  int list = level * WHEEL_SLOTS + slot;
+  int node = heads[list];
+  heads[list] = -1;
+  while(node != -1) {
+    int next = nodes[node].next;
+    insert(node);
+    node = next;
+  }
+}
+
+void TimerWheel::tick() {
+  int slot = slotOf(current, 0);
+  // At the start of a slot of a level, the timers of that slot go down
+  for(int level = 1; slot == 0 && level < WHEEL_LEVELS; ++level) {
+    slot = slotOf(current, level);
+    cascade(level, slot);
+  }
+
+  slot = slotOf(current, 0);
+  while(heads[slot] != -1) {
+    int node = heads[slot];
+    unlink(node);
+    std::function<void()> callback;
+    callback.swap(nodes[node].callback);
+    nodes[node].id = NO_TIMER;
+    unusedNodes.push_back(node);
+    --count;
+    // The callback may schedule timers and move the nodes
+    callback();
+  }
+}
+
+TimerId TimerWheel::schedule(Uint32 delay, const std::function<void()> &callback) {
+  int node;
+  if(unusedNodes.empty()) {
+    node = nodes.size();
+    nodes.push_back(TimerNode());
+  } else {
+    node = unusedNodes.back();
+    unusedNodes.pop_back();
+  }
+
+  ++generation;
+  if(generation == 0)
+    ++generation;
+  TimerNode &timer = nodes[node];
+  timer.id = (TimerId)generation << 32 | (Uint32)node;
+  timer.deadline = current + std::max(delay, (Uint32)1);
+  timer.callback = callback;
+  insert(node);
+  ++count;
+  return timer.id;
+}
+
+bool TimerWheel::isScheduled(TimerId id) {
+  Uint32 node = (Uint32)id;
+  return id != NO_TIMER && node < nodes.size() && nodes[node].id == id;
+}
+
+bool TimerWheel::cancel(TimerId id) {
+  if(!isScheduled(id))
+    return false;
+
+  int node = (Uint32)id;
+  unlink(node);
+  nodes[node].callback = nullptr;
+  nodes[node].id = NO_TIMER;
+  unusedNodes.push_back(node);
+  --count;
+  return true;
+}
+
+void TimerWheel::advance(Uint32 now) {
+  // The difference is right when the ticks of SDL wrap around
+  Uint64 target = current + (Uint32)(now - lastTime);
+  lastTime = now;
+  while(current < target && count > 0) {
+    // The milliseconds before the next slot with timers change nothing
+    current += getWait(target - current);
+    tick();
+  }
+  // Nothing is left to move down the levels
+  current = target;
+}
+
+Uint32 TimerWheel::getWait(Uint32 most) {
+  if(count == 0)
+    return most;
+
+  Uint64 best = most;
+  for(int i = 1; i < WHEEL_SLOTS && (Uint64)i < best; ++i)
+    if(heads[slotOf(current + i, 0)] != -1) {
+      best = i;
+      break;
+    }
+
+  // The timers of the levels above aren't due before their slot starts
+  for(int level = 1; level < WHEEL_LEVELS; ++level) {
+    int bits = level * WHEEL_SLOT_BITS;
+    Uint64 block = current >> bits;
+    for(int i = 1; i <= WHEEL_SLOTS && ((block + i) << bits) - current < best; ++i)
+      if(heads[level * WHEEL_SLOTS + slotOf((block + i) << bits, level)] != -1) {
+        best = ((block + i) << bits) - current;
+        break;
+      }
+  }
+  return best;
+}
+
+int TimerWheel::size() {
+  return count;
+}
@@ -0,0 +1,98 @@
+#ifndef __TIMERWHEEL_H
+#define __TIMERWHEEL_H
+
+#include <vector>
+#include <functional>
+#include <SDL2/SDL.h>
+
+// Levels of the wheel and slots on every level, a slot of a level spans
+// WHEEL_SLOTS slots of the level below
+const int WHEEL_LEVELS = 5;
+const int WHEEL_SLOT_BITS = 6;
+const int WHEEL_SLOTS = 1 << WHEEL_SLOT_BITS;
+
+// Longest delay the wheel holds in one place, in milliseconds (about 12
+// days), timers further away are placed again when they get closer
+const Uint64 WHEEL_RANGE = 1ull << (WHEEL_LEVELS * WHEEL_SLOT_BITS);
+
+// Handle of a scheduled timer, it stays unique after the timer runs or is
+// cancelled so old handles can't cancel a newer timer
+typedef Uint64 TimerId;
+
+// Never the handle of a timer
+const TimerId NO_TIMER = 0;
+
+// Calls functions after a delay, with a millisecond resolution
+// Timers due in less than WHEEL_SLOTS milliseconds are kept in the slots of
+// level 0, one for every millisecond. The ones due later are kept in the
+// coarser slots of the levels above and moved down a level once the slots
+// below reach them. Scheduling and cancelling a timer take the same time
+// however many timers there are
+class TimerWheel {
+private:
+  struct TimerNode {
+    TimerId id;
+
+    // Millisecond the timer is due, counted by the wheel
+    Uint64 deadline;
+
+    std::function<void()> callback;
+
+    // Neighbours in the list of its slot, -1 at the ends
+    int prev, next;
+
+    // Slot the node is in, level * WHEEL_SLOTS + slot, -1 for the unused
+    // nodes
+    int list;
+  };
+
+  std::vector<TimerNode> nodes;
+  std::vector<int> unusedNodes;
+
+  // First node of the list of every slot, -1 for the empty ones
+  int heads[WHEEL_LEVELS * WHEEL_SLOTS];
+
+  // Millisecond the timers ran up to, and the time it was at
+  Uint64 current;
+  Uint32 lastTime;
+
+  // Incremented for every timer, the lower bits of its id are its node
+  Uint32 generation;
+
+  int count;
+
+  // Put the node in the slot of its deadline
+  void insert(int node);
+  void unlink(int node);
+
+  // Move the timers of the slot of a level to the levels below
+  void cascade(int level, int slot);
+
+  // Run the timers due at the current millisecond
+  void tick();
+public:
+  // Wheel whose time starts at now
+  TimerWheel(Uint32 now);
+
+  // Call callback delay milliseconds after the time the wheel is at, at
+  // least one millisecond later
+  TimerId schedule(Uint32 delay, const std::function<void()> &callback);
+
+  // Returns false if the timer already ran or was cancelled
+  bool cancel(TimerId id);
+
+  bool isScheduled(TimerId id);
+
+  // Move the time of the wheel to now and run every timer due until then,
+  // in the order of their deadlines. The callbacks can schedule and cancel
+  // timers
+  void advance(Uint32 now);
+
+  // Milliseconds from the time of the wheel until the next timer is due or
+  // a timer is moved down a level, at most most
+  Uint32 getWait(Uint32 most);
+
+  int size();
+};
+
+#endif
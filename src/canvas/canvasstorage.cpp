@@ -0,0 +1,315 @@
+#include "canvas/canvasstorage.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+// First bytes of files written by CanvasStorage::save
+static const char SAVE_MAGIC[4] = {'P', 'S', 'C', '1'};
+
+static inline int getPitch(int width, PixelFormat format) {
+  if(format == FORMAT_RGB)
+    return width * 3;
+  if(format == FORMAT_INDEX8)
+    return width;
+  return (width + 1) / 2;
+}
+
+CanvasStorage::CanvasStorage(short _width, short _height, PixelFormat _format) {
+  width = _width;
+  height = _height;
+  format = _format;
+  pitch = getPitch(width, format);
+  data.assign(pitch * height, 0);
+  
+  if(format == FORMAT_INDEX8)
+    palette = Palette::getDefault(8);
+  else if(format == FORMAT_INDEX4)
+    palette = Palette::getDefault(4);
+}
+
+int CanvasStorage::getWidth() {
+  return width;
+}
+
+int CanvasStorage::getHeight() {
+  return height;
+}
+
+PixelFormat CanvasStorage::getFormat() {
+  return format;
+}
+
+bool CanvasStorage::isIndexed() {
+  return format != FORMAT_RGB;
+}
+
+const Palette& CanvasStorage::getPalette() {
+  return palette;
+}
+
+void CanvasStorage::setPalette(const Palette& _palette) {
+  palette = _palette;
+}
+
+bool CanvasStorage::inside(int x, int y) {
+  return 0 <= x && x < width && 0 <= y && y < height;
+}
+
+unsigned char CanvasStorage::getIndex(int x, int y) {
+  if(format == FORMAT_INDEX8)
+    return data[y * pitch + x];
+  unsigned char packed = data[y * pitch + x / 2];
+  return (x & 1) ? (packed >> 4) : (packed & 0x0f);
+}
+
+void CanvasStorage::setIndex(int x, int y, unsigned char index) {
+  if(format == FORMAT_INDEX8) {
+    data[y * pitch + x] = index;
+    return;
+  }
+  unsigned char &packed = data[y * pitch + x / 2];
+  if(x & 1)
+    packed = (packed & 0x0f) | (index << 4);
+  else
+    packed = (packed & 0xf0) | (index & 0x0f);
+}
+
+Pixel CanvasStorage::getPixel(int x, int y) {
+  if(format == FORMAT_RGB) {
+    unsigned char* p = &data[y * pitch + x * 3];
+    return {p[0], p[1], p[2]};
+  }
+  return palette.getColor(getIndex(x, y));
+}
+
+void CanvasStorage::setPixel(int x, int y, Pixel p) {
+  if(format == FORMAT_RGB) {
+    unsigned char* q = &data[y * pitch + x * 3];
+    q[0] = p.r;
+    q[1] = p.g;
+    q[2] = p.b;
+  } else
+    setIndex(x, y, palette.nearest(p));
+}
+
+void CanvasStorage::fillRow(int x, int y, int w, Pixel p) {
+  if(w <= 0)
+    return;
+  if(format != FORMAT_RGB) {
+    fillRowIndex(x, y, w, palette.nearest(p));
+    return;
+  }
+  
+  // Write one pixel, then keep doubling the filled part
+  unsigned char* row = &data[y * pitch + x * 3];
+  row[0] = p.r;
+  row[1] = p.g;
+  row[2] = p.b;
+  int filled = 3, size = w * 3;
+  while(filled < size) {
+    int count = std::min(filled, size - filled);
+    memcpy(row + filled, row, count);
+    filled += count;
+  }
+}
+
+void CanvasStorage::fillRowIndex(int x, int y, int w, unsigned char index) {
+  if(w <= 0)
+    return;
+  if(format == FORMAT_INDEX8) {
+    memset(&data[y * pitch + x], index, w);
+    return;
+  }
+  
+  // Half bytes at the ends, whole bytes between them
+  int end = x + w;
+  if(x & 1)
+    setIndex(x++, y, index);
+  if(end > x && (end & 1))
+    setIndex(--end, y, index);
+  if(end > x)
+    memset(&data[y * pitch + x / 2], (index & 0x0f) | (index << 4), (end - x) / 2);
+}
+
+void CanvasStorage::convert(PixelFormat _format) {
+  if(_format == format)
+    return;
+  
+  CanvasStorage converted(width, height, _format);
+  for(int y = 0; y < height; ++y)
+    for(int x = 0; x < width; ++x)
+      converted.setPixel(x, y, getPixel(x, y));
+  
+  format = converted.format;
+  pitch = converted.pitch;
+  palette = converted.palette;
+  data.swap(converted.data);
+}
+
+int CanvasStorage::getValueSize() {
+  return format == FORMAT_RGB ? 3 : 1;
+}
+
+void CanvasStorage::writeValue(int x, int y, unsigned char* &pnt) {
+  if(format == FORMAT_RGB) {
+    Pixel p = getPixel(x, y);
+    writeNumber(pnt, p.r);
+    writeNumber(pnt, p.g);
+    writeNumber(pnt, p.b);
+  } else
+    writeNumber(pnt, getIndex(x, y));
+}
+
+void CanvasStorage::readValue(int x, int y, unsigned char* &pnt) {
+  if(format == FORMAT_RGB) {
+    Pixel p;
+    readNumber(pnt, p.r);
+    readNumber(pnt, p.g);
+    readNumber(pnt, p.b);
+    setPixel(x, y, p);
+  } else {
+    unsigned char index;
+    readNumber(pnt, index);
+    setIndex(x, y, index);
+  }
+}
+
+int CanvasStorage::getRegionSize(int w, int h) {
+  return getPitch(w, format) * h;
+}
+
+void CanvasStorage::writeRegion(int x, int y, int w, int h, unsigned char* &pnt) {
+  int lineSize = getPitch(w, format), offset = getPitch(x, format);
+  for(int line = y; line < y + h; ++line) {
+    memcpy(pnt, &data[line * pitch + offset], lineSize);
+    pnt = pnt + lineSize;
+  }
+}
+
+void CanvasStorage::readRegion(int x, int y, int w, int h, unsigned char* &pnt) {
+  int lineSize = getPitch(w, format), offset = getPitch(x, format);
+  
+  // The last byte of an odd FORMAT_INDEX4 line is shared with the pixel
+  // on its right, which must be kept
+  bool sharedLast = format == FORMAT_INDEX4 && (w & 1) && x + w < width;
+  for(int line = y; line < y + h; ++line) {
+    unsigned char* target = &data[line * pitch + offset];
+    unsigned char kept = target[lineSize - 1] & 0xf0;
+    memcpy(target, pnt, lineSize);
+    if(sharedLast)
+      target[lineSize - 1] = (target[lineSize - 1] & 0x0f) | kept;
+    pnt = pnt + lineSize;
+  }
+}
+
+int CanvasStorage::getSnapshotSize() {
+  int size = sizeof(short) * 2 + sizeof(unsigned char);
+  if(isIndexed())
+    size += sizeof(unsigned char) + 3 * palette.size();
+  return size + data.size();
+}
+
+void CanvasStorage::writeSnapshot(unsigned char* &pnt) {
+  writeNumber(pnt, width);
+  writeNumber(pnt, height);
+  writeNumber(pnt, format);
+  
+  if(isIndexed()) {
+    writeNumber(pnt, (unsigned char)(palette.size() - 1));
+    for(int i = 0; i < palette.size(); ++i) {
+      Pixel color = palette.getColor(i);
+      writeNumber(pnt, color.r);
+      writeNumber(pnt, color.g);
+      writeNumber(pnt, color.b);
+    }
+  }
+  
+  // Empty canvases carry only the format and the palette
+  if(!data.empty())
+    memcpy(pnt, data.data(), data.size());
+  pnt = pnt + data.size();
+}
+
+CanvasStorage* CanvasStorage::readSnapshot(unsigned char* &pnt, int length) {
+  unsigned char* end = pnt + length;
+  short width, height;
+  PixelFormat format;
+  if(length < (int)(sizeof(short) * 2 + sizeof(unsigned char)))
+    return NULL;
+  readNumber(pnt, width);
+  readNumber(pnt, height);
+  readNumber(pnt, format);
+  if(width < 0 || height < 0 || format > FORMAT_INDEX4)
+    return NULL;
+  
+  CanvasStorage* canvas = new CanvasStorage(width, height, format);
+  
+  if(canvas->isIndexed()) {
+    unsigned char lastColor;
+    Pixel colors[MAX_PALETTE_SIZE];
+    if(end - pnt < 1 || end - pnt < 1 + 3 * (pnt[0] + 1)) {
+      delete canvas;
+      return NULL;
+    }
+    readNumber(pnt, lastColor);
+    for(int i = 0; i <= lastColor; ++i) {
+      readNumber(pnt, colors[i].r);
+      readNumber(pnt, colors[i].g);
+      readNumber(pnt, colors[i].b);
+    }
+    canvas->palette = Palette(colors, lastColor + 1);
+  }
+  
+  if(end - pnt < (int)canvas->data.size()) {
+    delete canvas;
+    return NULL;
+  }
+  if(!canvas->data.empty())
+    memcpy(canvas->data.data(), pnt, canvas->data.size());
+  pnt = pnt + canvas->data.size();
+  return canvas;
+}
+
+bool CanvasStorage::save(const char* filename) {
+  FILE *fout = fopen(filename, "wb");
+  if(fout == NULL)
+    return false;
+  
+  std::vector<unsigned char> buffer(getSnapshotSize());
+  unsigned char* pnt = buffer.data();
+  writeSnapshot(pnt);
+  
+  fwrite(SAVE_MAGIC, sizeof(char), 4, fout);
+  fwrite(buffer.data(), sizeof(unsigned char), buffer.size(), fout);
+  fclose(fout);
+  return true;
+}
+
+CanvasStorage* CanvasStorage::load(const char* filename) {
+  FILE *fin = fopen(filename, "rb");
+  if(fin == NULL)
+    return NULL;
+  
+  std::vector<unsigned char> buffer;
+  unsigned char chunk[4096];
+  size_t count;
+  while((count = fread(chunk, sizeof(unsigned char), sizeof(chunk), fin)) > 0)
+    buffer.insert(buffer.end(), chunk, chunk + count);
+  fclose(fin);
+  
+  CanvasStorage* canvas = NULL;
+  if(buffer.size() >= 4 && memcmp(buffer.data(), SAVE_MAGIC, 4) == 0) {
+    unsigned char* pnt = buffer.data() + 4;
+    canvas = readSnapshot(pnt, buffer.size() - 4);
+  } else if(buffer.size() >= sizeof(short) * 2) {
+    // Older servers saved short width, short height and the rgb pixels
+    unsigned char* pnt = buffer.data();
+    short width, height;
+    readNumber(pnt, width);
+    readNumber(pnt, height);
+    canvas = new CanvasStorage(width, height, FORMAT_RGB);
+    if(buffer.size() >= sizeof(short) * 2 + canvas->data.size() && !canvas->data.empty())
+      memcpy(canvas->data.data(), pnt, canvas->data.size());
+  }
+  return canvas;
+}
@@ -0,0 +1,112 @@
+#ifndef __CANVASSTORAGE_H
+#define __CANVASSTORAGE_H
+
+#include <vector>
+#include "canvas/protocol.h"
+#include "canvas/palette.h"
+
+// How the pixels of a canvas are stored
+enum PixelFormat : unsigned char {
+  // 3 bytes of free rgb color per pixel
+  FORMAT_RGB = 0,
+  // 1 byte palette index per pixel
+  FORMAT_INDEX8 = 1,
+  // 4 bit palette index per pixel, two pixels per byte
+  FORMAT_INDEX4 = 2
+};
+
+// Pixels of a canvas, shared by the client and the server
+// Lines are stored one after another, the pixel (x, y) is on line y and
+// column x
+class CanvasStorage {
+private:
+  short width, height;
+  PixelFormat format;
+  
+  // Colors used by the indexed formats
+  Palette palette;
+  
+  // Bytes per line
+  int pitch;
+  
+  // The pixels
+  std::vector<unsigned char> data;
+public:
+  // Create a black canvas
+  // Indexed formats use the default palette with the same number of bits
+  CanvasStorage(short _width, short _height, PixelFormat _format = FORMAT_RGB);
+  
+  int getWidth();
+  int getHeight();
+  PixelFormat getFormat();
+  
+  // Returns true if the format stores palette indices
+  bool isIndexed();
+  
+  // Palette of the indexed formats
+  const Palette& getPalette();
+  
+  // Replace the palette, the stored indices are kept
+  void setPalette(const Palette& _palette);
+  
+  // Returns true if (x, y) is on the canvas
+  bool inside(int x, int y);
+  
+  // Color of the pixel (x, y)
+  Pixel getPixel(int x, int y);
+  
+  // Set the color of the pixel (x, y)
+  // Indexed formats store the nearest color of the palette
+  void setPixel(int x, int y, Pixel p);
+  
+  // Palette index of the pixel (x, y), only for indexed formats
+  unsigned char getIndex(int x, int y);
+  void setIndex(int x, int y, unsigned char index);
+  
+  // Set w pixels of line y starting with column x, they must be inside
+  // The row is filled with whole blocks of bytes instead of pixel by pixel
+  void fillRow(int x, int y, int w, Pixel p);
+  void fillRowIndex(int x, int y, int w, unsigned char index);
+  
+  // Change the format of the canvas, keeping the colors as close as possible
+  void convert(PixelFormat _format);
+  
+  // Bytes of the stored value of one pixel (1 for both indexed formats)
+  int getValueSize();
+  
+  // Stored value of the pixel (x, y): rgb, or the palette index
+  void writeValue(int x, int y, unsigned char* &pnt);
+  void readValue(int x, int y, unsigned char* &pnt);
+  
+  // Size in bytes of the rectangle of w x h pixels as stored
+  // For FORMAT_INDEX4 the rectangle must start on an even column
+  int getRegionSize(int w, int h);
+  
+  // Copy the lines of the rectangle as stored, the rectangle must be
+  // inside the canvas
+  void writeRegion(int x, int y, int w, int h, unsigned char* &pnt);
+  void readRegion(int x, int y, int w, int h, unsigned char* &pnt);
+  
+  // Size in bytes of a snapshot of the canvas
+  int getSnapshotSize();
+  
+  // Write the whole canvas:
+  // short width, short height, format,
+  // for indexed formats: palette size - 1, rgb of every palette color
+  // then the lines of the canvas as stored
+  void writeSnapshot(unsigned char* &pnt);
+  
+  // Read a canvas written by writeSnapshot from length bytes
+  // Returns NULL if the bytes don't hold a whole canvas
+  static CanvasStorage* readSnapshot(unsigned char* &pnt, int length);
+  
+  // Save the canvas to a file
+  bool save(const char* filename);
+  
+  // Load a canvas saved with save(), or a canvas saved by older servers
+  // (short width, short height and rgb of every pixel)
+  // Returns NULL if the file can't be read
+  static CanvasStorage* load(const char* filename);
+};
+
+#endif
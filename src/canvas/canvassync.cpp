@@ -0,0 +1,383 @@
+#include "canvas/canvassync.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+
+// First bytes of files written by saveCanvas
+static const char SYNC_SAVE_MAGIC[4] = {'P', 'S', 'C', '2'};
+
+static const int SYNC_HEADER_SIZE = sizeof(unsigned char) +
+                                    sizeof(unsigned int) * 2;
+
+bool validCanvasName(const std::string &name) {
+  if(name.empty() || (int)name.size() > MAX_CANVAS_NAME)
+    return false;
+  for(unsigned int i = 0; i < name.size(); ++i)
+    if(!isalnum((unsigned char)name[i]) && name[i] != '-' && name[i] != '_')
+      return false;
+  return true;
+}
+
+void writeHello(const std::string &name, TileVersions* versions,
+                std::vector<unsigned char> &packet) {
+  TileVersions none(0, 0, 0);
+  if(versions == NULL)
+    versions = &none;
+  
+  packet.resize(sizeof(unsigned char) * 2 + name.size() + versions->getSize());
+  unsigned char* pnt = packet.data();
+  writeNumber(pnt, MSG_HELLO);
+  writeNumber(pnt, (unsigned char)name.size());
+  memcpy(pnt, name.data(), name.size());
+  pnt = pnt + name.size();
+  versions->write(pnt);
+}
+
+void writeHelloTiles(const std::string &name, std::vector<unsigned char> &packet) {
+  packet.resize(sizeof(unsigned char) * 2 + name.size());
+  unsigned char* pnt = packet.data();
+  writeNumber(pnt, MSG_HELLO_TILES);
+  writeNumber(pnt, (unsigned char)name.size());
+  memcpy(pnt, name.data(), name.size());
+}
+
+bool readHelloName(unsigned char* &pnt, int &length, std::string &name) {
+  unsigned char type, size;
+  if(length < (int)sizeof(unsigned char) * 2)
+    return false;
+  readNumber(pnt, type);
+  readNumber(pnt, size);
+  length -= sizeof(unsigned char) * 2;
+  if((type != MSG_HELLO && type != MSG_HELLO_TILES) || length < size)
+    return false;
+  name.assign((const char*)pnt, size);
+  pnt = pnt + size;
+  length -= size;
+  return validCanvasName(name);
+}
+
+void writeSnapshotReply(CanvasStorage* canvas, TileVersions* versions,
+                        std::vector<unsigned char> &packet) {
+  packet.resize(SYNC_HEADER_SIZE + canvas->getSnapshotSize());
+  unsigned char* pnt = packet.data();
+  writeNumber(pnt, MSG_SNAPSHOT);
+  writeNumber(pnt, versions->getEpoch());
+  writeNumber(pnt, versions->getVersion());
+  canvas->writeSnapshot(pnt);
+}
+
+void writeCanvasInfo(CanvasStorage* canvas, TileVersions* versions,
+                     std::vector<unsigned char> &packet) {
+  CanvasStorage empty(0, 0, canvas->getFormat());
+  empty.setPalette(canvas->getPalette());
+  packet.resize(SYNC_HEADER_SIZE + sizeof(short) * 2 + empty.getSnapshotSize());
+  unsigned char* pnt = packet.data();
+  writeNumber(pnt, MSG_CANVAS_INFO);
+  writeNumber(pnt, versions->getEpoch());
+  writeNumber(pnt, versions->getVersion());
+  writeNumber(pnt, (short)canvas->getWidth());
+  writeNumber(pnt, (short)canvas->getHeight());
+  empty.writeSnapshot(pnt);
+}
+
+bool writeTiles(CanvasStorage* canvas, TileVersions* versions,
+                unsigned char* request, int length, std::vector<unsigned char> &packet) {
+  unsigned char* pnt = request;
+  unsigned char* end = request + length;
+  unsigned char type;
+  unsigned short count;
+  if(length < (int)(sizeof(unsigned char) + sizeof(unsigned short)))
+    return false;
+  readNumber(pnt, type);
+  readNumber(pnt, count);
+  if(type != MSG_TILE_REQUEST || count > MAX_TILE_REQUEST ||
+     end - pnt < count * (int)(sizeof(int) + sizeof(unsigned int)))
+    return false;
+  
+  int tileSize = sizeof(int) + sizeof(unsigned int) + sizeof(unsigned char);
+  packet.resize(sizeof(unsigned char) + sizeof(unsigned int) + sizeof(unsigned short) +
+                count * (tileSize + canvas->getRegionSize(TILE_SIZE, TILE_SIZE)));
+  unsigned char* out = packet.data();
+  writeNumber(out, MSG_TILES);
+  writeNumber(out, versions->getEpoch());
+  writeNumber(out, count);
+  for(int i = 0; i < count; ++i) {
+    int tile;
+    unsigned int known;
+    readNumber(pnt, tile);
+    readNumber(pnt, known);
+    if(tile < 0 || tile >= versions->getTileCount())
+      return false;
+    
+    unsigned int version = versions->getTileVersion(tile);
+    bool send = known == 0 || known != version;
+    writeNumber(out, tile);
+    writeNumber(out, version);
+    writeNumber(out, (unsigned char)send);
+    if(send) {
+      int x, y, w, h;
+      versions->getTileRect(tile, canvas->getWidth(), canvas->getHeight(), x, y, w, h);
+      canvas->writeRegion(x, y, w, h, out);
+    }
+  }
+  packet.resize(out - packet.data());
+  return true;
+}
+
+// Returns true if the hello has the tile counts of the canvas, they come
+// from the client and are checked before reading its tiles
+static bool sameTileCounts(TileVersions* versions, unsigned char* hello, int length) {
+  unsigned int epoch, version;
+  short tilesX, tilesY;
+  if(length < (int)(sizeof(unsigned int) * 2 + sizeof(short) * 2))
+    return false;
+  readNumber(hello, epoch);
+  readNumber(hello, version);
+  readNumber(hello, tilesX);
+  readNumber(hello, tilesY);
+  return tilesX == versions->getTilesX() && tilesY == versions->getTilesY();
+}
+
+void writeSyncReply(CanvasStorage* canvas, TileVersions* versions,
+                    EditJournal &journal, unsigned char* hello, int length,
+                    std::vector<unsigned char> &packet) {
+  TileVersions* known = NULL;
+  if(sameTileCounts(versions, hello, length))
+    known = TileVersions::read(hello, length);
+  
+  if(known == NULL || known->getEpoch() != versions->getEpoch() ||
+     known->getTilesX() != versions->getTilesX() ||
+     known->getTilesY() != versions->getTilesY() ||
+     known->getVersion() > versions->getVersion()) {
+    delete known;
+    writeSnapshotReply(canvas, versions, packet);
+    return;
+  }
+  
+  int tileCount = versions->getTileCount();
+  int width = canvas->getWidth(), height = canvas->getHeight();
+  
+  // Pixels the journal lists for the changed tiles, as line * width + column
+  // and the tiles changed by commands since the version of the client
+  std::vector<int> pixels;
+  std::vector<bool> commanded(tileCount, false);
+  for(int i = 0; i < journal.size(); ++i) {
+    const JournalEntry &entry = journal.get(i);
+    int tile = versions->getTile(entry.x, entry.y);
+    unsigned int since = known->getTileVersion(tile);
+    if(entry.version <= since || !journal.covers(since))
+      continue;
+    if(entry.wholeTile)
+      commanded[tile] = true;
+    else
+      pixels.push_back(entry.y * width + entry.x);
+  }
+  std::sort(pixels.begin(), pixels.end());
+  pixels.erase(std::unique(pixels.begin(), pixels.end()), pixels.end());
+  
+  std::vector<int> journaled(tileCount, 0);
+  for(unsigned int i = 0; i < pixels.size(); ++i)
+    ++journaled[versions->getTile(pixels[i] % width, pixels[i] / width)];
+  
+  // Choose how every changed tile is sent
+  int pixelSize = sizeof(short) * 2 + canvas->getValueSize();
+  int size = SYNC_HEADER_SIZE + sizeof(int) * 2;
+  std::vector<bool> whole(tileCount, false);
+  for(int tile = 0; tile < tileCount; ++tile) {
+    unsigned int since = known->getTileVersion(tile);
+    if(versions->getTileVersion(tile) <= since)
+      continue;
+    
+    int x, y, w, h;
+    versions->getTileRect(tile, width, height, x, y, w, h);
+    int tileSize = sizeof(int) + canvas->getRegionSize(w, h);
+    // Stale tiles hold edits of the client the server may not have seen
+    if(known->isStale(tile) || commanded[tile] || !journal.covers(since) ||
+       tileSize < journaled[tile] * pixelSize) {
+      whole[tile] = true;
+      size += tileSize;
+    } else
+      size += journaled[tile] * pixelSize;
+  }
+  delete known;
+  
+  if(size >= SYNC_HEADER_SIZE + canvas->getSnapshotSize()) {
+    writeSnapshotReply(canvas, versions, packet);
+    return;
+  }
+  
+  packet.resize(size);
+  unsigned char* pnt = packet.data();
+  writeNumber(pnt, MSG_SYNC);
+  writeNumber(pnt, versions->getEpoch());
+  writeNumber(pnt, versions->getVersion());
+  
+  writeNumber(pnt, (int)std::count(whole.begin(), whole.end(), true));
+  for(int tile = 0; tile < tileCount; ++tile)
+    if(whole[tile]) {
+      int x, y, w, h;
+      versions->getTileRect(tile, width, height, x, y, w, h);
+      writeNumber(pnt, tile);
+      canvas->writeRegion(x, y, w, h, pnt);
+    }
+  
+  unsigned char* countPnt = pnt;
+  int pixelCount = 0;
+  writeNumber(pnt, pixelCount);
+  for(unsigned int i = 0; i < pixels.size(); ++i) {
+    short x = pixels[i] % width, y = pixels[i] / width;
+    if(whole[versions->getTile(x, y)])
+      continue;
+    writeNumber(pnt, y);
+    writeNumber(pnt, x);
+    canvas->writeValue(x, y, pnt);
+    ++pixelCount;
+  }
+  writeNumber(countPnt, pixelCount);
+}
+
+static void journalRegion(EditJournal &journal, int x, int y, int w, int h,
+                          unsigned int version) {
+  for(int ty = y / TILE_SIZE; ty <= (y + h - 1) / TILE_SIZE; ++ty)
+    for(int tx = x / TILE_SIZE; tx <= (x + w - 1) / TILE_SIZE; ++tx)
+      journal.record(version, tx * TILE_SIZE, ty * TILE_SIZE, true);
+}
+
+unsigned int recordRegion(TileVersions* versions, EditJournal &journal,
+                          int x, int y, int w, int h) {
+  unsigned int version = versions->touchRect(x, y, w, h);
+  journalRegion(journal, x, y, w, h, version);
+  return version;
+}
+
+void mirrorRegion(TileVersions* versions, EditJournal &journal,
+                  int x, int y, int w, int h, unsigned int version) {
+  versions->receiveRect(x, y, w, h, version);
+  journalRegion(journal, x, y, w, h, version);
+}
+
+static bool readSync(unsigned char* pnt, unsigned char* end, CanvasStorage* canvas,
+                     TileVersions* versions) {
+  int width = canvas->getWidth(), height = canvas->getHeight();
+  int count;
+  
+  if(end - pnt < (int)sizeof(int))
+    return false;
+  readNumber(pnt, count);
+  for(int i = 0; i < count; ++i) {
+    int tile, x, y, w, h;
+    if(end - pnt < (int)sizeof(int))
+      return false;
+    readNumber(pnt, tile);
+    if(tile < 0 || tile >= versions->getTileCount())
+      return false;
+    versions->getTileRect(tile, width, height, x, y, w, h);
+    if(end - pnt < canvas->getRegionSize(w, h))
+      return false;
+    canvas->readRegion(x, y, w, h, pnt);
+  }
+  
+  if(end - pnt < (int)sizeof(int))
+    return false;
+  readNumber(pnt, count);
+  int pixelSize = sizeof(short) * 2 + canvas->getValueSize();
+  for(int i = 0; i < count; ++i) {
+    short x, y;
+    if(end - pnt < pixelSize)
+      return false;
+    readNumber(pnt, y);
+    readNumber(pnt, x);
+    if(!canvas->inside(x, y))
+      return false;
+    canvas->readValue(x, y, pnt);
+  }
+  return true;
+}
+
+bool readSyncReply(unsigned char* pnt, int length, CanvasStorage* &canvas,
+                   TileVersions* &versions) {
+  unsigned char* end = pnt + length;
+  unsigned char type;
+  unsigned int epoch, version;
+  if(length < SYNC_HEADER_SIZE)
+    return false;
+  readNumber(pnt, type);
+  readNumber(pnt, epoch);
+  readNumber(pnt, version);
+  
+  if(type == MSG_SNAPSHOT) {
+    CanvasStorage* snapshot = CanvasStorage::readSnapshot(pnt, end - pnt);
+    if(snapshot == NULL)
+      return false;
+    delete canvas;
+    delete versions;
+    canvas = snapshot;
+    versions = new TileVersions(canvas->getWidth(), canvas->getHeight(), epoch);
+  } else if(type == MSG_SYNC) {
+    if(canvas == NULL || versions == NULL || versions->getEpoch() != epoch ||
+       !readSync(pnt, end, canvas, versions))
+      return false;
+  } else
+    return false;
+  
+  versions->reset(epoch, version);
+  return true;
+}
+
+bool saveCanvas(const char* filename, CanvasStorage* canvas, TileVersions* versions) {
+  FILE *fout = fopen(filename, "wb");
+  if(fout == NULL)
+    return false;
+  
+  std::vector<unsigned char> buffer(versions->getSize() + canvas->getSnapshotSize());
+  unsigned char* pnt = buffer.data();
+  versions->write(pnt);
+  canvas->writeSnapshot(pnt);
+  
+  fwrite(SYNC_SAVE_MAGIC, sizeof(char), 4, fout);
+  fwrite(buffer.data(), sizeof(unsigned char), buffer.size(), fout);
+  fclose(fout);
+  return true;
+}
+
+CanvasStorage* loadCanvas(const char* filename, TileVersions* &versions) {
+  FILE *fin = fopen(filename, "rb");
+  if(fin == NULL)
+    return NULL;
+  
+  char magic[4];
+  bool synced = fread(magic, sizeof(char), 4, fin) == 4 &&
+                memcmp(magic, SYNC_SAVE_MAGIC, 4) == 0;
+  
+  if(!synced) {
+    fclose(fin);
+    CanvasStorage* canvas = CanvasStorage::load(filename);
+    if(canvas != NULL)
+      versions = new TileVersions(canvas->getWidth(), canvas->getHeight(),
+                                  TileVersions::newEpoch());
+    return canvas;
+  }
+  
+  std::vector<unsigned char> buffer;
+  unsigned char chunk[4096];
+  size_t count;
+  while((count = fread(chunk, sizeof(unsigned char), sizeof(chunk), fin)) > 0)
+    buffer.insert(buffer.end(), chunk, chunk + count);
+  fclose(fin);
+  
+  unsigned char* pnt = buffer.data();
+  unsigned char* end = pnt + buffer.size();
+  TileVersions* loaded = TileVersions::read(pnt, end - pnt);
+  if(loaded == NULL)
+    return NULL;
+  CanvasStorage* canvas = CanvasStorage::readSnapshot(pnt, end - pnt);
+  if(canvas == NULL || TileVersions(canvas->getWidth(), canvas->getHeight(), 0)
+                       .getTileCount() != loaded->getTileCount()) {
+    delete canvas;
+    delete loaded;
+    return NULL;
+  }
+  versions = loaded;
+  return canvas;
+}
@@ -0,0 +1,89 @@
+#ifndef __CANVASSYNC_H
+#define __CANVASSYNC_H
+
+#include <vector>
+#include <string>
+#include "canvas/canvasstorage.h"
+#include "canvas/tileversions.h"
+#include "canvas/journal.h"
+
+// Bring the canvas cached by a client up to date with the server when it
+// connects, sending only what changed while it was away
+
+// Longest name of a canvas
+const int MAX_CANVAS_NAME = 32;
+
+// Canvas joined by the clients that don't name one
+const char* const DEFAULT_CANVAS = "default";
+
+// Returns true if name can name a canvas: 1 to MAX_CANVAS_NAME letters,
+// digits, '-' or '_', so it can be part of a file name
+bool validCanvasName(const std::string &name);
+
+// The MSG_HELLO packet of a client joining the canvas with the given name,
+// with its cached versions or NULL if it has no cache
+void writeHello(const std::string &name, TileVersions* versions,
+                std::vector<unsigned char> &packet);
+
+// Largest number of tiles asked for by one MSG_TILE_REQUEST
+const int MAX_TILE_REQUEST = 256;
+
+// The MSG_HELLO_TILES packet of a client joining the canvas with the given
+// name that keeps only the tiles it asks for
+void writeHelloTiles(const std::string &name, std::vector<unsigned char> &packet);
+
+// Read the name of the canvas from a MSG_HELLO or a MSG_HELLO_TILES of
+// length bytes, pnt and length are moved to what follows it
+// Returns false if the packet is cut or the name isn't valid
+bool readHelloName(unsigned char* &pnt, int &length, std::string &name);
+
+// MSG_SNAPSHOT packet with the whole canvas and its versions
+void writeSnapshotReply(CanvasStorage* canvas, TileVersions* versions,
+                        std::vector<unsigned char> &packet);
+
+// MSG_CANVAS_INFO packet with the size, format and palette of the canvas
+void writeCanvasInfo(CanvasStorage* canvas, TileVersions* versions,
+                     std::vector<unsigned char> &packet);
+
+// MSG_TILES reply to the MSG_TILE_REQUEST of length bytes, with the lines
+// of the tiles the client doesn't have the version of
+// Returns false if the request isn't valid
+bool writeTiles(CanvasStorage* canvas, TileVersions* versions,
+                unsigned char* request, int length, std::vector<unsigned char> &packet);
+
+// Reply of the server to the versions of length bytes in hello, the part
+// of a MSG_HELLO after the name
+// Every tile that changed since the version the client has is sent either
+// whole or as the pixels the journal lists for it, whichever is smaller
+// A MSG_SNAPSHOT is sent instead if the client's canvas is of another epoch
+// or if it is smaller than all the tiles
+void writeSyncReply(CanvasStorage* canvas, TileVersions* versions,
+                    EditJournal &journal, unsigned char* hello, int length,
+                    std::vector<unsigned char> &packet);
+
+// Count a command that changed the rectangle of w x h pixels at (x, y) of
+// the server canvas, its tiles are sent whole to the clients behind it
+// Returns the version of the edit
+unsigned int recordRegion(TileVersions* versions, EditJournal &journal,
+                          int x, int y, int w, int h);
+
+// Same for a command of the given version applied to a copy of the canvas
+// of another server, so the copy can sync clients of its own
+void mirrorRegion(TileVersions* versions, EditJournal &journal,
+                  int x, int y, int w, int h, unsigned int version);
+
+// Apply a MSG_SNAPSHOT or MSG_SYNC packet to the client's canvas
+// A snapshot replaces canvas and versions (which can be NULL before)
+// Returns false if the packet isn't a valid reply for them
+bool readSyncReply(unsigned char* pnt, int length, CanvasStorage* &canvas,
+                   TileVersions* &versions);
+
+// Save the canvas with its versions to a file
+bool saveCanvas(const char* filename, CanvasStorage* canvas, TileVersions* versions);
+
+// Load a canvas saved with saveCanvas()
+// Files saved without versions by CanvasStorage::save are loaded as a new
+// epoch. Returns NULL if the file can't be read
+CanvasStorage* loadCanvas(const char* filename, TileVersions* &versions);
+
+#endif
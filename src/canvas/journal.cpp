@@ -0,0 +1,34 @@
+#include "canvas/journal.h"
+
+EditJournal::EditJournal(unsigned int version) {
+  entries.resize(JOURNAL_SIZE);
+  reset(version);
+}
+
+void EditJournal::reset(unsigned int version) {
+  first = 0;
+  count = 0;
+  dropped = version;
+}
+
+void EditJournal::record(unsigned int version, short x, short y, bool wholeTile) {
+  if(count == JOURNAL_SIZE) {
+    dropped = entries[first].version;
+    first = (first + 1) % JOURNAL_SIZE;
+    --count;
+  }
+  entries[(first + count) % JOURNAL_SIZE] = {version, x, y, wholeTile};
+  ++count;
+}
+
+bool EditJournal::covers(unsigned int version) {
+  return version >= dropped;
+}
+
+int EditJournal::size() {
+  return count;
+}
+
+const JournalEntry& EditJournal::get(int i) {
+  return entries[(first + i) % JOURNAL_SIZE];
+}
@@ -0,0 +1,45 @@
+#ifndef __JOURNAL_H
+#define __JOURNAL_H
+
+#include <vector>
+
+// Number of edits remembered by the journal
+const int JOURNAL_SIZE = 1 << 16;
+
+// An edit of the pixel (x, y) of the canvas, or of the tile holding it
+// for the commands that change many pixels
+struct JournalEntry {
+  unsigned int version;
+  short x, y;
+  bool wholeTile;
+};
+
+// The last edits of the server canvas, oldest first, used to send only
+// the changed pixels to a client that was a few edits behind
+class EditJournal {
+private:
+  // Ring of entries, count of them starting with first
+  std::vector<JournalEntry> entries;
+  int first, count;
+  
+  // Newest version that isn't in the journal anymore
+  unsigned int dropped;
+public:
+  // Empty journal of a canvas whose last edit has the given version
+  EditJournal(unsigned int version = 0);
+  
+  // Forget every edit, the last one has the given version
+  void reset(unsigned int version);
+  
+  void record(unsigned int version, short x, short y, bool wholeTile = false);
+  
+  // Returns true if every edit newer than version is in the journal
+  bool covers(unsigned int version);
+  
+  int size();
+  
+  // The i-th edit kept, from the oldest
+  const JournalEntry& get(int i);
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include "canvas/messagebatch.h"
+#include "canvas/protocol.h"
+
+MessageBatch::MessageBatch() {
+  clear();
+}
+
+bool MessageBatch::add(const unsigned char* message, int length) {
+  if(length < 0 || length > MAX_BATCHED_MESSAGE)
+    return false;
+  
+  unsigned short size = length;
+  const unsigned char* sizeBytes = static_cast<const unsigned char*>(
+                                   static_cast<const void*>(&size));
+  data.insert(data.end(), sizeBytes, sizeBytes + sizeof(unsigned short));
+  data.insert(data.end(), message, message + length);
+  ++count;
+  return true;
+}
+
+int MessageBatch::getCount() {
+  return count;
+}
+
+int MessageBatch::getSize() {
+  return data.size();
+}
+
+const unsigned char* MessageBatch::getData() {
+  return data.data();
+}
+
+void MessageBatch::clear() {
+  data.assign(1, MSG_BATCH);
+  count = 0;
+}
+
+bool MessageBatch::next(unsigned char* &pnt, unsigned char* end,
+                        unsigned char* &message, int &length) {
+  unsigned short size;
+  if(end - pnt < (int)sizeof(unsigned short))
+    return false;
+  readNumber(pnt, size);
+  if(end - pnt < size)
+    return false;
+  message = pnt;
+  length = size;
+  pnt = pnt + size;
+  return true;
+}
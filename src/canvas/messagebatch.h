@@ -0,0 +1,42 @@
+#ifndef __MESSAGEBATCH_H
+#define __MESSAGEBATCH_H
+
+#include <vector>
+
+// Size after which a batch should be sent without waiting for more
+const int MAX_BATCH_SIZE = 16 * 1024;
+
+// Largest message a batch can hold, its length is kept in an unsigned short
+const int MAX_BATCHED_MESSAGE = 0xffff;
+
+// Messages sent together in one MSG_BATCH packet, so every peer gets one
+// packet for many edits instead of one packet per edit
+class MessageBatch {
+private:
+  // The packet: MSG_BATCH, then every message as unsigned short length
+  // followed by its bytes
+  std::vector<unsigned char> data;
+  int count;
+public:
+  MessageBatch();
+  
+  // Returns false, without adding it, if the message is longer than
+  // MAX_BATCHED_MESSAGE. It must be sent by itself
+  bool add(const unsigned char* message, int length);
+  
+  // Number of messages in the batch
+  int getCount();
+  
+  // Size in bytes of the packet
+  int getSize();
+  const unsigned char* getData();
+  
+  void clear();
+  
+  // Find the next message of a MSG_BATCH packet, pnt starts after the type
+  // Returns false at the end of the packet or if it is cut
+  static bool next(unsigned char* &pnt, unsigned char* end,
+                   unsigned char* &message, int &length);
+};
+
+#endif
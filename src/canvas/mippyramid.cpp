@@ -0,0 +1,153 @@
+#include "canvas/mippyramid.h"
+#include <algorithm>
+
+MipPyramid::MipPyramid(int width, int height, int _levels) {
+  levels = _levels;
+  for(int level = 1; level <= levels; ++level) {
+    width = (width + 1) / 2;
+    height = (height + 1) / 2;
+    widths.push_back(width);
+    heights.push_back(height);
+    pixels.push_back(std::vector<Pixel>(width * height, Pixel{0, 0, 0}));
+    dirtyTiles.push_back(std::vector<int>());
+    dirtyFlags.push_back(std::vector<unsigned char>());
+    dirtyFlags.back().assign(getTilesX(level) * getTilesY(level), 0);
+    tileUpdates.push_back(std::vector<unsigned int>(getTilesX(level) * getTilesY(level), 0));
+  }
+  updates = 0;
+
+  if(levels > 0)
+    for(int tile = 0; tile < getTilesX(1) * getTilesY(1); ++tile)
+      markTile(1, tile);
+}
+
+int MipPyramid::getTilesX(int level) {
+  return (widths[level - 1] + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+int MipPyramid::getTilesY(int level) {
+  return (heights[level - 1] + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+void MipPyramid::markTile(int level, int tile) {
+  if(dirtyFlags[level - 1][tile])
+    return;
+  dirtyFlags[level - 1][tile] = 1;
+  dirtyTiles[level - 1].push_back(tile);
+}
+
+int MipPyramid::getLevels() {
+  return levels;
+}
+
+int MipPyramid::getWidth(int level) {
+  return widths[level - 1];
+}
+
+int MipPyramid::getHeight(int level) {
+  return heights[level - 1];
+}
+
+void MipPyramid::getTileRect(int level, int tile, int &x, int &y, int &w, int &h) {
+  x = tile % getTilesX(level) * TILE_SIZE;
+  y = tile / getTilesX(level) * TILE_SIZE;
+  w = std::min(TILE_SIZE, widths[level - 1] - x);
+  h = std::min(TILE_SIZE, heights[level - 1] - y);
+}
+
+const Pixel* MipPyramid::getLevel(int level) {
+  return pixels[level - 1].data();
+}
+
+void MipPyramid::markDirty(int x, int y, int w, int h) {
+  if(levels == 0 || w <= 0 || h <= 0)
+    return;
+
+  // A tile of level 1 covers twice its size of the canvas
+  int size = TILE_SIZE * 2;
+  int tilesX = getTilesX(1), tilesY = getTilesY(1);
+  int x1 = std::min((x + w - 1) / size, tilesX - 1);
+  int y1 = std::min((y + h - 1) / size, tilesY - 1);
+  for(int ty = std::max(y, 0) / size; ty <= y1; ++ty)
+    for(int tx = std::max(x, 0) / size; tx <= x1; ++tx)
+      markTile(1, ty * tilesX + tx);
+}
+
+bool MipPyramid::isDirty() {
+  for(int level = 1; level <= levels; ++level)
+    if(!dirtyTiles[level - 1].empty())
+      return true;
+  return false;
+}
+
+unsigned int MipPyramid::getUpdate() {
+  return updates;
+}
+
+unsigned int MipPyramid::getTileUpdate(int level, int tile) {
+  return tileUpdates[level - 1][tile];
+}
+
+void MipPyramid::reduceTile(CanvasStorage* canvas, int level, int tile) {
+  int tilesX = getTilesX(level);
+  int x0 = tile % tilesX * TILE_SIZE, y0 = tile / tilesX * TILE_SIZE;
+  int x1 = std::min(x0 + TILE_SIZE, widths[level - 1]);
+  int y1 = std::min(y0 + TILE_SIZE, heights[level - 1]);
+
+  int sourceWidth = level == 1 ? canvas->getWidth() : widths[level - 2];
+  int sourceHeight = level == 1 ? canvas->getHeight() : heights[level - 2];
+  const Pixel* source = level == 1 ? NULL : pixels[level - 2].data();
+  Pixel* out = pixels[level - 1].data();
+
+  for(int y = y0; y < y1; ++y)
+    for(int x = x0; x < x1; ++x) {
+      int r = 0, g = 0, b = 0, count = 0;
+      for(int sy = y * 2; sy < std::min(y * 2 + 2, sourceHeight); ++sy)
+        for(int sx = x * 2; sx < std::min(x * 2 + 2, sourceWidth); ++sx) {
+          Pixel p = source == NULL ? canvas->getPixel(sx, sy)
+                                   : source[sy * sourceWidth + sx];
+          r += p.r;
+          g += p.g;
+          b += p.b;
+          ++count;
+        }
+      out[y * widths[level - 1] + x] = {(unsigned char)((r + count / 2) / count),
+                                        (unsigned char)((g + count / 2) / count),
+                                        (unsigned char)((b + count / 2) / count)};
+    }
+}
+
+int MipPyramid::update(CanvasStorage* canvas, ThreadPool* pool) {
+  if(!isDirty())
+    return 0;
+  ++updates;
+
+  int updated = 0;
+  for(int level = 1; level <= levels; ++level) {
+    std::vector<int> &tiles = dirtyTiles[level - 1];
+    if(tiles.empty())
+      continue;
+
+    // Tiles of one level don't share pixels, they can be computed together
+    if(pool != NULL && tiles.size() > 1)
+      pool->run(tiles.size(), [&](int i) {
+        reduceTile(canvas, level, tiles[i]);
+      });
+    else
+      for(unsigned int i = 0; i < tiles.size(); ++i)
+        reduceTile(canvas, level, tiles[i]);
+
+    // The tile of the next level over 2 x 2 of these has to follow
+    int tilesX = getTilesX(level);
+    for(unsigned int i = 0; i < tiles.size(); ++i) {
+      dirtyFlags[level - 1][tiles[i]] = 0;
+      tileUpdates[level - 1][tiles[i]] = updates;
+      if(level < levels)
+        markTile(level + 1, tiles[i] / tilesX / 2 * getTilesX(level + 1) +
+                            tiles[i] % tilesX / 2);
+    }
+    updated += tiles.size();
+    tiles.clear();
+  }
+  return updated;
+}
@@ -0,0 +1,69 @@
+#ifndef __MIPPYRAMID_H
+#define __MIPPYRAMID_H
+
+#include <vector>
+#include "canvas/canvasstorage.h"
+#include "canvas/tileversions.h"
+#include "baseclasses/threadpool.h"
+
+// Smaller copies of a canvas, each half the size of the one before
+// Level 1 is half the canvas, every pixel the average of the 2 x 2 pixels
+// under it (fewer on the last line and column of an odd size)
+// Levels are split in tiles of TILE_SIZE x TILE_SIZE of their own pixels,
+// only the tiles under the edits of the canvas are computed again
+class MipPyramid {
+private:
+  int levels;
+
+  // Size of every level, level 1 first
+  std::vector<int> widths, heights;
+  std::vector<std::vector<Pixel> > pixels;
+
+  // Tiles of every level to compute again, listed once with a flag
+  std::vector<std::vector<int> > dirtyTiles;
+  std::vector<std::vector<unsigned char> > dirtyFlags;
+
+  // Number of the update() that last computed every tile, and of the
+  // updates that computed tiles
+  std::vector<std::vector<unsigned int> > tileUpdates;
+  unsigned int updates;
+
+  void markTile(int level, int tile);
+
+  // Compute the pixels of one tile from the level below it
+  void reduceTile(CanvasStorage* canvas, int level, int tile);
+public:
+  // Pyramid of _levels levels for a canvas of width x height pixels, with
+  // every tile waiting to be computed
+  MipPyramid(int width, int height, int _levels);
+
+  int getLevels();
+  int getWidth(int level);
+  int getHeight(int level);
+  int getTilesX(int level);
+  int getTilesY(int level);
+
+  // Rectangle of the tile in the pixels of its level
+  void getTileRect(int level, int tile, int &x, int &y, int &w, int &h);
+
+  // Pixels of a level, line after line
+  const Pixel* getLevel(int level);
+
+  // The rectangle of w x h pixels at (x, y) of the canvas changed
+  void markDirty(int x, int y, int w, int h);
+
+  // Returns true if some tile waits to be computed
+  bool isDirty();
+
+  // Number of the calls to update() that computed tiles, and of the last
+  // one that computed the tile, 0 before it was computed
+  unsigned int getUpdate();
+  unsigned int getTileUpdate(int level, int tile);
+
+  // Compute the dirty tiles from the canvas, level by level
+  // The tiles of a level are split between the threads of the pool if
+  // there is one. Returns the number of tiles computed
+  int update(CanvasStorage* canvas, ThreadPool* pool = NULL);
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include "canvas/mipstream.h"
+#include <algorithm>
+
+int getMipLevels(int width, int height, int most) {
+  int levels = 0;
+  while(levels < most && (width >> (levels + 1)) > 0 && (height >> (levels + 1)) > 0)
+    ++levels;
+  return levels;
+}
+
+int getMipSize(int size, int level) {
+  for(int i = 0; i < level; ++i)
+    size = (size + 1) / 2;
+  return size;
+}
+
+int LevelSubscription::getSize() {
+  return sizeof(unsigned char) * 2 + sizeof(short) * 4;
+}
+
+void LevelSubscription::write(unsigned char* &pnt) {
+  writeNumber(pnt, MSG_SUBSCRIBE);
+  writeNumber(pnt, level);
+  writeNumber(pnt, line);
+  writeNumber(pnt, column);
+  writeNumber(pnt, lines);
+  writeNumber(pnt, columns);
+}
+
+bool LevelSubscription::read(unsigned char* &pnt, int length) {
+  unsigned char type;
+  if(length < getSize())
+    return false;
+  readNumber(pnt, type);
+  if(type != MSG_SUBSCRIBE)
+    return false;
+  readNumber(pnt, level);
+  readNumber(pnt, line);
+  readNumber(pnt, column);
+  readNumber(pnt, lines);
+  readNumber(pnt, columns);
+  return true;
+}
+
+bool LevelSubscription::getTiles(int tilesX, int tilesY, int &x0, int &y0, int &x1, int &y1) {
+  if(lines <= 0 || columns <= 0 || column + columns <= 0 || line + lines <= 0)
+    return false;
+  // A pixel of the level covers 2^level pixels of the canvas on each side
+  x0 = (std::max((int)column, 0) >> level) / TILE_SIZE;
+  y0 = (std::max((int)line, 0) >> level) / TILE_SIZE;
+  x1 = std::min(((column + columns - 1) >> level) / TILE_SIZE, tilesX - 1);
+  y1 = std::min(((line + lines - 1) >> level) / TILE_SIZE, tilesY - 1);
+  return x0 <= x1 && y0 <= y1;
+}
+
+int writeMipTiles(MipPyramid* pyramid, LevelSubscription &view, unsigned int since,
+                  LevelSubscription* known, std::vector<unsigned char> &packet) {
+  packet.clear();
+  int level = view.level;
+  int tilesX = pyramid->getTilesX(level), tilesY = pyramid->getTilesY(level);
+  int x0, y0, x1, y1;
+  if(!view.getTiles(tilesX, tilesY, x0, y0, x1, y1))
+    return 0;
+  int knownX0 = 0, knownY0 = 0, knownX1 = -1, knownY1 = -1;
+  if(known != NULL && known->level == level)
+    known->getTiles(tilesX, tilesY, knownX0, knownY0, knownX1, knownY1);
+
+  std::vector<int> changed;
+  int size = 0;
+  for(int ty = y0; ty <= y1; ++ty)
+    for(int tx = x0; tx <= x1; ++tx) {
+      int tile = ty * tilesX + tx;
+      bool held = knownX0 <= tx && tx <= knownX1 && knownY0 <= ty && ty <= knownY1;
+      if(held && pyramid->getTileUpdate(level, tile) <= since)
+        continue;
+      int x, y, w, h;
+      pyramid->getTileRect(level, tile, x, y, w, h);
+      changed.push_back(tile);
+      size += sizeof(int) + w * h * 3;
+    }
+  if(changed.empty())
+    return 0;
+
+  packet.resize(sizeof(unsigned char) * 2 + sizeof(unsigned short) + size);
+  unsigned char* pnt = packet.data();
+  writeNumber(pnt, MSG_MIP_TILES);
+  writeNumber(pnt, (unsigned char)level);
+  writeNumber(pnt, (unsigned short)changed.size());
+  const Pixel* pixels = pyramid->getLevel(level);
+  int width = pyramid->getWidth(level);
+  for(unsigned int i = 0; i < changed.size(); ++i) {
+    int x, y, w, h;
+    pyramid->getTileRect(level, changed[i], x, y, w, h);
+    writeNumber(pnt, changed[i]);
+    for(int line = y; line < y + h; ++line)
+      for(int column = x; column < x + w; ++column) {
+        Pixel p = pixels[line * width + column];
+        writeNumber(pnt, p.r);
+        writeNumber(pnt, p.g);
+        writeNumber(pnt, p.b);
+      }
+  }
+  return changed.size();
+}
+
+MipView::MipView() {
+  setLevel(0, 0, 0);
+}
+
+void MipView::setLevel(int _level, int _width, int _height) {
+  width = _width;
+  height = _height;
+  level = _level;
+  levelWidth = getMipSize(width, level);
+  levelHeight = getMipSize(height, level);
+  tilesX = (levelWidth + TILE_SIZE - 1) / TILE_SIZE;
+  tilesY = (levelHeight + TILE_SIZE - 1) / TILE_SIZE;
+  tiles.clear();
+}
+
+int MipView::getLevel() {
+  return level;
+}
+
+int MipView::getWidth() {
+  return levelWidth;
+}
+
+int MipView::getHeight() {
+  return levelHeight;
+}
+
+void MipView::keep(LevelSubscription &view) {
+  int x0, y0, x1, y1;
+  if(!view.getTiles(tilesX, tilesY, x0, y0, x1, y1)) {
+    tiles.clear();
+    return;
+  }
+
+  std::map<int, std::vector<Pixel> >::iterator it = tiles.begin();
+  while(it != tiles.end()) {
+    int tx = it->first % tilesX, ty = it->first / tilesX;
+    if(tx < x0 || tx > x1 || ty < y0 || ty > y1)
+      it = tiles.erase(it);
+    else
+      ++it;
+  }
+}
+
+bool MipView::receive(unsigned char* pnt, int length) {
+  unsigned char* end = pnt + length;
+  unsigned char type, tilesLevel;
+  unsigned short count;
+  if(length < (int)(sizeof(unsigned char) * 2 + sizeof(unsigned short)))
+    return false;
+  readNumber(pnt, type);
+  readNumber(pnt, tilesLevel);
+  readNumber(pnt, count);
+  if(type != MSG_MIP_TILES)
+    return false;
+  if(tilesLevel != level || level == 0)
+    return true;
+
+  for(int i = 0; i < count; ++i) {
+    int tile;
+    if(end - pnt < (int)sizeof(int))
+      return false;
+    readNumber(pnt, tile);
+    if(tile < 0 || tile >= tilesX * tilesY)
+      return false;
+
+    int w = std::min(TILE_SIZE, levelWidth - tile % tilesX * TILE_SIZE);
+    int h = std::min(TILE_SIZE, levelHeight - tile / tilesX * TILE_SIZE);
+    if(end - pnt < w * h * 3)
+      return false;
+    std::vector<Pixel> &pixels = tiles[tile];
+    pixels.resize(w * h);
+    for(int j = 0; j < w * h; ++j) {
+      readNumber(pnt, pixels[j].r);
+      readNumber(pnt, pixels[j].g);
+      readNumber(pnt, pixels[j].b);
+    }
+  }
+  return true;
+}
+
+bool MipView::getPixel(int x, int y, Pixel &p) {
+  int tile = y / TILE_SIZE * tilesX + x / TILE_SIZE;
+  std::map<int, std::vector<Pixel> >::iterator it = tiles.find(tile);
+  if(it == tiles.end())
+    return false;
+  int w = std::min(TILE_SIZE, levelWidth - tile % tilesX * TILE_SIZE);
+  p = it->second[y % TILE_SIZE * w + x % TILE_SIZE];
+  return true;
+}
@@ -0,0 +1,90 @@
+#ifndef __MIPSTREAM_H
+#define __MIPSTREAM_H
+
+#include <vector>
+#include <map>
+#include "canvas/protocol.h"
+#include "canvas/mippyramid.h"
+
+// Most levels of the pyramid a server keeps for the peers viewing a canvas
+// zoomed out
+const int MAX_MIP_LEVELS = 10;
+
+// Milliseconds between two MSG_MIP_TILES sent to a subscriber
+const unsigned int MIP_UPDATE_MS = 250;
+
+// Most tiles a subscription can view
+const int MAX_MIP_TILES = 1024;
+
+// Levels of the pyramid of a canvas of width x height pixels, at most most,
+// the last one keeps at least a pixel
+int getMipLevels(int width, int height, int most);
+
+// Size of a level of the pyramid of a canvas of the given size
+int getMipSize(int size, int level);
+
+// What a peer views of a canvas
+// Level 0 gets every edit of the pixels, the others get the tiles of that
+// level of the pyramid under the rectangle, given in pixels of the canvas,
+// when they change, at most every MIP_UPDATE_MS
+// Packet: MSG_SUBSCRIBE, unsigned char level, short line, short column,
+// short lines, short columns
+class LevelSubscription {
+public:
+  unsigned char level;
+  short line, column, lines, columns;
+
+  // Size in bytes of the packet, with the type
+  int getSize();
+
+  void write(unsigned char* &pnt);
+
+  // Read a subscription of length bytes, starting with the type
+  // Returns false if the bytes don't hold a whole subscription
+  bool read(unsigned char* &pnt, int length);
+
+  // Tiles of the level under the rectangle, for a level with tilesX x
+  // tilesY tiles. Returns false if there are none
+  bool getTiles(int tilesX, int tilesY, int &x0, int &y0, int &x1, int &y1);
+};
+
+// MSG_MIP_TILES with the tiles of view computed by the pyramid after the
+// update since, and the ones outside known whenever they were computed
+// known is the last view of the peer at the same level, NULL if it has none
+// Returns the number of tiles written, packet is left empty if there are none
+int writeMipTiles(MipPyramid* pyramid, LevelSubscription &view, unsigned int since,
+                  LevelSubscription* known, std::vector<unsigned char> &packet);
+
+// Tiles of one level of the pyramid of a canvas received from the server
+class MipView {
+private:
+  int width, height;
+  int level;
+  int levelWidth, levelHeight, tilesX, tilesY;
+
+  // Pixels of the tiles we have, line by line
+  std::map<int, std::vector<Pixel> > tiles;
+public:
+  MipView();
+
+  // View level of the pyramid of a canvas of _width x _height pixels, the
+  // tiles of the previous level are forgotten. Level 0 views nothing
+  void setLevel(int _level, int _width, int _height);
+
+  int getLevel();
+  int getWidth();
+  int getHeight();
+
+  // Forget the tiles that aren't under the subscription
+  void keep(LevelSubscription &view);
+
+  // Read a MSG_MIP_TILES of length bytes, the tiles of other levels are
+  // ignored. Returns false if it isn't valid
+  bool receive(unsigned char* pnt, int length);
+
+  // Color of the pixel (x, y) of the level
+  // Returns false if we don't have its tile
+  bool getPixel(int x, int y, Pixel &p);
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include "canvas/palette.h"
+
+static inline int colorDistance(Pixel a, Pixel b) {
+  int dr = (int)a.r - b.r, dg = (int)a.g - b.g, db = (int)a.b - b.b;
+  // Weighted to roughly follow how the eye perceives the channels
+  return 3 * dr * dr + 4 * dg * dg + 2 * db * db;
+}
+
+static inline int quantizedKey(Pixel p) {
+  return ((p.r >> 3) << 10) | ((p.g >> 3) << 5) | (p.b >> 3);
+}
+
+Palette::Palette() {
+}
+
+Palette::Palette(const Pixel* _colors, int count) {
+  if(count > MAX_PALETTE_SIZE)
+    count = MAX_PALETTE_SIZE;
+  colors.assign(_colors, _colors + count);
+  buildNearestTable();
+}
+
+void Palette::buildNearestTable() {
+  nearestTable.assign(1 << 15, 0);
+  sharedBucket.assign(1 << 15, false);
+  if(colors.empty())
+    return;
+  
+  for(int key = 0; key < (1 << 15); ++key) {
+    // Center of the quantization bucket
+    Pixel p = {(unsigned char)(((key >> 10) & 31) << 3 | 4),
+               (unsigned char)(((key >> 5) & 31) << 3 | 4),
+               (unsigned char)((key & 31) << 3 | 4)};
+    nearestTable[key] = findNearest(p);
+  }
+  
+  // The entries themselves must map exactly, buckets holding more than one
+  // entry are searched
+  std::vector<bool> used(1 << 15, false);
+  for(int i = (int)colors.size() - 1; i >= 0; --i) {
+    int key = quantizedKey(colors[i]);
+    if(used[key])
+      sharedBucket[key] = true;
+    used[key] = true;
+    nearestTable[key] = i;
+  }
+}
+
+int Palette::size() const {
+  return colors.size();
+}
+
+bool Palette::validIndex(int index) const {
+  return 0 <= index && index < (int)colors.size();
+}
+
+Pixel Palette::getColor(int index) const {
+  return colors[index];
+}
+
+unsigned char Palette::findNearest(Pixel p) const {
+  int best = 0, bestDistance = colorDistance(p, colors[0]);
+  for(unsigned int i = 1; i < colors.size() && bestDistance > 0; ++i) {
+    int distance = colorDistance(p, colors[i]);
+    if(distance < bestDistance) {
+      best = i;
+      bestDistance = distance;
+    }
+  }
+  return best;
+}
+
+unsigned char Palette::nearest(Pixel p) const {
+  int key = quantizedKey(p);
+  if(sharedBucket[key])
+    return findNearest(p);
+  return nearestTable[key];
+}
+
+Palette Palette::getDefault(int bits) {
+  if(bits == 4) {
+    const Pixel colors16[16] = {
+      {0xff, 0xff, 0xff}, {0xe4, 0xe4, 0xe4}, {0x88, 0x88, 0x88},
+      {0x22, 0x22, 0x22}, {0xff, 0xa7, 0xd1}, {0xe5, 0x00, 0x00},
+      {0xe5, 0x95, 0x00}, {0xa0, 0x6a, 0x42}, {0xe5, 0xd9, 0x00},
+      {0x94, 0xe0, 0x44}, {0x02, 0xbe, 0x01}, {0x00, 0xd3, 0xdd},
+      {0x00, 0x83, 0xc7}, {0x00, 0x00, 0xea}, {0xcf, 0x6e, 0xe4},
+      {0x82, 0x00, 0x80}
+    };
+    return Palette(colors16, 16);
+  }
+  
+  // 6x6x6 color cube followed by the grays that are not in the cube
+  Pixel colors256[256];
+  int count = 0;
+  for(int r = 0; r < 6; ++r)
+    for(int g = 0; g < 6; ++g)
+      for(int b = 0; b < 6; ++b)
+        colors256[count++] = {(unsigned char)(r * 51), (unsigned char)(g * 51),
+                              (unsigned char)(b * 51)};
+  for(int i = 0; count < 256; ++i)
+    colors256[count++] = {(unsigned char)(5 + i * 6), (unsigned char)(5 + i * 6),
+                          (unsigned char)(5 + i * 6)};
+  return Palette(colors256, 256);
+}
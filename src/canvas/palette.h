@@ -0,0 +1,52 @@
+#ifndef __PALETTE_H
+#define __PALETTE_H
+
+#include <vector>
+#include "canvas/protocol.h"
+
+// Maximum number of colors of a palette (indices are stored in one byte)
+const int MAX_PALETTE_SIZE = 256;
+
+// Fixed list of colors used by an indexed canvas
+class Palette {
+private:
+  // Colors of the palette
+  std::vector<Pixel> colors;
+  
+  // Nearest palette entry of every color quantized to 5 bits per channel
+  std::vector<unsigned char> nearestTable;
+  
+  // True for the buckets of nearestTable that hold more than one color
+  std::vector<bool> sharedBucket;
+  
+  // Fill nearestTable
+  void buildNearestTable();
+public:
+  // Empty palette
+  Palette();
+  
+  // Palette with the given colors, at most MAX_PALETTE_SIZE
+  Palette(const Pixel* _colors, int count);
+  
+  // Number of colors
+  int size() const;
+  
+  // Returns true if index is a color of the palette
+  bool validIndex(int index) const;
+  
+  // Returns the color with the given index
+  Pixel getColor(int index) const;
+  
+  // Returns the index of the color closest to p by searching every entry
+  unsigned char findNearest(Pixel p) const;
+  
+  // Returns the index of the color closest to p with a table lookup
+  // Colors of the palette are always mapped exactly, other colors are
+  // matched with 5 bits of precision per channel
+  unsigned char nearest(Pixel p) const;
+  
+  // Default palettes: 16 colors for 4 bits and 256 colors for 8 bits
+  static Palette getDefault(int bits);
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef __PROTOCOL_H
+#define __PROTOCOL_H
+
+// Messages exchanged between the client and the server
+// Every packet starts with one MessageType byte followed by the fields
+// listed next to the message
+
+// Port of the server
+const int SERVER_PORT = 9999;
+
+// A pixel with free rgb color
+struct Pixel {
+  unsigned char r, g, b;
+};
+
+inline bool operator== (const Pixel &a, const Pixel &b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+inline bool operator!= (const Pixel &a, const Pixel &b) {
+  return !(a == b);
+}
+
+enum MessageType : unsigned char {
+  // server -> client: unsigned int epoch, unsigned int version,
+  // the entire canvas (see CanvasStorage::writeSnapshot)
+  MSG_SNAPSHOT = 0,
+  // both ways: short line, short column, r, g, b
+  // from the server followed by the unsigned int version of the edit,
+  // from a client by the unsigned int sequence number of the write
+  MSG_PIXEL = 1,
+  // both ways: short line, short column, palette index
+  // followed by the version or the sequence number like MSG_PIXEL
+  MSG_PIXEL_INDEX = 2,
+  // client -> server, first message: unsigned char length and name of the
+  // canvas to join, the tile versions of the copy of it the client has
+  // cached (see TileVersions::write), epoch 0 if there is none
+  MSG_HELLO = 3,
+  // server -> client: unsigned int epoch, unsigned int version,
+  // int tile count, for every tile: int tile and its lines as stored
+  // (see CanvasStorage::writeRegion),
+  // int pixel count, for every pixel: short line, short column and its
+  // value as stored (see CanvasStorage::writeValue)
+  MSG_SYNC = 4,
+  // both ways: a command changing many pixels (see RegionCommand)
+  // followed by the version or the sequence number like MSG_PIXEL
+  MSG_FILL_RECT = 5,
+  MSG_STAMP = 6,
+  MSG_FLOOD_FILL = 7,
+  // server -> client: messages sent together, each as unsigned short
+  // length followed by the message (see MessageBatch)
+  MSG_BATCH = 8,
+  // server -> client: unsigned int sequence number of a write of the
+  // client, unsigned int version of its edit or 0 if it was rejected
+  MSG_ACK = 9,
+  // client -> server: a moderator locking or unlocking a rectangle of the
+  // canvas with the admin key of the server (see MaskChange), followed by
+  // the sequence number like MSG_PIXEL
+  // MSG_ACK answers it with the current version, 0 if it was rejected
+  MSG_LOCK_RECT = 10,
+  // client -> server, first message of the clients that only keep some
+  // tiles: unsigned char length and name of the canvas to join
+  // The server replies with MSG_CANVAS_INFO, the tiles are then asked for
+  // with MSG_TILE_REQUEST
+  MSG_HELLO_TILES = 11,
+  // server -> client: unsigned int epoch, unsigned int version,
+  // short width, short height, the snapshot of an empty canvas with the
+  // format and the palette (see CanvasStorage::writeSnapshot)
+  MSG_CANVAS_INFO = 12,
+  // client -> server: unsigned short count, for every tile: int tile and
+  // the unsigned int version the client has of it, 0 if it has none
+  MSG_TILE_REQUEST = 13,
+  // server -> client: unsigned int epoch, unsigned short count, for every
+  // tile: int tile, unsigned int version, unsigned char 1 followed by its
+  // lines as stored, or 0 if the client already has that version
+  MSG_TILES = 14,
+  // client -> server: what the client views of the canvas, level 0 for
+  // the edits of the pixels or a level of the pyramid of the canvas for
+  // its tiles (see LevelSubscription)
+  MSG_SUBSCRIBE = 15,
+  // server -> client: unsigned char level, unsigned short count, for every
+  // tile: int tile of the level, rgb of its pixels line by line
+  MSG_MIP_TILES = 16
+};
+
+// Size of the messages with a fixed size
+const int PIXEL_PACKET_SIZE = sizeof(unsigned char) + sizeof(short) * 2 +
+                              sizeof(unsigned char) * 3;
+const int PIXEL_INDEX_PACKET_SIZE = sizeof(unsigned char) + sizeof(short) * 2 +
+                                    sizeof(unsigned char);
+
+// Size of the version added to the pixels sent by the server
+const int VERSION_SIZE = sizeof(unsigned int);
+
+// Size of the sequence number that ends every write sent by a client
+const int SEQUENCE_SIZE = sizeof(unsigned int);
+
+const int ACK_PACKET_SIZE = sizeof(unsigned char) + sizeof(unsigned int) * 2;
+
+template<typename T>
+void readNumber(unsigned char* &data, T &x) {
+  // bruh
+  x = static_cast<T*>(static_cast<void*>(data))[0];
+  data = data + sizeof(T);
+}
+
+template<typename T>
+void writeNumber(unsigned char* &data, const T &x) {
+  // bruh
+  static_cast<T*>(static_cast<void*>(data))[0] = x;
+  data = data + sizeof(T);
+}
+
+#endif
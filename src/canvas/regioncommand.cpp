@@ -0,0 +1,296 @@
+#include "canvas/regioncommand.h"
+#include <algorithm>
+
+static int getColorSize(MessageType type) {
+  return sizeof(unsigned char) * (type == MSG_PIXEL_INDEX ? 1 : 3);
+}
+
+static void writeColor(unsigned char* &pnt, const CommandColor &color) {
+  if(color.type == MSG_PIXEL_INDEX)
+    writeNumber(pnt, color.index);
+  else {
+    writeNumber(pnt, color.color.r);
+    writeNumber(pnt, color.color.g);
+    writeNumber(pnt, color.color.b);
+  }
+}
+
+static void readColor(unsigned char* &pnt, CommandColor &color) {
+  if(color.type == MSG_PIXEL_INDEX)
+    readNumber(pnt, color.index);
+  else {
+    readNumber(pnt, color.color.r);
+    readNumber(pnt, color.color.g);
+    readNumber(pnt, color.color.b);
+  }
+}
+
+static bool validColor(CanvasStorage* canvas, const CommandColor &color) {
+  if(color.type == MSG_PIXEL)
+    return true;
+  return color.type == MSG_PIXEL_INDEX && canvas->isIndexed() &&
+         canvas->getPalette().validIndex(color.index);
+}
+
+// Fill the part of a row that is on the canvas
+static bool fillSpan(CanvasStorage* canvas, int x, int y, int w,
+                     const CommandColor &color) {
+  if(y < 0 || y >= canvas->getHeight())
+    return false;
+  int end = std::min(x + w, canvas->getWidth());
+  x = std::max(x, 0);
+  if(end <= x)
+    return false;
+  
+  if(color.type == MSG_PIXEL_INDEX)
+    canvas->fillRowIndex(x, y, end - x, color.index);
+  else
+    canvas->fillRow(x, y, end - x, color.color);
+  return true;
+}
+
+int RegionCommand::getSize() {
+  int size = sizeof(unsigned char) + sizeof(short) * 4;
+  if(type == MSG_FILL_RECT)
+    return size + sizeof(unsigned char) + getColorSize(color.type);
+  if(type == MSG_FLOOD_FILL)
+    return size + sizeof(short) * 2 + sizeof(unsigned char) +
+           getColorSize(color.type);
+  
+  size += sizeof(unsigned char) + sizeof(int);
+  for(unsigned int i = 0; i < runs.size(); ++i) {
+    size += sizeof(unsigned short);
+    if(!runs[i].transparent)
+      size += getColorSize(color.type);
+  }
+  return size;
+}
+
+void RegionCommand::write(unsigned char* &pnt) {
+  writeNumber(pnt, type);
+  if(type == MSG_FLOOD_FILL) {
+    writeNumber(pnt, seedLine);
+    writeNumber(pnt, seedColumn);
+  }
+  writeNumber(pnt, line);
+  writeNumber(pnt, column);
+  writeNumber(pnt, lines);
+  writeNumber(pnt, columns);
+  writeNumber(pnt, color.type);
+  
+  if(type != MSG_STAMP) {
+    writeColor(pnt, color);
+    return;
+  }
+  
+  writeNumber(pnt, (int)runs.size());
+  for(unsigned int i = 0; i < runs.size(); ++i) {
+    unsigned short length = runs[i].length;
+    if(runs[i].transparent)
+      length |= TRANSPARENT_RUN;
+    writeNumber(pnt, length);
+    if(!runs[i].transparent)
+      writeColor(pnt, runs[i].color);
+  }
+}
+
+bool RegionCommand::read(unsigned char* &pnt, int length) {
+  unsigned char* end = pnt + length;
+  if(length < (int)sizeof(unsigned char))
+    return false;
+  readNumber(pnt, type);
+  if(type != MSG_FILL_RECT && type != MSG_STAMP && type != MSG_FLOOD_FILL)
+    return false;
+  
+  int header = sizeof(short) * 4 + sizeof(unsigned char);
+  if(type == MSG_FLOOD_FILL)
+    header += sizeof(short) * 2;
+  if(end - pnt < header)
+    return false;
+  if(type == MSG_FLOOD_FILL) {
+    readNumber(pnt, seedLine);
+    readNumber(pnt, seedColumn);
+  }
+  readNumber(pnt, line);
+  readNumber(pnt, column);
+  readNumber(pnt, lines);
+  readNumber(pnt, columns);
+  readNumber(pnt, color.type);
+  if(color.type != MSG_PIXEL && color.type != MSG_PIXEL_INDEX)
+    return false;
+  int colorSize = getColorSize(color.type);
+  
+  if(type != MSG_STAMP) {
+    if(end - pnt < colorSize)
+      return false;
+    readColor(pnt, color);
+    return true;
+  }
+  
+  int count;
+  if(end - pnt < (int)sizeof(int))
+    return false;
+  readNumber(pnt, count);
+  if(count < 0 || count > (end - pnt) / (int)sizeof(unsigned short))
+    return false;
+  
+  runs.resize(count);
+  for(int i = 0; i < count; ++i) {
+    unsigned short runLength;
+    if(end - pnt < (int)sizeof(unsigned short))
+      return false;
+    readNumber(pnt, runLength);
+    runs[i].transparent = (runLength & TRANSPARENT_RUN) != 0;
+    runs[i].length = runLength & ~TRANSPARENT_RUN;
+    runs[i].color.type = color.type;
+    if(!runs[i].transparent) {
+      if(end - pnt < colorSize)
+        return false;
+      readColor(pnt, runs[i].color);
+    }
+  }
+  return true;
+}
+
+bool RegionCommand::valid(CanvasStorage* canvas) {
+  int maxSize = type == MSG_FLOOD_FILL ? MAX_FLOOD_SIZE : MAX_REGION_SIZE;
+  if(lines < 0 || columns < 0 || lines > maxSize || columns > maxSize ||
+     !validColor(canvas, color))
+    return false;
+  
+  if(type == MSG_FLOOD_FILL)
+    return line <= seedLine && seedLine < line + lines &&
+           column <= seedColumn && seedColumn < column + columns &&
+           canvas->inside(seedColumn, seedLine);
+  
+  if(type == MSG_STAMP) {
+    int total = 0;
+    for(unsigned int i = 0; i < runs.size(); ++i) {
+      total += runs[i].length;
+      if(total > lines * columns ||
+         (!runs[i].transparent && !validColor(canvas, runs[i].color)))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool RegionCommand::apply(CanvasStorage* canvas, int &x, int &y, int &w, int &h) {
+  // Changed rectangle for the fill and the stamp: their part on the canvas
+  x = std::max((int)column, 0);
+  y = std::max((int)line, 0);
+  w = std::min(column + columns, canvas->getWidth()) - x;
+  h = std::min(line + lines, canvas->getHeight()) - y;
+  if(w <= 0 || h <= 0)
+    return false;
+  
+  if(type == MSG_FILL_RECT) {
+    for(int i = y; i < y + h; ++i)
+      fillSpan(canvas, x, i, w, color);
+    return true;
+  }
+  
+  if(type == MSG_STAMP) {
+    bool changed = false;
+    int position = 0;
+    for(unsigned int i = 0; i < runs.size(); ++i) {
+      int left = runs[i].length;
+      while(!runs[i].transparent && left > 0) {
+        // Part of the run on the current line of the stamp
+        int c = position % columns, count = std::min(left, columns - c);
+        changed |= fillSpan(canvas, column + c, line + position / columns,
+                            count, runs[i].color);
+        position += count;
+        left -= count;
+      }
+      position += left;
+    }
+    return changed;
+  }
+  
+  std::vector<FloodSpan> spans;
+  if(!findFlood(canvas, spans))
+    return false;
+  
+  int minX = x + w, maxX = x, minY = y + h, maxY = y;
+  for(unsigned int i = 0; i < spans.size(); ++i) {
+    fillSpan(canvas, spans[i].column, spans[i].line, spans[i].length, color);
+    minX = std::min(minX, (int)spans[i].column);
+    maxX = std::max(maxX, spans[i].column + spans[i].length);
+    minY = std::min(minY, (int)spans[i].line);
+    maxY = std::max(maxY, spans[i].line + 1);
+  }
+  
+  x = minX;
+  y = minY;
+  w = maxX - minX;
+  h = maxY - minY;
+  return true;
+}
+
+bool RegionCommand::findFlood(CanvasStorage* canvas, std::vector<FloodSpan> &spans) {
+  spans.clear();
+  int left = std::max((int)column, 0), top = std::max((int)line, 0);
+  int right = std::min(column + columns, canvas->getWidth());
+  int bottom = std::min(line + lines, canvas->getHeight());
+  if(right <= left || bottom <= top)
+    return false;
+  
+  // The pixels connected to the seed that have its value, one span of a
+  // line at a time
+  bool indexed = canvas->isIndexed();
+  Pixel target = canvas->getPixel(seedColumn, seedLine);
+  unsigned char targetIndex = indexed ? canvas->getIndex(seedColumn, seedLine) : 0;
+  if(indexed) {
+    unsigned char index = color.type == MSG_PIXEL_INDEX ?
+                          color.index : canvas->getPalette().nearest(color.color);
+    if(index == targetIndex)
+      return false;
+  } else if(color.color == target)
+    return false;
+  
+  // The canvas isn't changed, the pixels of the spans found are marked
+  // instead so they stop matching
+  int width = right - left;
+  std::vector<bool> found(width * (bottom - top), false);
+  auto matches = [&](int px, int py) {
+    if(found[(py - top) * width + px - left])
+      return false;
+    if(indexed)
+      return canvas->getIndex(px, py) == targetIndex;
+    return canvas->getPixel(px, py) == target;
+  };
+  
+  std::vector<std::pair<short, short> > seeds;
+  seeds.push_back({seedColumn, seedLine});
+  while(!seeds.empty()) {
+    int px = seeds.back().first, py = seeds.back().second;
+    seeds.pop_back();
+    if(!matches(px, py))
+      continue;
+    
+    int from = px, to = px + 1;
+    while(from > left && matches(from - 1, py))
+      --from;
+    while(to < right && matches(to, py))
+      ++to;
+    spans.push_back({(short)py, (short)from, (short)(to - from)});
+    std::fill(found.begin() + (py - top) * width + from - left,
+              found.begin() + (py - top) * width + to - left, true);
+    
+    // One seed for every run of matching pixels above and below the span
+    for(int ny = py - 1; ny <= py + 1; ny += 2) {
+      if(ny < top || ny >= bottom)
+        continue;
+      bool inRun = false;
+      for(int i = from; i < to; ++i)
+        if(matches(i, ny)) {
+          if(!inRun)
+            seeds.push_back({(short)i, (short)ny});
+          inRun = true;
+        } else
+          inRun = false;
+    }
+  }
+  return !spans.empty();
+}
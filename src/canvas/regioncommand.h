@@ -0,0 +1,88 @@
+#ifndef __REGIONCOMMAND_H
+#define __REGIONCOMMAND_H
+
+#include <vector>
+#include "canvas/canvasstorage.h"
+
+// Largest side of the rectangle of a fill or a stamp
+const int MAX_REGION_SIZE = 1024;
+
+// Largest side of the area a flood fill may spread over
+const int MAX_FLOOD_SIZE = 256;
+
+// Largest length of a run of a stamp, the highest bit of the length marks
+// the transparent runs
+const int MAX_RUN_LENGTH = 0x7fff;
+const unsigned short TRANSPARENT_RUN = 0x8000;
+
+// Color of a command: a free rgb color, snapped to the palette by indexed
+// canvases, or a palette index, like MSG_PIXEL and MSG_PIXEL_INDEX
+struct CommandColor {
+  // MSG_PIXEL or MSG_PIXEL_INDEX
+  MessageType type;
+  Pixel color;
+  unsigned char index;
+};
+
+// Run of pixels of a stamp with the same color
+struct StampRun {
+  unsigned short length;
+  bool transparent;
+  CommandColor color;
+};
+
+// Pixels of a line changed by a flood fill
+struct FloodSpan {
+  short line, column, length;
+};
+
+// A change of many pixels sent as one message, applied the same way by the
+// server and by the clients so only the command crosses the network
+// Packets of the commands (see protocol.h):
+// MSG_FILL_RECT: short line, short column, short lines, short columns, color
+// MSG_STAMP: short line, short column, short lines, short columns,
+// color type, int run count, for every run: unsigned short length,
+// the color of the run unless it is transparent
+// MSG_FLOOD_FILL: short line, short column of the seed,
+// short line, short column, short lines, short columns of the area, color
+// A color is its type followed by r, g, b or by the palette index
+class RegionCommand {
+public:
+  MessageType type;
+  
+  // Rectangle of the fill or the stamp, area of the flood fill
+  short line, column, lines, columns;
+  
+  // Pixel the flood fill starts from
+  short seedLine, seedColumn;
+  
+  // Color of the fill and of the flood fill
+  CommandColor color;
+  
+  // Pixels of the stamp, line by line
+  std::vector<StampRun> runs;
+  
+  // Size in bytes of the packet of the command, with the type
+  int getSize();
+  
+  void write(unsigned char* &pnt);
+  
+  // Read a command of length bytes, starting with the type
+  // Returns false if the bytes don't hold a whole command
+  bool read(unsigned char* &pnt, int length);
+  
+  // Returns true if the command can be applied to the canvas: the sizes are
+  // in the limits and the colors can be stored by it
+  bool valid(CanvasStorage* canvas);
+  
+  // Apply the command to the canvas and find the rectangle it changed
+  // Returns false if it changed nothing
+  bool apply(CanvasStorage* canvas, int &x, int &y, int &w, int &h);
+  
+  // Find the spans of pixels a flood fill would change, without changing
+  // the canvas
+  // Returns false if it would change nothing
+  bool findFlood(CanvasStorage* canvas, std::vector<FloodSpan> &spans);
+};
+
+#endif
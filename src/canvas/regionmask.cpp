@@ -0,0 +1,271 @@
+#include "canvas/regionmask.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+// First bytes of files written by RegionMask::save
+static const char MASK_MAGIC[4] = {'P', 'S', 'M', '1'};
+
+// State of a tile in a saved mask
+static const unsigned char SAVED_FREE = 0;
+static const unsigned char SAVED_LOCKED = 1;
+static const unsigned char SAVED_MIXED = 2;
+
+// Bits of the columns x to x + w - 1 of a line of a tile
+static inline unsigned int lineBits(int x, int w) {
+  unsigned int bits = w >= TILE_SIZE ? ~0u : (1u << w) - 1;
+  return bits << x;
+}
+
+RegionMask::RegionMask(int _width, int _height) {
+  width = _width;
+  height = _height;
+  tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+  tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+  tiles.assign(tilesX * tilesY, MASK_FREE);
+}
+
+int RegionMask::getWidth() {
+  return width;
+}
+
+int RegionMask::getHeight() {
+  return height;
+}
+
+void RegionMask::getTileRect(int tile, int &x, int &y, int &w, int &h) {
+  x = tile % tilesX * TILE_SIZE;
+  y = tile / tilesX * TILE_SIZE;
+  w = std::min(TILE_SIZE, width - x);
+  h = std::min(TILE_SIZE, height - y);
+}
+
+void RegionMask::split(int tile) {
+  int block;
+  if(unusedBlocks.empty()) {
+    block = bits.size() / TILE_SIZE;
+    bits.resize(bits.size() + TILE_SIZE);
+  } else {
+    block = unusedBlocks.back();
+    unusedBlocks.pop_back();
+  }
+
+  unsigned int line = tiles[tile] == MASK_LOCKED ? ~0u : 0;
+  std::fill(bits.begin() + block * TILE_SIZE, bits.begin() + (block + 1) * TILE_SIZE, line);
+  tiles[tile] = block;
+}
+
+void RegionMask::merge(int tile) {
+  int block = tiles[tile];
+  if(block < 0)
+    return;
+
+  int x, y, w, h;
+  getTileRect(tile, x, y, w, h);
+  unsigned int all = lineBits(0, w);
+  bool free = true, locked = true;
+  for(int i = 0; i < h; ++i) {
+    unsigned int line = bits[block * TILE_SIZE + i] & all;
+    free = free && line == 0;
+    locked = locked && line == all;
+  }
+
+  if(free || locked) {
+    tiles[tile] = locked ? MASK_LOCKED : MASK_FREE;
+    unusedBlocks.push_back(block);
+  }
+}
+
+bool RegionMask::anyLocked(int x, int y, int w, int h) {
+  int x0 = std::max(x, 0), x1 = std::min(x + w, (int)width);
+  int y0 = std::max(y, 0), y1 = std::min(y + h, (int)height);
+  if(x0 >= x1 || y0 >= y1)
+    return false;
+
+  for(int ty = y0 / TILE_SIZE; ty <= (y1 - 1) / TILE_SIZE; ++ty)
+    for(int tx = x0 / TILE_SIZE; tx <= (x1 - 1) / TILE_SIZE; ++tx) {
+      int block = tiles[ty * tilesX + tx];
+      if(block == MASK_FREE)
+        continue;
+      if(block == MASK_LOCKED)
+        return true;
+
+      int left = std::max(x0 - tx * TILE_SIZE, 0);
+      int right = std::min(x1 - tx * TILE_SIZE, TILE_SIZE);
+      unsigned int columns = lineBits(left, right - left);
+      for(int i = std::max(y0 - ty * TILE_SIZE, 0); i < std::min(y1 - ty * TILE_SIZE, TILE_SIZE); ++i)
+        if(bits[block * TILE_SIZE + i] & columns)
+          return true;
+    }
+  return false;
+}
+
+void RegionMask::setRect(int x, int y, int w, int h, bool locked) {
+  int x0 = std::max(x, 0), x1 = std::min(x + w, (int)width);
+  int y0 = std::max(y, 0), y1 = std::min(y + h, (int)height);
+  if(x0 >= x1 || y0 >= y1)
+    return;
+
+  int state = locked ? MASK_LOCKED : MASK_FREE;
+  for(int ty = y0 / TILE_SIZE; ty <= (y1 - 1) / TILE_SIZE; ++ty)
+    for(int tx = x0 / TILE_SIZE; tx <= (x1 - 1) / TILE_SIZE; ++tx) {
+      int tile = ty * tilesX + tx;
+      if(tiles[tile] == state)
+        continue;
+
+      int tileX, tileY, tileW, tileH;
+      getTileRect(tile, tileX, tileY, tileW, tileH);
+      int left = std::max(x0 - tileX, 0), right = std::min(x1 - tileX, tileW);
+      int top = std::max(y0 - tileY, 0), bottom = std::min(y1 - tileY, tileH);
+
+      // The whole tile changes, its bits aren't needed anymore
+      if(left == 0 && right == tileW && top == 0 && bottom == tileH) {
+        if(tiles[tile] >= 0)
+          unusedBlocks.push_back(tiles[tile]);
+        tiles[tile] = state;
+        continue;
+      }
+
+      if(tiles[tile] < 0)
+        split(tile);
+      unsigned int columns = lineBits(left, right - left);
+      unsigned int* lines = &bits[tiles[tile] * TILE_SIZE];
+      for(int i = top; i < bottom; ++i)
+        if(locked)
+          lines[i] |= columns;
+        else
+          lines[i] &= ~columns;
+      merge(tile);
+    }
+}
+
+int RegionMask::countLocked() {
+  int count = 0;
+  for(int tile = 0; tile < (int)tiles.size(); ++tile) {
+    int x, y, w, h;
+    getTileRect(tile, x, y, w, h);
+    if(tiles[tile] == MASK_LOCKED)
+      count += w * h;
+    else if(tiles[tile] >= 0)
+      for(int i = 0; i < h; ++i)
+        count += __builtin_popcount(bits[tiles[tile] * TILE_SIZE + i] & lineBits(0, w));
+  }
+  return count;
+}
+
+bool RegionMask::save(const char* filename) {
+  FILE *fout = fopen(filename, "wb");
+  if(fout == NULL)
+    return false;
+
+  std::vector<unsigned char> buffer(sizeof(short) * 2 + tiles.size() *
+                                    (sizeof(unsigned char) + sizeof(unsigned int) * TILE_SIZE));
+  unsigned char* pnt = buffer.data();
+  writeNumber(pnt, width);
+  writeNumber(pnt, height);
+  for(unsigned int tile = 0; tile < tiles.size(); ++tile) {
+    if(tiles[tile] == MASK_FREE)
+      writeNumber(pnt, SAVED_FREE);
+    else if(tiles[tile] == MASK_LOCKED)
+      writeNumber(pnt, SAVED_LOCKED);
+    else {
+      writeNumber(pnt, SAVED_MIXED);
+      for(int i = 0; i < TILE_SIZE; ++i)
+        writeNumber(pnt, bits[tiles[tile] * TILE_SIZE + i]);
+    }
+  }
+
+  fwrite(MASK_MAGIC, sizeof(char), 4, fout);
+  fwrite(buffer.data(), sizeof(unsigned char), pnt - buffer.data(), fout);
+  fclose(fout);
+  return true;
+}
+
+RegionMask* RegionMask::load(const char* filename) {
+  FILE *fin = fopen(filename, "rb");
+  if(fin == NULL)
+    return NULL;
+
+  char magic[4];
+  std::vector<unsigned char> buffer;
+  if(fread(magic, sizeof(char), 4, fin) == 4 && memcmp(magic, MASK_MAGIC, 4) == 0) {
+    unsigned char chunk[4096];
+    size_t count;
+    while((count = fread(chunk, sizeof(unsigned char), sizeof(chunk), fin)) > 0)
+      buffer.insert(buffer.end(), chunk, chunk + count);
+  }
+  fclose(fin);
+
+  unsigned char* pnt = buffer.data();
+  unsigned char* end = pnt + buffer.size();
+  short width, height;
+  if(end - pnt < (int)sizeof(short) * 2)
+    return NULL;
+  readNumber(pnt, width);
+  readNumber(pnt, height);
+  if(width < 0 || height < 0)
+    return NULL;
+
+  RegionMask* mask = new RegionMask(width, height);
+  for(unsigned int tile = 0; tile < mask->tiles.size(); ++tile) {
+    unsigned char state;
+    if(end - pnt < (int)sizeof(unsigned char)) {
+      delete mask;
+      return NULL;
+    }
+    readNumber(pnt, state);
+    if(state == SAVED_LOCKED)
+      mask->tiles[tile] = MASK_LOCKED;
+    else if(state == SAVED_MIXED) {
+      if(end - pnt < (int)sizeof(unsigned int) * TILE_SIZE) {
+        delete mask;
+        return NULL;
+      }
+      mask->split(tile);
+      for(int i = 0; i < TILE_SIZE; ++i)
+        readNumber(pnt, mask->bits[mask->tiles[tile] * TILE_SIZE + i]);
+      mask->merge(tile);
+    }
+  }
+  return mask;
+}
+
+int MaskChange::getSize() {
+  return sizeof(unsigned char) * 2 + key.size() + sizeof(short) * 4 +
+         sizeof(unsigned char);
+}
+
+void MaskChange::write(unsigned char* &pnt) {
+  writeNumber(pnt, MSG_LOCK_RECT);
+  writeNumber(pnt, (unsigned char)key.size());
+  memcpy(pnt, key.data(), key.size());
+  pnt = pnt + key.size();
+  writeNumber(pnt, line);
+  writeNumber(pnt, column);
+  writeNumber(pnt, lines);
+  writeNumber(pnt, columns);
+  writeNumber(pnt, (unsigned char)locked);
+}
+
+bool MaskChange::read(unsigned char* &pnt, int length) {
+  unsigned char* end = pnt + length;
+  unsigned char type, size;
+  if(length < (int)sizeof(unsigned char) * 2)
+    return false;
+  readNumber(pnt, type);
+  readNumber(pnt, size);
+  if(type != MSG_LOCK_RECT ||
+     end - pnt < size + (int)(sizeof(short) * 4 + sizeof(unsigned char)))
+    return false;
+  key.assign((const char*)pnt, size);
+  pnt = pnt + size;
+
+  unsigned char lock;
+  readNumber(pnt, line);
+  readNumber(pnt, column);
+  readNumber(pnt, lines);
+  readNumber(pnt, columns);
+  readNumber(pnt, lock);
+  locked = lock != 0;
+  return true;
+}
@@ -0,0 +1,96 @@
+#ifndef __REGIONMASK_H
+#define __REGIONMASK_H
+
+#include <vector>
+#include <string>
+#include "canvas/protocol.h"
+#include "canvas/tileversions.h"
+
+// A line of a tile is one unsigned int of bits
+static_assert(TILE_SIZE == 32, "RegionMask stores a line of a tile in 32 bits");
+
+// State of a tile of the mask, the mixed tiles hold the number of their
+// block of bits instead
+const int MASK_FREE = -1;
+const int MASK_LOCKED = -2;
+
+// Pixels of a canvas that can't be edited, locked by the moderators
+// Every tile is either free, locked or mixed; only mixed tiles keep a bit
+// for every pixel, so most pixels are checked with one lookup
+class RegionMask {
+private:
+  short width, height;
+  int tilesX, tilesY;
+
+  // MASK_FREE, MASK_LOCKED or the block of bits of every tile
+  std::vector<int> tiles;
+
+  // Blocks of TILE_SIZE lines of bits, bit x of a line is column x of the
+  // tile, and the blocks no tile uses
+  std::vector<unsigned int> bits;
+  std::vector<int> unusedBlocks;
+
+  // Give the tile a block of bits holding its current state
+  void split(int tile);
+
+  // Make the tile free or locked if all its pixels on the canvas are
+  void merge(int tile);
+
+  // Rectangle of the tile inside the canvas
+  void getTileRect(int tile, int &x, int &y, int &w, int &h);
+public:
+  // Mask of a canvas of width x height pixels, nothing locked
+  RegionMask(int _width, int _height);
+
+  int getWidth();
+  int getHeight();
+
+  // Returns true if the pixel (x, y) of the canvas is locked
+  inline bool isLocked(int x, int y);
+
+  // Returns true if some pixel of the rectangle of w x h pixels at (x, y)
+  // is locked, the parts outside the canvas are ignored
+  bool anyLocked(int x, int y, int w, int h);
+
+  // Lock or unlock the rectangle, the parts outside the canvas are ignored
+  void setRect(int x, int y, int w, int h, bool locked);
+
+  // Number of locked pixels
+  int countLocked();
+
+  // Save the mask to a file
+  bool save(const char* filename);
+
+  // Load a mask saved with save()
+  // Returns NULL if the file can't be read
+  static RegionMask* load(const char* filename);
+};
+
+inline bool RegionMask::isLocked(int x, int y) {
+  int tile = tiles[(y / TILE_SIZE) * tilesX + x / TILE_SIZE];
+  if(tile < 0)
+    return tile == MASK_LOCKED;
+  return (bits[tile * TILE_SIZE + y % TILE_SIZE] >> (x % TILE_SIZE)) & 1;
+}
+
+// A moderator locking or unlocking a rectangle of the canvas
+// Packet: MSG_LOCK_RECT, unsigned char length and admin key,
+// short line, short column, short lines, short columns, unsigned char
+// 1 to lock or 0 to unlock (see protocol.h)
+class MaskChange {
+public:
+  std::string key;
+  short line, column, lines, columns;
+  bool locked;
+
+  // Size in bytes of the packet, with the type
+  int getSize();
+
+  void write(unsigned char* &pnt);
+
+  // Read a change of length bytes, starting with the type
+  // Returns false if the bytes don't hold a whole change
+  bool read(unsigned char* &pnt, int length);
+};
+
+#endif
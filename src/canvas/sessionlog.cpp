@@ -0,0 +1,60 @@
+#include "canvas/sessionlog.h"
+#include "canvas/canvassync.h"
+#include <chrono>
+
+// Longest message read from a log, larger than the snapshot of any canvas
+static const unsigned int MAX_ENTRY_SIZE = 1 << 28;
+
+SessionLog::SessionLog() {
+  file = NULL;
+}
+
+SessionLog::~SessionLog() {
+  close();
+}
+
+bool SessionLog::open(const char* filename) {
+  close();
+  file = fopen(filename, "ab");
+  return file != NULL;
+}
+
+bool SessionLog::isOpen() {
+  return file != NULL;
+}
+
+void SessionLog::close() {
+  if(file != NULL)
+    fclose(file);
+  file = NULL;
+}
+
+void SessionLog::writeSnapshot(CanvasStorage* canvas, TileVersions* versions) {
+  std::vector<unsigned char> message;
+  writeSnapshotReply(canvas, versions, message);
+  write(message.data(), message.size());
+}
+
+void SessionLog::write(const unsigned char* message, int length) {
+  if(file == NULL)
+    return;
+  long long time = now();
+  unsigned int size = length;
+  fwrite(&time, sizeof(long long), 1, file);
+  fwrite(&size, sizeof(unsigned int), 1, file);
+  fwrite(message, sizeof(unsigned char), length, file);
+}
+
+long long SessionLog::now() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+         std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool SessionLog::read(FILE* file, long long &time, std::vector<unsigned char> &message) {
+  unsigned int size;
+  if(fread(&time, sizeof(long long), 1, file) != 1 ||
+     fread(&size, sizeof(unsigned int), 1, file) != 1 || size > MAX_ENTRY_SIZE)
+    return false;
+  message.resize(size);
+  return fread(message.data(), sizeof(unsigned char), size, file) == size;
+}
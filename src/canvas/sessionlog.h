@@ -0,0 +1,39 @@
+#ifndef __SESSIONLOG_H
+#define __SESSIONLOG_H
+
+#include <cstdio>
+#include <vector>
+#include "canvas/canvasstorage.h"
+#include "canvas/tileversions.h"
+
+// Edits of a canvas recorded by the server, for tools that replay its
+// history without connecting to it
+// The log is a list of entries: long long time in milliseconds since
+// 1970, unsigned int length and a message as the server broadcasts it
+// Every session starts with a MSG_SNAPSHOT of the canvas, followed by the
+// edits with their versions (MSG_PIXEL, MSG_PIXEL_INDEX and the commands)
+class SessionLog {
+private:
+  FILE* file;
+public:
+  SessionLog();
+  ~SessionLog();
+
+  // Append to the log in the given file, creating it if needed
+  bool open(const char* filename);
+  bool isOpen();
+  void close();
+
+  // Start a session with the current canvas
+  void writeSnapshot(CanvasStorage* canvas, TileVersions* versions);
+  void write(const unsigned char* message, int length);
+
+  // Current time as written in the entries
+  static long long now();
+
+  // Read the next entry of a log
+  // Returns false at the end of the file or if the entry is cut
+  static bool read(FILE* file, long long &time, std::vector<unsigned char> &message);
+};
+
+#endif
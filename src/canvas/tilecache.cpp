@@ -0,0 +1,602 @@
+#include "canvas/tilecache.h"
+#include <cstring>
+#include <algorithm>
+
+// First bytes of files written by TileCache::save
+static const char INDEX_MAGIC[4] = {'P', 'S', 'T', '1'};
+
+// Most slots on a line of the canvas holding them, its width is a short
+static const int MAX_SLOTS_X = 32767 / TILE_SIZE;
+
+TileCache::TileCache(int _width, int _height, CanvasStorage* header, unsigned int _epoch,
+                     unsigned int _version, int budget) {
+  width = _width;
+  height = _height;
+  epoch = _epoch;
+  version = _version;
+  tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+  tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+  tiles.assign(tilesX * tilesY, CachedTile{-1, 0, 0, 0, false, 0, false});
+
+  // No more slots than tiles, and no more than the canvas of the slots holds
+  int count = budget / header->getRegionSize(TILE_SIZE, TILE_SIZE);
+  count = std::min(std::max(count, MIN_CACHED_TILES), (int)tiles.size());
+  count = std::min(std::max(count, 1), MAX_SLOTS_X * MAX_SLOTS_X);
+  slotsX = std::min(count, MAX_SLOTS_X);
+  int slotsY = (count + slotsX - 1) / slotsX;
+  slots = new CanvasStorage(slotsX * TILE_SIZE, slotsY * TILE_SIZE, header->getFormat());
+  slots->setPalette(header->getPalette());
+  slotTiles.assign(slotsX * slotsY, -1);
+  for(int slot = slotsX * slotsY - 1; slot >= 0; --slot)
+    freeSlots.push_back(slot);
+
+  keepX0 = keepY0 = 0;
+  keepX1 = keepY1 = -1;
+  frame = 0;
+  disk = NULL;
+}
+
+TileCache::~TileCache() {
+  if(disk != NULL)
+    fclose(disk);
+  delete slots;
+}
+
+bool TileCache::openDisk(const char* filename, bool keep) {
+  if(disk != NULL)
+    fclose(disk);
+  disk = keep ? fopen(filename, "r+b") : NULL;
+  if(disk == NULL) {
+    // The tiles of the old file are gone
+    for(unsigned int tile = 0; tile < tiles.size(); ++tile)
+      if(tiles[tile].onDisk) {
+        tiles[tile].onDisk = false;
+        if(tiles[tile].slot < 0)
+          tiles[tile].held = 0;
+      }
+    disk = fopen(filename, "w+b");
+  }
+  return disk != NULL;
+}
+
+int TileCache::getWidth() {
+  return width;
+}
+
+int TileCache::getHeight() {
+  return height;
+}
+
+PixelFormat TileCache::getFormat() {
+  return slots->getFormat();
+}
+
+bool TileCache::isIndexed() {
+  return slots->isIndexed();
+}
+
+const Palette& TileCache::getPalette() {
+  return slots->getPalette();
+}
+
+unsigned int TileCache::getEpoch() {
+  return epoch;
+}
+
+unsigned int TileCache::getVersion() {
+  return version;
+}
+
+void TileCache::setVersion(unsigned int _version) {
+  version = _version;
+}
+
+int TileCache::getTilesX() {
+  return tilesX;
+}
+
+int TileCache::getTilesY() {
+  return tilesY;
+}
+
+int TileCache::getTile(int x, int y) {
+  return y / TILE_SIZE * tilesX + x / TILE_SIZE;
+}
+
+void TileCache::getTileRect(int tile, int &x, int &y, int &w, int &h) {
+  x = tile % tilesX * TILE_SIZE;
+  y = tile / tilesX * TILE_SIZE;
+  w = std::min(TILE_SIZE, width - x);
+  h = std::min(TILE_SIZE, height - y);
+}
+
+bool TileCache::isLoaded(int tile) {
+  return tiles[tile].slot >= 0;
+}
+
+int TileCache::getDiskSlotSize() {
+  return slots->getRegionSize(TILE_SIZE, TILE_SIZE);
+}
+
+void TileCache::getSlotRect(int slot, int &x, int &y) {
+  x = slot % slotsX * TILE_SIZE;
+  y = slot / slotsX * TILE_SIZE;
+}
+
+void TileCache::toSlot(int &x, int &y) {
+  int slotX, slotY;
+  getSlotRect(tiles[getTile(x, y)].slot, slotX, slotY);
+  x = slotX + x % TILE_SIZE;
+  y = slotY + y % TILE_SIZE;
+}
+
+Pixel TileCache::getPixel(int x, int y) {
+  toSlot(x, y);
+  return slots->getPixel(x, y);
+}
+
+unsigned char TileCache::getIndex(int x, int y) {
+  toSlot(x, y);
+  return slots->getIndex(x, y);
+}
+
+bool TileCache::copyTile(int tile, CanvasStorage* target, int x, int y) {
+  if(tiles[tile].slot < 0)
+    return false;
+  int tileX, tileY, w, h, slotX, slotY;
+  getTileRect(tile, tileX, tileY, w, h);
+  getSlotRect(tiles[tile].slot, slotX, slotY);
+
+  std::vector<unsigned char> buffer(slots->getRegionSize(w, h));
+  unsigned char* pnt = buffer.data();
+  slots->writeRegion(slotX, slotY, w, h, pnt);
+  pnt = buffer.data();
+  target->readRegion(x, y, w, h, pnt);
+  return true;
+}
+
+void TileCache::storeTile(int tile, CanvasStorage* source, int x, int y) {
+  int tileX, tileY, w, h, slotX, slotY;
+  getTileRect(tile, tileX, tileY, w, h);
+  getSlotRect(tiles[tile].slot, slotX, slotY);
+
+  std::vector<unsigned char> buffer(slots->getRegionSize(w, h));
+  unsigned char* pnt = buffer.data();
+  source->writeRegion(x, y, w, h, pnt);
+  pnt = buffer.data();
+  slots->readRegion(slotX, slotY, w, h, pnt);
+}
+
+int TileCache::allocateSlot() {
+  if(freeSlots.empty()) {
+    // Drop the oldest quarter of the tiles away from the view at once, so
+    // the next tiles find a slot without searching again
+    std::vector<std::pair<unsigned int, int> > candidates;
+    for(unsigned int slot = 0; slot < slotTiles.size(); ++slot) {
+      int tile = slotTiles[slot];
+      int tx = tile % tilesX, ty = tile / tilesX;
+      if(tile >= 0 && (tx < keepX0 || tx > keepX1 || ty < keepY0 || ty > keepY1))
+        candidates.push_back({tiles[tile].lastUsed, tile});
+    }
+    if(candidates.empty())
+      return -1;
+    std::sort(candidates.begin(), candidates.end());
+    int count = std::max(1, (int)candidates.size() / 4);
+    for(int i = 0; i < count; ++i)
+      unload(candidates[i].second, true);
+  }
+
+  int slot = freeSlots.back();
+  freeSlots.pop_back();
+  return slot;
+}
+
+void TileCache::spill(int tile) {
+  int x, y, w, h, slotX, slotY;
+  getTileRect(tile, x, y, w, h);
+  getSlotRect(tiles[tile].slot, slotX, slotY);
+
+  std::vector<unsigned char> buffer(slots->getRegionSize(w, h));
+  unsigned char* pnt = buffer.data();
+  slots->writeRegion(slotX, slotY, w, h, pnt);
+  if(fseek(disk, (long)tile * getDiskSlotSize(), SEEK_SET) == 0 &&
+     fwrite(buffer.data(), sizeof(unsigned char), buffer.size(), disk) == buffer.size())
+    tiles[tile].onDisk = true;
+  else
+    tiles[tile].onDisk = false;
+}
+
+void TileCache::unload(int tile, bool keep) {
+  CachedTile &cached = tiles[tile];
+  if(keep && disk != NULL && cached.held != 0)
+    spill(tile);
+  else
+    cached.onDisk = false;
+  if(!cached.onDisk)
+    cached.held = 0;
+
+  slotTiles[cached.slot] = -1;
+  freeSlots.push_back(cached.slot);
+  cached.slot = -1;
+}
+
+bool TileCache::loadFromDisk(int tile) {
+  int x, y, w, h, slotX, slotY;
+  getTileRect(tile, x, y, w, h);
+  std::vector<unsigned char> buffer(slots->getRegionSize(w, h));
+  if(disk == NULL || fseek(disk, (long)tile * getDiskSlotSize(), SEEK_SET) != 0 ||
+     fread(buffer.data(), sizeof(unsigned char), buffer.size(), disk) != buffer.size()) {
+    tiles[tile].onDisk = false;
+    tiles[tile].held = 0;
+    return false;
+  }
+
+  int slot = allocateSlot();
+  if(slot < 0)
+    return false;
+  getSlotRect(slot, slotX, slotY);
+  unsigned char* pnt = buffer.data();
+  slots->readRegion(slotX, slotY, w, h, pnt);
+  slotTiles[slot] = tile;
+  tiles[tile].slot = slot;
+  tiles[tile].lastUsed = frame;
+  return true;
+}
+
+bool TileCache::receivePixel(int x, int y, const CommandColor &color, unsigned int _version) {
+  version = std::max(version, _version);
+  if(x < 0 || x >= width || y < 0 || y >= height)
+    return false;
+
+  // Tiles received after the edit already have it
+  CachedTile &cached = tiles[getTile(x, y)];
+  cached.latest = std::max(cached.latest, _version);
+  if(cached.slot < 0 || _version <= cached.held)
+    return false;
+  cached.held = _version;
+
+  toSlot(x, y);
+  if(color.type == MSG_PIXEL)
+    slots->setPixel(x, y, color.color);
+  else if(slots->isIndexed() && slots->getPalette().validIndex(color.index))
+    slots->setIndex(x, y, color.index);
+  else
+    return false;
+  return true;
+}
+
+bool TileCache::receiveCommand(const RegionCommand &command, unsigned int _version,
+                               int &x, int &y, int &w, int &h) {
+  version = std::max(version, _version);
+  int x0 = std::max((int)command.column, 0), x1 = std::min(command.column + command.columns, (int)width);
+  int y0 = std::max((int)command.line, 0), y1 = std::min(command.line + command.lines, (int)height);
+  if(x0 >= x1 || y0 >= y1)
+    return false;
+
+  bool complete = true;
+  for(int ty = y0 / TILE_SIZE; ty <= (y1 - 1) / TILE_SIZE; ++ty)
+    for(int tx = x0 / TILE_SIZE; tx <= (x1 - 1) / TILE_SIZE; ++tx) {
+      CachedTile &cached = tiles[ty * tilesX + tx];
+      cached.latest = std::max(cached.latest, _version);
+      complete = complete && cached.slot >= 0 && cached.held < _version;
+    }
+
+  bool changed;
+  if(command.type == MSG_FLOOD_FILL && !complete) {
+    // The fill may spread through the tiles we don't have, the ones we
+    // have are asked for again
+    changed = false;
+    for(int ty = y0 / TILE_SIZE; ty <= (y1 - 1) / TILE_SIZE; ++ty)
+      for(int tx = x0 / TILE_SIZE; tx <= (x1 - 1) / TILE_SIZE; ++tx)
+        if(tiles[ty * tilesX + tx].slot >= 0 && tiles[ty * tilesX + tx].held < _version) {
+          unload(ty * tilesX + tx, false);
+          changed = true;
+        }
+    x = x0;
+    y = y0;
+    w = x1 - x0;
+    h = y1 - y0;
+    return changed;
+  }
+
+  changed = applyCommand(command, width, height, getFormat(), getPalette(),
+    [&](int tile, CanvasStorage* area, int areaX, int areaY) {
+      return tiles[tile].held < _version && copyTile(tile, area, areaX, areaY);
+    },
+    [&](int tile, CanvasStorage* area, int areaX, int areaY) {
+      storeTile(tile, area, areaX, areaY);
+    }, x, y, w, h);
+
+  for(int ty = y0 / TILE_SIZE; ty <= (y1 - 1) / TILE_SIZE; ++ty)
+    for(int tx = x0 / TILE_SIZE; tx <= (x1 - 1) / TILE_SIZE; ++tx) {
+      CachedTile &cached = tiles[ty * tilesX + tx];
+      if(cached.slot >= 0)
+        cached.held = std::max(cached.held, _version);
+    }
+  return changed;
+}
+
+bool TileCache::receiveTiles(unsigned char* pnt, int length) {
+  unsigned char* end = pnt + length;
+  unsigned char type;
+  unsigned int tilesEpoch;
+  unsigned short count;
+  if(length < (int)(sizeof(unsigned char) + sizeof(unsigned int) + sizeof(unsigned short)))
+    return false;
+  readNumber(pnt, type);
+  readNumber(pnt, tilesEpoch);
+  readNumber(pnt, count);
+  if(type != MSG_TILES || tilesEpoch != epoch)
+    return false;
+
+  for(int i = 0; i < count; ++i) {
+    int tile;
+    unsigned int tileVersion;
+    unsigned char hasLines;
+    if(end - pnt < (int)(sizeof(int) + sizeof(unsigned int) + sizeof(unsigned char)))
+      return false;
+    readNumber(pnt, tile);
+    readNumber(pnt, tileVersion);
+    readNumber(pnt, hasLines);
+    if(tile < 0 || tile >= (int)tiles.size())
+      return false;
+
+    CachedTile &cached = tiles[tile];
+    int x, y, w, h;
+    getTileRect(tile, x, y, w, h);
+    bool used = cached.requests <= 1 && !cached.expired;
+    if(cached.requests > 0)
+      --cached.requests;
+    if(!used) {
+      if(hasLines)
+        pnt = pnt + std::min((int)(end - pnt), slots->getRegionSize(w, h));
+      continue;
+    }
+    cached.latest = std::max(cached.latest, tileVersion);
+
+    if(!hasLines) {
+      // Our copy on disk is the current one
+      if(cached.slot < 0 && cached.onDisk && cached.held == tileVersion)
+        loadFromDisk(tile);
+      continue;
+    }
+
+    if(end - pnt < slots->getRegionSize(w, h))
+      return false;
+    if(cached.slot < 0) {
+      int slot = allocateSlot();
+      if(slot < 0) {
+        pnt = pnt + slots->getRegionSize(w, h);
+        continue;
+      }
+      slotTiles[slot] = tile;
+      cached.slot = slot;
+      cached.lastUsed = frame;
+    }
+    int slotX, slotY;
+    getSlotRect(cached.slot, slotX, slotY);
+    slots->readRegion(slotX, slotY, w, h, pnt);
+    cached.held = tileVersion;
+  }
+  return true;
+}
+
+void TileCache::update(int x, int y, int w, int h, int panX, int panY,
+                       std::vector<unsigned char> &request) {
+  ++frame;
+  request.clear();
+
+  int x0 = std::max(x, 0), x1 = std::min(x + w, (int)width);
+  int y0 = std::max(y, 0), y1 = std::min(y + h, (int)height);
+  if(x0 >= x1 || y0 >= y1) {
+    keepX0 = keepY0 = 0;
+    keepX1 = keepY1 = -1;
+    return;
+  }
+
+  // The tiles of the view with one more around them, and a few more on the
+  // side the view moves to
+  int viewX0 = x0 / TILE_SIZE, viewX1 = (x1 - 1) / TILE_SIZE;
+  int viewY0 = y0 / TILE_SIZE, viewY1 = (y1 - 1) / TILE_SIZE;
+  keepX0 = std::max(viewX0 - 1 - (panX < 0 ? PREFETCH_TILES : 0), 0);
+  keepX1 = std::min(viewX1 + 1 + (panX > 0 ? PREFETCH_TILES : 0), tilesX - 1);
+  keepY0 = std::max(viewY0 - 1 - (panY < 0 ? PREFETCH_TILES : 0), 0);
+  keepY1 = std::min(viewY1 + 1 + (panY > 0 ? PREFETCH_TILES : 0), tilesY - 1);
+
+  for(int ty = keepY0; ty <= keepY1; ++ty)
+    for(int tx = keepX0; tx <= keepX1; ++tx)
+      tiles[ty * tilesX + tx].lastUsed = frame;
+
+  // The tiles of the view first, then the others
+  std::vector<std::pair<int, unsigned int> > wanted;
+  for(int pass = 0; pass < 2; ++pass)
+    for(int ty = keepY0; ty <= keepY1; ++ty)
+      for(int tx = keepX0; tx <= keepX1; ++tx) {
+        bool inView = viewX0 <= tx && tx <= viewX1 && viewY0 <= ty && ty <= viewY1;
+        int tile = ty * tilesX + tx;
+        CachedTile &cached = tiles[tile];
+        if(inView != (pass == 0) || cached.slot >= 0 ||
+           (cached.requests > 0 && !cached.expired))
+          continue;
+
+        // A copy on disk can be used without asking once the server told
+        // us it is the current one
+        if(cached.onDisk && cached.latest != 0 && cached.held == cached.latest &&
+           loadFromDisk(tile))
+          continue;
+        if((int)wanted.size() < MAX_TILE_REQUEST) {
+          wanted.push_back({tile, cached.onDisk ? cached.held : 0});
+          ++cached.requests;
+          cached.expired = false;
+        }
+      }
+
+  if(wanted.empty())
+    return;
+  request.resize(sizeof(unsigned char) + sizeof(unsigned short) +
+                 wanted.size() * (sizeof(int) + sizeof(unsigned int)));
+  unsigned char* pnt = request.data();
+  writeNumber(pnt, MSG_TILE_REQUEST);
+  writeNumber(pnt, (unsigned short)wanted.size());
+  for(unsigned int i = 0; i < wanted.size(); ++i) {
+    writeNumber(pnt, wanted[i].first);
+    writeNumber(pnt, wanted[i].second);
+  }
+}
+
+void TileCache::expire() {
+  for(unsigned int slot = 0; slot < slotTiles.size(); ++slot)
+    if(slotTiles[slot] >= 0)
+      unload(slotTiles[slot], true);
+  for(unsigned int tile = 0; tile < tiles.size(); ++tile) {
+    tiles[tile].latest = 0;
+    tiles[tile].expired = tiles[tile].requests > 0;
+  }
+}
+
+bool TileCache::save(const char* indexFile) {
+  if(disk == NULL)
+    return false;
+  for(unsigned int slot = 0; slot < slotTiles.size(); ++slot)
+    if(slotTiles[slot] >= 0 && tiles[slotTiles[slot]].held != 0)
+      spill(slotTiles[slot]);
+  fflush(disk);
+
+  FILE *fout = fopen(indexFile, "wb");
+  if(fout == NULL)
+    return false;
+
+  CanvasStorage header(0, 0, getFormat());
+  header.setPalette(getPalette());
+  std::vector<unsigned char> buffer(sizeof(unsigned int) + sizeof(short) * 2 +
+                                    header.getSnapshotSize() +
+                                    sizeof(unsigned int) * tiles.size());
+  unsigned char* pnt = buffer.data();
+  writeNumber(pnt, epoch);
+  writeNumber(pnt, width);
+  writeNumber(pnt, height);
+  header.writeSnapshot(pnt);
+  for(unsigned int tile = 0; tile < tiles.size(); ++tile)
+    writeNumber(pnt, tiles[tile].onDisk ? tiles[tile].held : 0u);
+
+  fwrite(INDEX_MAGIC, sizeof(char), 4, fout);
+  fwrite(buffer.data(), sizeof(unsigned char), buffer.size(), fout);
+  fclose(fout);
+  return true;
+}
+
+TileCache* TileCache::load(const char* indexFile, const char* diskFile, int budget) {
+  FILE *fin = fopen(indexFile, "rb");
+  if(fin == NULL)
+    return NULL;
+
+  char magic[4];
+  std::vector<unsigned char> buffer;
+  if(fread(magic, sizeof(char), 4, fin) == 4 && memcmp(magic, INDEX_MAGIC, 4) == 0) {
+    unsigned char chunk[4096];
+    size_t count;
+    while((count = fread(chunk, sizeof(unsigned char), sizeof(chunk), fin)) > 0)
+      buffer.insert(buffer.end(), chunk, chunk + count);
+  }
+  fclose(fin);
+
+  unsigned char* pnt = buffer.data();
+  unsigned char* end = pnt + buffer.size();
+  unsigned int epoch;
+  short width, height;
+  if(end - pnt < (int)(sizeof(unsigned int) + sizeof(short) * 2))
+    return NULL;
+  readNumber(pnt, epoch);
+  readNumber(pnt, width);
+  readNumber(pnt, height);
+  if(width < 0 || height < 0)
+    return NULL;
+  CanvasStorage* header = CanvasStorage::readSnapshot(pnt, end - pnt);
+  if(header == NULL)
+    return NULL;
+
+  TileCache* cache = new TileCache(width, height, header, epoch, 0, budget);
+  delete header;
+  if(end - pnt < (int)(sizeof(unsigned int) * cache->tiles.size())) {
+    delete cache;
+    return NULL;
+  }
+  for(unsigned int tile = 0; tile < cache->tiles.size(); ++tile) {
+    readNumber(pnt, cache->tiles[tile].held);
+    cache->tiles[tile].onDisk = cache->tiles[tile].held != 0;
+  }
+
+  if(!cache->openDisk(diskFile, true)) {
+    delete cache;
+    return NULL;
+  }
+  return cache;
+}
+
+TileCache* TileCache::readInfo(unsigned char* pnt, int length, int budget) {
+  unsigned char* end = pnt + length;
+  unsigned char type;
+  unsigned int epoch, version;
+  short width, height;
+  if(length < (int)(sizeof(unsigned char) + sizeof(unsigned int) * 2 + sizeof(short) * 2))
+    return NULL;
+  readNumber(pnt, type);
+  readNumber(pnt, epoch);
+  readNumber(pnt, version);
+  readNumber(pnt, width);
+  readNumber(pnt, height);
+  if(type != MSG_CANVAS_INFO || width < 0 || height < 0)
+    return NULL;
+
+  CanvasStorage* header = CanvasStorage::readSnapshot(pnt, end - pnt);
+  if(header == NULL)
+    return NULL;
+  TileCache* cache = new TileCache(width, height, header, epoch, version, budget);
+  delete header;
+  return cache;
+}
+
+bool TileCache::applyCommand(RegionCommand command, int width, int height,
+                             PixelFormat format, const Palette &palette,
+                             const std::function<bool(int, CanvasStorage*, int, int)> &read,
+                             const std::function<void(int, CanvasStorage*, int, int)> &write,
+                             int &x, int &y, int &w, int &h) {
+  int x0 = std::max((int)command.column, 0), x1 = std::min(command.column + command.columns, width);
+  int y0 = std::max((int)command.line, 0), y1 = std::min(command.line + command.lines, height);
+  if(x0 >= x1 || y0 >= y1)
+    return false;
+
+  // The command is applied to a canvas made of the tiles under it, which
+  // start on even columns as INDEX4 regions must
+  int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+  int tx0 = x0 / TILE_SIZE, tx1 = (x1 - 1) / TILE_SIZE;
+  int ty0 = y0 / TILE_SIZE, ty1 = (y1 - 1) / TILE_SIZE;
+  int areaX = tx0 * TILE_SIZE, areaY = ty0 * TILE_SIZE;
+  CanvasStorage area(std::min((tx1 + 1) * TILE_SIZE, width) - areaX,
+                     std::min((ty1 + 1) * TILE_SIZE, height) - areaY, format);
+  area.setPalette(palette);
+
+  std::vector<bool> loaded;
+  for(int ty = ty0; ty <= ty1; ++ty)
+    for(int tx = tx0; tx <= tx1; ++tx) {
+      loaded.push_back(read(ty * tilesX + tx, &area, tx * TILE_SIZE - areaX,
+                            ty * TILE_SIZE - areaY));
+      if(!loaded.back() && command.type == MSG_FLOOD_FILL)
+        return false;
+    }
+
+  command.line -= areaY;
+  command.column -= areaX;
+  command.seedLine -= areaY;
+  command.seedColumn -= areaX;
+  if(!command.valid(&area) || !command.apply(&area, x, y, w, h))
+    return false;
+
+  for(int ty = y / TILE_SIZE; ty <= (y + h - 1) / TILE_SIZE; ++ty)
+    for(int tx = x / TILE_SIZE; tx <= (x + w - 1) / TILE_SIZE; ++tx)
+      if(loaded[ty * (tx1 - tx0 + 1) + tx])
+        write((ty + ty0) * tilesX + tx + tx0, &area, tx * TILE_SIZE, ty * TILE_SIZE);
+  x += areaX;
+  y += areaY;
+  return true;
+}
@@ -0,0 +1,181 @@
+#ifndef __TILECACHE_H
+#define __TILECACHE_H
+
+#include <cstdio>
+#include <vector>
+#include <functional>
+#include "canvas/canvassync.h"
+#include "canvas/regioncommand.h"
+
+// Fewest tiles a cache holds in memory, enough for the view and around it
+const int MIN_CACHED_TILES = 64;
+
+// Tiles asked for ahead of the view in the direction it moves
+const int PREFETCH_TILES = 4;
+
+// The tiles a client keeps of a canvas too large to hold whole
+// Tiles are kept in memory in slots of one canvas sized by the memory
+// budget. When every slot is used, the tiles that weren't used for the
+// longest time and are away from the view are dropped, after being written
+// to a file on disk if there is one. The file also keeps the tiles between
+// sessions. Tiles in neither place are asked for with MSG_TILE_REQUEST
+class TileCache {
+private:
+  struct CachedTile {
+    // Slot of the tile in memory, -1 if it isn't in memory
+    int slot;
+
+    // Version of the tile in memory, or of its copy on disk, 0 if we have
+    // neither
+    unsigned int held;
+
+    // Newest version of the tile we know of, 0 until the server tells us
+    unsigned int latest;
+
+    // Frame the tile was last used in
+    unsigned int lastUsed;
+
+    bool onDisk;
+
+    // Replies to our requests for the tile still to come, only the last
+    // one is used
+    unsigned short requests;
+
+    // Set by expire(), the replies to come may be older than the edits we
+    // missed and are ignored
+    bool expired;
+  };
+
+  short width, height;
+  int tilesX, tilesY;
+  unsigned int epoch, version;
+  std::vector<CachedTile> tiles;
+
+  // Slots of TILE_SIZE x TILE_SIZE pixels, slotsX on every line, with the
+  // tile in every slot (-1 for the free ones)
+  CanvasStorage* slots;
+  int slotsX;
+  std::vector<int> slotTiles;
+  std::vector<int> freeSlots;
+
+  // Tiles that are kept in memory, around the view
+  int keepX0, keepY0, keepX1, keepY1;
+  unsigned int frame;
+
+  // File with a slot for every tile, NULL if the tiles aren't kept on disk
+  FILE* disk;
+
+  // Number of bytes of a tile on disk
+  int getDiskSlotSize();
+
+  // Rectangle of the slot in slots
+  void getSlotRect(int slot, int &x, int &y);
+
+  // Find a slot for a tile, dropping the oldest tiles if there is none
+  // Returns -1 if every tile in memory is kept
+  int allocateSlot();
+
+  // Remove the tile from memory, writing it to disk first if keep is true
+  // and there is a disk
+  void unload(int tile, bool keep);
+
+  // Write the tile in memory to disk
+  void spill(int tile);
+
+  // Copy the tile from disk to memory, returns false if it can't be read
+  bool loadFromDisk(int tile);
+
+  // Move (x, y) to the slot of its tile, which must be in memory
+  void toSlot(int &x, int &y);
+public:
+  // Cache of a canvas of width x height pixels with the format and the
+  // palette of header, using about budget bytes for the tiles in memory
+  TileCache(int _width, int _height, CanvasStorage* header, unsigned int _epoch,
+            unsigned int _version, int budget);
+  ~TileCache();
+
+  // Keep the tiles in the given file, keeping the tiles it already has if
+  // keep is true. Returns false if the file can't be opened
+  bool openDisk(const char* filename, bool keep);
+
+  int getWidth();
+  int getHeight();
+  PixelFormat getFormat();
+  bool isIndexed();
+  const Palette& getPalette();
+
+  unsigned int getEpoch();
+
+  // Version of the newest edit we know of
+  unsigned int getVersion();
+  void setVersion(unsigned int _version);
+
+  int getTilesX();
+  int getTilesY();
+  int getTile(int x, int y);
+
+  // Rectangle of the tile on the canvas
+  void getTileRect(int tile, int &x, int &y, int &w, int &h);
+
+  // Returns true if the tile is in memory
+  bool isLoaded(int tile);
+
+  // Colors of the pixel (x, y), its tile must be in memory
+  Pixel getPixel(int x, int y);
+  unsigned char getIndex(int x, int y);
+
+  // Copy the tile to (x, y) of target, which has the format of the cache
+  // Returns false if the tile isn't in memory
+  bool copyTile(int tile, CanvasStorage* target, int x, int y);
+
+  // Replace the tile, in memory, with the pixels at (x, y) of source
+  void storeTile(int tile, CanvasStorage* source, int x, int y);
+
+  // Apply an edit of the given version received from the server
+  // Edits of tiles that aren't in memory only make their copy on disk old
+  // Returns true if it changed a tile in memory
+  bool receivePixel(int x, int y, const CommandColor &color, unsigned int _version);
+  bool receiveCommand(const RegionCommand &command, unsigned int _version,
+                      int &x, int &y, int &w, int &h);
+
+  // Read the MSG_TILES reply of length bytes to our requests
+  // Returns false if it isn't valid
+  bool receiveTiles(unsigned char* pnt, int length);
+
+  // Start a frame showing the rectangle of w x h pixels at (x, y) while the
+  // view moves by (panX, panY): the tiles of the view and around it are
+  // kept in memory, the missing ones are loaded from disk or asked for in
+  // the MSG_TILE_REQUEST put in request (left empty if there are none)
+  void update(int x, int y, int w, int h, int panX, int panY,
+              std::vector<unsigned char> &request);
+
+  // Forget the tiles in memory and the replies still to come, when the
+  // edits stopped reaching us for a while. Every tile is asked for again,
+  // with the version we have on disk
+  void expire();
+
+  // Write the tiles in memory to disk and save the versions of the tiles
+  // on disk to indexFile, so the next session can use them
+  bool save(const char* indexFile);
+
+  // Load the cache saved by save() with its tiles in diskFile
+  // Returns NULL if they can't be read
+  static TileCache* load(const char* indexFile, const char* diskFile, int budget);
+
+  // Cache of the canvas described by a MSG_CANVAS_INFO of length bytes
+  // Returns NULL if it isn't valid
+  static TileCache* readInfo(unsigned char* pnt, int length, int budget);
+
+  // Apply a command to a canvas of width x height pixels split in tiles,
+  // through functions that copy a tile to (x, y) of a canvas and back
+  // read returns false if the tile is missing: the fills and the stamps
+  // skip it, flood fills can't be applied without it
+  // Returns false if nothing changed
+  static bool applyCommand(RegionCommand command, int width, int height,
+                           PixelFormat format, const Palette &palette,
+                           const std::function<bool(int, CanvasStorage*, int, int)> &read,
+                           const std::function<void(int, CanvasStorage*, int, int)> &write,
+                           int &x, int &y, int &w, int &h);
+};
+
+#endif
@@ -0,0 +1,142 @@
+#include "canvas/tileversions.h"
+#include "canvas/protocol.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+TileVersions::TileVersions(int width, int height, unsigned int _epoch) {
+  tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+  tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+  epoch = _epoch;
+  version = 1;
+  tiles.assign(tilesX * tilesY, version);
+}
+
+unsigned int TileVersions::newEpoch() {
+  std::random_device device;
+  unsigned int epoch = device() ^ (unsigned int)
+    std::chrono::system_clock::now().time_since_epoch().count();
+  return epoch == 0 ? 1 : epoch;
+}
+
+int TileVersions::getTilesX() {
+  return tilesX;
+}
+
+int TileVersions::getTilesY() {
+  return tilesY;
+}
+
+int TileVersions::getTileCount() {
+  return tiles.size();
+}
+
+int TileVersions::getTile(int x, int y) {
+  return y / TILE_SIZE * tilesX + x / TILE_SIZE;
+}
+
+void TileVersions::getTileRect(int tile, int width, int height,
+                               int &x, int &y, int &w, int &h) {
+  x = tile % tilesX * TILE_SIZE;
+  y = tile / tilesX * TILE_SIZE;
+  w = std::min(TILE_SIZE, width - x);
+  h = std::min(TILE_SIZE, height - y);
+}
+
+unsigned int TileVersions::getEpoch() {
+  return epoch;
+}
+
+unsigned int TileVersions::getVersion() {
+  return version;
+}
+
+unsigned int TileVersions::getTileVersion(int tile) {
+  return tiles[tile];
+}
+
+void TileVersions::receive(int x, int y, unsigned int _version) {
+  int tile = getTile(x, y);
+  if(tiles[tile] != 0)
+    tiles[tile] = _version;
+  version = std::max(version, _version);
+}
+
+unsigned int TileVersions::touch(int x, int y) {
+  tiles[getTile(x, y)] = ++version;
+  return version;
+}
+
+void TileVersions::receiveRect(int x, int y, int w, int h, unsigned int _version) {
+  for(int ty = y / TILE_SIZE; ty <= (y + h - 1) / TILE_SIZE; ++ty)
+    for(int tx = x / TILE_SIZE; tx <= (x + w - 1) / TILE_SIZE; ++tx)
+      if(tiles[ty * tilesX + tx] != 0)
+        tiles[ty * tilesX + tx] = _version;
+  version = std::max(version, _version);
+}
+
+unsigned int TileVersions::touchRect(int x, int y, int w, int h) {
+  ++version;
+  for(int ty = y / TILE_SIZE; ty <= (y + h - 1) / TILE_SIZE; ++ty)
+    for(int tx = x / TILE_SIZE; tx <= (x + w - 1) / TILE_SIZE; ++tx)
+      tiles[ty * tilesX + tx] = version;
+  return version;
+}
+
+void TileVersions::markStale(int x, int y) {
+  tiles[getTile(x, y)] = 0;
+}
+
+void TileVersions::markStaleRect(int x, int y, int w, int h) {
+  for(int ty = y / TILE_SIZE; ty <= (y + h - 1) / TILE_SIZE; ++ty)
+    for(int tx = x / TILE_SIZE; tx <= (x + w - 1) / TILE_SIZE; ++tx)
+      tiles[ty * tilesX + tx] = 0;
+}
+
+bool TileVersions::isStale(int tile) {
+  return tiles[tile] == 0;
+}
+
+void TileVersions::reset(unsigned int _epoch, unsigned int _version) {
+  epoch = _epoch;
+  version = _version;
+  std::fill(tiles.begin(), tiles.end(), version);
+}
+
+int TileVersions::getSize() {
+  return sizeof(unsigned int) * 2 + sizeof(short) * 2 +
+         sizeof(unsigned int) * tiles.size();
+}
+
+void TileVersions::write(unsigned char* &pnt) {
+  writeNumber(pnt, epoch);
+  writeNumber(pnt, version);
+  writeNumber(pnt, tilesX);
+  writeNumber(pnt, tilesY);
+  for(unsigned int i = 0; i < tiles.size(); ++i)
+    writeNumber(pnt, tiles[i]);
+}
+
+TileVersions* TileVersions::read(unsigned char* &pnt, int length) {
+  unsigned int epoch, version;
+  short tilesX, tilesY;
+  if(length < (int)(sizeof(unsigned int) * 2 + sizeof(short) * 2))
+    return NULL;
+  readNumber(pnt, epoch);
+  readNumber(pnt, version);
+  readNumber(pnt, tilesX);
+  readNumber(pnt, tilesY);
+  length -= sizeof(unsigned int) * 2 + sizeof(short) * 2;
+  if(tilesX < 0 || tilesY < 0 ||
+     (long long)sizeof(unsigned int) * tilesX * tilesY > length)
+    return NULL;
+  
+  TileVersions* versions = new TileVersions(0, 0, epoch);
+  versions->tilesX = tilesX;
+  versions->tilesY = tilesY;
+  versions->version = version;
+  versions->tiles.resize(tilesX * tilesY);
+  for(unsigned int i = 0; i < versions->tiles.size(); ++i)
+    readNumber(pnt, versions->tiles[i]);
+  return versions;
+}
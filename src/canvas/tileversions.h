@@ -0,0 +1,77 @@
+#ifndef __TILEVERSIONS_H
+#define __TILEVERSIONS_H
+
+#include <vector>
+
+// Side of the square tiles the canvas is split into when it is synced
+// A multiple of 2, so tiles start on whole bytes in every format
+const int TILE_SIZE = 32;
+
+// Version of every tile of a canvas
+// The server counts the edits of its canvas: every edit gets the next
+// version, which becomes the version of its tile. The epoch tells apart
+// canvases whose versions can't be compared (another server, a canvas
+// created again or converted)
+// Versions start at 1, a tile with version 0 is unknown to its holder
+class TileVersions {
+private:
+  short tilesX, tilesY;
+  unsigned int epoch;
+  
+  // Version of the last edit
+  unsigned int version;
+  
+  std::vector<unsigned int> tiles;
+public:
+  // Versions of a new canvas of width x height pixels
+  TileVersions(int width, int height, unsigned int _epoch);
+  
+  // Random nonzero epoch for a new canvas
+  static unsigned int newEpoch();
+  
+  int getTilesX();
+  int getTilesY();
+  int getTileCount();
+  
+  // Tile of the pixel (x, y)
+  int getTile(int x, int y);
+  
+  // Rectangle of the tile inside a canvas of width x height pixels
+  void getTileRect(int tile, int width, int height, int &x, int &y, int &w, int &h);
+  
+  unsigned int getEpoch();
+  unsigned int getVersion();
+  unsigned int getTileVersion(int tile);
+  
+  // Count an edit of the pixel (x, y) received from the server
+  // A stale tile stays stale
+  void receive(int x, int y, unsigned int _version);
+  
+  // Count an edit of the pixel (x, y) on the server, returns its version
+  unsigned int touch(int x, int y);
+  
+  // Same for every tile of the rectangle of w x h pixels at (x, y)
+  void receiveRect(int x, int y, int w, int h, unsigned int _version);
+  unsigned int touchRect(int x, int y, int w, int h);
+  
+  // Mark the tile of (x, y) as unknown, it's sent whole on the next sync
+  void markStale(int x, int y);
+  void markStaleRect(int x, int y, int w, int h);
+  bool isStale(int tile);
+  
+  // Every tile is up to date with the given version of the epoch
+  void reset(unsigned int _epoch, unsigned int _version);
+  
+  // Size in bytes of the versions written by write()
+  int getSize();
+  
+  // Write unsigned int epoch, unsigned int version, short tilesX,
+  // short tilesY and the version of every tile, line by line
+  void write(unsigned char* &pnt);
+  
+  // Read versions written by write() from length bytes
+  // Returns NULL if the bytes don't hold all of them
+  static TileVersions* read(unsigned char* &pnt, int length);
+};
+
+#endif
@@ -1,9 +1,36 @@
 #include <SDL2/SDL.h>
 #include "colorpicker.h"
 #include <enet/enet.h>
+#include <algorithm>
+#include <cstring>
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <map>
+#include "canvas/canvassync.h"
+#include "canvas/regioncommand.h"
+#include "canvas/messagebatch.h"
+#include "canvas/regionmask.h"
+#include "canvas/tilecache.h"
+#include "canvas/mipstream.h"
+#include "baseclasses/spscqueue.h"
+#include "baseclasses/profiler.h"
 
 const char* IP_ADDRESS = "localhost";
 
+// Tiles of the canvas kept by the last session, so reconnecting only
+// downloads the tiles that changed, for every canvas: the versions of the
+// tiles in canvascache_<name>.dat and the tiles in canvascache_<name>.tiles
+const char* CACHE_FILE = "canvascache_%s.dat";
+const char* TILES_FILE = "canvascache_%s.tiles";
+
+// Megabytes of tiles kept in memory when --memory isn't given
+const int DEFAULT_MEMORY_MB = 64;
+
+// --admin-key: key sent with the regions we lock, empty if we can't
+std::string adminKey;
+
 void initENET() {
 	if(enet_initialize() < 0) {
 		fprintf(stderr, "Enet failed to initialize\n");
@@ -27,8 +54,27 @@ const int SCREEN_HEIGHT = 600;
 const int PICKER_WIDTH  = 256 + 10;
 const int PICKER_HEIGHT = 200;
 
+// Pixels the camera moves every 10 milliseconds
 const float CAMERA_SPEED = 3.5f;
 
+// Zoom levels showing the pixels of the canvas, down to 3 x 3 on the screen
+const int RAW_ZOOMS = 3;
+
+// Every zoom level halves the size of the pixels on the screen, the first
+// RAW_ZOOMS show the pixels of the canvas, the next ones the levels of its
+// pyramid sent by the server
+const int MAX_ZOOM = RAW_ZOOMS + MAX_MIP_LEVELS;
+
+// Most updates from the server applied in one frame, the rest wait for
+// the next frames so a burst of updates doesn't stall the rendering
+const int MAX_UPDATES_PER_FRAME = 4096;
+
+// Capacity of the queues between the network thread and the main thread
+const int UPDATE_QUEUE_SIZE = 1 << 16;
+
+// Frame length used when the renderer can't wait for vsync
+const float FALLBACK_FRAME_MS = 1000.0f / 120.0f;
+
 const int HUE_R1 =  90;
 const int HUE_R2 = 100;
 
@@ -40,6 +86,12 @@ const int SAT_VAL_H = sqrt(2.0f) * SAT_VAL_RAY - 2;
 
 const int HUE_PRECISION = 2000;
 
+// Swatches of the palette, shown under the picker for indexed canvases
+const int SWATCH_SIZE = 12;
+const int SWATCHES_PER_LINE = 16;
+const int SWATCH_X = SCREEN_WIDTH / 2 - SWATCH_SIZE * SWATCHES_PER_LINE / 2;
+const int SWATCH_Y = SCREEN_HEIGHT / 2 + HUE_R2 + 20;
+
 void initSDL() {
   
   if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
@@ -54,7 +106,8 @@ void initSDL() {
     exit(1);
   }
   
-  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED |
+                                            SDL_RENDERER_PRESENTVSYNC);
   if(renderer == NULL) {
     SDL_Log("Unable to create renderer: %s\n", SDL_GetError());
     exit(1);
@@ -71,110 +124,901 @@ void deinitSDL() {
   SDL_Quit();
 }
 
-struct Pixel {
-  unsigned char r, g, b;
+// A change of one pixel of the canvas, or a command changing many
+struct CanvasUpdate {
+  // MSG_PIXEL, MSG_PIXEL_INDEX, the type of the command, MSG_ACK,
+  // MSG_TILES or MSG_MIP_TILES
+  unsigned char type;
+  short lPixel, cPixel;
+  Pixel color;
+  unsigned char index;
+  
+  // The command, deleted by whoever applies or sends the update
+  RegionCommand* command;
+  
+  // The MSG_TILES or MSG_MIP_TILES packet, deleted by whoever applies the
+  // update
+  std::vector<unsigned char>* tiles;
+  
+  // Version of the edit given by the server, 0 if it rejected our write
+  unsigned int version;
+  
+  // Number of our write, for the ones we paint and their MSG_ACK
+  unsigned int sequence;
 };
 
-template<typename T>
-void readNumber(unsigned char* &data, T &x) {
-  // bruh
-  x = static_cast<T*>(static_cast<void*>(data))[0];
-  data = data + sizeof(T);
-}
+// A write we painted that isn't in the state confirmed by the server yet
+struct PendingWrite {
+  CanvasUpdate update;
+  
+  // True once the server acknowledged it with update.version
+  bool acknowledged;
+};
 
-template<typename T>
-void writeNumber(unsigned char* &data, T &x) {
-  // bruh
-  static_cast<T*>(static_cast<void*>(data))[0] = x;
-  data = data + sizeof(T);
+// Color of the pixels whose tile we don't have yet
+const Pixel MISSING_COLOR = {0x40, 0x40, 0x40};
+
+// Copy the rectangle of w x h pixels at (x, y) of source to (targetX,
+// targetY) of target, which has the same format
+void copyRegion(CanvasStorage* source, int x, int y, int w, int h,
+                CanvasStorage* target, int targetX, int targetY) {
+  std::vector<unsigned char> buffer(source->getRegionSize(w, h));
+  unsigned char* pnt = buffer.data();
+  source->writeRegion(x, y, w, h, pnt);
+  pnt = buffer.data();
+  target->readRegion(targetX, targetY, w, h, pnt);
 }
 
+// The canvas as confirmed by the server, with the writes we painted shown
+// on top of it until the server confirms them, so painting is immediate and
+// the canvas still converges to the one of the server when writes are
+// rejected or overwritten by others
+// Only the tiles around the view are kept, in a TileCache, and the writes
+// are shown on copies of the tiles they touch
 class Canvas {
 private:
-  short width;
-  short height;
+  // Confirmed state, what is synced and cached
+  TileCache* cache;
   
-  Pixel** data;
-public:
-  Canvas(unsigned char* dataInput) {
-    if(dataInput != NULL) {    
-      readNumber(dataInput, width);
-      readNumber(dataInput, height);
-      
-      data = new Pixel*[height];
-      for(int i = 0; i < height; ++i) {
-        data[i] = new Pixel[width];
-        for(int j = 0; j < width; ++j) {
-          readNumber(dataInput, data[i][j].r);
-          readNumber(dataInput, data[i][j].g);
-          readNumber(dataInput, data[i][j].b);
-        }
+  // Where the tiles are kept between sessions, NULL if they aren't
+  const char* indexFile;
+  const char* tilesFile;
+  
+  // Bytes of tiles kept in memory
+  int budget;
+  
+  // Tiles touched by the pending writes with the writes applied, what is
+  // shown instead of the tiles of the cache
+  std::map<int, CanvasStorage*> overlay;
+  
+  // Level of the pyramid shown when zoomed out
+  MipView mip;
+  
+  // Writes sent to the server and not confirmed yet, in order
+  std::deque<PendingWrite> pending;
+  unsigned int nextSequence;
+  
+  // Set when overlay must be built again from the confirmed state
+  bool dirty;
+  
+  // Apply a pixel write to the tile at (tileX, tileY) of the canvas
+  static void applyPixel(CanvasStorage* tile, int tileX, int tileY,
+                         const CanvasUpdate &update) {
+    int x = update.cPixel - tileX, y = update.lPixel - tileY;
+    if(update.type == MSG_PIXEL)
+      tile->setPixel(x, y, update.color);
+    else if(update.type == MSG_PIXEL_INDEX && tile->isIndexed() &&
+            tile->getPalette().validIndex(update.index))
+      tile->setIndex(x, y, update.index);
+  }
+  
+  // Show a pending write, copying the tiles it touches from the cache
+  // Tiles that aren't in the cache don't show it
+  void showWrite(const CanvasUpdate &update) {
+    int x0 = update.cPixel, x1 = update.cPixel + 1;
+    int y0 = update.lPixel, y1 = update.lPixel + 1;
+    if(update.command != NULL) {
+      x0 = update.command->column;
+      x1 = update.command->column + update.command->columns;
+      y0 = update.command->line;
+      y1 = update.command->line + update.command->lines;
+    }
+    x0 = std::max(x0, 0);
+    x1 = std::min(x1, getWidth());
+    y0 = std::max(y0, 0);
+    y1 = std::min(y1, getHeight());
+    if(x0 >= x1 || y0 >= y1)
+      return;
+    
+    int tileX, tileY, w, h;
+    for(int ty = y0 / TILE_SIZE; ty <= (y1 - 1) / TILE_SIZE; ++ty)
+      for(int tx = x0 / TILE_SIZE; tx <= (x1 - 1) / TILE_SIZE; ++tx) {
+        int tile = ty * cache->getTilesX() + tx;
+        if(overlay.count(tile) != 0 || !cache->isLoaded(tile))
+          continue;
+        cache->getTileRect(tile, tileX, tileY, w, h);
+        CanvasStorage* copy = new CanvasStorage(w, h, cache->getFormat());
+        copy->setPalette(cache->getPalette());
+        cache->copyTile(tile, copy, 0, 0);
+        overlay[tile] = copy;
       }
-    } else {
-      width = height = 16;
-      data = new Pixel*[height];
-      for(int i = 0; i < height; ++i) {
-        data[i] = new Pixel[width];
-        for(int j = 0; j < width; ++j) {
-          if(i == j)
-            data[i][j] = {0xff, 0xff, 0xff};
-          else
-            data[i][j] = {0, 0, 0};
-        }
+    
+    if(update.command == NULL) {
+      std::map<int, CanvasStorage*>::iterator it = overlay.find(cache->getTile(x0, y0));
+      if(it != overlay.end()) {
+        cache->getTileRect(it->first, tileX, tileY, w, h);
+        applyPixel(it->second, tileX, tileY, update);
       }
+      return;
+    }
+    
+    int x, y;
+    TileCache::applyCommand(*update.command, getWidth(), getHeight(), cache->getFormat(),
+                            cache->getPalette(),
+      [&](int tile, CanvasStorage* area, int areaX, int areaY) {
+        std::map<int, CanvasStorage*>::iterator it = overlay.find(tile);
+        if(it == overlay.end())
+          return false;
+        copyRegion(it->second, 0, 0, it->second->getWidth(), it->second->getHeight(),
+                   area, areaX, areaY);
+        return true;
+      },
+      [&](int tile, CanvasStorage* area, int areaX, int areaY) {
+        CanvasStorage* copy = overlay[tile];
+        copyRegion(area, areaX, areaY, copy->getWidth(), copy->getHeight(), copy, 0, 0);
+      }, x, y, w, h);
+  }
+  
+  void clearOverlay() {
+    for(std::map<int, CanvasStorage*>::iterator it = overlay.begin(); it != overlay.end(); ++it)
+      delete it->second;
+    overlay.clear();
+  }
+  
+  void rebuild() {
+    PROFILE_ZONE("Canvas::rebuild");
+    clearOverlay();
+    for(unsigned int i = 0; cache != NULL && i < pending.size(); ++i)
+      showWrite(pending[i].update);
+    dirty = false;
+  }
+  
+  // Tile shown for the pixel (x, y) from the overlay, NULL if it has none
+  CanvasStorage* getOverlay(int &x, int &y) {
+    if(dirty)
+      rebuild();
+    if(overlay.empty())
+      return NULL;
+    std::map<int, CanvasStorage*>::iterator it = overlay.find(cache->getTile(x, y));
+    if(it == overlay.end())
+      return NULL;
+    int tileX, tileY, w, h;
+    cache->getTileRect(it->first, tileX, tileY, w, h);
+    x -= tileX;
+    y -= tileY;
+    return it->second;
+  }
+  
+  // Show the confirmed state of the rectangle with the pending writes on top
+  void refresh(int x, int y, int w, int h) {
+    if(dirty)
+      return;
+    
+    // Tiles without pending writes are shown from the cache
+    bool touched = false;
+    for(std::map<int, CanvasStorage*>::iterator it = overlay.begin();
+        !touched && it != overlay.end(); ++it) {
+      int tileX, tileY, tileW, tileH;
+      cache->getTileRect(it->first, tileX, tileY, tileW, tileH);
+      touched = tileX < x + w && x < tileX + tileW && tileY < y + h && y < tileY + tileH;
+    }
+    if(!touched)
+      return;
+    
+    // Commands may depend on the pixels around them, so they are replayed
+    // on every tile they touch
+    bool single = w == 1 && h == 1;
+    for(unsigned int i = 0; single && i < pending.size(); ++i)
+      single = pending[i].update.command == NULL;
+    if(!single || !cache->isLoaded(cache->getTile(x, y))) {
+      dirty = true;
+      return;
+    }
+    
+    int localX = x, localY = y;
+    CanvasStorage* tile = getOverlay(localX, localY);
+    if(tile == NULL)
+      return;
+    if(cache->isIndexed())
+      tile->setIndex(localX, localY, cache->getIndex(x, y));
+    else
+      tile->setPixel(localX, localY, cache->getPixel(x, y));
+    for(unsigned int i = 0; i < pending.size(); ++i)
+      if(pending[i].update.cPixel == x && pending[i].update.lPixel == y)
+        applyPixel(tile, x - localX, y - localY, pending[i].update);
+  }
+  
+  // Stop showing the pending write, after it was confirmed or rejected
+  void drop(unsigned int i) {
+    CanvasUpdate update = pending[i].update;
+    pending.erase(pending.begin() + i);
+    if(pending.empty()) {
+      // The cache shows everything again
+      delete update.command;
+      clearOverlay();
+      dirty = false;
+    } else if(update.command != NULL) {
+      delete update.command;
+      dirty = true;
+    } else if(0 <= update.cPixel && update.cPixel < getWidth() &&
+              0 <= update.lPixel && update.lPixel < getHeight())
+      refresh(update.cPixel, update.lPixel, 1, 1);
+  }
+public:
+  // Use about _budget bytes for the tiles in memory, and keep them in
+  // _tilesFile with their versions in _indexFile if they aren't NULL
+  // The tiles kept by the last session are loaded
+  Canvas(const char* _indexFile, const char* _tilesFile, int _budget) {
+    indexFile = _indexFile;
+    tilesFile = _tilesFile;
+    budget = _budget;
+    cache = tilesFile == NULL ? NULL : TileCache::load(indexFile, tilesFile, budget);
+    nextSequence = 1;
+    dirty = false;
+  }
+  
+  ~Canvas() {
+    while(!pending.empty()) {
+      delete pending.back().update.command;
+      pending.pop_back();
+    }
+    clearOverlay();
+    delete cache;
+  }
+  
+  // Apply the MSG_CANVAS_INFO reply of the server to our MSG_HELLO_TILES
+  // The tiles we kept are used if they are of the same canvas
+  // Returns false if it isn't valid
+  bool sync(unsigned char* packet, int length) {
+    TileCache* info = TileCache::readInfo(packet, length, budget);
+    if(info == NULL)
+      return false;
+    
+    if(cache != NULL && cache->getEpoch() == info->getEpoch() &&
+       cache->getWidth() == info->getWidth() && cache->getHeight() == info->getHeight() &&
+       cache->getFormat() == info->getFormat()) {
+      cache->setVersion(info->getVersion());
+      delete info;
+    } else {
+      delete cache;
+      cache = info;
+      if(tilesFile != NULL && !cache->openDisk(tilesFile, false))
+        fprintf(stderr, "Failed to open %s, tiles aren't kept on disk\n", tilesFile);
     }
+    rebuild();
+    return true;
   }
   
-  void setPixel(int x, int y, Pixel p) {
-    data[y][x] = p;
+  // Replace the canvas with a placeholder, when the server doesn't send one
+  void usePlaceholder() {
+    CanvasStorage placeholder(16, 16);
+    for(int i = 0; i < 16; ++i)
+      placeholder.setPixel(i, i, {0xff, 0xff, 0xff});
+    TileVersions versions(16, 16, 0);
+    
+    // The placeholder serves its own tiles
+    delete cache;
+    cache = new TileCache(16, 16, &placeholder, 0, versions.getVersion(), budget);
+    std::vector<unsigned char> request, reply;
+    cache->update(0, 0, 16, 16, 0, 0, request);
+    if(writeTiles(&placeholder, &versions, request.data(), request.size(), reply))
+      cache->receiveTiles(reply.data(), reply.size());
+    tilesFile = NULL;
+    rebuild();
+  }
+  
+  // Save the tiles and their versions, if they are kept on disk
+  bool save() {
+    return cache->save(indexFile);
   }
   
-  void display(SDL_Renderer* renderer, int xCamera, int yCamera) {
-    for(int i = 0; i < height; ++i)
-      for(int j = 0; j < width; ++j) {
-        int realX = j * PIXEL_WIDTH - xCamera;
-        int realY = i * PIXEL_HEIGHT - yCamera;
-        SDL_Rect rect = {realX, realY, PIXEL_WIDTH, PIXEL_HEIGHT};
-        SDL_SetRenderDrawColor(renderer, data[i][j].r, data[i][j].g, 
-                                         data[i][j].b, 0xff);
+  // Keep the tiles around the w x h pixels at (x, y) as the view moves by
+  // (panX, panY), the tiles to ask the server for are put in request
+  void update(int x, int y, int w, int h, int panX, int panY,
+              std::vector<unsigned char> &request) {
+    cache->update(x, y, w, h, panX, panY, request);
+    
+    // The overlay of the tiles the cache dropped would miss the edits of
+    // the others
+    for(std::map<int, CanvasStorage*>::iterator it = overlay.begin();
+        !dirty && it != overlay.end(); ++it)
+      dirty = !cache->isLoaded(it->first);
+  }
+  
+  // Show level of the pyramid of the canvas instead of its pixels, or the
+  // pixels again with level 0
+  void setLevel(int level) {
+    if(level == mip.getLevel())
+      return;
+    // The edits of the pixels didn't reach us while zoomed out
+    if(level == 0) {
+      cache->expire();
+      dirty = true;
+    }
+    mip.setLevel(level, getWidth(), getHeight());
+  }
+  
+  int getLevel() {
+    return mip.getLevel();
+  }
+  
+  // Forget the tiles of the level outside the view we subscribed to
+  void keepView(LevelSubscription &view) {
+    mip.keep(view);
+  }
+  
+  // Show a write we are about to send and give it its sequence number
+  void paint(CanvasUpdate &update) {
+    update.sequence = nextSequence++;
+    if(!dirty)
+      showWrite(update);
+    
+    PendingWrite write;
+    write.update = update;
+    write.acknowledged = false;
+    if(update.command != NULL)
+      write.update.command = new RegionCommand(*update.command);
+    pending.push_back(write);
+  }
+  
+  // Draw the canvas seen from (xCamera, yCamera) with pixels of
+  // PIXEL_WIDTH x PIXEL_HEIGHT multiplied by scale, only the ones on the
+  // screen are drawn. Zoomed out, the pixels of the level are drawn instead
+  void display(SDL_Renderer* renderer, float xCamera, float yCamera, float scale) {
+    PROFILE_ZONE("Canvas::display");
+    int level = mip.getLevel();
+    int width = level == 0 ? getWidth() : mip.getWidth();
+    int height = level == 0 ? getHeight() : mip.getHeight();
+    float cellWidth = PIXEL_WIDTH << level, cellHeight = PIXEL_HEIGHT << level;
+    
+    int firstX = std::max(0, (int)floor(xCamera / cellWidth));
+    int firstY = std::max(0, (int)floor(yCamera / cellHeight));
+    int lastX = std::min(width - 1, (int)floor((xCamera + SCREEN_WIDTH / scale) / cellWidth));
+    int lastY = std::min(height - 1, (int)floor((yCamera + SCREEN_HEIGHT / scale) / cellHeight));
+    for(int i = firstY; i <= lastY; ++i)
+      for(int j = firstX; j <= lastX; ++j) {
+        int realX = (int)floor((j * cellWidth - xCamera) * scale);
+        int realY = (int)floor((i * cellHeight - yCamera) * scale);
+        SDL_Rect rect = {realX, realY,
+                         (int)floor(((j + 1) * cellWidth - xCamera) * scale) - realX,
+                         (int)floor(((i + 1) * cellHeight - yCamera) * scale) - realY};
+        Pixel p = MISSING_COLOR;
+        if(level == 0)
+          p = getPixel(j, i);
+        else
+          mip.getPixel(j, i, p);
+        SDL_SetRenderDrawColor(renderer, p.r, p.g, p.b, 0xff);
         SDL_RenderFillRect(renderer, &rect);
       }
   }
   
   int getWidth() {
-    return width;
+    return cache->getWidth();
   }
   
   int getHeight() {
-    return height;
+    return cache->getHeight();
+  }
+  
+  // Returns true if we have the tile of the pixel (x, y)
+  bool isLoaded(int x, int y) {
+    return cache->isLoaded(cache->getTile(x, y));
   }
   
+  // Color shown for the pixel (x, y), MISSING_COLOR if we don't have it
   Pixel getPixel(int x, int y) {
-    return data[y][x];
+    int tileX = x, tileY = y;
+    CanvasStorage* tile = getOverlay(tileX, tileY);
+    if(tile != NULL)
+      return tile->getPixel(tileX, tileY);
+    if(!isLoaded(x, y))
+      return MISSING_COLOR;
+    return cache->getPixel(x, y);
+  }
+  
+  // Palette index shown for the pixel (x, y), only for indexed canvases
+  // and pixels we have
+  unsigned char getIndex(int x, int y) {
+    int tileX = x, tileY = y;
+    CanvasStorage* tile = getOverlay(tileX, tileY);
+    if(tile != NULL)
+      return tile->getIndex(tileX, tileY);
+    return cache->getIndex(x, y);
+  }
+  
+  // Returns true if the canvas only accepts the colors of its palette
+  bool isIndexed() {
+    return cache->isIndexed();
+  }
+  
+  const Palette& getPalette() {
+    return cache->getPalette();
+  }
+  
+  // Number of our writes the server hasn't confirmed yet
+  int getPendingCount() {
+    return pending.size();
+  }
+  
+  // Apply a change, an acknowledgement or tiles received from the server
+  void apply(const CanvasUpdate &update) {
+    if(update.type == MSG_ACK && update.sequence == 0) {
+      // Our admin messages aren't painted, only their rejection is shown
+      if(update.version == 0)
+        fprintf(stderr, "The server refused to change the locked regions\n");
+    } else if(update.type == MSG_ACK) {
+      for(unsigned int i = 0; i < pending.size(); ++i)
+        if(pending[i].update.sequence == update.sequence) {
+          pending[i].acknowledged = true;
+          pending[i].update.version = update.version;
+          if(update.version == 0)
+            drop(i);
+          break;
+        }
+    } else if(update.type == MSG_MIP_TILES) {
+      if(!mip.receive(update.tiles->data(), update.tiles->size()))
+        fprintf(stderr, "Received invalid tiles of level %d\n", mip.getLevel());
+      delete update.tiles;
+    } else if(update.type == MSG_TILES) {
+      // The new tiles may be under our pending writes
+      if(!cache->receiveTiles(update.tiles->data(), update.tiles->size()))
+        fprintf(stderr, "Received invalid tiles\n");
+      if(!pending.empty())
+        dirty = true;
+      delete update.tiles;
+    } else {
+      int x, y, w, h;
+      bool changed;
+      if(update.command != NULL)
+        changed = cache->receiveCommand(*update.command, update.version, x, y, w, h);
+      else {
+        CommandColor color = {(MessageType)update.type, update.color, update.index};
+        x = update.cPixel;
+        y = update.lPixel;
+        w = h = 1;
+        changed = cache->receivePixel(x, y, color, update.version);
+      }
+      if(changed && !pending.empty())
+        refresh(x, y, w, h);
+      delete update.command;
+    }
+    
+    // Writes the confirmed state has caught up with aren't pending anymore
+    while(!pending.empty() && pending.front().acknowledged &&
+          pending.front().update.version <= cache->getVersion())
+      drop(0);
   }
 };
 
-ENetPeer* peer;
+// Owns the ENet host and runs on its own thread
+// Packets from the server are decoded into incoming, the main thread
+// pushes the pixels it paints into outgoing
+class NetworkThread {
+private:
+  ENetHost* client;
+  ENetPeer* peer;
+  
+  std::thread thread;
+  
+  // Set by the main thread when we should disconnect
+  std::atomic<bool> stopping;
+  
+  // Set when the connection to the server is lost
+  std::atomic<bool> disconnected;
+  
+  // Updates that didn't fit in incoming, in order
+  std::deque<CanvasUpdate> overflow;
+  
+  // Number of updates waiting in overflow
+  std::atomic<int> overflowSize;
+  
+  // Admin messages pushed by the main thread, sent as they are
+  std::mutex packetLock;
+  std::vector<std::vector<unsigned char> > packets;
+  
+  void sendUpdate(const CanvasUpdate &update) {
+    if(update.command != NULL) {
+      ENetPacket* packet = enet_packet_create(NULL, update.command->getSize() +
+                                                    SEQUENCE_SIZE,
+                                              ENET_PACKET_FLAG_RELIABLE);
+      unsigned char* pnt = packet->data;
+      update.command->write(pnt);
+      writeNumber(pnt, update.sequence);
+      enet_peer_send(peer, 0, packet);
+      delete update.command;
+      return;
+    }
+    
+    unsigned char packetsend[PIXEL_PACKET_SIZE + SEQUENCE_SIZE];
+    unsigned char* pnt = packetsend;
+    int size;
+    
+    writeNumber(pnt, update.type);
+    writeNumber(pnt, update.lPixel);
+    writeNumber(pnt, update.cPixel);
+    if(update.type == MSG_PIXEL_INDEX) {
+      writeNumber(pnt, update.index);
+      size = PIXEL_INDEX_PACKET_SIZE;
+    } else {
+      writeNumber(pnt, update.color.r);
+      writeNumber(pnt, update.color.g);
+      writeNumber(pnt, update.color.b);
+      size = PIXEL_PACKET_SIZE;
+    }
+    writeNumber(pnt, update.sequence);
+    size += SEQUENCE_SIZE;
+    
+    ENetPacket* packet = enet_packet_create(packetsend, size,
+                                            ENET_PACKET_FLAG_RELIABLE);
+    enet_peer_send(peer, 0, packet);
+  }
+  
+  // Decode a message of length bytes from the server
+  void receive(unsigned char* message, int length) {
+    unsigned char* packetdata = message;
+    CanvasUpdate update;
+    update.command = NULL;
+    update.tiles = NULL;
+    
+    if(length > 0 && packetdata[0] == MSG_BATCH) {
+      unsigned char* part;
+      int partLength;
+      ++packetdata;
+      while(MessageBatch::next(packetdata, message + length, part, partLength))
+        receive(part, partLength);
+      return;
+    }
+    
+    if(length > 0 && (packetdata[0] == MSG_TILES || packetdata[0] == MSG_MIP_TILES)) {
+      update.type = packetdata[0];
+      update.tiles = new std::vector<unsigned char>(message, message + length);
+      
+      if(!overflow.empty() || !incoming.push(update))
+        overflow.push_back(update);
+      return;
+    }
+    
+    if(length >= ACK_PACKET_SIZE && packetdata[0] == MSG_ACK) {
+      readNumber(packetdata, update.type);
+      readNumber(packetdata, update.sequence);
+      readNumber(packetdata, update.version);
+      
+      if(!overflow.empty() || !incoming.push(update))
+        overflow.push_back(update);
+      return;
+    }
+    
+    if(length > 0 && (packetdata[0] == MSG_FILL_RECT ||
+                      packetdata[0] == MSG_STAMP ||
+                      packetdata[0] == MSG_FLOOD_FILL)) {
+      update.type = packetdata[0];
+      update.command = new RegionCommand();
+      if(!update.command->read(packetdata, length)) {
+        delete update.command;
+        return;
+      }
+      update.version = 0;
+      if(packetdata + VERSION_SIZE <= message + length)
+        readNumber(packetdata, update.version);
+      
+      if(!overflow.empty() || !incoming.push(update))
+        overflow.push_back(update);
+      return;
+    }
+    
+    if(length < PIXEL_INDEX_PACKET_SIZE)
+      return;
+    readNumber(packetdata, update.type);
+    readNumber(packetdata, update.lPixel);
+    readNumber(packetdata, update.cPixel);
+    
+    if(update.type == MSG_PIXEL && length >= PIXEL_PACKET_SIZE) {
+      readNumber(packetdata, update.color.r);
+      readNumber(packetdata, update.color.g);
+      readNumber(packetdata, update.color.b);
+    } else if(update.type == MSG_PIXEL_INDEX)
+      readNumber(packetdata, update.index);
+    else
+      return;
+    
+    update.version = 0;
+    if(packetdata + VERSION_SIZE <= message + length)
+      readNumber(packetdata, update.version);
+    
+    if(!overflow.empty() || !incoming.push(update))
+      overflow.push_back(update);
+  }
+  
+  void run() {
+    ENetEvent enetevent;
+    CanvasUpdate update;
+    
+    while(!stopping && !disconnected) {
+      while(outgoing.pop(update))
+        sendUpdate(update);
+      
+      {
+        std::lock_guard<std::mutex> guard(packetLock);
+        for(unsigned int i = 0; i < packets.size(); ++i)
+          enet_peer_send(peer, 0, enet_packet_create(packets[i].data(), packets[i].size(),
+                                                     ENET_PACKET_FLAG_RELIABLE));
+        packets.clear();
+      }
+      
+      while(!overflow.empty() && incoming.push(overflow.front()))
+        overflow.pop_front();
+      overflowSize = overflow.size();
+      
+      // Wait at most 1 ms so painted pixels leave quickly
+      if(enet_host_service(client, &enetevent, 1) > 0) {
+        do {
+          if(enetevent.type == ENET_EVENT_TYPE_RECEIVE) {
+            receive(enetevent.packet->data, enetevent.packet->dataLength);
+            enet_packet_destroy(enetevent.packet);
+          } else if(enetevent.type == ENET_EVENT_TYPE_DISCONNECT) {
+            fprintf(stderr, "Disconnected from server\n");
+            disconnected = true;
+          }
+        } while(!disconnected && enet_host_service(client, &enetevent, 0) > 0);
+      }
+    }
+    
+    if(disconnected)
+      return;
+    
+    enet_peer_disconnect(peer, 0);
+    bool disconnect = false;
+    while(!disconnect && enet_host_service(client, &enetevent, 2000) > 0) {
+      if(enetevent.type == ENET_EVENT_TYPE_DISCONNECT) {
+        fprintf(stderr, "Disconnected succesfully from server\n");
+        disconnect = true;
+      } else if(enetevent.type == ENET_EVENT_TYPE_RECEIVE)
+        enet_packet_destroy(enetevent.packet);
+    }
+    
+    if(!disconnect) {
+      fprintf(stderr, "Disconnected forcefuly from server\n");
+      enet_peer_reset(peer);
+    }
+    disconnected = true;
+  }
+public:
+  // Updates from the server, popped by the main thread
+  SPSCQueue<CanvasUpdate> incoming;
+  
+  // Pixels painted by the user, pushed by the main thread
+  SPSCQueue<CanvasUpdate> outgoing;
+  
+  NetworkThread(ENetHost* _client, ENetPeer* _peer) :
+    incoming(UPDATE_QUEUE_SIZE), outgoing(UPDATE_QUEUE_SIZE) {
+    client = _client;
+    peer = _peer;
+    stopping = false;
+    disconnected = false;
+    overflowSize = 0;
+  }
+  
+  void start() {
+    thread = std::thread(&NetworkThread::run, this);
+  }
+  
+  // Disconnect from the server and wait for the thread to finish
+  void stop() {
+    stopping = true;
+    if(thread.joinable())
+      thread.join();
+  }
+  
+  // Send a pixel to the server
+  void send(const CanvasUpdate &update) {
+    while(!outgoing.push(update))
+      std::this_thread::yield();
+  }
+  
+  // Send a packet that doesn't change the canvas, after the pixels already
+  // pushed
+  void sendPacket(const std::vector<unsigned char> &packet) {
+    std::lock_guard<std::mutex> guard(packetLock);
+    packets.push_back(packet);
+  }
+  
+  bool isDisconnected() {
+    return disconnected;
+  }
+  
+  // Number of received updates that weren't applied yet
+  int getBacklog() {
+    return incoming.size() + overflowSize;
+  }
+};
+
+// Frame time and backlog of the last frames, drawn over the canvas
+class FrameStats {
+private:
+  static const int HISTORY = 128;
+  
+  float frameMs[HISTORY];
+  int backlog[HISTORY];
+  int last;
+  
+  // Time and frames since the title was updated
+  float titleMs;
+  int titleFrames;
+public:
+  bool visible;
+  
+  FrameStats() {
+    for(int i = 0; i < HISTORY; ++i) {
+      frameMs[i] = 0.0f;
+      backlog[i] = 0;
+    }
+    last = 0;
+    titleMs = 0.0f;
+    titleFrames = 0;
+    visible = false;
+  }
+  
+  void addFrame(float ms, int _backlog) {
+    last = (last + 1) % HISTORY;
+    frameMs[last] = ms;
+    backlog[last] = _backlog;
+    
+    titleMs += ms;
+    ++titleFrames;
+    if(titleMs >= 1000.0f) {
+      char title[128];
+      snprintf(title, sizeof(title), "Deeznuts | %.2f ms/frame | backlog %d",
+               titleMs / titleFrames, _backlog);
+      SDL_SetWindowTitle(window, title);
+      titleMs = 0.0f;
+      titleFrames = 0;
+    }
+  }
+  
+  // Frame times are bars of 4 pixels per millisecond, the line marks
+  // 60 frames per second. The bar under them is the backlog compared to
+  // the size of the queue
+  void display(SDL_Renderer* renderer) {
+    if(!visible)
+      return;
+    
+    const int baseY = SCREEN_HEIGHT - 10;
+    SDL_Rect background = {0, baseY - 100, HISTORY * 2, 110};
+    SDL_SetRenderDrawColor(renderer, 0x20, 0x20, 0x20, 0xff);
+    SDL_RenderFillRect(renderer, &background);
+    
+    for(int i = 0; i < HISTORY; ++i) {
+      int frame = (last + 1 + i) % HISTORY;
+      int h = std::min(100, (int)(frameMs[frame] * 4.0f));
+      SDL_Rect bar = {i * 2, baseY - h, 2, h};
+      if(frameMs[frame] <= 1000.0f / 60.0f + 1.0f)
+        SDL_SetRenderDrawColor(renderer, 0x00, 0xc0, 0x00, 0xff);
+      else
+        SDL_SetRenderDrawColor(renderer, 0xe0, 0x20, 0x20, 0xff);
+      SDL_RenderFillRect(renderer, &bar);
+    }
+    
+    SDL_SetRenderDrawColor(renderer, 0xff, 0xff, 0xff, 0xff);
+    SDL_RenderDrawLine(renderer, 0, baseY - (int)(4000.0f / 60.0f),
+                       HISTORY * 2, baseY - (int)(4000.0f / 60.0f));
+    
+    int backlogWidth = (int)((long long)backlog[last] * HISTORY * 2 /
+                             UPDATE_QUEUE_SIZE);
+    SDL_Rect backlogBar = {0, baseY + 2, std::min(HISTORY * 2, backlogWidth), 6};
+    SDL_SetRenderDrawColor(renderer, 0xe0, 0xe0, 0x00, 0xff);
+    SDL_RenderFillRect(renderer, &backlogBar);
+  }
+};
+
+NetworkThread* network;
 class Camera {
 private:
+  // Corner of the screen, in pixels of the screen at zoom 0
   float x, y;
   Canvas* canvas;
   
+  // Direction the camera moved in the last frame, -1, 0 or 1 on each axis
+  int panX, panY;
+  
+  // 0 up to MAX_ZOOM, changed with the mouse wheel
+  int zoom;
+  
+  // What we last asked the server to send, level 0 at first
+  LevelSubscription subscription;
+  
   bool pressing, colorPicker, pipette;
   
+  // Corner of the rectangle being selected while selectKey is held: R to
+  // fill it, L to lock it and U to unlock it
+  bool selecting;
+  int selectKey;
+  int selectX, selectY;
+  
   Pixel color;
   double globalHue, globalS, globalV;
   
+  // Palette entry of color, for indexed canvases
+  unsigned char colorIndex;
+  
+  // Pick the given color, snapped to the palette for indexed canvases
+  void setColor(Pixel p) {
+    if(canvas->isIndexed()) {
+      colorIndex = canvas->getPalette().nearest(p);
+      p = canvas->getPalette().getColor(colorIndex);
+    }
+    color = p;
+  }
+  
+  // Size of the pixels on the screen compared to zoom 0
+  float getScale() {
+    return 1.0f / (1 << zoom);
+  }
+  
+  // Find the pixel of the canvas under (xMouse, yMouse)
+  // Returns false if the mouse isn't over the canvas, or if the canvas is
+  // shown zoomed out as a level of its pyramid
+  bool pixelAt(int xMouse, int yMouse, int &xPixel, int &yPixel) {
+    xPixel = (int)floor((x + xMouse / getScale()) / PIXEL_WIDTH);
+    yPixel = (int)floor((y + yMouse / getScale()) / PIXEL_HEIGHT);
+    return canvas->getLevel() == 0 &&
+           0 <= xPixel && xPixel < canvas->getWidth() &&
+           0 <= yPixel && yPixel < canvas->getHeight();
+  }
+  
+  // Paint the command locally and send it to the server
+  void sendCommand(RegionCommand &command) {
+    command.color.type = canvas->isIndexed() ? MSG_PIXEL_INDEX : MSG_PIXEL;
+    command.color.color = color;
+    command.color.index = colorIndex;
+    
+    CanvasUpdate update;
+    update.type = command.type;
+    update.command = new RegionCommand(command);
+    update.tiles = NULL;
+    canvas->paint(update);
+    network->send(update);
+  }
+  
+  // Returns the palette swatch under (xMouse, yMouse), -1 if there is none
+  int swatchAt(int xMouse, int yMouse) {
+    if(xMouse < SWATCH_X || yMouse < SWATCH_Y)
+      return -1;
+    int swatch = (yMouse - SWATCH_Y) / SWATCH_SIZE * SWATCHES_PER_LINE +
+                 (xMouse - SWATCH_X) / SWATCH_SIZE;
+    if(xMouse >= SWATCH_X + SWATCH_SIZE * SWATCHES_PER_LINE ||
+       !canvas->getPalette().validIndex(swatch))
+      return -1;
+    return swatch;
+  }
+  
 public:
   Camera(Canvas* _canvas, float _x, float _y) {
     x = _x;
     y = _y;
     canvas = _canvas;
+    panX = panY = 0;
+    zoom = 0;
+    subscription.level = 0;
+    subscription.line = subscription.column = 0;
+    subscription.lines = subscription.columns = 0;
     pressing = false;
     colorPicker = false;
     pipette = false;
+    selecting = false;
+    selectKey = 0;
     
-    color = {0x00, 0x00, 0x00};
+    colorIndex = 0;
+    setColor({0x00, 0x00, 0x00});
     globalHue = globalS = globalV = 0.0f;
   }
   
@@ -192,41 +1036,36 @@ public:
   
   void mouseMotion(int xMouse, int yMouse) {
     if(pressing && !colorPicker) {
-      xMouse = (int)floor(x + xMouse); // Real x and y
-      yMouse = (int)floor(y + yMouse);
-      
-      if(xMouse < 0)
-        xMouse = xMouse - PIXEL_WIDTH + 1;
-      if(yMouse < 0)
-        yMouse = yMouse - PIXEL_HEIGHT + 1;
-      xMouse = xMouse / PIXEL_WIDTH;
-      yMouse = yMouse / PIXEL_HEIGHT;
-
-      if(0 <= xMouse && xMouse < canvas->getWidth() &&
-         0 <= yMouse && yMouse < canvas->getHeight()) {
+      if(pixelAt(xMouse, yMouse, xMouse, yMouse) && canvas->isLoaded(xMouse, yMouse)) {
+        bool painted = canvas->isIndexed() ?
+                       canvas->getIndex(xMouse, yMouse) == colorIndex :
+                       canvas->getPixel(xMouse, yMouse) == color;
         if(pipette)
-          color = canvas->getPixel(xMouse, yMouse);
-        else {
-          short lPixel = yMouse, cPixel = xMouse;
-          canvas->setPixel(xMouse, yMouse, color);
-          unsigned char* packetsend = new unsigned char[sizeof(short) * 2 +
-                                                        sizeof(unsigned char) * 3];
-          unsigned char* pnt = packetsend;
-          
-          writeNumber(pnt, lPixel);
-          writeNumber(pnt, cPixel);
-          writeNumber(pnt, color.r);
-          writeNumber(pnt, color.g);
-          writeNumber(pnt, color.b);
-          
-          ENetPacket* packet = enet_packet_create(packetsend,
-                                                  sizeof(short) * 2 +
-                                                  sizeof(unsigned char) * 3,
-                                                  ENET_PACKET_FLAG_RELIABLE);
-          enet_peer_send(peer, 0, packet);
+          setColor(canvas->getPixel(xMouse, yMouse));
+        else if(!painted) {
+          // Holding the button over a pixel we already painted sends nothing
+          CanvasUpdate update;
+          update.lPixel = yMouse;
+          update.cPixel = xMouse;
+          update.color = color;
+          update.index = colorIndex;
+          update.command = NULL;
+          update.tiles = NULL;
+          update.type = canvas->isIndexed() ? MSG_PIXEL_INDEX : MSG_PIXEL;
+          canvas->paint(update);
+          network->send(update);
         }
       }
     } else if(pressing) {
+      if(canvas->isIndexed()) {
+        int swatch = swatchAt(xMouse, yMouse);
+        if(swatch >= 0) {
+          colorIndex = swatch;
+          color = canvas->getPalette().getColor(swatch);
+          return;
+        }
+      }
+      
       int xd = SCREEN_WIDTH / 2 - xMouse,
           yd = SCREEN_HEIGHT / 2 - yMouse;
       int dist = xd * xd + yd * yd;
@@ -244,9 +1083,9 @@ public:
         globalV = (double)(yMouse - SAT_VAL_Y) / SAT_VAL_H;
       }
       rgb colorrgb = hsv2rgb({globalHue, globalS, globalV});
-      color.r = (int)floor(colorrgb.r * 255.0f);
-      color.g = (int)floor(colorrgb.g * 255.0f);
-      color.b = (int)floor(colorrgb.b * 255.0f);
+      setColor({(unsigned char)floor(colorrgb.r * 255.0f),
+                (unsigned char)floor(colorrgb.g * 255.0f),
+                (unsigned char)floor(colorrgb.b * 255.0f)});
     }
   }
   
@@ -254,6 +1093,7 @@ public:
     SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xff);
     SDL_RenderClear(renderer);
     if(colorPicker) {
+      PROFILE_ZONE("Camera::display color picker");
       hsv colorhsv = rgb2hsv({color.r / 255.0f, color.g / 255.0f, color.b / 255.0f});
       
       for(int i = 0; i < HUE_PRECISION; ++i) {
@@ -287,41 +1127,214 @@ public:
           SDL_RenderDrawPoint(renderer, SAT_VAL_X + s, SAT_VAL_Y + v);
         }
       
+      if(canvas->isIndexed()) {
+        const Palette& palette = canvas->getPalette();
+        for(int i = 0; i < palette.size(); ++i) {
+          Pixel swatch = palette.getColor(i);
+          SDL_Rect rect = {SWATCH_X + i % SWATCHES_PER_LINE * SWATCH_SIZE,
+                           SWATCH_Y + i / SWATCHES_PER_LINE * SWATCH_SIZE,
+                           SWATCH_SIZE, SWATCH_SIZE};
+          SDL_SetRenderDrawColor(renderer, swatch.r, swatch.g, swatch.b, 0xff);
+          SDL_RenderFillRect(renderer, &rect);
+        }
+      }
+      
       SDL_Rect rect = {0, 0, 40, 40};
       SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, 0xff);
       SDL_RenderFillRect(renderer, &rect);
     } else {
-      canvas->display(renderer, (int)floor(x), (int)floor(y));
+      canvas->display(renderer, x, y, getScale());
     }
   }
   
-  void keyHold(const Uint8* state) {
-    if(state[SDL_SCANCODE_A])
-      x -= CAMERA_SPEED;
-    if(state[SDL_SCANCODE_D])
-      x += CAMERA_SPEED;
-    if(state[SDL_SCANCODE_S])
-      y += CAMERA_SPEED;
-    if(state[SDL_SCANCODE_W])
-      y -= CAMERA_SPEED;
+  // Move the camera for a frame that lasted elapsedMs milliseconds
+  void keyHold(const Uint8* state, float elapsedMs) {
+    float speed = CAMERA_SPEED * elapsedMs / 10.0f;
+    panX = state[SDL_SCANCODE_D] - state[SDL_SCANCODE_A];
+    panY = state[SDL_SCANCODE_S] - state[SDL_SCANCODE_W];
+    x += panX * speed / getScale();
+    y += panY * speed / getScale();
+  }
+  
+  // Zoom in or out by amount levels, keeping the point under the mouse
+  void mouseWheel(int amount) {
+    int xMouse, yMouse;
+    SDL_GetMouseState(&xMouse, &yMouse);
+    float xWorld = x + xMouse / getScale(), yWorld = y + yMouse / getScale();
+    zoom = std::max(0, std::min(zoom - amount, MAX_ZOOM));
+    x = xWorld - xMouse / getScale();
+    y = yWorld - yMouse / getScale();
   }
   
+  // Keep what is on the screen and ask the server for what is missing
+  // Close up these are the tiles of the canvas, with a few more in the
+  // direction we move. Zoomed out past RAW_ZOOMS the server sends the
+  // tiles of a level of the pyramid instead of the edits of the pixels,
+  // we subscribe again when the view leaves the tiles we subscribed to
+  void requestView() {
+    int width = canvas->getWidth(), height = canvas->getHeight();
+    int level = std::max(0, std::min(zoom - RAW_ZOOMS,
+                                     getMipLevels(width, height, MAX_MIP_LEVELS)));
+    int viewX = (int)floor(x / PIXEL_WIDTH), viewY = (int)floor(y / PIXEL_HEIGHT);
+    int viewW = (int)(SCREEN_WIDTH / getScale() / PIXEL_WIDTH) + 2;
+    int viewH = (int)(SCREEN_HEIGHT / getScale() / PIXEL_HEIGHT) + 2;
+    
+    LevelSubscription view;
+    view.level = level;
+    view.column = std::max(viewX, 0);
+    view.line = std::max(viewY, 0);
+    view.columns = std::max(std::min(viewX + viewW, width) - view.column, 0);
+    view.lines = std::max(std::min(viewY + viewH, height) - view.line, 0);
+    
+    bool changed = level != subscription.level;
+    if(!changed && level > 0) {
+      int tilesX = (getMipSize(width, level) + TILE_SIZE - 1) / TILE_SIZE;
+      int tilesY = (getMipSize(height, level) + TILE_SIZE - 1) / TILE_SIZE;
+      int x0, y0, x1, y1, subX0, subY0, subX1, subY1;
+      bool visible = view.getTiles(tilesX, tilesY, x0, y0, x1, y1);
+      bool subscribed = subscription.getTiles(tilesX, tilesY, subX0, subY0, subX1, subY1);
+      changed = visible && (!subscribed || x0 < subX0 || x1 > subX1 || y0 < subY0 || y1 > subY1);
+    }
+    
+    if(changed) {
+      // One more tile of the level around the view, so moving a little
+      // doesn't subscribe again
+      if(level > 0) {
+        int margin = TILE_SIZE << level;
+        view.column = std::max(view.column - margin, 0);
+        view.line = std::max(view.line - margin, 0);
+        view.columns = std::min(viewX + viewW + margin, width) - view.column;
+        view.lines = std::min(viewY + viewH + margin, height) - view.line;
+      }
+      std::vector<unsigned char> packet(view.getSize());
+      unsigned char* pnt = packet.data();
+      view.write(pnt);
+      network->sendPacket(packet);
+      subscription = view;
+      canvas->setLevel(level);
+      canvas->keepView(view);
+    }
+    
+    if(level == 0) {
+      std::vector<unsigned char> request;
+      canvas->update(viewX, viewY, viewW, viewH, panX, panY, request);
+      if(!request.empty())
+        network->sendPacket(request);
+    }
+  }
+  
+  // R selects a rectangle to fill while it is held, F flood fills the
+  // area around the mouse
+  // With --admin-key, L and U select a rectangle to lock or unlock
   void keyPress(int key) {
+    int xMouse, yMouse;
+    SDL_GetMouseState(&xMouse, &yMouse);
+    
     if(key == SDL_SCANCODE_E)
       pipette = true;
+    bool lockKey = (key == SDL_SCANCODE_L || key == SDL_SCANCODE_U) && !adminKey.empty();
+    if((key == SDL_SCANCODE_R || lockKey) && !colorPicker && !selecting) {
+      selecting = pixelAt(xMouse, yMouse, selectX, selectY);
+      selectKey = key;
+    }
+    
+    int xPixel, yPixel;
+    if(key == SDL_SCANCODE_F && !colorPicker &&
+       pixelAt(xMouse, yMouse, xPixel, yPixel)) {
+      RegionCommand command;
+      command.type = MSG_FLOOD_FILL;
+      command.seedLine = yPixel;
+      command.seedColumn = xPixel;
+      command.line = std::max(0, yPixel - MAX_FLOOD_SIZE / 2);
+      command.column = std::max(0, xPixel - MAX_FLOOD_SIZE / 2);
+      command.lines = MAX_FLOOD_SIZE;
+      command.columns = MAX_FLOOD_SIZE;
+      sendCommand(command);
+    }
   }
   
   void keyRelease(int key) {
     if(key == SDL_SCANCODE_E)
       pipette = false;
+    
+    int xMouse, yMouse, xPixel, yPixel;
+    SDL_GetMouseState(&xMouse, &yMouse);
+    if(key == selectKey && selecting && key != SDL_SCANCODE_R) {
+      selecting = false;
+      if(!pixelAt(xMouse, yMouse, xPixel, yPixel))
+        return;
+      
+      // Admin messages end with sequence 0, which no write of ours has
+      MaskChange change;
+      change.key = adminKey;
+      change.line = std::min(yPixel, selectY);
+      change.column = std::min(xPixel, selectX);
+      change.lines = abs(yPixel - selectY) + 1;
+      change.columns = abs(xPixel - selectX) + 1;
+      change.locked = key == SDL_SCANCODE_L;
+      std::vector<unsigned char> packet(change.getSize() + SEQUENCE_SIZE);
+      unsigned char* pnt = packet.data();
+      change.write(pnt);
+      writeNumber(pnt, (unsigned int)0);
+      network->sendPacket(packet);
+    }
+    
+    if(key == SDL_SCANCODE_R && selecting && selectKey == key) {
+      selecting = false;
+      if(!pixelAt(xMouse, yMouse, xPixel, yPixel))
+        return;
+      
+      RegionCommand command;
+      command.type = MSG_FILL_RECT;
+      command.line = std::min(yPixel, selectY);
+      command.column = std::min(xPixel, selectX);
+      command.lines = std::min(abs(yPixel - selectY) + 1, MAX_REGION_SIZE);
+      command.columns = std::min(abs(xPixel - selectX) + 1, MAX_REGION_SIZE);
+      sendCommand(command);
+    }
   }
 };
 
-int main() {
+int main(int argc, char** argv) {
+  // --trace file writes the profiling zones as a Chrome trace when we exit
+  // --canvas name joins another canvas than the default one
+  // --admin-key key locks regions of the canvas with L and unlocks them
+  // with U, if the server has the same key
+  // --memory mb keeps at most about mb megabytes of tiles in memory
+  // --no-disk-cache doesn't keep the tiles on disk
+  const char* traceFile = NULL;
+  std::string canvasName = DEFAULT_CANVAS;
+  int memoryMb = DEFAULT_MEMORY_MB;
+  bool diskCache = true;
+  for(int i = 1; i < argc; ++i)
+    if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+      traceFile = argv[++i];
+    else if(strcmp(argv[i], "--canvas") == 0 && i + 1 < argc)
+      canvasName = argv[++i];
+    else if(strcmp(argv[i], "--admin-key") == 0 && i + 1 < argc)
+      adminKey = argv[++i];
+    else if(strcmp(argv[i], "--memory") == 0 && i + 1 < argc)
+      memoryMb = std::max(atoi(argv[++i]), 1);
+    else if(strcmp(argv[i], "--no-disk-cache") == 0)
+      diskCache = false;
+  
+  // The zones are only recorded when they are written somewhere
+  if(traceFile != NULL)
+    Profiler::get().enable();
+  
+  if(!validCanvasName(canvasName)) {
+    fprintf(stderr, "Canvas names are made of letters, digits, '-' and '_'\n");
+    exit(EXIT_FAILURE);
+  }
+  char cacheFile[64], tilesFile[64];
+  snprintf(cacheFile, sizeof(cacheFile), CACHE_FILE, canvasName.c_str());
+  snprintf(tilesFile, sizeof(tilesFile), TILES_FILE, canvasName.c_str());
+  
   initSDL();
   initENET();
   
 	ENetHost* client;
+  ENetPeer* peer;
 	
 	client = enet_host_create(NULL, 1, 2, 0, 0);
   
@@ -334,7 +1347,7 @@ int main() {
 	ENetEvent enetevent;
 	
 	enet_address_set_host(&address, IP_ADDRESS);
-	address.port = 9999;
+	address.port = SERVER_PORT;
   
 	peer = enet_host_connect(client, &address, 2, 0);
 
@@ -346,16 +1359,28 @@ int main() {
 	fprintf(stderr, "Created peer successfully.\n");
 	enet_host_service(client, NULL, 0);
   
-  Canvas* canvas = NULL;
+  Canvas* canvas = new Canvas(cacheFile, diskCache ? tilesFile : NULL,
+                              std::min(memoryMb, 1024) * 1024 * 1024);
+  bool synced = false;
   
   if(enet_host_service(client, &enetevent, 1000) && enetevent.type == ENET_EVENT_TYPE_CONNECT) {
 		fprintf(stderr, "Connection to server succeeded.\n");
 
     fprintf(stderr, "Loading map:\n");
     
-    if(enet_host_service(client, &enetevent, 10000) > 0) {
-      canvas = new Canvas(enetevent.packet->data);
-      fprintf(stderr, "Loaded map successfuly\n");
+    // The server replies with the size of the canvas, the tiles are asked
+    // for as they come in view
+    std::vector<unsigned char> hello;
+    writeHelloTiles(canvasName, hello);
+    enet_peer_send(peer, 0, enet_packet_create(hello.data(), hello.size(),
+                                               ENET_PACKET_FLAG_RELIABLE));
+    
+    if(enet_host_service(client, &enetevent, 10000) > 0 &&
+       enetevent.type == ENET_EVENT_TYPE_RECEIVE) {
+      synced = canvas->sync(enetevent.packet->data, enetevent.packet->dataLength);
+      if(synced)
+        fprintf(stderr, "Loaded map successfuly\n");
+      enet_packet_destroy(enetevent.packet);
     }
 	} else {
 		enet_peer_reset(peer);
@@ -364,56 +1389,51 @@ int main() {
     exit(EXIT_FAILURE);
 	}
   
+  if(!synced)
+    canvas->usePlaceholder();
+  
   Camera* camera = new Camera(canvas, 0, 0);
   
+  network = new NetworkThread(client, peer);
+  network->start();
+  
+  FrameStats stats;
+  SDL_RendererInfo rendererInfo;
+  bool vsync = SDL_GetRendererInfo(renderer, &rendererInfo) == 0 &&
+               (rendererInfo.flags & SDL_RENDERER_PRESENTVSYNC);
+  
+  Uint64 frequency = SDL_GetPerformanceFrequency();
+  Uint64 lastFrame = SDL_GetPerformanceCounter();
+  float elapsedMs = 0.0f;
+  
   SDL_Event event;
   bool quit = false;
   
   while(!quit) {
-    while(!quit && enet_host_service(client, &enetevent, 0) > 0) {
-      if(enetevent.type == ENET_EVENT_TYPE_RECEIVE) {
-        unsigned char* packetdata = enetevent.packet->data;
-        short lPixel, cPixel;
-        Pixel newPixel;
-        
-        readNumber(packetdata, lPixel);
-        readNumber(packetdata, cPixel);
-        readNumber(packetdata, newPixel.r);
-        readNumber(packetdata, newPixel.g);
-        readNumber(packetdata, newPixel.b);
-      
-        canvas->setPixel(cPixel, lPixel, newPixel);
-        
-        enet_packet_destroy(enetevent.packet);
-      } else if(enetevent.type == ENET_EVENT_TYPE_DISCONNECT) {
-        fprintf(stderr, "Disconnected from server\n");
-        quit = true;
-      }
+    CanvasUpdate update;
+    {
+      PROFILE_ZONE("apply updates");
+      for(int i = 0; i < MAX_UPDATES_PER_FRAME && network->incoming.pop(update); ++i)
+        canvas->apply(update);
     }
+    
+    if(network->isDisconnected())
+      quit = true;
+    
     while(SDL_PollEvent(&event)) {
-      if(event.type == SDL_QUIT) {
+      if(event.type == SDL_QUIT)
         quit = true;
-		    enet_peer_disconnect(peer, 0);
-        bool disconnect = false;
-        while(!disconnect && enet_host_service(client, &enetevent, 2000) > 0) {
-          if(enetevent.type == ENET_EVENT_TYPE_DISCONNECT) {
-            fprintf(stderr, "Disconnected succesfully from server\n");
-            disconnect = true;
-          } else if(enetevent.type == ENET_EVENT_TYPE_RECEIVE)
-            enet_packet_destroy(enetevent.packet);
-        }
-        
-        if(!disconnect) {
-          fprintf(stderr, "Disconnected forcefuly from server\n");
-          enet_peer_reset(peer);
-        }
-      } else if(event.type == SDL_MOUSEBUTTONDOWN)
+      else if(event.type == SDL_MOUSEBUTTONDOWN)
         camera->mousePress(event.button.button);
       else if(event.type == SDL_MOUSEBUTTONUP)
         camera->mouseRelease(event.button.button);
-      else if(event.type == SDL_KEYDOWN)
+      else if(event.type == SDL_MOUSEWHEEL)
+        camera->mouseWheel(event.wheel.y);
+      else if(event.type == SDL_KEYDOWN) {
+        if(event.key.keysym.scancode == SDL_SCANCODE_F3)
+          stats.visible = !stats.visible;
         camera->keyPress(event.key.keysym.scancode);
-      else if(event.type == SDL_KEYUP)
+      } else if(event.type == SDL_KEYUP)
         camera->keyRelease(event.key.keysym.scancode);
     }
     
@@ -424,13 +1444,41 @@ int main() {
     const Uint8* state;
     state = SDL_GetKeyboardState(NULL);
     
-    camera->keyHold(state);
+    camera->keyHold(state, elapsedMs);
+    camera->requestView();
     
     camera->display(renderer);
+    stats.display(renderer);
     SDL_RenderPresent(renderer);
-    SDL_Delay(10);
+    
+    Uint64 now = SDL_GetPerformanceCounter();
+    elapsedMs = (float)(now - lastFrame) * 1000.0f / frequency;
+    if(!vsync && elapsedMs < FALLBACK_FRAME_MS) {
+      SDL_Delay((Uint32)(FALLBACK_FRAME_MS - elapsedMs));
+      now = SDL_GetPerformanceCounter();
+      elapsedMs = (float)(now - lastFrame) * 1000.0f / frequency;
+    }
+    lastFrame = now;
+    stats.addFrame(elapsedMs, network->getBacklog());
+    Profiler::get().nextFrame();
   }
   
+  if(traceFile != NULL && !Profiler::get().dumpChromeTrace(traceFile))
+    fprintf(stderr, "Failed to write the trace to %s\n", traceFile);
+  
+  network->stop();
+  
+  // Edits still waiting are sent again on the next sync if they are left
+  // out of the cache, but applying them is cheaper
+  CanvasUpdate update;
+  while(network->incoming.pop(update))
+    canvas->apply(update);
+  if(synced && diskCache && !canvas->save())
+    fprintf(stderr, "Failed to save the canvas to %s\n", cacheFile);
+  
+  delete network;
+  network = NULL;
+  
 	enet_host_destroy(client);
   
   deinitENET();
@@ -0,0 +1,243 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <enet/enet.h>
+#include "canvas/canvassync.h"
+#include "canvas/messagebatch.h"
+#include "baseclasses/timer.h"
+
+// Load driver for pscplm30-server: many clients painting pixels at a fixed
+// rate, measuring the packets they receive and the time until the server
+// sends their own pixels back to them
+// The server must keep rgb colors (no --palette) for the pixels to be
+// recognized
+
+// Pixels of the canvas the clients paint, at least the default canvas has
+// them
+const int LOAD_COLUMNS = 100;
+const int LOAD_LINES = 100;
+
+// Writes not sent back after this long are counted as lost
+const Uint64 LOST_AFTER_NS = 10000000000ull;
+
+// A simulated client
+struct LoadClient {
+  ENetPeer* peer;
+
+  // The pixels of the client are in its column, with its tag in the red
+  // component and a counter in the others
+  int column;
+  unsigned char tag;
+  unsigned short counter;
+
+  // The server answered the hello
+  bool joined;
+
+  Uint64 nextWrite;
+
+  // Time every write waiting to come back was sent, by counter
+  std::map<unsigned short, Uint64> sentAt;
+};
+
+std::vector<LoadClient> clients;
+
+// Totals of the run
+unsigned long long writes = 0, echoes = 0, lost = 0;
+unsigned long long packets = 0, messages = 0;
+std::vector<double> latencies;
+
+// A message from the server to a client, pixels of MSG_BATCH included
+void receiveMessage(LoadClient &client, unsigned char* message, int length, Uint64 now) {
+  unsigned char* pnt = message;
+  unsigned char type;
+  if(length < (int)sizeof(unsigned char))
+    return;
+  readNumber(pnt, type);
+
+  if(type == MSG_BATCH) {
+    unsigned char* part;
+    int partLength;
+    while(MessageBatch::next(pnt, message + length, part, partLength))
+      receiveMessage(client, part, partLength, now);
+    return;
+  }
+
+  ++messages;
+  if(type != MSG_PIXEL || length < PIXEL_PACKET_SIZE)
+    return;
+  short line, column;
+  unsigned char r, g, b;
+  readNumber(pnt, line);
+  readNumber(pnt, column);
+  readNumber(pnt, r);
+  readNumber(pnt, g);
+  readNumber(pnt, b);
+  if(column != client.column || r != client.tag)
+    return;
+
+  std::map<unsigned short, Uint64>::iterator it = client.sentAt.find(g << 8 | b);
+  if(it == client.sentAt.end())
+    return;
+  latencies.push_back((now - it->second) / 1e6);
+  ++echoes;
+  client.sentAt.erase(it);
+}
+
+void sendWrite(LoadClient &client, Uint64 now) {
+  unsigned char packet[PIXEL_PACKET_SIZE + SEQUENCE_SIZE];
+  unsigned char* pnt = packet;
+  unsigned short counter = client.counter++;
+  writeNumber(pnt, (unsigned char)MSG_PIXEL);
+  writeNumber(pnt, (short)(counter % LOAD_LINES));
+  writeNumber(pnt, (short)client.column);
+  writeNumber(pnt, client.tag);
+  writeNumber(pnt, (unsigned char)(counter >> 8));
+  writeNumber(pnt, (unsigned char)(counter & 0xff));
+  writeNumber(pnt, (unsigned int)counter);
+  enet_peer_send(client.peer, 0, enet_packet_create(packet, sizeof(packet),
+                                                    ENET_PACKET_FLAG_RELIABLE));
+
+  // A write whose counter comes around again is lost
+  if(client.sentAt.count(counter) != 0)
+    ++lost;
+  client.sentAt[counter] = now;
+  ++writes;
+}
+
+int main(int argc, char** argv) {
+  // pscplm30-loadtest [options]
+  // --host host and --port port of the server (localhost:SERVER_PORT)
+  // --canvas name painted by the clients (DEFAULT_CANVAS)
+  // --clients n connected by this process (16)
+  // --first id of the first client, so processes paint different pixels
+  // --rate writes every client sends every second (20)
+  // --seconds of painting (10)
+  const char* host = "localhost";
+  int port = SERVER_PORT;
+  std::string canvasName = DEFAULT_CANVAS;
+  int clientCount = 16, first = 0;
+  double rate = 20.0, seconds = 10.0;
+  for(int i = 1; i < argc; ++i)
+    if(strcmp(argv[i], "--host") == 0 && i + 1 < argc)
+      host = argv[++i];
+    else if(strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+      port = atoi(argv[++i]);
+    else if(strcmp(argv[i], "--canvas") == 0 && i + 1 < argc)
+      canvasName = argv[++i];
+    else if(strcmp(argv[i], "--clients") == 0 && i + 1 < argc)
+      clientCount = atoi(argv[++i]);
+    else if(strcmp(argv[i], "--first") == 0 && i + 1 < argc)
+      first = atoi(argv[++i]);
+    else if(strcmp(argv[i], "--rate") == 0 && i + 1 < argc)
+      rate = atof(argv[++i]);
+    else if(strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+      seconds = atof(argv[++i]);
+
+  if(clientCount <= 0 || rate <= 0.0 || seconds <= 0.0) {
+    fprintf(stderr, "Usage: %s [--host host] [--port port] [--canvas name] [--clients n] "
+                    "[--first id] [--rate writes] [--seconds s]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if(enet_initialize() < 0) {
+    fprintf(stderr, "Enet failed to initialize\n");
+    exit(EXIT_FAILURE);
+  }
+  ENetHost* host_ = enet_host_create(NULL, clientCount, 2, 0, 0);
+  if(host_ == NULL) {
+    fprintf(stderr, "Failed to create the clients\n");
+    exit(EXIT_FAILURE);
+  }
+  ENetAddress address;
+  enet_address_set_host(&address, host);
+  address.port = port;
+
+  clients.resize(clientCount);
+  for(int i = 0; i < clientCount; ++i) {
+    LoadClient &client = clients[i];
+    client.peer = enet_host_connect(host_, &address, 2, 0);
+    if(client.peer == NULL) {
+      fprintf(stderr, "Failed to connect client %d\n", first + i);
+      exit(EXIT_FAILURE);
+    }
+    client.peer->data = &client;
+    client.column = (first + i) % LOAD_COLUMNS;
+    client.tag = (first + i) / LOAD_COLUMNS;
+    client.counter = 0;
+    client.joined = false;
+  }
+
+  Uint64 interval = (Uint64)(1e9 / rate);
+  Uint64 start = Timer::getTimeNs();
+  Uint64 end = start + (Uint64)(seconds * 1e9);
+  std::vector<unsigned char> hello;
+  writeHello(canvasName, NULL, hello);
+  ENetEvent event;
+
+  while(Timer::getTimeNs() < end) {
+    while(enet_host_service(host_, &event, 1) > 0) {
+      LoadClient &client = *static_cast<LoadClient*>(event.peer->data);
+      Uint64 now = Timer::getTimeNs();
+      if(event.type == ENET_EVENT_TYPE_CONNECT)
+        enet_peer_send(event.peer, 0, enet_packet_create(hello.data(), hello.size(),
+                                                         ENET_PACKET_FLAG_RELIABLE));
+      else if(event.type == ENET_EVENT_TYPE_RECEIVE) {
+        // The first reply is the canvas, the writes start after it, spread
+        // over the interval
+        if(!client.joined) {
+          client.joined = true;
+          client.nextWrite = now + interval * (&client - &clients[0]) / clientCount;
+        } else {
+          ++packets;
+          receiveMessage(client, event.packet->data, event.packet->dataLength, now);
+        }
+        enet_packet_destroy(event.packet);
+      } else if(event.type == ENET_EVENT_TYPE_DISCONNECT) {
+        fprintf(stderr, "Client %d was disconnected\n", first + (int)(&client - &clients[0]));
+        client.joined = false;
+        client.nextWrite = ~0ull;
+      }
+    }
+
+    Uint64 now = Timer::getTimeNs();
+    for(unsigned int i = 0; i < clients.size(); ++i)
+      while(clients[i].joined && clients[i].nextWrite <= now) {
+        sendWrite(clients[i], now);
+        clients[i].nextWrite += interval;
+      }
+    enet_host_flush(host_);
+  }
+
+  // Writes still waiting for too long
+  Uint64 now = Timer::getTimeNs();
+  for(unsigned int i = 0; i < clients.size(); ++i) {
+    std::map<unsigned short, Uint64>::iterator it;
+    for(it = clients[i].sentAt.begin(); it != clients[i].sentAt.end(); ++it)
+      if(now - it->second >= LOST_AFTER_NS)
+        ++lost;
+    enet_peer_disconnect_now(clients[i].peer, 0);
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  double average = 0.0;
+  for(unsigned int i = 0; i < latencies.size(); ++i)
+    average += latencies[i];
+  if(!latencies.empty())
+    average /= latencies.size();
+  double elapsed = (now - start) / 1e9;
+  printf("clients %d writes %llu echoes %llu lost %llu packets %llu (%.1f per client "
+         "per second) messages %llu (%.1f per packet) latency ms average %.2f "
+         "median %.2f p99 %.2f max %.2f\n",
+         clientCount, writes, echoes, lost, packets, packets / elapsed / clientCount,
+         messages, packets > 0 ? (double)messages / packets : 0.0, average,
+         latencies.empty() ? 0.0 : latencies[latencies.size() / 2],
+         latencies.empty() ? 0.0 : latencies[latencies.size() * 99 / 100],
+         latencies.empty() ? 0.0 : latencies.back());
+
+  enet_host_destroy(host_);
+  enet_deinitialize();
+  return 0;
+}
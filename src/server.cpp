@@ -1,7 +1,20 @@
 #include <cstdio>
+#include <cstring>
 #include <vector>
+#include <string>
+#include <map>
+#include <deque>
+#include <algorithm>
 #include <enet/enet.h>
 #include "baseclasses/graphicshandler.h"
+#include "canvas/canvassync.h"
+#include "canvas/regioncommand.h"
+#include "canvas/messagebatch.h"
+#include "canvas/sessionlog.h"
+#include "canvas/regionmask.h"
+#include "canvas/mipstream.h"
+#include "baseclasses/profiler.h"
+#include "baseclasses/timerwheel.h"
 
 const int SCREEN_WIDTH = 800;
 const int SCREEN_HEIGHT = 600;
@@ -42,79 +55,780 @@ void deinitSDL() {
   SDL_Quit();
 }
 
-struct Pixel {
-  unsigned char r, g, b;
+const int DEFAULT_WIDTH  = 100;
+const int DEFAULT_HEIGHT = 100;
+
+// File of the default canvas, the others are saved in savedcanvas_<name>.dat
+const char* SAVE_FILE = "savedcanvas.dat";
+
+// Peers connected to the server, over all the canvases
+const int MAX_PEERS = 256;
+
+// A canvas without peers for this long is saved and unloaded
+const Uint32 IDLE_UNLOAD_MS = 60 * 1000;
+
+// The canvases we are the origin of are saved this often while loaded
+const Uint32 AUTOSAVE_MS = 5 * 60 * 1000;
+
+// Edits wait this long in the batch of their canvas for the ones after them
+const Uint32 BATCH_DELAY_MS = 10;
+
+// Longest wait for the peers, so the events of the window are handled, and
+// for the peers of a relay, so the edits from upstream aren't held up
+const Uint32 MAX_WAIT_MS = 100;
+const Uint32 RELAY_WAIT_MS = 10;
+
+// A peer viewing a level of the pyramid of a canvas instead of the edits
+// of its pixels
+struct Subscriber {
+  LevelSubscription view;
+  
+  // Update of the pyramid the tiles of the view were last sent after
+  unsigned int sent;
 };
 
-short width, height;
-Pixel** data;
+// A canvas served by the server, with the peers that joined it
+struct Board {
+  std::string name;
+  
+  // NULL while a relay waits for the copy from upstream
+  CanvasStorage* canvas;
+  TileVersions* versions;
+  
+  // Last edits, for the clients that reconnect
+  EditJournal journal;
+  
+  // Pixels locked by the moderators, NULL for a relay (the server we relay
+  // checks the edits)
+  RegionMask* mask;
+  
+  // Writes rejected because they touched a locked pixel
+  unsigned int rejected;
+  
+  std::vector<ENetPeer*> peers;
+  
+  // Edits waiting to be sent to every peer
+  MessageBatch batch;
+  
+  // Connection to the server we relay the canvas of, NULL for the origin
+  ENetPeer* upstream;
+  
+  // Writes passed upstream waiting for their MSG_ACK, in order, with the
+  // peer that sent them (NULL once it left)
+  std::deque<std::pair<ENetPeer*, unsigned int> > forwarded;
+  
+  // Hellos of the peers that joined before the copy arrived
+  std::vector<std::pair<ENetPeer*, std::vector<unsigned char> > > waiting;
+  
+  // Unloads the board once the last peer left, NO_TIMER while it has peers
+  TimerId unloadTimer;
+  
+  // Saves the canvas of an origin board every AUTOSAVE_MS
+  TimerId saveTimer;
+  
+  // Sends the batch BATCH_DELAY_MS after its first edit
+  TimerId flushTimer;
+  
+  // Levels of the canvas for the peers viewing it zoomed out, NULL until
+  // one subscribes to a level
+  MipPyramid* pyramid;
+  std::map<ENetPeer*, Subscriber> subscribers;
+  
+  // Sends the subscribers the tiles that changed, while there are some
+  TimerId mipTimer;
+  
+  // Log of the edits with --record
+  SessionLog record;
+};
 
-const int DEFAULT_WIDTH  = 100;
-const int DEFAULT_HEIGHT = 100;
+// Loaded canvases by name, every peer that joined one points to it with
+// its data
+std::map<std::string, Board*> boards;
 
-void saveData() {
-  FILE *fout = fopen("savedcanvas.dat", "wb");
-  fwrite(&width, sizeof(short), 1, fout);
-  fwrite(&height, sizeof(short), 1, fout);
-  for(int i = 0; i < width; ++i)
-    for(int j = 0; j < height; ++j) {
-      fwrite(&data[i][j].r, sizeof(unsigned char), 1, fout);
-      fwrite(&data[i][j].g, sizeof(unsigned char), 1, fout);
-      fwrite(&data[i][j].b, sizeof(unsigned char), 1, fout);
-    }
-  fclose(fout);
+// Server we relay the canvases of, NULL if we are the origin server
+const char* relay = NULL;
+ENetHost* upstreamHost = NULL;
+
+// --palette for the canvases created by this server
+bool convertFormat = false;
+PixelFormat format = FORMAT_RGB;
+
+// Deferred work of the boards, run by the main loop
+TimerWheel* timers = NULL;
+
+// --admin-key: key of the moderators allowed to lock regions, NULL if
+// nobody is
+const char* adminKey = NULL;
+
+// --record: log the edits of every canvas for pscplm30-timelapse
+bool recordSessions = false;
+
+// --no-batch: send every message by itself, to compare with the batches
+bool batching = true;
+
+// Packets and bytes sent to our peers, printed when we exit so the load of
+// the origin can be compared with and without relays
+unsigned long long sentPackets = 0, sentBytes = 0;
+
+std::string getSaveFile(const std::string &name) {
+  if(name == DEFAULT_CANVAS)
+    return SAVE_FILE;
+  return "savedcanvas_" + name + ".dat";
 }
 
-template<typename T>
-void readNumber(unsigned char* &data, T &x) {
-  // bruh
-  x = static_cast<T*>(static_cast<void*>(data))[0];
-  data = data + sizeof(T);
+std::string getRecordFile(const std::string &name) {
+  if(name == DEFAULT_CANVAS)
+    return "recordedcanvas.log";
+  return "recordedcanvas_" + name + ".log";
 }
 
-template<typename T>
-void writeNumber(unsigned char* &data, T &x) {
-  // bruh
-  static_cast<T*>(static_cast<void*>(data))[0] = x;
-  data = data + sizeof(T);
+// Start a session of the log of the board with its canvas as loaded
+void startRecording(Board* board) {
+  if(!recordSessions)
+    return;
+  std::string file = getRecordFile(board->name);
+  if(board->record.open(file.c_str()))
+    board->record.writeSnapshot(board->canvas, board->versions);
+  else
+    fprintf(stderr, "Failed to open the record %s\n", file.c_str());
 }
 
-const int MAX_PEERS = 8;
-ENetPeer* peers[MAX_PEERS];
+std::string getMaskFile(const std::string &name) {
+  if(name == DEFAULT_CANVAS)
+    return "savedmask.dat";
+  return "savedmask_" + name + ".dat";
+}
 
-int main() {
-  for(int i = 0; i < MAX_PEERS; ++i)
-    peers[i] = NULL;
-  
-  FILE *fin = fopen("savedcanvas.dat", "rb");
-  if(fin == NULL) {
-    width = DEFAULT_WIDTH;
-    height = DEFAULT_HEIGHT;
+void saveData(Board* board) {
+  std::string file = getSaveFile(board->name);
+  if(!saveCanvas(file.c_str(), board->canvas, board->versions))
+    fprintf(stderr, "Failed to save the canvas to %s\n", file.c_str());
+  file = getMaskFile(board->name);
+  if(!board->mask->save(file.c_str()))
+    fprintf(stderr, "Failed to save the mask to %s\n", file.c_str());
+}
+
+// Load the saved canvas of the board or create a new one
+void loadData(Board* board) {
+  board->canvas = loadCanvas(getSaveFile(board->name).c_str(), board->versions);
+  if(board->canvas == NULL) {
+    board->canvas = new CanvasStorage(DEFAULT_WIDTH, DEFAULT_HEIGHT, format);
     
-    data = new Pixel*[height];
-    for(int i = 0; i < height; ++i) {
-      data[i] = new Pixel[width];
-      for(int j = 0; j < width; ++j)
+    for(int i = 0; i < DEFAULT_HEIGHT; ++i)
+      for(int j = 0; j < DEFAULT_WIDTH; ++j)
         if(i == j)
-          data[i][j] = {0xff, 0xff, 0xff};
+          board->canvas->setPixel(j, i, {0xff, 0xff, 0xff});
         else
-          data[i][j] = {0, 0, 0};
+          board->canvas->setPixel(j, i, {0, 0, 0});
+    board->versions = new TileVersions(DEFAULT_WIDTH, DEFAULT_HEIGHT,
+                                       TileVersions::newEpoch());
+  } else if(convertFormat && board->canvas->getFormat() != format) {
+    // Cached canvases of the clients can't be patched anymore
+    board->canvas->convert(format);
+    delete board->versions;
+    board->versions = new TileVersions(board->canvas->getWidth(),
+                                       board->canvas->getHeight(),
+                                       TileVersions::newEpoch());
+  }
+  board->journal.reset(board->versions->getVersion());
+  
+  // A mask of another size doesn't match the canvas anymore
+  board->mask = RegionMask::load(getMaskFile(board->name).c_str());
+  if(board->mask != NULL && (board->mask->getWidth() != board->canvas->getWidth() ||
+                             board->mask->getHeight() != board->canvas->getHeight())) {
+    fprintf(stderr, "Ignoring the mask of %s, it doesn't match the canvas\n",
+            board->name.c_str());
+    delete board->mask;
+    board->mask = NULL;
+  }
+  if(board->mask == NULL)
+    board->mask = new RegionMask(board->canvas->getWidth(), board->canvas->getHeight());
+}
+
+// Connect to the server at host:port that we relay
+// Returns false if the address is wrong
+bool connectUpstream(Board* board) {
+  char host[256];
+  int port = SERVER_PORT;
+  snprintf(host, sizeof(host), "%s", relay);
+  char* colon = strrchr(host, ':');
+  if(colon != NULL) {
+    *colon = '\0';
+    port = atoi(colon + 1);
+  }
+  
+  ENetAddress address;
+  if(enet_address_set_host(&address, host) < 0)
+    return false;
+  address.port = port;
+  board->upstream = enet_host_connect(upstreamHost, &address, 2, 0);
+  if(board->upstream == NULL)
+    return false;
+  board->upstream->data = board;
+  return true;
+}
+
+// Save the canvas of the board every AUTOSAVE_MS, so a crash loses less
+void scheduleAutosave(Board* board) {
+  board->saveTimer = timers->schedule(AUTOSAVE_MS, [board]() {
+    saveData(board);
+    scheduleAutosave(board);
+  });
+}
+
+// Find the board with the given name for a peer joining it, loading it if
+// needed. Relays get the canvas from upstream, the board is returned before
+// it arrives. Returns NULL if it can't be loaded
+Board* getBoard(const std::string &name) {
+  std::map<std::string, Board*>::iterator it = boards.find(name);
+  if(it != boards.end()) {
+    timers->cancel(it->second->unloadTimer);
+    it->second->unloadTimer = NO_TIMER;
+    return it->second;
+  }
+  
+  PROFILE_ZONE("server load board");
+  Board* board = new Board();
+  board->name = name;
+  board->canvas = NULL;
+  board->versions = NULL;
+  board->mask = NULL;
+  board->rejected = 0;
+  board->upstream = NULL;
+  board->unloadTimer = NO_TIMER;
+  board->saveTimer = NO_TIMER;
+  board->flushTimer = NO_TIMER;
+  board->pyramid = NULL;
+  board->mipTimer = NO_TIMER;
+  
+  if(relay == NULL) {
+    loadData(board);
+    startRecording(board);
+    scheduleAutosave(board);
+  } else if(!connectUpstream(board)) {
+    delete board;
+    return NULL;
+  }
+  
+  fprintf(stderr, "Loaded canvas %s\n", name.c_str());
+  boards[name] = board;
+  return board;
+}
+
+void unloadBoard(Board* board) {
+  fprintf(stderr, "Unloading canvas %s\n", board->name.c_str());
+  if(board->rejected > 0)
+    fprintf(stderr, "Rejected %u writes to locked pixels of %s\n", board->rejected,
+            board->name.c_str());
+  // Relays only have a copy of the canvas, possibly not even that yet, the
+  // saved canvas of that name belongs to this server
+  if(relay == NULL)
+    saveData(board);
+  else if(board->upstream != NULL) {
+    board->upstream->data = NULL;
+    enet_peer_disconnect(board->upstream, 0);
+  }
+  
+  timers->cancel(board->unloadTimer);
+  timers->cancel(board->saveTimer);
+  timers->cancel(board->flushTimer);
+  timers->cancel(board->mipTimer);
+  boards.erase(board->name);
+  delete board->canvas;
+  delete board->versions;
+  delete board->mask;
+  delete board->pyramid;
+  delete board;
+}
+
+// Send the batch of the board to every peer as one packet
+void flushBatch(Board* board) {
+  if(board->batch.getCount() == 0)
+    return;
+  
+  PROFILE_ZONE("server flush batch");
+  for(unsigned int i = 0; i < board->peers.size(); ++i) {
+    // Subscribers get the tiles of their level instead
+    if(board->subscribers.count(board->peers[i]) != 0)
+      continue;
+    ENetPacket* packet = enet_packet_create(board->batch.getData(),
+                                            board->batch.getSize(),
+                                            ENET_PACKET_FLAG_RELIABLE);
+    enet_peer_send(board->peers[i], 0, packet);
+  }
+  board->batch.clear();
+}
+
+// Add a message for every peer of the board to its batch
+// Messages too long for a batch, or every message with --no-batch, are sent
+// by themselves, after the batch
+void queueMessage(Board* board, const unsigned char* message, int length) {
+  board->record.write(message, length);
+  if(!batching || !board->batch.add(message, length)) {
+    flushBatch(board);
+    for(unsigned int i = 0; i < board->peers.size(); ++i)
+      if(board->subscribers.count(board->peers[i]) == 0)
+        enet_peer_send(board->peers[i], 0, enet_packet_create(message, length,
+                                                              ENET_PACKET_FLAG_RELIABLE));
+    return;
+  }
+  if(board->batch.getSize() >= MAX_BATCH_SIZE)
+    flushBatch(board);
+  else if(board->flushTimer == NO_TIMER)
+    board->flushTimer = timers->schedule(BATCH_DELAY_MS, [board]() {
+      board->flushTimer = NO_TIMER;
+      flushBatch(board);
+    });
+}
+
+// The rectangle of w x h pixels at (x, y) of the canvas changed, the tiles
+// of the pyramid over it are computed again before they are sent
+void markChanged(Board* board, int x, int y, int w, int h) {
+  if(board->pyramid != NULL)
+    board->pyramid->markDirty(x, y, w, h);
+}
+
+// Send the pixel (lPixel, cPixel) to every peer, in the format of the canvas
+// with the version of its edit
+void broadcastPixel(Board* board, short lPixel, short cPixel, unsigned int version) {
+  CanvasStorage* canvas = board->canvas;
+  unsigned char sentpacketdata[PIXEL_PACKET_SIZE + VERSION_SIZE];
+  unsigned char* pnt = sentpacketdata;
+  int size;
+  
+  if(canvas->isIndexed()) {
+    writeNumber(pnt, MSG_PIXEL_INDEX);
+    writeNumber(pnt, lPixel);
+    writeNumber(pnt, cPixel);
+    writeNumber(pnt, canvas->getIndex(cPixel, lPixel));
+    size = PIXEL_INDEX_PACKET_SIZE;
+  } else {
+    Pixel newPixel = canvas->getPixel(cPixel, lPixel);
+    writeNumber(pnt, MSG_PIXEL);
+    writeNumber(pnt, lPixel);
+    writeNumber(pnt, cPixel);
+    writeNumber(pnt, newPixel.r);
+    writeNumber(pnt, newPixel.g);
+    writeNumber(pnt, newPixel.b);
+    size = PIXEL_PACKET_SIZE;
+  }
+  writeNumber(pnt, version);
+  size += VERSION_SIZE;
+  
+  queueMessage(board, sentpacketdata, size);
+}
+
+// Send a command applied to the canvas to every peer as one message, with
+// the version of its edit
+void broadcastCommand(Board* board, RegionCommand &command, unsigned int version) {
+  std::vector<unsigned char> message(command.getSize() + VERSION_SIZE);
+  unsigned char* pnt = message.data();
+  command.write(pnt);
+  writeNumber(pnt, version);
+  queueMessage(board, message.data(), message.size());
+}
+
+// Answer the hello of the peer, then add it to the peers of the board
+// MSG_HELLO gets what changed since the canvas the peer cached,
+// MSG_HELLO_TILES only the size and the format, the peer asks for the tiles
+void join(Board* board, ENetPeer* peer, unsigned char* hello, int length) {
+  PROFILE_ZONE("server send sync");
+  std::vector<unsigned char> reply;
+  unsigned char* pnt = hello;
+  std::string name;
+  readHelloName(pnt, length, name);
+  if(hello[0] == MSG_HELLO_TILES)
+    writeCanvasInfo(board->canvas, board->versions, reply);
+  else
+    writeSyncReply(board->canvas, board->versions, board->journal, pnt, length, reply);
+  ENetPacket* packet = enet_packet_create(reply.data(), reply.size(),
+                                          ENET_PACKET_FLAG_RELIABLE);
+  enet_peer_send(peer, 0, packet);
+  board->peers.push_back(peer);
+}
+
+// Remove the peer from its board, if it joined one
+void leave(ENetPeer* peer) {
+  Board* board = static_cast<Board*>(peer->data);
+  if(board == NULL)
+    return;
+  peer->data = NULL;
+  
+  board->peers.erase(std::remove(board->peers.begin(), board->peers.end(), peer),
+                     board->peers.end());
+  board->subscribers.erase(peer);
+  for(unsigned int i = 0; i < board->forwarded.size(); ++i)
+    if(board->forwarded[i].first == peer)
+      board->forwarded[i].first = NULL;
+  unsigned int i = 0;
+  while(i < board->waiting.size())
+    if(board->waiting[i].first == peer)
+      board->waiting.erase(board->waiting.begin() + i);
+    else
+      ++i;
+  if(board->peers.empty() && board->waiting.empty() && board->unloadTimer == NO_TIMER)
+    board->unloadTimer = timers->schedule(IDLE_UNLOAD_MS, [board]() {
+      board->unloadTimer = NO_TIMER;
+      unloadBoard(board);
+    });
+}
+
+// Tell the peer the version its write got, 0 if it was rejected
+void sendAck(ENetPeer* peer, unsigned int sequence, unsigned int version) {
+  unsigned char ack[ACK_PACKET_SIZE];
+  unsigned char* pnt = ack;
+  writeNumber(pnt, MSG_ACK);
+  writeNumber(pnt, sequence);
+  writeNumber(pnt, version);
+  enet_peer_send(peer, 0, enet_packet_create(ack, ACK_PACKET_SIZE,
+                                             ENET_PACKET_FLAG_RELIABLE));
+}
+
+// Returns true if the command would change a locked pixel of the board
+// Flood fills are only checked pixel by pixel when their area has locked
+// pixels
+bool isLocked(Board* board, RegionCommand &command) {
+  if(!board->mask->anyLocked(command.column, command.line, command.columns,
+                             command.lines))
+    return false;
+  if(command.type != MSG_FLOOD_FILL)
+    return true;
+  
+  std::vector<FloodSpan> spans;
+  command.findFlood(board->canvas, spans);
+  for(unsigned int i = 0; i < spans.size(); ++i)
+    if(board->mask->anyLocked(spans[i].column, spans[i].line, spans[i].length, 1))
+      return true;
+  return false;
+}
+
+// Apply a write sent by a peer of the board and acknowledge it
+void applyEdit(Board* board, ENetPeer* peer, unsigned char* packetData, int length) {
+  CanvasStorage* canvas = board->canvas;
+  unsigned char* pnt = packetData;
+  unsigned char type = 0xff;
+  short lPixel = -1, cPixel = -1;
+  bool valid = false;
+  
+  // Every write ends with its sequence number
+  unsigned int sequence;
+  if(length < (int)sizeof(unsigned char) + SEQUENCE_SIZE)
+    return;
+  length -= SEQUENCE_SIZE;
+  pnt = packetData + length;
+  readNumber(pnt, sequence);
+  pnt = packetData;
+  
+  if(board->upstream != NULL) {
+    // The origin server applies it, acknowledges it to us and sends it back
+    enet_peer_send(board->upstream, 0, enet_packet_create(packetData,
+                                                         length + SEQUENCE_SIZE,
+                                                         ENET_PACKET_FLAG_RELIABLE));
+    board->forwarded.push_back({peer, sequence});
+    return;
+  }
+  
+  if(packetData[0] == MSG_LOCK_RECT) {
+    MaskChange change;
+    unsigned int version = 0;
+    if(change.read(pnt, length) && adminKey != NULL && change.key == adminKey) {
+      board->mask->setRect(change.column, change.line, change.columns, change.lines,
+                           change.locked);
+      fprintf(stderr, "%s %d x %d pixels at (%d, %d) of %s, %d locked\n",
+              change.locked ? "Locked" : "Unlocked", change.columns, change.lines,
+              change.column, change.line, board->name.c_str(),
+              board->mask->countLocked());
+      version = board->versions->getVersion();
     }
+    sendAck(peer, sequence, version);
+    return;
+  }
+  
+  if(packetData[0] == MSG_FILL_RECT || packetData[0] == MSG_STAMP ||
+     packetData[0] == MSG_FLOOD_FILL) {
+    PROFILE_ZONE("server region command");
+    RegionCommand command;
+    int x, y, w, h;
+    unsigned int version = 0;
+    // A command touching a locked pixel is rejected whole
+    if(command.read(pnt, length) && command.valid(canvas)) {
+      if(isLocked(board, command))
+        ++board->rejected;
+      else if(command.apply(canvas, x, y, w, h)) {
+        version = recordRegion(board->versions, board->journal, x, y, w, h);
+        markChanged(board, x, y, w, h);
+        broadcastCommand(board, command, version);
+      }
+    }
+    sendAck(peer, sequence, version);
+    return;
+  }
+  
+  if(length >= PIXEL_INDEX_PACKET_SIZE) {
+    readNumber(pnt, type);
+    readNumber(pnt, lPixel);
+    readNumber(pnt, cPixel);
+  }
+  
+  if(0 <= lPixel && lPixel < canvas->getHeight() &&
+     0 <= cPixel && cPixel < canvas->getWidth()) {
+    if(board->mask->isLocked(cPixel, lPixel))
+      ++board->rejected;
+    else if(type == MSG_PIXEL && length >= PIXEL_PACKET_SIZE) {
+      // Free colors are snapped to the palette by indexed canvases
+      Pixel newPixel;
+      readNumber(pnt, newPixel.r);
+      readNumber(pnt, newPixel.g);
+      readNumber(pnt, newPixel.b);
+      canvas->setPixel(cPixel, lPixel, newPixel);
+      valid = true;
+    } else if(type == MSG_PIXEL_INDEX && canvas->isIndexed()) {
+      unsigned char index;
+      readNumber(pnt, index);
+      if(canvas->getPalette().validIndex(index)) {
+        canvas->setIndex(cPixel, lPixel, index);
+        valid = true;
+      }
+    }
+  }
+  
+  // We must broadcast the change to everyone
+  unsigned int version = 0;
+  if(valid) {
+    version = board->versions->touch(cPixel, lPixel);
+    board->journal.record(version, cPixel, lPixel);
+    markChanged(board, cPixel, lPixel, 1, 1);
+    broadcastPixel(board, lPixel, cPixel, version);
+  }
+  sendAck(peer, sequence, version);
+}
+
+// Send every subscriber the tiles of its view that changed since the last
+// time, instead of every edit of their pixels
+void sendMipTiles(Board* board) {
+  PROFILE_ZONE("server send mip tiles");
+  board->pyramid->update(board->canvas);
+  std::vector<unsigned char> packet;
+  for(std::map<ENetPeer*, Subscriber>::iterator it = board->subscribers.begin();
+      it != board->subscribers.end(); ++it) {
+    Subscriber &subscriber = it->second;
+    if(writeMipTiles(board->pyramid, subscriber.view, subscriber.sent, &subscriber.view,
+                     packet) > 0)
+      enet_peer_send(it->first, 0, enet_packet_create(packet.data(), packet.size(),
+                                                      ENET_PACKET_FLAG_RELIABLE));
+    subscriber.sent = board->pyramid->getUpdate();
+  }
+}
+
+// Send the subscribers of the board the tiles that changed every
+// MIP_UPDATE_MS, until there are none
+void scheduleMipTiles(Board* board) {
+  board->mipTimer = timers->schedule(MIP_UPDATE_MS, [board]() {
+    board->mipTimer = NO_TIMER;
+    if(board->subscribers.empty())
+      return;
+    sendMipTiles(board);
+    scheduleMipTiles(board);
+  });
+}
+
+// Change what the peer views of the canvas of the board
+// The tiles of a level the peer doesn't have yet are sent at once, level 0
+// and the views we don't serve get the edits of the pixels again
+void subscribe(Board* board, ENetPeer* peer, unsigned char* packetData, int length) {
+  PROFILE_ZONE("server subscribe");
+  LevelSubscription view;
+  unsigned char* pnt = packetData;
+  if(!view.read(pnt, length))
+    return;
+  
+  int width = board->canvas->getWidth(), height = board->canvas->getHeight();
+  if(view.level > 0 && board->pyramid == NULL)
+    board->pyramid = new MipPyramid(width, height,
+                                    getMipLevels(width, height, MAX_MIP_LEVELS));
+  int x0, y0, x1, y1;
+  if(view.level == 0 || view.level > board->pyramid->getLevels() ||
+     (view.getTiles(board->pyramid->getTilesX(view.level),
+                    board->pyramid->getTilesY(view.level), x0, y0, x1, y1) &&
+      (x1 - x0 + 1) * (y1 - y0 + 1) > MAX_MIP_TILES)) {
+    board->subscribers.erase(peer);
+    return;
+  }
+  
+  LevelSubscription* known = NULL;
+  unsigned int since = 0;
+  std::map<ENetPeer*, Subscriber>::iterator it = board->subscribers.find(peer);
+  if(it != board->subscribers.end()) {
+    known = &it->second.view;
+    since = it->second.sent;
+  }
+  
+  std::vector<unsigned char> packet;
+  board->pyramid->update(board->canvas);
+  if(writeMipTiles(board->pyramid, view, since, known, packet) > 0)
+    enet_peer_send(peer, 0, enet_packet_create(packet.data(), packet.size(),
+                                               ENET_PACKET_FLAG_RELIABLE));
+  board->subscribers[peer] = {view, board->pyramid->getUpdate()};
+  if(board->mipTimer == NO_TIMER)
+    scheduleMipTiles(board);
+}
+
+// Apply an edit of the server we relay to our copy of the canvas, keeping
+// its version, and pass it on to our peers
+void mirrorMessage(Board* board, unsigned char* message, int length) {
+  CanvasStorage* canvas = board->canvas;
+  unsigned char* pnt = message;
+  unsigned char* end = message + length;
+  unsigned char type;
+  if(length < (int)sizeof(unsigned char))
+    return;
+  readNumber(pnt, type);
+  
+  if(type == MSG_BATCH) {
+    unsigned char* part;
+    int partLength;
+    while(MessageBatch::next(pnt, end, part, partLength))
+      mirrorMessage(board, part, partLength);
+    return;
+  }
+  
+  unsigned int version;
+  if(type == MSG_FILL_RECT || type == MSG_STAMP || type == MSG_FLOOD_FILL) {
+    RegionCommand command;
+    int x, y, w, h;
+    pnt = message;
+    if(!command.read(pnt, length) || end - pnt < VERSION_SIZE)
+      return;
+    readNumber(pnt, version);
+    if(command.valid(canvas) && command.apply(canvas, x, y, w, h)) {
+      mirrorRegion(board->versions, board->journal, x, y, w, h, version);
+      markChanged(board, x, y, w, h);
+    }
+    queueMessage(board, message, length);
+    return;
+  }
+  
+  short lPixel, cPixel;
+  int size = type == MSG_PIXEL ? PIXEL_PACKET_SIZE : PIXEL_INDEX_PACKET_SIZE;
+  if((type != MSG_PIXEL && type != MSG_PIXEL_INDEX) || length < size + VERSION_SIZE)
+    return;
+  readNumber(pnt, lPixel);
+  readNumber(pnt, cPixel);
+  if(!canvas->inside(cPixel, lPixel))
+    return;
+  
+  if(type == MSG_PIXEL) {
+    Pixel newPixel;
+    readNumber(pnt, newPixel.r);
+    readNumber(pnt, newPixel.g);
+    readNumber(pnt, newPixel.b);
+    canvas->setPixel(cPixel, lPixel, newPixel);
   } else {
-    fread(&width, sizeof(short), 1, fin);
-    fread(&height, sizeof(short), 1, fin);
-    
-    data = new Pixel*[height];
-    for(int i = 0; i < height; ++i) {
-      data[i] = new Pixel[width];
-      for(int j = 0; j < width; ++j) {
-        fread(&data[i][j].r, sizeof(unsigned char), 1, fin);
-        fread(&data[i][j].g, sizeof(unsigned char), 1, fin);
-        fread(&data[i][j].b, sizeof(unsigned char), 1, fin);
+    unsigned char index;
+    readNumber(pnt, index);
+    if(canvas->isIndexed() && canvas->getPalette().validIndex(index))
+      canvas->setIndex(cPixel, lPixel, index);
+  }
+  readNumber(pnt, version);
+  board->versions->receive(cPixel, lPixel, version);
+  board->journal.record(version, cPixel, lPixel);
+  markChanged(board, cPixel, lPixel, 1, 1);
+  queueMessage(board, message, length);
+}
+
+// Handle an event of the connections to the server we relay
+void upstreamEvent(ENetEvent &event) {
+  Board* board = static_cast<Board*>(event.peer->data);
+  if(event.type == ENET_EVENT_TYPE_RECEIVE) {
+    PROFILE_ZONE("relay receive");
+    if(board != NULL && board->canvas != NULL && !board->forwarded.empty() &&
+       (int)event.packet->dataLength >= ACK_PACKET_SIZE &&
+       event.packet->data[0] == MSG_ACK) {
+      // Acknowledgement of the oldest write we passed on
+      ENetPeer* peer = board->forwarded.front().first;
+      unsigned int sequence = board->forwarded.front().second;
+      board->forwarded.pop_front();
+      unsigned char* pnt = event.packet->data + sizeof(unsigned char) +
+                           sizeof(unsigned int);
+      unsigned int version;
+      readNumber(pnt, version);
+      if(peer != NULL)
+        sendAck(peer, sequence, version);
+    } else if(board != NULL && board->canvas != NULL)
+      mirrorMessage(board, event.packet->data, event.packet->dataLength);
+    else if(board != NULL) {
+      // The copy of the canvas, the peers waiting for it can join
+      if(readSyncReply(event.packet->data, event.packet->dataLength,
+                       board->canvas, board->versions)) {
+        board->journal.reset(board->versions->getVersion());
+        startRecording(board);
+        for(unsigned int i = 0; i < board->waiting.size(); ++i)
+          join(board, board->waiting[i].first, board->waiting[i].second.data(),
+               board->waiting[i].second.size());
+        board->waiting.clear();
       }
     }
-    fclose(fin);
+    enet_packet_destroy(event.packet);
+  } else if(event.type == ENET_EVENT_TYPE_CONNECT && board != NULL) {
+    // We keep no cache, the first reply is a snapshot
+    std::vector<unsigned char> hello;
+    writeHello(board->name, NULL, hello);
+    enet_peer_send(event.peer, 0, enet_packet_create(hello.data(), hello.size(),
+                                                     ENET_PACKET_FLAG_RELIABLE));
+  } else if(event.type == ENET_EVENT_TYPE_DISCONNECT && board != NULL) {
+    // Our peers can't be kept up to date anymore, they reconnect
+    fprintf(stderr, "Lost the connection to %s for %s\n", relay, board->name.c_str());
+    std::vector<ENetPeer*> peers = board->peers;
+    for(unsigned int i = 0; i < board->waiting.size(); ++i)
+      peers.push_back(board->waiting[i].first);
+    for(unsigned int i = 0; i < peers.size(); ++i) {
+      leave(peers[i]);
+      enet_peer_disconnect(peers[i], 0);
+    }
+    unloadBoard(board);
   }
+}
+
+int main(int argc, char** argv) {
+  // --palette 4 or --palette 8 stores palette indices instead of rgb colors
+  // --trace file writes the profiling zones as a Chrome trace when we exit
+  // --port port listens on another port than SERVER_PORT
+  // --relay host:port serves copies of the canvases of another server:
+  // our peers sync from the copies, their edits go to that server and its
+  // edits are passed on to them. Relays can relay other relays
+  // --admin-key key lets the clients with the key lock and unlock regions
+  // of the canvases
+  // --record appends the edits of every canvas to recordedcanvas.log, or
+  // recordedcanvas_<name>.log for the named ones
+  // --no-batch sends every edit to the peers right away in its own packet
+  int paletteBits = 0;
+  int port = SERVER_PORT;
+  const char* traceFile = NULL;
+  for(int i = 1; i < argc; ++i)
+    if(strcmp(argv[i], "--palette") == 0 && i + 1 < argc)
+      paletteBits = atoi(argv[++i]);
+    else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+      traceFile = argv[++i];
+    else if(strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+      port = atoi(argv[++i]);
+    else if(strcmp(argv[i], "--relay") == 0 && i + 1 < argc)
+      relay = argv[++i];
+    else if(strcmp(argv[i], "--admin-key") == 0 && i + 1 < argc)
+      adminKey = argv[++i];
+    else if(strcmp(argv[i], "--record") == 0)
+      recordSessions = true;
+    else if(strcmp(argv[i], "--no-batch") == 0)
+      batching = false;
+  
+  // The zones are only recorded when they are written somewhere
+  if(traceFile != NULL)
+    Profiler::get().enable();
+  
+  convertFormat = paletteBits != 0;
+  if(paletteBits == 4)
+    format = FORMAT_INDEX4;
+  else if(paletteBits == 8)
+    format = FORMAT_INDEX8;
   
   initSDL();
   
@@ -128,7 +842,7 @@ int main() {
 	ENetHost* server;
 
 	address.host = ENET_HOST_ANY;
-	address.port = 9999;
+	address.port = port;
 
 	server = enet_host_create(&address, MAX_PEERS, 2, 0, 0);
 
@@ -137,77 +851,65 @@ int main() {
 		exit(EXIT_FAILURE);
 	}
   
+  // One connection upstream for every canvas we relay
+  if(relay != NULL) {
+    upstreamHost = enet_host_create(NULL, MAX_PEERS, 2, 0, 0);
+    if(upstreamHost == NULL) {
+      fprintf(stderr, "Failed to create the connection to %s\n", relay);
+      exit(EXIT_FAILURE);
+    }
+  }
+  
   ENetEvent event;
   SDL_Event sdlevent;
+  timers = new TimerWheel(SDL_GetTicks());
   
   bool quit = false;
   while(!quit) {
-    while(enet_host_service(server, &event, 10) > 0) {
+    // Wait for the peers until the next timer is due, then only take the
+    // events already there
+    Uint32 wait = timers->getWait(upstreamHost != NULL ? RELAY_WAIT_MS : MAX_WAIT_MS);
+    while(enet_host_service(server, &event, wait) > 0) {
+      wait = 0;
       if(event.type == ENET_EVENT_TYPE_CONNECT) {
         fprintf(stderr, "A new client connected from %x:%u.\n", event.peer->address.host,
                                                                 event.peer->address.port);
-        int i = 0;
-        while(i < MAX_PEERS && peers[i] != NULL)
-          ++i;
-        
-        if(peers[i] == NULL)
-          peers[i] = event.peer;
-        // We must send the entire picture to the newly connected peer
-        
-        unsigned char* packetData = new unsigned char[sizeof(short) * 2 +
-                                                      3 * width * height * 
-                                                      sizeof(unsigned char)];
-        
-        unsigned char* pnt = packetData;
-        
-        writeNumber(pnt, width);
-        writeNumber(pnt, height);
-        for(int i = 0; i < width; ++i)
-          for(int j = 0; j < height; ++j) {
-            writeNumber(pnt, data[i][j].r);
-            writeNumber(pnt, data[i][j].g);
-            writeNumber(pnt, data[i][j].b);
-          }
-        
-        ENetPacket* packet = enet_packet_create(packetData, 
-                             sizeof(short) * 2 + 3 * width * height * 
-                                                 sizeof(unsigned char),
-                                                 ENET_PACKET_FLAG_RELIABLE);
-        enet_peer_send(event.peer, 0, packet);
+        // The peer gets the canvas once it says hello
+        event.peer->data = NULL;
       } else if(event.type == ENET_EVENT_TYPE_RECEIVE) {
+        PROFILE_ZONE("server receive");
         unsigned char* packetData = static_cast<unsigned char*>(event.packet->data);
-        unsigned char* pnt = packetData;
-        short lPixel, cPixel;
-        Pixel newPixel;
-        readNumber(pnt, lPixel);
-        readNumber(pnt, cPixel);
-        readNumber(pnt, newPixel.r);
-        readNumber(pnt, newPixel.g);
-        readNumber(pnt, newPixel.b);
+        int length = event.packet->dataLength;
+        Board* board = static_cast<Board*>(event.peer->data);
         
-        if(0 <= lPixel && lPixel < width && 0 <= cPixel && cPixel < height) {
-          data[lPixel][cPixel] = newPixel;
-          // We must broadcast the change to everyone
-          
-          for(int i = 0; i < MAX_PEERS; ++i)
-            if(peers[i] != NULL) {
-              unsigned char* sentpacketdata 
-                           = new unsigned char[sizeof(short) * 2
-                                             + sizeof(unsigned char) * 3];
-              pnt = sentpacketdata;
-              writeNumber(pnt, lPixel);
-              writeNumber(pnt, cPixel);
-              writeNumber(pnt, newPixel.r);
-              writeNumber(pnt, newPixel.g);
-              writeNumber(pnt, newPixel.b);
-              
-              ENetPacket* packet = enet_packet_create(sentpacketdata, 
-                                                      sizeof(short) * 2 +
-                                                      sizeof(unsigned char) * 3, 
-                                                      ENET_PACKET_FLAG_RELIABLE);
-              enet_peer_send(peers[i], 0, packet);
-            }
-        }
+        if(length > 0 && (packetData[0] == MSG_HELLO || packetData[0] == MSG_HELLO_TILES)) {
+          unsigned char* pnt = packetData;
+          int left = length;
+          std::string name;
+          leave(event.peer);
+          if(readHelloName(pnt, left, name) && (board = getBoard(name)) != NULL) {
+            event.peer->data = board;
+            if(board->canvas != NULL)
+              join(board, event.peer, packetData, length);
+            else
+              board->waiting.push_back({event.peer,
+                                        std::vector<unsigned char>(packetData, packetData + length)});
+          } else
+            enet_peer_disconnect(event.peer, 0);
+        } else if(length > 0 && packetData[0] == MSG_TILE_REQUEST) {
+          // The tiles must hold every edit the peer got before them
+          if(board != NULL && board->canvas != NULL) {
+            std::vector<unsigned char> reply;
+            flushBatch(board);
+            if(writeTiles(board->canvas, board->versions, packetData, length, reply))
+              enet_peer_send(event.peer, 0, enet_packet_create(reply.data(), reply.size(),
+                                                               ENET_PACKET_FLAG_RELIABLE));
+          }
+        } else if(length > 0 && packetData[0] == MSG_SUBSCRIBE) {
+          if(board != NULL && board->canvas != NULL)
+            subscribe(board, event.peer, packetData, length);
+        } else if(board != NULL && board->canvas != NULL)
+          applyEdit(board, event.peer, packetData, length);
         
         //fprintf(stderr, "Received packet(%u): %s | %u :%s\n", event.packet->dataLength,
         //                                                      event.peer->data,
@@ -215,9 +917,7 @@ int main() {
         //                                                      event.packet->data);
         enet_packet_destroy(event.packet);
       } else if(event.type == ENET_EVENT_TYPE_DISCONNECT) {
-        for(int i = 0; i < MAX_PEERS; ++i)
-          if(peers[i] == event.peer)
-            peers[i] = NULL;
+        leave(event.peer);
         fprintf(stderr, "%x:%u disconnected.\n", event.peer->address.host,
                                                  event.peer->address.port);
       } else {
@@ -225,16 +925,42 @@ int main() {
       }
     }
     
+    while(upstreamHost != NULL && enet_host_service(upstreamHost, &event, 0) > 0)
+      upstreamEvent(event);
+    
+    // ENet counts in 32 bits, they are moved to ours before they wrap
+    sentPackets += server->totalSentPackets;
+    sentBytes += server->totalSentData;
+    server->totalSentPackets = 0;
+    server->totalSentData = 0;
+    
+    // Send the batches, the tiles of the subscribers, save and unload the
+    // boards when their time comes
+    timers->advance(SDL_GetTicks());
+    
     while(SDL_PollEvent(&sdlevent)) {
       if(sdlevent.type == SDL_QUIT)
         quit = true;
     }
-    SDL_Delay(10);
+    Profiler::get().nextFrame();
   }
-
-  saveData();
+  
+  while(!boards.empty()) {
+    flushBatch(boards.begin()->second);
+    unloadBoard(boards.begin()->second);
+  }
+  delete timers;
+  enet_host_flush(server);
+  sentPackets += server->totalSentPackets;
+  sentBytes += server->totalSentData;
+  fprintf(stderr, "Sent %llu packets, %llu bytes to the peers\n", sentPackets, sentBytes);
+  
+  if(traceFile != NULL && !Profiler::get().dumpChromeTrace(traceFile))
+    fprintf(stderr, "Failed to write the trace to %s\n", traceFile);
 
 	enet_host_destroy(server);
+  if(upstreamHost != NULL)
+    enet_host_destroy(upstreamHost);
   enet_deinitialize();
   
   deinitSDL();
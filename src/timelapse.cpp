@@ -0,0 +1,224 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include "canvas/canvassync.h"
+#include "canvas/regioncommand.h"
+#include "canvas/mipstream.h"
+#include "canvas/sessionlog.h"
+#include "baseclasses/threadpool.h"
+#include "baseclasses/timer.h"
+
+// Render the history of a canvas recorded by pscplm30-server --record as
+// a stream of frames, one every interval of the recorded time
+
+// Options of the frames
+long long interval = 60 * 1000;
+long long maxGap = 10 * 60 * 1000;
+int scale = 0;
+bool raw = false;
+bool lastOnly = false;
+
+CanvasStorage* canvas = NULL;
+TileVersions* versions = NULL;
+MipPyramid* pyramid = NULL;
+ThreadPool* pool = NULL;
+
+FILE* output = stdout;
+int frameCount = 0;
+
+// Last frame written, used again while the canvas doesn't change
+std::vector<unsigned char> frame;
+bool changed = true;
+
+// Size of every frame, the one of the first frame. Canvases of another size
+// are centered in it, cut or surrounded with black
+int frameWidth = 0, frameHeight = 0;
+
+// A new canvas was loaded, every tile of the pyramid is computed again
+// Smaller canvases get fewer levels
+void resetPyramid() {
+  delete pyramid;
+  pyramid = new MipPyramid(canvas->getWidth(), canvas->getHeight(),
+                           getMipLevels(canvas->getWidth(), canvas->getHeight(), scale));
+}
+
+// Apply an edit of the log to the canvas, keeping the pyramid up to date
+void applyMessage(unsigned char* message, int length) {
+  unsigned char* pnt = message;
+  unsigned char type = message[0];
+
+  if(type == MSG_SNAPSHOT) {
+    if(readSyncReply(message, length, canvas, versions)) {
+      resetPyramid();
+      changed = true;
+    }
+    return;
+  }
+  if(canvas == NULL)
+    return;
+
+  if(type == MSG_FILL_RECT || type == MSG_STAMP || type == MSG_FLOOD_FILL) {
+    RegionCommand command;
+    int x, y, w, h;
+    if(command.read(pnt, length) && command.valid(canvas) &&
+       command.apply(canvas, x, y, w, h)) {
+      pyramid->markDirty(x, y, w, h);
+      changed = true;
+    }
+    return;
+  }
+
+  short lPixel, cPixel;
+  int size = type == MSG_PIXEL ? PIXEL_PACKET_SIZE : PIXEL_INDEX_PACKET_SIZE;
+  if((type != MSG_PIXEL && type != MSG_PIXEL_INDEX) || length < size)
+    return;
+  pnt = message + sizeof(unsigned char);
+  readNumber(pnt, lPixel);
+  readNumber(pnt, cPixel);
+  if(!canvas->inside(cPixel, lPixel))
+    return;
+
+  if(type == MSG_PIXEL) {
+    Pixel newPixel;
+    readNumber(pnt, newPixel.r);
+    readNumber(pnt, newPixel.g);
+    readNumber(pnt, newPixel.b);
+    canvas->setPixel(cPixel, lPixel, newPixel);
+  } else {
+    unsigned char index;
+    readNumber(pnt, index);
+    if(canvas->isIndexed() && canvas->getPalette().validIndex(index))
+      canvas->setIndex(cPixel, lPixel, index);
+  }
+  pyramid->markDirty(cPixel, lPixel, 1, 1);
+  changed = true;
+}
+
+// Write the canvas as it is now, downscaled by the last level of the pyramid
+// Only the tiles changed since the previous frame are computed again
+void writeFrame() {
+  int levels = pyramid->getLevels();
+  int width = levels == 0 ? canvas->getWidth() : pyramid->getWidth(levels);
+  int height = levels == 0 ? canvas->getHeight() : pyramid->getHeight(levels);
+  if(frameCount == 0) {
+    frameWidth = width;
+    frameHeight = height;
+    fprintf(stderr, "Frames of %d x %d pixels\n", width, height);
+  }
+
+  if(changed) {
+    pyramid->update(canvas, pool);
+    frame.assign(frameWidth * frameHeight * 3, 0);
+    int left = (frameWidth - width) / 2;
+    int top = (frameHeight - height) / 2;
+    const Pixel* pixels = levels == 0 ? NULL : pyramid->getLevel(levels);
+    for(int i = std::max(0, -top); i < height && i + top < frameHeight; ++i) {
+      unsigned char* pnt = frame.data() + ((i + top) * frameWidth + std::max(0, left)) * 3;
+      for(int j = std::max(0, -left); j < width && j + left < frameWidth; ++j) {
+        Pixel p = levels == 0 ? canvas->getPixel(j, i) : pixels[i * width + j];
+        writeNumber(pnt, p.r);
+        writeNumber(pnt, p.g);
+        writeNumber(pnt, p.b);
+      }
+    }
+    changed = false;
+  }
+
+  if(!raw)
+    fprintf(output, "P6\n%d %d\n255\n", frameWidth, frameHeight);
+  fwrite(frame.data(), sizeof(unsigned char), frame.size(), output);
+  ++frameCount;
+}
+
+int main(int argc, char** argv) {
+  // pscplm30-timelapse [options] recordedcanvas.log
+  // --interval seconds of recorded time between two frames (60)
+  // --max-gap seconds without edits shown at most, longer gaps between the
+  // sessions are cut short (600), 0 shows them whole
+  // --scale n halves the frames n times with the kernel of the mip pyramid
+  // --raw writes the rgb of the frames without PPM headers
+  // --last writes only the final frame, as a thumbnail
+  // --output file instead of the standard output
+  // --threads n downscales the tiles on n threads, every core by default
+  const char* logFile = NULL;
+  const char* outputFile = NULL;
+  int threadCount = 0;
+  for(int i = 1; i < argc; ++i)
+    if(strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+      interval = atof(argv[++i]) * 1000;
+    else if(strcmp(argv[i], "--max-gap") == 0 && i + 1 < argc)
+      maxGap = atof(argv[++i]) * 1000;
+    else if(strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+      scale = atoi(argv[++i]);
+    else if(strcmp(argv[i], "--raw") == 0)
+      raw = true;
+    else if(strcmp(argv[i], "--last") == 0)
+      lastOnly = true;
+    else if(strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+      outputFile = argv[++i];
+    else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+      threadCount = atoi(argv[++i]);
+    else
+      logFile = argv[i];
+
+  if(logFile == NULL || interval <= 0 || maxGap < 0) {
+    fprintf(stderr, "Usage: %s [--interval seconds] [--max-gap seconds] [--scale n] "
+                    "[--raw] [--last] "
+                    "[--output file] [--threads n] recordedcanvas.log\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  FILE* fin = fopen(logFile, "rb");
+  if(fin == NULL) {
+    fprintf(stderr, "Failed to open %s\n", logFile);
+    exit(EXIT_FAILURE);
+  }
+  if(outputFile != NULL && (output = fopen(outputFile, "wb")) == NULL) {
+    fprintf(stderr, "Failed to open %s\n", outputFile);
+    exit(EXIT_FAILURE);
+  }
+  pool = new ThreadPool(threadCount);
+
+  // The first frame shows the canvas of the first session, then the edits
+  // are applied up to the time of every frame
+  // Frames of a gap longer than maxGap are skipped, keeping the rest of the
+  // frames on the same interval
+  Uint64 start = Timer::getTimeNs();
+  long long time, lastTime = 0;
+  long long nextFrame = 0;
+  std::vector<unsigned char> message;
+  while(SessionLog::read(fin, time, message)) {
+    if(message.empty())
+      continue;
+    if(canvas == NULL)
+      nextFrame = time;
+    else if(!lastOnly) {
+      if(maxGap > 0 && time - lastTime > maxGap)
+        nextFrame += (time - lastTime - maxGap) / interval * interval;
+      for(; nextFrame <= time; nextFrame += interval)
+        writeFrame();
+    }
+    lastTime = time;
+    applyMessage(message.data(), message.size());
+  }
+  fclose(fin);
+
+  if(canvas == NULL) {
+    fprintf(stderr, "%s holds no canvas\n", logFile);
+    exit(EXIT_FAILURE);
+  }
+  writeFrame();
+  double seconds = (Timer::getTimeNs() - start) / 1e9;
+  fprintf(stderr, "Wrote %d frames in %.2f seconds (%.1f frames per second)\n", frameCount,
+          seconds, frameCount / seconds);
+
+  if(output != stdout)
+    fclose(output);
+  delete pool;
+  delete pyramid;
+  delete canvas;
+  delete versions;
+  return 0;
+}
@@ -0,0 +1,81 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include "baseclasses/broadphase.h"
+#include "baseclasses/timer.h"
+
+// Times SpatialHash::findPairs on worlds of 10k and 100k small boxes, with
+// and without a few huge ones, and checks the 10k pairs against brute force
+
+const int RUNS = 10;
+
+static float randomFloat(float most) {
+  return (float)rand() / RAND_MAX * most;
+}
+
+// Boxes of side 1 to 3 spread so a box touches about one other, and a few
+// boxes an eighth of the world wide
+static std::vector<BoundingBox> makeWorld(int count, int hugeCount) {
+  std::vector<BoundingBox> boxes;
+  float side = sqrt(count) * 4.0f;
+  for(int i = 0; i < count; ++i) {
+    float x = randomFloat(side), y = randomFloat(side);
+    float w = 1.0f + randomFloat(2.0f), h = 1.0f + randomFloat(2.0f);
+    boxes.push_back({x, y, x + w, y + h});
+  }
+  for(int i = 0; i < hugeCount; ++i) {
+    float x = randomFloat(side), y = randomFloat(side);
+    boxes.push_back({x, y, x + side / 8.0f, y + side / 8.0f});
+  }
+  return boxes;
+}
+
+static void bruteForce(const std::vector<BoundingBox> &boxes, std::vector<BodyPair> &pairs) {
+  pairs.clear();
+  for(int i = 0; i < (int)boxes.size(); ++i)
+    for(int j = i + 1; j < (int)boxes.size(); ++j)
+      if(boxes[i].intersects(boxes[j]))
+        pairs.push_back(BodyPair(i, j));
+}
+
+static bool bench(int count, int hugeCount, bool check) {
+  std::vector<BoundingBox> boxes = makeWorld(count, hugeCount);
+  SpatialHash hash;
+  std::vector<BodyPair> pairs;
+  
+  Uint64 best = ~0ull, total = 0;
+  for(int run = 0; run < RUNS; ++run) {
+    Uint64 start = Timer::getTimeNs();
+    hash.clear();
+    for(int i = 0; i < (int)boxes.size(); ++i)
+      hash.insert(i, boxes[i]);
+    hash.findPairs(pairs);
+    Uint64 duration = Timer::getTimeNs() - start;
+    best = std::min(best, duration);
+    total += duration;
+  }
+  printf("broadphase %6d bodies %3d huge: %8.3f ms best %8.3f ms average, %zu pairs\n",
+         count, hugeCount, best / 1e6, total / 1e6 / RUNS, pairs.size());
+  
+  if(!check)
+    return true;
+  std::vector<BodyPair> expected;
+  Uint64 start = Timer::getTimeNs();
+  bruteForce(boxes, expected);
+  printf("brute force %6d bodies: %8.3f ms\n", count, (Timer::getTimeNs() - start) / 1e6);
+  if(pairs != expected) {
+    printf("broadphase %d bodies: the pairs differ from brute force\n", count);
+    return false;
+  }
+  return true;
+}
+
+int main() {
+  srand(31);
+  bool ok = bench(10000, 0, true);
+  ok = bench(10000, 16, true) && ok;
+  ok = bench(100000, 0, false) && ok;
+  ok = bench(100000, 16, false) && ok;
+  return ok ? 0 : 1;
+}
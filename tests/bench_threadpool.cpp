@@ -0,0 +1,94 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include "baseclasses/physicsworld.h"
+#include "baseclasses/threadpool.h"
+#include "baseclasses/timer.h"
+
+// Frame time of PhysicsWorld::step() and of a bare ThreadPool batch for
+// every thread count from 1 to the number of cores, the steps must give the
+// same positions whatever the thread count
+// The first argument replaces the number of cores
+
+// Piles of overlapping boxes, each one an island of the solver
+const int PILES = 2500;
+const int BOXES_PER_PILE = 4;
+const int STEPS = 20;
+
+// Tasks of the bare pool batch, and the work of every one
+const int POOL_TASKS = 4096;
+const int POOL_WORK = 20000;
+
+static float randomFloat(float most) {
+  return (float)rand() / RAND_MAX * most;
+}
+
+// Steps a fresh world with the given threads, returns the average frame in
+// milliseconds and the positions of the bodies at the end
+static double stepWorld(int threads, std::vector<float> &positions) {
+  srand(34);
+  std::vector<Polygon> shapes;
+  shapes.reserve(PILES * BOXES_PER_PILE);
+  PhysicsWorld world;
+  world.setThreadCount(threads);
+  for(int pile = 0; pile < PILES; ++pile) {
+    float x = pile % 50 * 20.0f, y = pile / 50 * 20.0f;
+    for(int i = 0; i < BOXES_PER_PILE; ++i) {
+      shapes.push_back(getRectangle(x + randomFloat(2.0f), y + randomFloat(2.0f), 3.0f, 3.0f));
+      world.createBody(&shapes.back());
+    }
+  }
+  
+  Uint64 start = Timer::getTimeNs();
+  for(int step = 0; step < STEPS; ++step) {
+    for(int body = 0; body < world.getCapacity(); ++body)
+      world.addForce(body, Vector2D(0.0f, 0.1f));
+    world.step();
+  }
+  double frame = (Timer::getTimeNs() - start) / 1e6 / STEPS;
+  
+  positions.clear();
+  for(int body = 0; body < world.getCapacity(); ++body) {
+    positions.push_back(world.getPosition(body).x);
+    positions.push_back(world.getPosition(body).y);
+  }
+  return frame;
+}
+
+// Runs one batch of busy tasks on a pool, returns its length in milliseconds
+static double runPool(int threads) {
+  ThreadPool pool(threads);
+  std::vector<unsigned int> results(POOL_TASKS);
+  Uint64 start = Timer::getTimeNs();
+  pool.run(POOL_TASKS, [&](int task) {
+    unsigned int value = task;
+    for(int i = 0; i < POOL_WORK; ++i)
+      value = value * 1664525u + 1013904223u;
+    results[task] = value;
+  });
+  return (Timer::getTimeNs() - start) / 1e6;
+}
+
+int main(int argc, char** argv) {
+  int cores = std::max((int)std::thread::hardware_concurrency(), 1);
+  if(argc > 1)
+    cores = std::max(atoi(argv[1]), 1);
+  std::vector<float> reference, positions;
+  double single = stepWorld(1, reference);
+  double singlePool = runPool(1);
+  bool same = true;
+  
+  printf("threads  step ms  speedup  pool ms  speedup\n");
+  for(int threads = 1; threads <= cores; ++threads) {
+    double frame = threads == 1 ? single : stepWorld(threads, positions);
+    double batch = threads == 1 ? singlePool : runPool(threads);
+    if(threads > 1 && positions != reference) {
+      printf("%d threads: the positions differ from 1 thread\n", threads);
+      same = false;
+    }
+    printf("%7d %8.3f %7.2fx %8.3f %7.2fx\n", threads, frame, single / frame,
+           batch, singlePool / batch);
+  }
+  return same ? 0 : 1;
+}
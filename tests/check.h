@@ -0,0 +1,27 @@
+#ifndef __CHECK_H
+#define __CHECK_H
+
+#include <cstdio>
+
+// Checks that failed so far in the test
+static int failedChecks = 0;
+
+// Report the condition if it doesn't hold, the test goes on
+#define CHECK(condition) \
+  do { \
+    if(!(condition)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      ++failedChecks; \
+    } \
+  } while(0)
+
+// Print the result of the test, returns the exit code of the test
+static inline int checkResult(const char* name) {
+  if(failedChecks == 0)
+    printf("%s: ok\n", name);
+  else
+    printf("%s: %d checks failed\n", name, failedChecks);
+  return failedChecks == 0 ? 0 : 1;
+}
+
+#endif
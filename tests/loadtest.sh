@@ -0,0 +1,78 @@
+#!/bin/sh
+# Load test of the server on localhost, with PROCESSES pscplm30-loadtest
+# processes of CLIENTS clients each writing RATE pixels a second for
+# DURATION seconds:
+# - direct: the clients on the origin server, with and without --no-batch
+# - relay: the clients spread over RELAYS relays of the origin, then twice
+#   as many clients, the packets sent by the origin should stay flat
+# Every process prints the packets its clients got and the latency of
+# their writes, then the origin prints the packets and bytes it sent
+# Usage: tests/loadtest.sh [processes] [clients] [rate] [seconds] [relays]
+PROCESSES=${1:-4}
+CLIENTS=${2:-16}
+RATE=${3:-20}
+DURATION=${4:-10}
+RELAYS=${5:-2}
+PORT=9998
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+DIR=$(mktemp -d)
+cd "$DIR" || exit 1
+
+# The servers open a window
+export SDL_VIDEODRIVER=dummy
+
+# run name relays processes [server options]
+# Runs the origin with the options, the relays on the next ports and the
+# drivers on the relays in turn, or on the origin without relays
+run() {
+  NAME=$1
+  RELAY_COUNT=$2
+  DRIVER_COUNT=$3
+  shift 3
+  "$ROOT/pscplm30-server" --port $PORT "$@" > origin.txt 2>&1 &
+  ORIGIN=$!
+  sleep 1
+
+  SERVERS=
+  r=1
+  while [ $r -le $RELAY_COUNT ]; do
+    "$ROOT/pscplm30-server" --port $((PORT + r)) --relay localhost:$PORT > relay_$r.txt 2>&1 &
+    SERVERS="$SERVERS $!"
+    r=$((r + 1))
+  done
+  [ $RELAY_COUNT -gt 0 ] && sleep 1
+
+  DRIVERS=
+  i=0
+  while [ $i -lt $DRIVER_COUNT ]; do
+    TARGET=$PORT
+    [ $RELAY_COUNT -gt 0 ] && TARGET=$((PORT + 1 + i % RELAY_COUNT))
+    "$ROOT/pscplm30-loadtest" --port $TARGET --clients $CLIENTS --first $((i * CLIENTS)) \
+      --rate $RATE --seconds $DURATION > driver_$i.txt &
+    DRIVERS="$DRIVERS $!"
+    i=$((i + 1))
+  done
+  wait $DRIVERS
+
+  # The relays go first so the origin only counts what it sent to them
+  for SERVER in $SERVERS; do
+    kill $SERVER
+    wait $SERVER
+  done
+  kill $ORIGIN
+  wait $ORIGIN
+
+  echo "$NAME:"
+  cat driver_*.txt
+  echo "origin: $(grep '^Sent ' origin.txt)"
+  rm -f driver_*.txt relay_*.txt origin.txt
+}
+
+run "direct batch" 0 $PROCESSES
+run "direct no-batch" 0 $PROCESSES --no-batch
+run "$RELAYS relays" $RELAYS $PROCESSES
+run "$RELAYS relays, twice the clients" $RELAYS $((PROCESSES * 2))
+
+cd "$ROOT"
+rm -rf "$DIR"
@@ -0,0 +1,81 @@
+#include <cstdlib>
+#include <vector>
+#include "check.h"
+#include "canvas/canvassync.h"
+
+// Checks of the reply of the server to the versions of a joining client:
+// a sync for a client of the same canvas, a snapshot for the others, and
+// hellos with tile counts that don't fit the packet or the canvas
+
+const unsigned int EPOCH = 41;
+
+// The part of a MSG_HELLO after the name, for the given versions
+static std::vector<unsigned char> helloOf(TileVersions &versions) {
+  std::vector<unsigned char> hello(versions.getSize());
+  unsigned char* pnt = hello.data();
+  versions.write(pnt);
+  return hello;
+}
+
+// A hello of the header only, with the given tile counts
+static std::vector<unsigned char> header(short tilesX, short tilesY) {
+  std::vector<unsigned char> hello(sizeof(unsigned int) * 2 + sizeof(short) * 2);
+  unsigned char* pnt = hello.data();
+  writeNumber(pnt, EPOCH);
+  writeNumber(pnt, (unsigned int)0);
+  writeNumber(pnt, tilesX);
+  writeNumber(pnt, tilesY);
+  return hello;
+}
+
+static unsigned char replyTo(CanvasStorage &canvas, TileVersions &versions,
+                             EditJournal &journal, std::vector<unsigned char> hello) {
+  std::vector<unsigned char> packet;
+  writeSyncReply(&canvas, &versions, journal, hello.data(), hello.size(), packet);
+  return packet.empty() ? 0 : packet[0];
+}
+
+static void testReply() {
+  CanvasStorage canvas(300, 200);
+  TileVersions versions(300, 200, EPOCH);
+  EditJournal journal;
+  TileVersions client = versions;
+  canvas.setPixel(10, 10, {1, 2, 3});
+  journal.record(versions.touch(10, 10), 10, 10);
+
+  // Same canvas, then another epoch
+  CHECK(replyTo(canvas, versions, journal, helloOf(client)) == MSG_SYNC);
+  TileVersions other(300, 200, EPOCH + 1);
+  CHECK(replyTo(canvas, versions, journal, helloOf(other)) == MSG_SNAPSHOT);
+
+  // Versions of a canvas with other tile counts
+  TileVersions larger(600, 200, EPOCH);
+  CHECK(replyTo(canvas, versions, journal, helloOf(larger)) == MSG_SNAPSHOT);
+  std::vector<unsigned char> cut = helloOf(client);
+  cut.pop_back();
+  CHECK(replyTo(canvas, versions, journal, cut) == MSG_SNAPSHOT);
+}
+
+static void testHugeCounts() {
+  // Counts whose product overflows an int are refused without reading past
+  // the packet
+  std::vector<unsigned char> hello = header(32767, 32767);
+  unsigned char* pnt = hello.data();
+  CHECK(TileVersions::read(pnt, hello.size()) == NULL);
+  hello = header(-1, 5);
+  pnt = hello.data();
+  CHECK(TileVersions::read(pnt, hello.size()) == NULL);
+
+  CanvasStorage canvas(300, 200);
+  TileVersions versions(300, 200, EPOCH);
+  EditJournal journal;
+  CHECK(replyTo(canvas, versions, journal, header(32767, 32767)) == MSG_SNAPSHOT);
+  CHECK(replyTo(canvas, versions, journal, header(0, 0)) == MSG_SNAPSHOT);
+}
+
+int main() {
+  srand(41);
+  testReply();
+  testHugeCounts();
+  return checkResult("canvassync");
+}
@@ -0,0 +1,174 @@
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include "check.h"
+#include "baseclasses/geometry.h"
+#include "baseclasses/collision.h"
+#include "baseclasses/broadphase.h"
+
+// Checks of the narrow phase, the broad phase and the geometry helpers they
+// use, on hand made cases and on random shapes
+
+static float randomFloat(float least, float most) {
+  return least + (float)rand() / RAND_MAX * (most - least);
+}
+
+static bool near(float a, float b, float epsilon = 1e-3f) {
+  return fabs(a - b) <= epsilon;
+}
+
+// A random rectangle, regular polygon, segment or circle around (x, y)
+static Polygon randomShape(float x, float y) {
+  Polygon shape;
+  int kind = rand() % 4;
+  if(kind == 0)
+    shape = getRectangle(x, y, randomFloat(0.5f, 3.0f), randomFloat(0.5f, 3.0f));
+  else if(kind == 1)
+    shape = getRegularPolygon(x, y, randomFloat(0.5f, 2.0f), 3 + rand() % 8);
+  else if(kind == 2)
+    shape = getSegment(x, y, x + randomFloat(-2.0f, 2.0f), y + randomFloat(-2.0f, 2.0f));
+  else
+    shape = getCircle(x, y, randomFloat(0.5f, 2.0f));
+  shape.setRotation(randomFloat(0.0f, 2.0f * PI));
+  return shape;
+}
+
+static void testGeometry() {
+  CHECK(near(pointToSegmentDistance(Vector2D(0, 1), Vector2D(-1, 0), Vector2D(1, 0)), 1.0f));
+  CHECK(near(pointToSegmentDistance(Vector2D(3, 4), Vector2D(-1, 0), Vector2D(0, 0)), 5.0f));
+  Vector2D closest = closestPointOnSegment(Vector2D(0.5f, 3), Vector2D(0, 0), Vector2D(2, 0));
+  CHECK(near(closest.x, 0.5f) && near(closest.y, 0.0f));
+  
+  CHECK(insideTriangle(Vector2D(0, 0), Vector2D(4, 0), Vector2D(0, 4), Vector2D(1, 1)));
+  CHECK(!insideTriangle(Vector2D(0, 0), Vector2D(4, 0), Vector2D(0, 4), Vector2D(3, 3)));
+  
+  // The SSE rotation matches the plain one, odd counts included
+  for(int count = 1; count <= 9; ++count) {
+    Vector2D from[9], to[9];
+    for(int i = 0; i < count; ++i)
+      from[i] = Vector2D(randomFloat(-5, 5), randomFloat(-5, 5));
+    float angle = randomFloat(0.0f, 2.0f * PI);
+    rotateVertices(from, to, count, cos(angle), sin(angle));
+    for(int i = 0; i < count; ++i) {
+      CHECK(near(to[i].x, from[i].x * cos(angle) - from[i].y * sin(angle)));
+      CHECK(near(to[i].y, from[i].x * sin(angle) + from[i].y * cos(angle)));
+    }
+  }
+  
+  // The cached bounding box holds every vertex after moves and rotations
+  for(int i = 0; i < 200; ++i) {
+    Polygon shape = randomShape(randomFloat(-10, 10), randomFloat(-10, 10));
+    shape.translate(Vector2D(randomFloat(-3, 3), randomFloat(-3, 3)));
+    shape.rotate(randomFloat(0.0f, 2.0f * PI));
+    BoundingBox box = shape.getBoundingBox();
+    for(int j = 0; j < shape.size(); ++j) {
+      Vector2D vertex = shape.getVertex(j);
+      CHECK(box.x1 - 1e-3f <= vertex.x && vertex.x <= box.x2 + 1e-3f);
+      CHECK(box.y1 - 1e-3f <= vertex.y && vertex.y <= box.y2 + 1e-3f);
+    }
+  }
+}
+
+static void testKnownContacts() {
+  ContactManifold manifold;
+  
+  // Squares of side 2 overlapping by 0.5 along x
+  Polygon a = getRectangle(0, 0, 2, 2), b = getRectangle(1.5f, 0, 2, 2);
+  CHECK(collidePolygons(&a, &b, &manifold));
+  CHECK(near(manifold.penetration, 0.5f));
+  CHECK(near(manifold.normal.x, 1.0f) && near(manifold.normal.y, 0.0f));
+  CHECK(manifold.pointCount == 2);
+  
+  Polygon far = getRectangle(5, 0, 2, 2);
+  CHECK(!collidePolygons(&a, &far, &manifold));
+  CHECK(!collideConvex(&a, &far, &manifold));
+  
+  // Circles of radius 1 with centers 1.5 apart along y
+  Polygon c = getCircle(0, 0, 1), d = getCircle(0, 1.5f, 1);
+  CHECK(collideCircles(&c, &d, &manifold));
+  CHECK(near(manifold.penetration, 0.5f));
+  CHECK(near(manifold.normal.x, 0.0f) && near(manifold.normal.y, 1.0f));
+  CHECK(manifold.pointCount == 1);
+  
+  // Circle of radius 1 sinking 0.25 into the top of a square
+  Polygon ball = getCircle(c.centroidPos.x, a.getBoundingBox().y1 - 0.75f, 1);
+  CHECK(collideCirclePolygon(&ball, &a, &manifold));
+  CHECK(near(manifold.penetration, 0.25f));
+  
+  // A point inside and outside a square
+  Polygon inside = getPoint(a.centroidPos.x, a.centroidPos.y);
+  Polygon outside = getPoint(a.centroidPos.x + 5, a.centroidPos.y);
+  CHECK(collideShapes(&inside, &a, NULL));
+  CHECK(!collideShapes(&outside, &a, NULL));
+  
+  // Coordinates so large that GJK gets no direction out of them, it must
+  // not report a collision it didn't find
+  Polygon left = getCircle(-3e38f, 0, 1), right = getCircle(3e38f, 0, 1);
+  CHECK(!collideCircles(&left, &right, NULL));
+  CHECK(!collideConvex(&left, &right, &manifold));
+  CHECK(!collideConvex(&left, &right, NULL));
+}
+
+static void testRandomContacts() {
+  int collisions = 0;
+  for(int i = 0; i < 5000; ++i) {
+    Polygon a = randomShape(0, 0);
+    Polygon b = randomShape(randomFloat(-4, 4), randomFloat(-4, 4));
+    ContactManifold exact, gjk;
+    bool hit = collideShapes(&a, &b, &exact);
+    bool gjkHit = collideConvex(&a, &b, &gjk);
+    
+    // Shapes barely touching may go either way
+    if(hit != gjkHit) {
+      CHECK((hit ? exact.penetration : gjk.penetration) < 1e-2f);
+      continue;
+    }
+    CHECK(hit == a.collides(&b));
+    if(!hit)
+      continue;
+    ++collisions;
+    
+    CHECK(near(dot(exact.normal, exact.normal), 1.0f));
+    CHECK(exact.penetration >= 0.0f);
+    CHECK(exact.pointCount >= 1 && exact.pointCount <= MAX_CONTACT_POINTS);
+    CHECK(near(exact.penetration, gjk.penetration, 2e-2f));
+    
+    // Moving b along the normal a bit further than the penetration
+    // separates the shapes
+    b.translate(exact.normal * (exact.penetration + 1e-2f));
+    CHECK(!collideShapes(&a, &b, NULL));
+  }
+  CHECK(collisions > 500);
+}
+
+static void testBroadPhase() {
+  std::vector<BoundingBox> boxes;
+  SpatialHash hash;
+  for(int i = 0; i < 2000; ++i) {
+    float x = randomFloat(0, 200), y = randomFloat(0, 200);
+    // A few boxes cover many cells
+    float size = i % 100 == 0 ? 40.0f : randomFloat(0.5f, 3.0f);
+    boxes.push_back({x, y, x + size, y + size});
+    hash.insert(i, boxes.back());
+  }
+  // Removed bodies aren't reported
+  for(int i = 0; i < 2000; i += 7)
+    hash.remove(i);
+  
+  std::vector<BodyPair> pairs, expected;
+  hash.findPairs(pairs);
+  for(int i = 0; i < 2000; ++i)
+    for(int j = i + 1; j < 2000; ++j)
+      if(i % 7 != 0 && j % 7 != 0 && boxes[i].intersects(boxes[j]))
+        expected.push_back(BodyPair(i, j));
+  CHECK(pairs == expected);
+}
+
+int main() {
+  srand(32);
+  testGeometry();
+  testKnownContacts();
+  testRandomContacts();
+  testBroadPhase();
+  return checkResult("collision");
+}
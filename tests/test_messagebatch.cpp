@@ -0,0 +1,86 @@
+#include <cstdlib>
+#include <vector>
+#include "check.h"
+#include "canvas/messagebatch.h"
+#include "canvas/protocol.h"
+
+// Checks that the messages of a batch come out of its packet as they went
+// in, including empty and the longest ones, and that longer ones are refused
+
+// Read every message of a batch packet, returns false if it is cut
+static bool readBatch(const unsigned char* data, int size,
+                      std::vector<std::vector<unsigned char> > &messages) {
+  std::vector<unsigned char> packet(data, data + size);
+  messages.clear();
+  if(packet.empty() || packet[0] != MSG_BATCH)
+    return false;
+  unsigned char* pnt = packet.data() + sizeof(unsigned char);
+  unsigned char* end = packet.data() + packet.size();
+  unsigned char* message;
+  int length;
+  while(pnt != end) {
+    if(!MessageBatch::next(pnt, end, message, length))
+      return false;
+    messages.push_back(std::vector<unsigned char>(message, message + length));
+  }
+  return true;
+}
+
+static void testMessages() {
+  MessageBatch batch;
+  CHECK(batch.getCount() == 0 && batch.getSize() == 1 && batch.getData()[0] == MSG_BATCH);
+
+  std::vector<std::vector<unsigned char> > sent, received;
+  for(int i = 0; i < 100; ++i) {
+    std::vector<unsigned char> message(i % 10 == 0 ? 0 : rand() % 300);
+    for(unsigned int j = 0; j < message.size(); ++j)
+      message[j] = rand();
+    sent.push_back(message);
+    CHECK(batch.add(message.data(), message.size()));
+  }
+  CHECK(batch.getCount() == 100);
+  CHECK(readBatch(batch.getData(), batch.getSize(), received));
+  CHECK(received == sent);
+
+  // A packet cut anywhere gives the whole messages before the cut only
+  for(int size = 1; size < batch.getSize(); size += 37) {
+    readBatch(batch.getData(), size, received);
+    CHECK(received.size() < sent.size());
+    for(unsigned int i = 0; i < received.size(); ++i)
+      CHECK(received[i] == sent[i]);
+  }
+
+  batch.clear();
+  CHECK(batch.getCount() == 0 && batch.getSize() == 1);
+  CHECK(readBatch(batch.getData(), batch.getSize(), received) && received.empty());
+}
+
+static void testLimit() {
+  MessageBatch batch;
+  std::vector<unsigned char> longest(MAX_BATCHED_MESSAGE, 7);
+  longest.back() = 9;
+  CHECK(batch.add(longest.data(), longest.size()));
+
+  // Longer messages would get a wrong length, they are left out
+  std::vector<unsigned char> tooLong(MAX_BATCHED_MESSAGE + 1, 8);
+  CHECK(!batch.add(tooLong.data(), tooLong.size()));
+  CHECK(!batch.add(tooLong.data(), -1));
+  CHECK(batch.getCount() == 1);
+
+  unsigned char small[] = {1, 2, 3};
+  CHECK(batch.add(small, sizeof(small)));
+
+  std::vector<std::vector<unsigned char> > received;
+  CHECK(readBatch(batch.getData(), batch.getSize(), received));
+  CHECK(received.size() == 2);
+  if(received.size() == 2)
+    CHECK(received[0] == longest &&
+          received[1] == std::vector<unsigned char>(small, small + sizeof(small)));
+}
+
+int main() {
+  srand(43);
+  testMessages();
+  testLimit();
+  return checkResult("messagebatch");
+}
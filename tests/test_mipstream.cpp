@@ -0,0 +1,162 @@
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include "check.h"
+#include "canvas/mipstream.h"
+
+// Checks of the subscriptions to the levels of a pyramid and of the tiles
+// sent to them: the packets, the tiles under a view, and a MipView getting
+// the same pixels as the pyramid of the server
+
+static void testLevels() {
+  CHECK(getMipLevels(1000, 600, 10) == 9);
+  CHECK(getMipLevels(1000, 600, 3) == 3);
+  CHECK(getMipLevels(1, 600, 10) == 0);
+  CHECK(getMipSize(101, 0) == 101);
+  CHECK(getMipSize(101, 1) == 51);
+  CHECK(getMipSize(101, 3) == 13);
+}
+
+static void testSubscription() {
+  LevelSubscription view;
+  view.level = 2;
+  view.line = -20;
+  view.column = 100;
+  view.lines = 300;
+  view.columns = 400;
+  std::vector<unsigned char> packet(view.getSize());
+  unsigned char* pnt = packet.data();
+  view.write(pnt);
+  CHECK(pnt == packet.data() + packet.size());
+
+  LevelSubscription read;
+  pnt = packet.data();
+  CHECK(read.read(pnt, packet.size()));
+  CHECK(read.level == 2 && read.line == -20 && read.column == 100 && read.lines == 300 &&
+        read.columns == 400);
+  for(unsigned int length = 0; length < packet.size(); ++length) {
+    pnt = packet.data();
+    CHECK(!read.read(pnt, length));
+  }
+  packet[0] = MSG_MIP_TILES;
+  pnt = packet.data();
+  CHECK(!read.read(pnt, packet.size()));
+
+  // Pixels 100 to 499 and 0 to 279 of the canvas are 25 to 124 and 0 to 69
+  // of level 2, on tiles 0 to 3 and 0 to 2, cut to the tiles of the level
+  int x0, y0, x1, y1;
+  CHECK(view.getTiles(10, 10, x0, y0, x1, y1));
+  CHECK(x0 == 0 && x1 == 3 && y0 == 0 && y1 == 2);
+  CHECK(view.getTiles(2, 2, x0, y0, x1, y1));
+  CHECK(x1 == 1 && y1 == 1);
+
+  // Views off the canvas or empty have no tiles
+  view.column = -400;
+  CHECK(!view.getTiles(10, 10, x0, y0, x1, y1));
+  view.column = 0;
+  view.lines = 0;
+  CHECK(!view.getTiles(10, 10, x0, y0, x1, y1));
+}
+
+// Returns true if the view has the pixels of the level of the pyramid
+// under the subscription, and no others
+static bool sameAsPyramid(MipView &view, MipPyramid &pyramid, LevelSubscription &subscription) {
+  int level = view.getLevel(), width = pyramid.getWidth(level);
+  int x0, y0, x1, y1;
+  subscription.getTiles(pyramid.getTilesX(level), pyramid.getTilesY(level), x0, y0, x1, y1);
+  for(int y = 0; y < pyramid.getHeight(level); ++y)
+    for(int x = 0; x < width; ++x) {
+      int tx = x / TILE_SIZE, ty = y / TILE_SIZE;
+      bool under = x0 <= tx && tx <= x1 && y0 <= ty && ty <= y1;
+      Pixel p;
+      if(view.getPixel(x, y, p) != under)
+        return false;
+      if(under && p != pyramid.getLevel(level)[y * width + x])
+        return false;
+    }
+  return true;
+}
+
+static void testTiles() {
+  CanvasStorage canvas(300, 200);
+  for(int i = 0; i < 200; ++i)
+    for(int j = 0; j < 300; ++j)
+      canvas.setPixel(j, i, {(unsigned char)rand(), (unsigned char)rand(),
+                             (unsigned char)rand()});
+  MipPyramid pyramid(300, 200, getMipLevels(300, 200, 3));
+  pyramid.markDirty(0, 0, 300, 200);
+  pyramid.update(&canvas);
+
+  // Every pixel of level 1 is between the pixels under it
+  const Pixel* level1 = pyramid.getLevel(1);
+  bool between = true;
+  for(int y = 0; y < 100; ++y)
+    for(int x = 0; x < 150; ++x) {
+      int low = 255, high = 0;
+      for(int i = 0; i < 4; ++i) {
+        unsigned char r = canvas.getPixel(x * 2 + i % 2, y * 2 + i / 2).r;
+        low = std::min(low, (int)r);
+        high = std::max(high, (int)r);
+      }
+      between &= low <= level1[y * 150 + x].r && level1[y * 150 + x].r <= high;
+    }
+  CHECK(between);
+
+  // A first view of level 1 gets every tile under it
+  LevelSubscription subscription;
+  subscription.level = 1;
+  subscription.line = 0;
+  subscription.column = 70;
+  subscription.lines = 200;
+  subscription.columns = 100;
+  std::vector<unsigned char> packet;
+  CHECK(writeMipTiles(&pyramid, subscription, 0, NULL, packet) == 2 * 4);
+  MipView view;
+  view.setLevel(1, 300, 200);
+  CHECK(view.getWidth() == 150 && view.getHeight() == 100);
+  CHECK(view.receive(packet.data(), packet.size()));
+  CHECK(sameAsPyramid(view, pyramid, subscription));
+
+  // Then only the tiles changed since, and the ones it didn't view
+  unsigned int since = pyramid.getUpdate();
+  CHECK(writeMipTiles(&pyramid, subscription, since, &subscription, packet) == 0);
+  CHECK(packet.empty());
+  canvas.setPixel(100, 100, {1, 2, 3});
+  pyramid.markDirty(100, 100, 1, 1);
+  pyramid.update(&canvas);
+  CHECK(writeMipTiles(&pyramid, subscription, since, &subscription, packet) == 1);
+  CHECK(view.receive(packet.data(), packet.size()));
+  CHECK(sameAsPyramid(view, pyramid, subscription));
+
+  LevelSubscription moved = subscription;
+  moved.column = 0;
+  moved.columns = 300;
+  CHECK(writeMipTiles(&pyramid, moved, pyramid.getUpdate(), &subscription, packet) ==
+        5 * 4 - 2 * 4);
+  CHECK(view.receive(packet.data(), packet.size()));
+  CHECK(sameAsPyramid(view, pyramid, moved));
+
+  // Tiles outside the view are forgotten when it moves back
+  view.keep(subscription);
+  CHECK(sameAsPyramid(view, pyramid, subscription));
+
+  // Tiles of other levels are ignored, broken packets refused
+  LevelSubscription other = moved;
+  other.level = 2;
+  CHECK(writeMipTiles(&pyramid, other, 0, &moved, packet) > 0);
+  CHECK(view.receive(packet.data(), packet.size()));
+  CHECK(sameAsPyramid(view, pyramid, subscription));
+  CHECK(writeMipTiles(&pyramid, subscription, 0, NULL, packet) > 0);
+  CHECK(!view.receive(packet.data(), packet.size() - 1));
+  unsigned char* pnt = packet.data() + sizeof(unsigned char) * 2 + sizeof(unsigned short);
+  writeNumber(pnt, 1000);
+  CHECK(!view.receive(packet.data(), packet.size()));
+}
+
+int main() {
+  srand(49);
+  testLevels();
+  testSubscription();
+  testTiles();
+  return checkResult("mipstream");
+}
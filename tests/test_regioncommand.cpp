@@ -0,0 +1,240 @@
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include "check.h"
+#include "canvas/regioncommand.h"
+
+// Checks of the fill, stamp and flood fill commands: their packets, their
+// limits and the pixels they change, the flood fill against a plain search
+
+static CommandColor rgb(unsigned char r, unsigned char g, unsigned char b) {
+  CommandColor color;
+  color.type = MSG_PIXEL;
+  color.color = {r, g, b};
+  color.index = 0;
+  return color;
+}
+
+static RegionCommand makeCommand(MessageType type, int line, int column, int lines,
+                                 int columns, CommandColor color) {
+  RegionCommand command;
+  command.type = type;
+  command.line = line;
+  command.column = column;
+  command.lines = lines;
+  command.columns = columns;
+  command.seedLine = line;
+  command.seedColumn = column;
+  command.color = color;
+  return command;
+}
+
+// Write the command and read it back, every shorter packet must be refused
+static bool roundTrip(RegionCommand &command, RegionCommand &read) {
+  std::vector<unsigned char> packet(command.getSize());
+  unsigned char* pnt = packet.data();
+  command.write(pnt);
+  if(pnt != packet.data() + packet.size())
+    return false;
+  for(unsigned int length = 0; length < packet.size(); ++length) {
+    RegionCommand cut;
+    pnt = packet.data();
+    if(cut.read(pnt, length))
+      return false;
+  }
+  pnt = packet.data();
+  return read.read(pnt, packet.size()) && pnt == packet.data() + packet.size();
+}
+
+static void testPackets() {
+  RegionCommand fill = makeCommand(MSG_FILL_RECT, -3, 5, 10, 20, rgb(1, 2, 3)), read;
+  CHECK(roundTrip(fill, read));
+  CHECK(read.type == MSG_FILL_RECT && read.line == -3 && read.column == 5 &&
+        read.lines == 10 && read.columns == 20 && read.color.color == fill.color.color);
+
+  RegionCommand flood = makeCommand(MSG_FLOOD_FILL, 0, 0, 64, 64, rgb(9, 8, 7));
+  flood.seedLine = 12;
+  flood.seedColumn = 34;
+  CHECK(roundTrip(flood, read));
+  CHECK(read.type == MSG_FLOOD_FILL && read.seedLine == 12 && read.seedColumn == 34 &&
+        read.lines == 64 && read.color.color == flood.color.color);
+
+  RegionCommand stamp = makeCommand(MSG_STAMP, 1, 2, 2, 3, rgb(0, 0, 0));
+  stamp.runs.push_back({2, false, rgb(10, 20, 30)});
+  stamp.runs.push_back({3, true, rgb(0, 0, 0)});
+  stamp.runs.push_back({1, false, rgb(40, 50, 60)});
+  CHECK(roundTrip(stamp, read));
+  CHECK(read.runs.size() == 3 && read.runs[0].length == 2 && !read.runs[0].transparent &&
+        read.runs[1].length == 3 && read.runs[1].transparent &&
+        read.runs[2].color.color == stamp.runs[2].color.color);
+
+  // Unknown command and color types
+  unsigned char bad[] = {MSG_PIXEL, 0, 0, 0, 0, 0, 0, 0, 0, MSG_PIXEL, 0, 0, 0};
+  unsigned char* pnt = bad;
+  CHECK(!read.read(pnt, sizeof(bad)));
+  bad[0] = MSG_FILL_RECT;
+  bad[9] = MSG_ACK;
+  pnt = bad;
+  CHECK(!read.read(pnt, sizeof(bad)));
+}
+
+static void testValid() {
+  CanvasStorage canvas(100, 80);
+  CHECK(makeCommand(MSG_FILL_RECT, 0, 0, MAX_REGION_SIZE, 1, rgb(1, 1, 1)).valid(&canvas));
+  CHECK(!makeCommand(MSG_FILL_RECT, 0, 0, MAX_REGION_SIZE + 1, 1, rgb(1, 1, 1)).valid(&canvas));
+  CHECK(!makeCommand(MSG_FILL_RECT, 0, 0, -1, 1, rgb(1, 1, 1)).valid(&canvas));
+
+  // The seed must be inside the area and on the canvas
+  RegionCommand flood = makeCommand(MSG_FLOOD_FILL, 0, 0, MAX_FLOOD_SIZE, 50, rgb(1, 1, 1));
+  CHECK(flood.valid(&canvas));
+  flood.lines = MAX_FLOOD_SIZE + 1;
+  CHECK(!flood.valid(&canvas));
+  flood.lines = 10;
+  flood.seedLine = 10;
+  CHECK(!flood.valid(&canvas));
+  flood = makeCommand(MSG_FLOOD_FILL, -5, -5, 10, 10, rgb(1, 1, 1));
+  CHECK(!flood.valid(&canvas));
+
+  // The runs of a stamp fit in its rectangle
+  RegionCommand stamp = makeCommand(MSG_STAMP, 0, 0, 2, 2, rgb(0, 0, 0));
+  stamp.runs.push_back({4, false, rgb(1, 1, 1)});
+  CHECK(stamp.valid(&canvas));
+  stamp.runs.push_back({1, true, rgb(0, 0, 0)});
+  CHECK(!stamp.valid(&canvas));
+
+  // Palette indices only go to indexed canvases, and only valid ones
+  CommandColor index = rgb(0, 0, 0);
+  index.type = MSG_PIXEL_INDEX;
+  index.index = 3;
+  CHECK(!makeCommand(MSG_FILL_RECT, 0, 0, 5, 5, index).valid(&canvas));
+  CanvasStorage indexed(100, 80, FORMAT_INDEX4);
+  CHECK(makeCommand(MSG_FILL_RECT, 0, 0, 5, 5, index).valid(&indexed));
+  index.index = 200;
+  CHECK(!makeCommand(MSG_FILL_RECT, 0, 0, 5, 5, index).valid(&indexed));
+}
+
+static void testFillAndStamp() {
+  CanvasStorage canvas(50, 40);
+  Pixel black = {0, 0, 0}, red = {255, 0, 0}, blue = {0, 0, 255};
+  int x, y, w, h;
+
+  // Only the part on the canvas is filled and reported
+  RegionCommand fill = makeCommand(MSG_FILL_RECT, 35, -5, 10, 10, rgb(255, 0, 0));
+  CHECK(fill.apply(&canvas, x, y, w, h));
+  CHECK(x == 0 && y == 35 && w == 5 && h == 5);
+  for(int i = 0; i < 40; ++i)
+    for(int j = 0; j < 50; ++j)
+      CHECK(canvas.getPixel(j, i) == (i >= 35 && j < 5 ? red : black));
+  CHECK(!makeCommand(MSG_FILL_RECT, 50, 0, 5, 5, rgb(1, 1, 1)).apply(&canvas, x, y, w, h));
+
+  // A stamp of 3 x 2 pixels: blue, transparent, transparent / blue, blue, red
+  RegionCommand stamp = makeCommand(MSG_STAMP, 10, 20, 2, 3, rgb(0, 0, 0));
+  stamp.runs.push_back({1, false, rgb(0, 0, 255)});
+  stamp.runs.push_back({2, true, rgb(0, 0, 0)});
+  stamp.runs.push_back({2, false, rgb(0, 0, 255)});
+  stamp.runs.push_back({1, false, rgb(255, 0, 0)});
+  CHECK(stamp.valid(&canvas));
+  CHECK(stamp.apply(&canvas, x, y, w, h));
+  CHECK(x == 20 && y == 10 && w == 3 && h == 2);
+  CHECK(canvas.getPixel(20, 10) == blue && canvas.getPixel(21, 10) == black &&
+        canvas.getPixel(22, 10) == black);
+  CHECK(canvas.getPixel(20, 11) == blue && canvas.getPixel(21, 11) == blue &&
+        canvas.getPixel(22, 11) == red);
+
+  // A transparent stamp changes nothing
+  RegionCommand clear = makeCommand(MSG_STAMP, 0, 0, 2, 2, rgb(0, 0, 0));
+  clear.runs.push_back({4, true, rgb(0, 0, 0)});
+  CHECK(!clear.apply(&canvas, x, y, w, h));
+}
+
+// The pixels connected to the seed with its color, inside the area
+static std::vector<bool> searchFlood(CanvasStorage &canvas, RegionCommand &command) {
+  int width = canvas.getWidth();
+  std::vector<bool> reached(width * canvas.getHeight(), false);
+  Pixel target = canvas.getPixel(command.seedColumn, command.seedLine);
+  std::vector<std::pair<int, int> > stack;
+  stack.push_back({command.seedColumn, command.seedLine});
+  while(!stack.empty()) {
+    int px = stack.back().first, py = stack.back().second;
+    stack.pop_back();
+    if(px < std::max((int)command.column, 0) || py < std::max((int)command.line, 0) ||
+       px >= std::min(command.column + command.columns, width) ||
+       py >= std::min(command.line + command.lines, canvas.getHeight()) ||
+       reached[py * width + px] || canvas.getPixel(px, py) != target)
+      continue;
+    reached[py * width + px] = true;
+    stack.push_back({px - 1, py});
+    stack.push_back({px + 1, py});
+    stack.push_back({px, py - 1});
+    stack.push_back({px, py + 1});
+  }
+  return reached;
+}
+
+static void testFloodFill() {
+  Pixel white = {255, 255, 255}, black = {0, 0, 0};
+  for(int round = 0; round < 200; ++round) {
+    CanvasStorage canvas(60, 50);
+    for(int i = 0; i < 50; ++i)
+      for(int j = 0; j < 60; ++j)
+        if(rand() % 100 < 35)
+          canvas.setPixel(j, i, white);
+
+    RegionCommand flood = makeCommand(MSG_FLOOD_FILL, rand() % 70 - 10, rand() % 80 - 10,
+                                      rand() % 40 + 1, rand() % 40 + 1, rgb(9, 9, 9));
+    flood.seedLine = flood.line + rand() % flood.lines;
+    flood.seedColumn = flood.column + rand() % flood.columns;
+    if(!flood.valid(&canvas))
+      continue;
+    std::vector<bool> expected = searchFlood(canvas, flood);
+
+    // The spans cover every pixel of the search once, without changing the
+    // canvas
+    std::vector<FloodSpan> spans;
+    CHECK(flood.findFlood(&canvas, spans));
+    std::vector<int> covered(60 * 50, 0);
+    for(unsigned int i = 0; i < spans.size(); ++i)
+      for(int j = 0; j < spans[i].length; ++j)
+        ++covered[spans[i].line * 60 + spans[i].column + j];
+    bool same = true, unchanged = true;
+    for(int i = 0; i < 60 * 50; ++i) {
+      same &= covered[i] == (expected[i] ? 1 : 0);
+      unchanged &= canvas.getPixel(i % 60, i / 60) != flood.color.color;
+    }
+    CHECK(same);
+    CHECK(unchanged);
+
+    // apply() changes those pixels and reports their bounds
+    std::vector<Pixel> before(60 * 50);
+    for(int i = 0; i < 60 * 50; ++i)
+      before[i] = canvas.getPixel(i % 60, i / 60);
+    int x, y, w, h;
+    CHECK(flood.apply(&canvas, x, y, w, h));
+    for(int i = 0; i < 60 * 50; ++i) {
+      int px = i % 60, py = i / 60;
+      if(expected[i]) {
+        CHECK(canvas.getPixel(px, py) == flood.color.color);
+        CHECK(x <= px && px < x + w && y <= py && py < y + h);
+      } else
+        CHECK(canvas.getPixel(px, py) == before[i]);
+    }
+  }
+
+  // Filling with the color of the seed changes nothing
+  CanvasStorage canvas(10, 10);
+  RegionCommand flood = makeCommand(MSG_FLOOD_FILL, 0, 0, 10, 10, rgb(0, 0, 0));
+  std::vector<FloodSpan> spans;
+  int x, y, w, h;
+  CHECK(!flood.findFlood(&canvas, spans) && spans.empty());
+  CHECK(!flood.apply(&canvas, x, y, w, h));
+  CHECK(canvas.getPixel(5, 5) == black);
+}
+
+int main() {
+  srand(42);
+  testPackets();
+  testValid();
+  testFillAndStamp();
+  testFloodFill();
+  return checkResult("regioncommand");
+}
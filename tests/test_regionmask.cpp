@@ -0,0 +1,159 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include "check.h"
+#include "canvas/regionmask.h"
+
+// Checks of RegionMask against a plain grid of locked flags, on canvases
+// whose size isn't a whole number of tiles, and of saving and loading it
+
+const char* MASK_FILE = "test_regionmask.dat";
+
+// The same pixels locked as the mask, one flag for every pixel
+struct Grid {
+  int width, height;
+  std::vector<bool> locked;
+
+  void setRect(int x, int y, int w, int h, bool value) {
+    for(int i = std::max(y, 0); i < std::min(y + h, height); ++i)
+      for(int j = std::max(x, 0); j < std::min(x + w, width); ++j)
+        locked[i * width + j] = value;
+  }
+
+  bool anyLocked(int x, int y, int w, int h) {
+    for(int i = std::max(y, 0); i < std::min(y + h, height); ++i)
+      for(int j = std::max(x, 0); j < std::min(x + w, width); ++j)
+        if(locked[i * width + j])
+          return true;
+    return false;
+  }
+
+  int countLocked() {
+    int count = 0;
+    for(unsigned int i = 0; i < locked.size(); ++i)
+      count += locked[i];
+    return count;
+  }
+};
+
+static bool sameAsGrid(RegionMask* mask, Grid &grid) {
+  if(mask->getWidth() != grid.width || mask->getHeight() != grid.height ||
+     mask->countLocked() != grid.countLocked())
+    return false;
+  for(int i = 0; i < grid.height; ++i)
+    for(int j = 0; j < grid.width; ++j)
+      if(mask->isLocked(j, i) != grid.locked[i * grid.width + j])
+        return false;
+  return true;
+}
+
+static void testRects() {
+  RegionMask mask(100, 70);
+  Grid grid = {100, 70, std::vector<bool>(100 * 70, false)};
+  CHECK(mask.countLocked() == 0);
+  CHECK(!mask.anyLocked(0, 0, 100, 70));
+
+  // Whole tiles, parts of tiles, the canvas edges and rectangles outside it
+  mask.setRect(0, 0, 32, 32, true);
+  grid.setRect(0, 0, 32, 32, true);
+  mask.setRect(90, 60, 40, 40, true);
+  grid.setRect(90, 60, 40, 40, true);
+  mask.setRect(-10, 40, 15, 3, true);
+  grid.setRect(-10, 40, 15, 3, true);
+  mask.setRect(200, 200, 10, 10, true);
+  CHECK(sameAsGrid(&mask, grid));
+
+  // Unlocking part of a locked tile and locking the rest of a mixed one
+  mask.setRect(8, 8, 4, 4, false);
+  grid.setRect(8, 8, 4, 4, false);
+  CHECK(sameAsGrid(&mask, grid));
+  mask.setRect(8, 8, 4, 4, true);
+  grid.setRect(8, 8, 4, 4, true);
+  CHECK(sameAsGrid(&mask, grid));
+
+  for(int i = 0; i < 500; ++i) {
+    int x = rand() % 120 - 10, y = rand() % 90 - 10;
+    int w = rand() % 40, h = rand() % 40;
+    bool value = rand() % 3 != 0;
+    mask.setRect(x, y, w, h, value);
+    grid.setRect(x, y, w, h, value);
+
+    x = rand() % 120 - 10;
+    y = rand() % 90 - 10;
+    w = rand() % 20;
+    h = rand() % 20;
+    CHECK(mask.anyLocked(x, y, w, h) == grid.anyLocked(x, y, w, h));
+  }
+  CHECK(sameAsGrid(&mask, grid));
+
+  mask.setRect(0, 0, 100, 70, false);
+  CHECK(mask.countLocked() == 0);
+}
+
+static void testSaveLoad() {
+  RegionMask mask(75, 130);
+  Grid grid = {75, 130, std::vector<bool>(75 * 130, false)};
+  for(int i = 0; i < 40; ++i) {
+    int x = rand() % 75, y = rand() % 130, w = rand() % 30, h = rand() % 30;
+    mask.setRect(x, y, w, h, true);
+    grid.setRect(x, y, w, h, true);
+  }
+  mask.setRect(32, 32, 32, 32, true);
+  grid.setRect(32, 32, 32, 32, true);
+
+  CHECK(mask.save(MASK_FILE));
+  RegionMask* loaded = RegionMask::load(MASK_FILE);
+  CHECK(loaded != NULL);
+  if(loaded != NULL)
+    CHECK(sameAsGrid(loaded, grid));
+  delete loaded;
+
+  // A cut file isn't loaded
+  FILE* file = fopen(MASK_FILE, "r+b");
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fclose(file);
+  CHECK(truncate(MASK_FILE, size / 2) == 0);
+  loaded = RegionMask::load(MASK_FILE);
+  CHECK(loaded == NULL);
+  delete loaded;
+
+  remove(MASK_FILE);
+  CHECK(RegionMask::load(MASK_FILE) == NULL);
+}
+
+static void testMaskChange() {
+  MaskChange change;
+  change.key = "moderator";
+  change.line = 3;
+  change.column = -4;
+  change.lines = 50;
+  change.columns = 60;
+  change.locked = true;
+  std::vector<unsigned char> packet(change.getSize());
+  unsigned char* pnt = packet.data();
+  change.write(pnt);
+  CHECK(pnt == packet.data() + packet.size());
+
+  MaskChange read;
+  pnt = packet.data();
+  CHECK(read.read(pnt, packet.size()));
+  CHECK(read.key == change.key && read.line == 3 && read.column == -4 &&
+        read.lines == 50 && read.columns == 60 && read.locked);
+
+  // A packet cut anywhere is refused
+  for(unsigned int length = 0; length < packet.size(); ++length) {
+    pnt = packet.data();
+    CHECK(!read.read(pnt, length));
+  }
+}
+
+int main() {
+  srand(47);
+  testRects();
+  testSaveLoad();
+  testMaskChange();
+  return checkResult("regionmask");
+}
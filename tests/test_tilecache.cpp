@@ -0,0 +1,284 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include "check.h"
+#include "canvas/tilecache.h"
+
+// Checks of TileCache as a view walks over a canvas larger than its
+// memory: the tiles it asks for, the ones it drops, and the copies it keeps
+// on disk and between sessions
+
+const char* DISK_FILE = "test_tilecache.dat";
+const char* INDEX_FILE = "test_tilecache.idx";
+
+// Canvas of 10 x 10 tiles, more than the MIN_CACHED_TILES slots the cache
+// gets with no budget
+const int WIDTH = 10 * TILE_SIZE;
+const int HEIGHT = 10 * TILE_SIZE;
+const unsigned int EPOCH = 7;
+
+// The canvas as the server has it, with the version of every tile
+CanvasStorage* reference = NULL;
+std::vector<unsigned int> tileVersions;
+
+// Tiles asked for by a MSG_TILE_REQUEST, with the version the cache has
+static std::vector<std::pair<int, unsigned int> > readRequest(std::vector<unsigned char> &request) {
+  std::vector<std::pair<int, unsigned int> > wanted;
+  if(request.empty())
+    return wanted;
+  unsigned char* pnt = request.data();
+  unsigned char type;
+  unsigned short count;
+  readNumber(pnt, type);
+  readNumber(pnt, count);
+  CHECK(type == MSG_TILE_REQUEST);
+  CHECK(request.size() == sizeof(unsigned char) + sizeof(unsigned short) +
+                          count * (sizeof(int) + sizeof(unsigned int)));
+  for(int i = 0; i < count; ++i) {
+    int tile;
+    unsigned int version;
+    readNumber(pnt, tile);
+    readNumber(pnt, version);
+    wanted.push_back({tile, version});
+  }
+  return wanted;
+}
+
+// Answer the request like the server, the tiles the cache has the version
+// of are sent without their lines
+static void answer(TileCache* cache, std::vector<std::pair<int, unsigned int> > &wanted) {
+  std::vector<unsigned char> reply(sizeof(unsigned char) + sizeof(unsigned int) +
+                                   sizeof(unsigned short));
+  unsigned char* pnt = reply.data();
+  writeNumber(pnt, MSG_TILES);
+  writeNumber(pnt, EPOCH);
+  writeNumber(pnt, (unsigned short)wanted.size());
+  for(unsigned int i = 0; i < wanted.size(); ++i) {
+    int tile = wanted[i].first, x, y, w, h;
+    cache->getTileRect(tile, x, y, w, h);
+    bool hasLines = wanted[i].second != tileVersions[tile];
+    int size = reply.size();
+    reply.resize(size + sizeof(int) + sizeof(unsigned int) + sizeof(unsigned char) +
+                 (hasLines ? reference->getRegionSize(w, h) : 0));
+    pnt = reply.data() + size;
+    writeNumber(pnt, tile);
+    writeNumber(pnt, tileVersions[tile]);
+    writeNumber(pnt, (unsigned char)hasLines);
+    if(hasLines)
+      reference->writeRegion(x, y, w, h, pnt);
+  }
+  CHECK(cache->receiveTiles(reply.data(), reply.size()));
+}
+
+// Returns true if the tile in memory has the pixels of the reference
+static bool sameTile(TileCache* cache, int tile) {
+  int x, y, w, h;
+  cache->getTileRect(tile, x, y, w, h);
+  for(int i = y; i < y + h; ++i)
+    for(int j = x; j < x + w; ++j)
+      if(cache->getPixel(j, i) != reference->getPixel(j, i))
+        return false;
+  return true;
+}
+
+static int countLoaded(TileCache* cache) {
+  int count = 0;
+  for(int tile = 0; tile < cache->getTilesX() * cache->getTilesY(); ++tile)
+    count += cache->isLoaded(tile);
+  return count;
+}
+
+static TileCache* newCache() {
+  CanvasStorage header(0, 0);
+  return new TileCache(WIDTH, HEIGHT, &header, EPOCH, 1, 0);
+}
+
+// The view of 2 x 2 tiles at tile (tx, ty), the tiles around it are kept
+static void view(TileCache* cache, int tx, int ty,
+                 std::vector<std::pair<int, unsigned int> > &wanted) {
+  std::vector<unsigned char> request;
+  cache->update(tx * TILE_SIZE, ty * TILE_SIZE, TILE_SIZE * 2, TILE_SIZE * 2, 0, 0, request);
+  wanted = readRequest(request);
+}
+
+static bool inKept(int tile, int tx, int ty) {
+  int x = tile % 10, y = tile / 10;
+  return tx - 1 <= x && x <= tx + 2 && ty - 1 <= y && y <= ty + 2;
+}
+
+static void testRequests() {
+  TileCache* cache = newCache();
+  std::vector<std::pair<int, unsigned int> > wanted;
+  view(cache, 4, 4, wanted);
+
+  // The 4 tiles of the view first, then the 12 around them, none held
+  CHECK(wanted.size() == 16);
+  for(unsigned int i = 0; i < wanted.size(); ++i) {
+    int x = wanted[i].first % 10, y = wanted[i].first / 10;
+    bool inView = 4 <= x && x <= 5 && 4 <= y && y <= 5;
+    CHECK(inView == (i < 4));
+    CHECK(inKept(wanted[i].first, 4, 4));
+    CHECK(wanted[i].second == 0);
+  }
+
+  // Tiles already asked for aren't asked for again before the reply
+  std::vector<std::pair<int, unsigned int> > again;
+  view(cache, 4, 4, again);
+  CHECK(again.empty());
+
+  answer(cache, wanted);
+  for(unsigned int i = 0; i < wanted.size(); ++i)
+    CHECK(cache->isLoaded(wanted[i].first) && sameTile(cache, wanted[i].first));
+  CHECK(countLoaded(cache) == 16);
+
+  // Edits of a tile in memory change it once, older ones are ignored
+  int tile = cache->getTile(4 * TILE_SIZE + 3, 4 * TILE_SIZE + 5);
+  CommandColor red;
+  red.type = MSG_PIXEL;
+  red.color = {255, 0, 0};
+  red.index = 0;
+  CHECK(cache->receivePixel(4 * TILE_SIZE + 3, 4 * TILE_SIZE + 5, red, tileVersions[tile] + 1));
+  CHECK(cache->getPixel(4 * TILE_SIZE + 3, 4 * TILE_SIZE + 5) == red.color);
+  red.color = {0, 255, 0};
+  CHECK(!cache->receivePixel(4 * TILE_SIZE + 3, 4 * TILE_SIZE + 5, red, tileVersions[tile]));
+  CHECK(cache->getPixel(4 * TILE_SIZE + 3, 4 * TILE_SIZE + 5) != red.color);
+  CHECK(!cache->receivePixel(0, 0, red, 1000));
+  CHECK(cache->getVersion() == 1000);
+  delete cache;
+}
+
+// Walk the view over the whole canvas: the kept tiles are always in memory
+// and the tiles dropped are never newer than the ones left away from the
+// view
+static void walk(TileCache* cache, std::vector<int> &lastUsed, int &step) {
+  int tiles = cache->getTilesX() * cache->getTilesY();
+  for(int ty = 0; ty < 9; ++ty)
+    for(int tx = 0; tx < 9; ++tx) {
+      std::vector<bool> before(tiles);
+      for(int tile = 0; tile < tiles; ++tile)
+        before[tile] = cache->isLoaded(tile);
+
+      std::vector<std::pair<int, unsigned int> > wanted;
+      view(cache, tx, ty, wanted);
+      answer(cache, wanted);
+      ++step;
+      for(int tile = 0; tile < tiles; ++tile)
+        if(inKept(tile, tx, ty))
+          lastUsed[tile] = step;
+
+      int newestDropped = -1, oldestLeft = step + 1;
+      for(int tile = 0; tile < tiles; ++tile) {
+        if(inKept(tile, tx, ty)) {
+          CHECK(cache->isLoaded(tile) && sameTile(cache, tile));
+          continue;
+        }
+        if(before[tile] && !cache->isLoaded(tile))
+          newestDropped = std::max(newestDropped, lastUsed[tile]);
+        else if(cache->isLoaded(tile))
+          oldestLeft = std::min(oldestLeft, lastUsed[tile]);
+      }
+      CHECK(newestDropped <= oldestLeft);
+      CHECK(countLoaded(cache) <= MIN_CACHED_TILES);
+    }
+}
+
+static void testEviction() {
+  TileCache* cache = newCache();
+  std::vector<int> lastUsed(100, 0);
+  int step = 0;
+  walk(cache, lastUsed, step);
+  CHECK(countLoaded(cache) > 16);
+
+  // Without a disk the dropped tiles are asked for again from scratch
+  std::vector<std::pair<int, unsigned int> > wanted;
+  view(cache, 0, 0, wanted);
+  CHECK(!wanted.empty());
+  for(unsigned int i = 0; i < wanted.size(); ++i)
+    CHECK(wanted[i].second == 0);
+  delete cache;
+}
+
+static void testDisk() {
+  TileCache* cache = newCache();
+  CHECK(cache->openDisk(DISK_FILE, false));
+  std::vector<int> lastUsed(100, 0);
+  int step = 0;
+  walk(cache, lastUsed, step);
+
+  // Tile 0 was dropped to disk and changed since, tile 1 didn't change
+  CHECK(!cache->isLoaded(0) && !cache->isLoaded(1));
+  CommandColor blue;
+  blue.type = MSG_PIXEL;
+  blue.color = {0, 0, 255};
+  blue.index = 0;
+  CHECK(!cache->receivePixel(2, 2, blue, 5000));
+  reference->setPixel(2, 2, blue.color);
+  unsigned int oldVersion = tileVersions[0];
+  tileVersions[0] = 5000;
+
+  // Back at the start, the current copies on disk are used without asking,
+  // the old one is asked for with the version we have
+  std::vector<std::pair<int, unsigned int> > wanted;
+  view(cache, 0, 0, wanted);
+  CHECK(cache->isLoaded(1) && sameTile(cache, 1));
+  bool askedOld = false;
+  for(unsigned int i = 0; i < wanted.size(); ++i) {
+    CHECK(wanted[i].first != 1);
+    if(wanted[i].first == 0)
+      askedOld = wanted[i].second == oldVersion;
+  }
+  CHECK(askedOld);
+  answer(cache, wanted);
+  CHECK(cache->isLoaded(0) && sameTile(cache, 0));
+
+  // The next session finds the tiles on disk, and asks for them with their
+  // versions
+  CHECK(cache->save(INDEX_FILE));
+  delete cache;
+  cache = TileCache::load(INDEX_FILE, DISK_FILE, 0);
+  CHECK(cache != NULL);
+  if(cache != NULL) {
+    CHECK(cache->getWidth() == WIDTH && cache->getHeight() == HEIGHT &&
+          cache->getEpoch() == EPOCH);
+    view(cache, 0, 0, wanted);
+    CHECK(wanted.size() == 9);
+    for(unsigned int i = 0; i < wanted.size(); ++i)
+      CHECK(wanted[i].second == tileVersions[wanted[i].first]);
+    answer(cache, wanted);
+    for(unsigned int i = 0; i < wanted.size(); ++i)
+      CHECK(cache->isLoaded(wanted[i].first) && sameTile(cache, wanted[i].first));
+    CHECK(cache->save(INDEX_FILE));
+  }
+  delete cache;
+
+  // An index with a negative width is refused
+  FILE* index = fopen(INDEX_FILE, "r+b");
+  CHECK(index != NULL);
+  if(index != NULL) {
+    short width = -1;
+    fseek(index, 4 + sizeof(unsigned int), SEEK_SET);
+    fwrite(&width, sizeof(short), 1, index);
+    fclose(index);
+    CHECK(TileCache::load(INDEX_FILE, DISK_FILE, 0) == NULL);
+  }
+  remove(DISK_FILE);
+  remove(INDEX_FILE);
+}
+
+int main() {
+  srand(48);
+  reference = new CanvasStorage(WIDTH, HEIGHT);
+  for(int i = 0; i < HEIGHT; ++i)
+    for(int j = 0; j < WIDTH; ++j)
+      reference->setPixel(j, i, {(unsigned char)rand(), (unsigned char)rand(),
+                                 (unsigned char)rand()});
+  for(int tile = 0; tile < 100; ++tile)
+    tileVersions.push_back(tile + 1);
+
+  testRequests();
+  testEviction();
+  testDisk();
+  delete reference;
+  return checkResult("tilecache");
+}
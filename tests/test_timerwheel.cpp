@@ -0,0 +1,160 @@
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include "check.h"
+#include "baseclasses/timerwheel.h"
+
+// Checks of TimerWheel against the deadlines the timers should have: on
+// every level and past the range of the wheel, cancelled, scheduled from
+// callbacks, and across the wrap around of the ticks of SDL
+
+// A timer of the test, with the millisecond it is due, counted from the
+// start of the test
+struct TestTimer {
+  TimerId id;
+  unsigned long long deadline;
+  bool cancelled;
+  int runs;
+};
+
+std::vector<TestTimer> timers;
+
+// Time of the test, and the time of SDL it is at
+unsigned long long now = 0;
+Uint32 ticks = 0;
+
+// Deadline of the last timer that ran, they must run in order
+unsigned long long lastRun = 0;
+bool inOrder = true, onTime = true;
+
+static void advance(TimerWheel &wheel, unsigned long long step) {
+  now += step;
+  ticks += (Uint32)step;
+  wheel.advance(ticks);
+}
+
+static void schedule(TimerWheel &wheel, Uint32 delay) {
+  int timer = timers.size();
+  timers.push_back({NO_TIMER, now + std::max(delay, (Uint32)1), false, 0});
+  timers[timer].id = wheel.schedule(delay, [timer]() {
+    TestTimer &t = timers[timer];
+    ++t.runs;
+    inOrder &= t.deadline >= lastRun;
+    onTime &= t.deadline <= now;
+    lastRun = t.deadline;
+  });
+}
+
+// Advance the wheel by steps of at most most, checking the timers that ran
+// after every step
+static void run(TimerWheel &wheel, unsigned long long until, unsigned long long most) {
+  while(now < until) {
+    unsigned long long step = std::min(1 + (unsigned long long)rand() % most, until - now);
+
+    // Nothing is due before the wait
+    Uint32 wait = wheel.getWait(0xffffffff);
+    unsigned long long next = ~0ull;
+    for(unsigned int i = 0; i < timers.size(); ++i)
+      if(timers[i].runs == 0 && !timers[i].cancelled)
+        next = std::min(next, timers[i].deadline);
+    CHECK(wait >= 1 && now + wait <= next);
+
+    lastRun = 0;
+    advance(wheel, step);
+    for(unsigned int i = 0; i < timers.size(); ++i) {
+      bool due = timers[i].deadline <= now && !timers[i].cancelled;
+      CHECK(timers[i].runs == (due ? 1 : 0));
+      CHECK(wheel.isScheduled(timers[i].id) == (!due && !timers[i].cancelled));
+    }
+  }
+  CHECK(inOrder);
+  CHECK(onTime);
+}
+
+static void testLevels() {
+  TimerWheel wheel(ticks);
+  // Delays on every level, and past the range of the wheel
+  for(int level = 0; level < WHEEL_LEVELS; ++level)
+    for(int i = 0; i < 40; ++i)
+      schedule(wheel, rand() % (1 << ((level + 1) * WHEEL_SLOT_BITS)));
+  schedule(wheel, WHEEL_RANGE + 12345);
+  schedule(wheel, 0xffffffff);
+  CHECK(wheel.size() == (int)timers.size());
+
+  // Small steps, then larger ones over the furthest timers
+  run(wheel, now + 5000, 7);
+  run(wheel, now + 2000000, 3000);
+  run(wheel, now + 0x100000000ull, 50000000);
+  CHECK(wheel.size() == 0);
+  timers.clear();
+}
+
+static void testCancel() {
+  TimerWheel wheel(ticks);
+  for(int i = 0; i < 300; ++i)
+    schedule(wheel, rand() % 100000);
+  for(int i = 0; i < 300; i += 3) {
+    CHECK(wheel.cancel(timers[i].id));
+    CHECK(!wheel.cancel(timers[i].id));
+    timers[i].cancelled = true;
+  }
+  CHECK(wheel.size() == 200);
+  run(wheel, now + 50000, 500);
+
+  // Timers that ran can't be cancelled, and their handles don't cancel the
+  // timers that reuse their nodes
+  std::vector<TimerId> old;
+  for(unsigned int i = 0; i < timers.size(); ++i)
+    if(timers[i].runs == 1) {
+      CHECK(!wheel.cancel(timers[i].id));
+      old.push_back(timers[i].id);
+    }
+  int first = timers.size();
+  for(int i = 0; i < 50; ++i)
+    schedule(wheel, 10 + rand() % 1000);
+  for(unsigned int i = 0; i < old.size(); ++i)
+    CHECK(!wheel.cancel(old[i]));
+  for(unsigned int i = first; i < timers.size(); ++i)
+    CHECK(wheel.isScheduled(timers[i].id));
+  CHECK(!wheel.cancel(NO_TIMER));
+
+  run(wheel, now + 200000, 700);
+  CHECK(wheel.size() == 0);
+  timers.clear();
+}
+
+static void testCallbacks() {
+  TimerWheel wheel(ticks);
+  // A timer scheduling the next one from its callback, and one cancelling
+  // a later timer
+  int count = 0;
+  bool cancelled = false, victimRan = false;
+  std::function<void()> repeat = [&]() {
+    if(++count < 100)
+      wheel.schedule(37, repeat);
+  };
+  wheel.schedule(37, repeat);
+  TimerId victim = wheel.schedule(500, [&]() {
+    victimRan = true;
+  });
+  wheel.schedule(400, [&]() {
+    cancelled = wheel.cancel(victim);
+  });
+  advance(wheel, 37 * 100 + 10);
+  CHECK(count == 100);
+  CHECK(cancelled && !victimRan);
+  CHECK(wheel.size() == 0);
+}
+
+int main() {
+  srand(50);
+  testLevels();
+  testCancel();
+  testCallbacks();
+
+  // Again with the ticks of SDL wrapping around during the test
+  ticks = 0xffffffff - 3000;
+  testLevels();
+  testCancel();
+  return checkResult("timerwheel");
+}